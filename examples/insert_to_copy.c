@@ -6,422 +6,1451 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include <pg_query.h>
-#include "cJSON.h"
+
+#include "insert_to_copy_input.h"
+#include "insert_to_copy_catalog.h"
+#include "insert_to_copy_binary.h"
+#include "insert_to_copy_output.h"
+#include "insert_to_copy_pgwire.h"
+#include "insert_to_copy_directory.h"
+#include "insert_to_copy_reorder.h"
+#include "insert_to_copy_filter.h"
+#include "insert_to_copy_checkpoint.h"
+#include "insert_to_copy_stats.h"
+#include "insert_to_copy_shard.h"
+
+// Opção do COPY para as linhas com valores DEFAULT (PostgreSQL 16)
+#define COPY_DEFAULT_OPTION " WITH (DEFAULT E'\\\\D')"
+
+// Tamanho a partir do qual o INSERT das linhas não constantes fecha o bloco
+#define FALLBACK_BATCH_BYTES (1024 * 1024)
+
+// Tamanho a partir do qual o INSERT é convertido e escrito um lote de linhas por vez,
+// e o tamanho dos lotes
+#define LONG_INSERT_BYTES (1024 * 1024)
+#define LONG_INSERT_BATCH_BYTES (64 * 1024)
+
+// Intervalo padrão entre os pontos de retomada (--checkpoint), em bytes da entrada
+#define CHECKPOINT_INTERVAL (1024ULL * 1024 * 1024)
 
 #ifdef _WIN32
-#define strncasecmp _strnicmp
+#include <direct.h>
+#else
+#include <pthread.h>
+#include <sys/stat.h>
 #endif
 
-#define INITIAL_BUFFER_CAPACITY 8192
+// Uma instrução da entrada e o resultado da sua conversão
+typedef struct {
+    StatementSlice statement;
+    const char* statement_trimmed;      // Início do INSERT, NULL para outras instruções
+    bool long_insert;                   // Convertido na escrita, um lote de linhas por vez (write_long_insert)
+    PgQueryInsertToCopyResult result;
+    bool classify;                      // Classificar as instruções que não viram COPY (--reorder, --filter-ddl)
+    PgQueryStatementInfoResult info;
+    size_t text_offset;                 // Posição da cópia da instrução no lote (entrada não mapeada)
+    uint64_t input_end;                 // Posição da entrada logo depois da instrução (--checkpoint)
+    bool timed;                         // Medir a conversão (--stats)
+    uint64_t convert_ns;
+    uint64_t classify_ns;
+} ConvertedStatement;
+
+// Converte a instrução inteira de uma vez
+void convert_whole_statement(ConvertedStatement* converted) {
+    uint64_t start = converted->timed ? stats_now_ns() : 0;
 
-// Função para substituir aspas simples escapadas por uma única aspa simples
-char* unescape_single_quotes(const char* input) {
-    size_t len = strlen(input);
-    char* output = malloc(len + 1);
-    if (!output) {
+    if (converted->statement_trimmed) {
+        converted->result = pg_query_insert_to_copy_len(converted->statement.data, converted->statement.len, PG_QUERY_PARSE_DEFAULT);
+        if (converted->timed) {
+            uint64_t end = stats_now_ns();
+            converted->convert_ns = end - start;
+            start = end;
+        }
+    }
+
+    // Os dados de um COPY e os comandos do psql não são SQL
+    if (converted->classify && !converted->result.relation &&
+        (converted->statement.kind == STATEMENT_SQL || converted->statement.kind == STATEMENT_COPY_FROM_STDIN)) {
+        converted->info = pg_query_statement_info_len(converted->statement.data, converted->statement.len, PG_QUERY_PARSE_DEFAULT);
+        if (converted->timed) {
+            converted->classify_ns = stats_now_ns() - start;
+        }
+    }
+}
+
+// Função para converter uma instrução INSERT (pode rodar em qualquer thread)
+void convert_statement(ConvertedStatement* converted) {
+    const char* statement_trimmed;
+    bool is_insert = statement_is_insert(converted->statement, &statement_trimmed);
+
+    converted->statement_trimmed = is_insert ? statement_trimmed : NULL;
+    // Um INSERT longo convertido de uma vez ocuparia memória proporcional ao seu
+    // tamanho, por isso fica para a escrita, que converte e escreve cada lote de linhas
+    converted->long_insert = is_insert && converted->statement.len > LONG_INSERT_BYTES;
+    if (!converted->long_insert) {
+        convert_whole_statement(converted);
+    }
+}
+
+typedef enum {
+    OUTPUT_TEXT,
+    OUTPUT_BINARY,
+    OUTPUT_DIRECTORY
+} OutputFormat;
+
+// Destino da conversão. INSERTs consecutivos na mesma tabela e com as mesmas
+// colunas formam um único bloco COPY, que fica aberto até que o destino mude ou
+// apareça outra instrução. As linhas com valores que não são constantes (now(),
+// nextval(...)) não interrompem o bloco: elas se juntam em um único INSERT,
+// escrito logo depois dele.
+//
+// No formato binário (--format=binary) os dados de cada bloco vão para um
+// arquivo PGCOPY em data_dir, e o script de saída recebe um
+// "\copy ... FROM 'arquivo'" no lugar dos INSERTs. Os tipos das colunas vêm
+// dos CREATE TABLE anteriores no dump.
+//
+// Com --connect nada é escrito: as instruções vão para o servidor como Query e
+// as linhas dos blocos como CopyData (wire != NULL), também no formato binário.
+//
+// No formato diretório (--format=directory) a saída é um diretório para carga
+// em paralelo, veja insert_to_copy_directory.h.
+//
+// Com --reorder as instruções passam por reorder (veja insert_to_copy_reorder.h),
+// que as devolve na ordem de restauração pelas funções reorder_write_*.
+//
+// Com --include-table / --exclude-table (filter != NULL) os dados das tabelas
+// deixadas de fora são descartados já na leitura, veja insert_to_copy_filter.h.
+//
+// Com --checkpoint (checkpoint_path != NULL) a saída é gravada no disco a cada
+// checkpoint_interval bytes da entrada e um ponto de retomada é escrito, veja
+// insert_to_copy_checkpoint.h.
+//
+// Com --stats ou --progress (stats != NULL) o tempo de cada fase e os números de
+// cada tabela são contados, veja insert_to_copy_stats.h.
+//
+// Com --catalog (map_columns) as linhas de cada INSERT são escritas na ordem das
+// colunas da tabela, do catálogo montado com os CREATE TABLE e ALTER TABLE do
+// dump, e INSERTs com listas de colunas diferentes ficam no mesmo bloco. Os
+// valores que o servidor rejeitaria são avisados já na conversão.
+//
+// Com --shards N (shards != NULL) a saída são N scripts ou conexões, um por shard,
+// e as linhas vão para o shard do hash da chave da tabela, veja
+// insert_to_copy_shard.h.
+typedef struct {
+    OutputSink sink;
+    PgWire* wire;
+    DirectoryOutput* directory;
+    ReorderOutput* reorder;
+    TableFilter* filter;
+    ConversionStats* stats;
+    ShardOutput* shards;
+    bool input_mapped;                  // Trechos da entrada podem ir para a saída sem cópia
+    OutputFormat format;
+    TableCatalog catalog;               // Com --format=binary ou --catalog
+    bool map_columns;
+    const char* data_dir;
+    bool data_dir_created;
+    int n_data_files;
+
+    // Bloco COPY aberto (relation != NULL)
+    char* relation;
+    char* column_list;                  // " (a, b)" ou ""
+    bool binary_block;
+    bool default_block;                 // Com a opção DEFAULT, as linhas podem ter valores DEFAULT
+    ByteBuffer fallback;                // Linhas com valores não constantes, um INSERT escrito depois do bloco
+    FILE* data_file;
+    char* data_path;
+    ByteBuffer tuples;
+
+    const char* checkpoint_path;
+    uint64_t checkpoint_interval;
+    uint64_t next_checkpoint;           // Posição da entrada a partir da qual vem o próximo
+} CopyOutput;
+
+// Escreve a lista de colunas como no comando COPY, " (a, b)" ou "" sem colunas
+char* format_column_list(PgQueryInsertToCopyResult* result) {
+    size_t len = 1;
+    for (int i = 0; i < result->n_columns; i++) {
+        len += strlen(result->columns[i]) + 4;
+    }
+    char* list = malloc(len);
+    if (!list) {
         fprintf(stderr, "Erro de alocação de memória\n");
         exit(1);
     }
-    size_t j = 0;
-    for (size_t i = 0; i < len; i++) {
-        if (input[i] == '\'' && input[i + 1] == '\'') {
-            output[j++] = '\'';
-            i++; // Pular a segunda aspa
-        }
-        else {
-            output[j++] = input[i];
+
+    char* ptr = list;
+    for (int i = 0; i < result->n_columns; i++) {
+        ptr += sprintf(ptr, "%s%s", i == 0 ? " (" : ", ", result->columns[i]);
+    }
+    if (result->n_columns > 0) {
+        *ptr++ = ')';
+    }
+    *ptr = '\0';
+    return list;
+}
+
+// Se o bloco aberto tem a mesma tabela e colunas do INSERT, sem montar a lista de colunas
+bool same_copy_target(CopyOutput* output, PgQueryInsertToCopyResult* result) {
+    if (!output->relation || strcmp(output->relation, result->relation) != 0) {
+        return false;
+    }
+
+    const char* ptr = output->column_list;
+    for (int i = 0; i < result->n_columns; i++) {
+        size_t len = strlen(result->columns[i]);
+        if (strncmp(ptr, i == 0 ? " (" : ", ", 2) != 0 || strncmp(ptr + 2, result->columns[i], len) != 0) {
+            return false;
         }
+        ptr += 2 + len;
     }
-    output[j] = '\0';
-    return output;
+    return strcmp(ptr, result->n_columns > 0 ? ")" : "") == 0;
 }
 
-// Função para ignorar comentários e espaços em branco no início do buffer
-char* skip_comments_and_whitespace(char* input) {
-    char* ptr = input;
+// Fecha o bloco COPY aberto. No formato binário escreve o comando que carrega o arquivo:
+// o psql não aceita dados binários no próprio script, por isso \copy com o caminho do arquivo.
+void close_copy_block(CopyOutput* output) {
+    if (!output->relation) {
+        return;
+    }
 
-    while (*ptr) {
-        // Ignorar espaços em branco iniciais
-        while (isspace((unsigned char)*ptr)) {
-            ptr++;
+    if (output->binary_block && output->wire) {
+        ByteBuffer trailer = { 0 };
+        copy_binary_append_trailer(&trailer);
+        pgwire_copy_data(output->wire, trailer.data, trailer.len);
+        pgwire_copy_done(output->wire);
+        byte_buffer_free(&trailer);
+    }
+    else if (output->binary_block) {
+        copy_binary_write_trailer(output->data_file);
+        if (fclose(output->data_file) != 0) {
+            perror("Erro ao escrever o arquivo de dados");
+            exit(1);
         }
+        output->data_file = NULL;
 
-        // Verificar se é um comentário de linha
-        if (ptr[0] == '-' && ptr[1] == '-') {
-            // Pular até o final da linha ou do buffer
-            ptr += 2;
-            while (*ptr && *ptr != '\n') {
-                ptr++;
-            }
-            // Se chegar ao fim do buffer, sair
-            if (!*ptr) {
-                break;
+        output_sink_puts(&output->sink, "\\copy ");
+        output_sink_puts(&output->sink, output->relation);
+        output_sink_puts(&output->sink, output->column_list);
+        output_sink_puts(&output->sink, " FROM '");
+        for (const char* c = output->data_path; *c; c++) {
+            if (*c == '\'') {
+                output_sink_putc(&output->sink, '\'');
             }
-            ptr++; // Pular o '\n'
-            continue;
+            output_sink_putc(&output->sink, *c);
+        }
+        output_sink_puts(&output->sink, "' WITH (FORMAT binary)\n");
+
+        free(output->data_path);
+        output->data_path = NULL;
+    }
+    else if (output->wire) {
+        pgwire_copy_done(output->wire);
+    }
+    else {
+        // Finalizar o comando COPY
+        output_sink_puts(&output->sink, "\\.\n");
+    }
+
+    free(output->relation);
+    free(output->column_list);
+    output->relation = NULL;
+    output->column_list = NULL;
+    output->binary_block = false;
+    output->default_block = false;
+
+    // As linhas não constantes do bloco, depois das linhas do COPY
+    if (output->fallback.len > 0) {
+        byte_buffer_append(&output->fallback, ";\n", 2);
+        if (output->wire) {
+            pgwire_query(output->wire, output->fallback.data, output->fallback.len);
+        }
+        else {
+            output_sink_write(&output->sink, output->fallback.data, output->fallback.len);
         }
+        output->fallback.len = 0;
+    }
+}
+
+// Escreve um trecho da instrução original. Com a entrada mapeada o trecho continua
+// válido até o fim, e vai para a saída sem ser copiado
+void write_input(CopyOutput* output, const char* data, size_t len) {
+    if (output->input_mapped) {
+        output_sink_write_ref(&output->sink, data, len);
+    }
+    else {
+        output_sink_write(&output->sink, data, len);
+    }
+}
 
-        // Verificar se é um comentário de bloco
-        if (ptr[0] == '/' && ptr[1] == '*') {
-            // Pular até o final do comentário de bloco
-            ptr += 2;
-            while (*ptr && !(ptr[0] == '*' && ptr[1] == '/')) {
-                ptr++;
+// Instrução que não é convertida: escrita como está, ou enviada ao servidor
+void write_passthrough(CopyOutput* output, StatementSlice statement) {
+    if (output->directory) {
+        directory_output_statement(output->directory, statement);
+    }
+    else if (output->shards) {
+        shard_output_statement(output->shards, statement);
+    }
+    else if (output->wire) {
+        switch (statement.kind) {
+        case STATEMENT_COPY_DATA:
+            pgwire_copy_data(output->wire, statement.data, statement.len);
+            break;
+        case STATEMENT_COPY_END:
+            pgwire_copy_done(output->wire);
+            break;
+        case STATEMENT_META_COMMAND: {
+            // Só o psql sabe executar (\connect, \restrict)
+            const char* start = statement_skip_comments(statement.data, statement.data + statement.len);
+            int len = (int)(statement.data + statement.len - start);
+            while (len > 0 && (start[len - 1] == '\n' || start[len - 1] == '\r')) {
+                len--;
             }
-            // Se chegar ao fim do buffer, sair
-            if (!*ptr) {
-                break;
+            fprintf(stderr, "Aviso: Comando do psql ignorado: %.*s\n", len, start);
+            break;
+        }
+        default:
+            // Só comentários e espaços em branco (o fim do dump) não vão para o servidor
+            if (statement_skip_comments(statement.data, statement.data + statement.len) != statement.data + statement.len) {
+                pgwire_query(output->wire, statement.data, statement.len);
             }
-            ptr += 2; // Pular '*/'
-            continue;
+            break;
         }
+    }
+    else {
+        write_input(output, statement.data, statement.len);
+    }
+}
 
-        // Se não for espaço em branco nem comentário, sair do loop
-        break;
+// INSERT que não pode ser convertido, escrito como está
+void write_unconverted_insert(CopyOutput* output, StatementSlice statement) {
+    if (output->directory) {
+        directory_output_insert(output->directory, statement);
     }
+    else if (output->shards) {
+        shard_output_insert(output->shards, statement);
+    }
+    else {
+        write_passthrough(output, statement);
+    }
+}
 
-    return ptr;
+// Inicia o comando COPY do bloco aberto, precedido pelos comentários e espaços em
+// branco que vêm antes do INSERT
+void begin_copy_command(CopyOutput* output, const char* prefix, size_t prefix_len, const char* options) {
+    if (output->wire) {
+        pgwire_begin_query(output->wire);
+        pgwire_append(output->wire, prefix, prefix_len);
+        pgwire_append(output->wire, "COPY ", 5);
+        pgwire_append(output->wire, output->relation, strlen(output->relation));
+        pgwire_append(output->wire, output->column_list, strlen(output->column_list));
+        pgwire_append(output->wire, " FROM stdin", 11);
+        pgwire_append(output->wire, options, strlen(options));
+        pgwire_end_query(output->wire);
+    }
+    else {
+        write_input(output, prefix, prefix_len);
+        output_sink_puts(&output->sink, "COPY ");
+        output_sink_puts(&output->sink, output->relation);
+        output_sink_puts(&output->sink, output->column_list);
+        output_sink_puts(&output->sink, " FROM stdin");
+        output_sink_puts(&output->sink, options);
+        output_sink_puts(&output->sink, ";\n");
+    }
 }
 
-// Função para processar uma instrução analisada
-void process_parsed_statement(const char* parse_tree_json, FILE* output) {
-    // Analisar o JSON
-    cJSON* root = cJSON_Parse(parse_tree_json);
-    if (!root) {
-        fprintf(stderr, "Erro ao analisar o JSON\n");
-        return;
+// Saída do --reorder. As instruções vêm de cópias que reorder libera depois, por
+// isso não são escritas como referências
+void reorder_write_statement(void* context, const char* data, size_t len) {
+    CopyOutput* output = (CopyOutput*)context;
+
+    if (output->wire) {
+        const char* start = statement_skip_comments(data, data + len);
+        if (start != data + len && *start == '\\') {
+            StatementSlice statement = { start, data + len - start, STATEMENT_META_COMMAND };
+            write_passthrough(output, statement);
+        }
+        else if (start != data + len) {
+            pgwire_query(output->wire, data, len);
+        }
+    }
+    else {
+        output_sink_write(&output->sink, data, len);
+    }
+}
+
+void reorder_write_begin_copy(void* context, const char* relation, const char* column_list, const char* options) {
+    CopyOutput* output = (CopyOutput*)context;
+
+    output->relation = strdup(relation);
+    output->column_list = strdup(column_list);
+    if (!output->relation || !output->column_list) {
+        fprintf(stderr, "Erro de alocação de memória\n");
+        exit(1);
+    }
+    begin_copy_command(output, "", 0, options);
+}
+
+void reorder_write_copy_data(void* context, const char* data, size_t len) {
+    CopyOutput* output = (CopyOutput*)context;
+
+    if (output->wire) {
+        pgwire_copy_data(output->wire, data, len);
+    }
+    else {
+        output_sink_write(&output->sink, data, len);
+    }
+}
+
+void reorder_write_end_copy(void* context) {
+    close_copy_block((CopyOutput*)context);
+}
+
+bool only_whitespace(const char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] != ' ' && data[i] != '\t' && data[i] != '\n' && data[i] != '\r') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Cria o arquivo de dados do bloco binário, e mantém no script os comentários e
+// espaços em branco que precedem o primeiro INSERT do bloco
+void open_binary_data_file(CopyOutput* output, StatementSlice statement, const char* statement_trimmed) {
+    if (!output->data_dir_created) {
+#ifdef _WIN32
+        _mkdir(output->data_dir);
+#else
+        mkdir(output->data_dir, 0777);
+#endif
+        output->data_dir_created = true;
     }
 
-    //printf("JSON: %s",parse_tree_json);
+    output->data_path = malloc(strlen(output->data_dir) + 16);
+    if (!output->data_path) {
+        fprintf(stderr, "Erro de alocação de memória\n");
+        exit(1);
+    }
+    sprintf(output->data_path, "%s/%06d.bin", output->data_dir, ++output->n_data_files);
+    output->data_file = fopen(output->data_path, "wb");
+    if (!output->data_file) {
+        perror("Erro ao criar o arquivo de dados");
+        exit(1);
+    }
+    copy_binary_write_header(output->data_file);
+    write_input(output, statement.data, statement_trimmed - statement.data);
+}
 
-    cJSON* stmts = cJSON_GetObjectItem(root, "stmts");
-    if (!stmts) {
-        cJSON_Delete(root);
+// Tenta escrever as linhas do INSERT no formato binário, continuando o bloco binário
+// aberto se same_block. Retorna false quando os tipos das colunas não são conhecidos
+// ou algum valor não pode ser convertido, e nesse caso o INSERT é escrito como COPY em
+// formato texto.
+bool write_binary_statement(ConvertedStatement* converted, CopyOutput* output, bool same_block) {
+    StatementSlice statement = converted->statement;
+    PgQueryInsertToCopyResult* result = &converted->result;
+
+    CatalogTable* table = table_catalog_find(&output->catalog, result->relation);
+    if (!table || (result->n_columns == 0 && !table->complete)) {
+        return false;
+    }
+
+    int n_types = result->n_columns > 0 ? result->n_columns : table->n_columns;
+    CopyBinaryType* types = malloc(sizeof(CopyBinaryType) * (n_types > 0 ? n_types : 1));
+    if (!types) {
+        fprintf(stderr, "Erro de alocação de memória\n");
+        exit(1);
+    }
+    bool ok = n_types > 0;
+    for (int i = 0; ok && i < n_types; i++) {
+        int column = result->n_columns > 0 ? catalog_table_column(table, result->columns[i]) : i;
+        ok = column >= 0 && (types[i] = copy_binary_type(table->columns[column].type_name, table->columns[column].is_array)) != COPY_BINARY_UNSUPPORTED;
+    }
+
+    output->tuples.len = 0;
+    ok = ok && copy_binary_append_rows(&output->tuples, types, n_types, result->copy_data, result->copy_data_len);
+    free(types);
+    if (!ok) {
+        return false;
+    }
+
+    if (!same_block) {
+        close_copy_block(output);
+        output->relation = strdup(result->relation);
+        output->column_list = format_column_list(result);
+        output->binary_block = true;
+
+        if (output->wire) {
+            begin_copy_command(output, statement.data, converted->statement_trimmed - statement.data, " WITH (FORMAT binary)");
+            ByteBuffer header = { 0 };
+            copy_binary_append_header(&header);
+            pgwire_copy_data(output->wire, header.data, header.len);
+            byte_buffer_free(&header);
+        }
+        else {
+            open_binary_data_file(output, statement, converted->statement_trimmed);
+        }
+    }
+
+    if (output->wire) {
+        pgwire_copy_data(output->wire, output->tuples.data, output->tuples.len);
+    }
+    else {
+        fwrite(output->tuples.data, 1, output->tuples.len, output->data_file);
+    }
+    return true;
+}
+
+// Função para escrever uma instrução convertida, na ordem da entrada
+// Instruções que não podem ser convertidas são escritas sem alterações
+void write_statement(ConvertedStatement* converted, CopyOutput* copy_output) {
+    StatementSlice statement = converted->statement;
+    PgQueryInsertToCopyResult* result = &converted->result;
+    bool binary = copy_output->format == OUTPUT_BINARY;
+
+    if (copy_output->filter && copy_output->filter->filter_ddl && statement.kind == STATEMENT_SQL && !result->relation) {
+        // Esquema das tabelas deixadas de fora (--filter-ddl)
+        if (table_filter_skip_statement(copy_output->filter, &converted->info)) {
+            pg_query_free_statement_info_result(converted->info);
+            memset(&converted->info, 0, sizeof(PgQueryStatementInfoResult));
+            pg_query_free_insert_to_copy_result(*result);
+            memset(result, 0, sizeof(PgQueryInsertToCopyResult));
+            return;
+        }
+    }
+
+    // Sem --reorder a classificação só serve ao filtro, inclusive a dos COPY ... FROM stdin
+    if (!copy_output->reorder) {
+        pg_query_free_statement_info_result(converted->info);
+        memset(&converted->info, 0, sizeof(PgQueryStatementInfoResult));
+    }
+
+    // Definições das tabelas, e as linhas na ordem das colunas delas com --catalog
+    if (binary || copy_output->map_columns) {
+        if (!converted->statement_trimmed && statement.kind == STATEMENT_SQL) {
+            table_catalog_add_statement(&copy_output->catalog, statement);
+        }
+        else if (copy_output->map_columns && result->relation && !result->error) {
+            table_catalog_map_rows(&copy_output->catalog, result);
+        }
+    }
+
+    if (copy_output->reorder) {
+        if (result->relation) {
+            reorder_output_rows(copy_output->reorder, result);
+        }
+        else if (statement.kind == STATEMENT_COPY_DATA || statement.kind == STATEMENT_COPY_END) {
+            reorder_output_copy_data(copy_output->reorder, statement);
+        }
+        else {
+            if (result->error) {
+                fprintf(stderr, "Aviso: Erro ao analisar SQL: %s\n", result->error->message);
+            }
+            reorder_output_statement(copy_output->reorder, statement, &converted->info);
+            pg_query_free_statement_info_result(converted->info);
+            memset(&converted->info, 0, sizeof(PgQueryStatementInfoResult));
+        }
+        pg_query_free_insert_to_copy_result(*result);
+        memset(result, 0, sizeof(PgQueryInsertToCopyResult));
         return;
     }
 
-    cJSON* stmt_item;
-    cJSON_ArrayForEach(stmt_item, stmts) {
-        cJSON* stmt = cJSON_GetObjectItem(stmt_item, "stmt");
-        if (!stmt) continue;
+    if (!converted->statement_trimmed) {
+        // Não é um INSERT, escrever a instrução original diretamente da entrada
+        close_copy_block(copy_output);
+        write_passthrough(copy_output, statement);
+        return;
+    }
+
+    if (result->error) {
+        fprintf(stderr, "Aviso: Erro ao analisar SQL: %s\n", result->error->message);
+        close_copy_block(copy_output);
+        write_unconverted_insert(copy_output, statement);
+    }
+    else if (!result->relation) {
+        // Valores não constantes, ON CONFLICT, etc.
+        close_copy_block(copy_output);
+        write_unconverted_insert(copy_output, statement);
+    }
+    else if (copy_output->directory) {
+        // Linhas no arquivo de dados da tabela, as não constantes em data/inserts.sql
+        if (result->n_rows > 0) {
+            directory_output_rows(copy_output->directory, result);
+        }
+        if (result->fallback_insert) {
+            directory_output_fallback(copy_output->directory, result);
+        }
+    }
+    else if (copy_output->shards) {
+        // Cada linha no shard da sua chave, as não constantes no INSERT de cada shard
+        shard_output_rows(copy_output->shards, statement, converted->statement_trimmed - statement.data, result);
+    }
+    else {
+        // Continuar o bloco aberto quando o destino é o mesmo e só há espaços em branco
+        // entre os INSERTs (comentários ficam no lugar, e por isso iniciam outro bloco)
+        size_t prefix_len = converted->statement_trimmed - statement.data;
+        bool same_block = same_copy_target(copy_output, result) && only_whitespace(statement.data, prefix_len);
+        bool text_block = same_block && !copy_output->binary_block && (copy_output->default_block || !result->has_default);
 
-        cJSON* insert_stmt = cJSON_GetObjectItem(stmt, "InsertStmt");
-        if (insert_stmt) {
-            // Este é um comando INSERT
+        if (result->n_rows == 0) {
+            // Só linhas não constantes: ficam para depois do bloco aberto, ou o INSERT é escrito como está
+            if (!same_block) {
+                close_copy_block(copy_output);
+                write_unconverted_insert(copy_output, statement);
+            }
+        }
+        else if (binary && !text_block && !result->has_default && write_binary_statement(converted, copy_output, same_block)) {
+            // Linhas gravadas no arquivo de dados do bloco (ou enviadas ao servidor)
+        }
+        else {
+            if (!text_block) {
+                close_copy_block(copy_output);
 
-            // Extrair o nome da tabela
-            cJSON* relation = cJSON_GetObjectItem(insert_stmt, "relation");
-            if (!relation) continue;
-            cJSON* schemaname = cJSON_GetObjectItem(relation, "schemaname");
-            cJSON* relname = cJSON_GetObjectItem(relation, "relname");
+                // Iniciar o comando COPY, mantendo os comentários e espaços em branco que precedem o INSERT
+                copy_output->relation = strdup(result->relation);
+                copy_output->column_list = format_column_list(result);
+                copy_output->default_block = result->has_default;
+                begin_copy_command(copy_output, statement.data, prefix_len, result->has_default ? COPY_DEFAULT_OPTION : "");
+            }
 
-            char full_table_name[512];
-            if (schemaname && schemaname->valuestring) {
-                snprintf(full_table_name, sizeof(full_table_name), "%s.%s", schemaname->valuestring, relname->valuestring);
+            if (copy_output->wire) {
+                pgwire_copy_data(copy_output->wire, result->copy_data, result->copy_data_len);
             }
             else {
-                snprintf(full_table_name, sizeof(full_table_name), "%s", relname->valuestring);
+                output_sink_write(&copy_output->sink, result->copy_data, result->copy_data_len);
             }
+        }
 
-            // Iniciar o comando COPY
-            fprintf(output, "COPY %s FROM stdin;\n", full_table_name);
-
-            // Processar valores
-            cJSON* cols = cJSON_GetObjectItem(insert_stmt, "cols");
-            cJSON* colnames = NULL;
-            if (cols) {
-                colnames = cJSON_CreateArray();
-                cJSON* col_item;
-                cJSON_ArrayForEach(col_item, cols) {
-                    cJSON* res_target = cJSON_GetObjectItem(col_item, "ResTarget");
-                    if (res_target) {
-                        cJSON* name = cJSON_GetObjectItem(res_target, "name");
-                        
-                        if (name) {
-                            cJSON_AddItemToArray(colnames, cJSON_Duplicate(name, 1));
-                        }
-                    }
-                }
+        if (result->fallback_insert && copy_output->relation) {
+            // Um só INSERT para as linhas não constantes do bloco, com as colunas dele
+            if (copy_output->fallback.len == 0) {
+                byte_buffer_append(&copy_output->fallback, result->fallback_insert, strlen(result->fallback_insert));
             }
-
-            cJSON* values_lists = cJSON_GetObjectItem(insert_stmt, "selectStmt");
-            if (values_lists) {
-                cJSON* values = cJSON_GetObjectItem(values_lists, "SelectStmt");
-                if (values) {
-                    cJSON* values_clause = cJSON_GetObjectItem(values, "valuesLists");
-                    
-                    if (values_clause) {
-                        cJSON* row_values;
-                        cJSON_ArrayForEach(row_values, values_clause) {
-                            cJSON* vList = cJSON_GetObjectItem(row_values, "List");
-                            cJSON* vItems = cJSON_GetObjectItem(vList, "items");
-                            // Processar cada valor da linha
-                            cJSON* value_item;
-                            int first_value = 1;
-                            cJSON_ArrayForEach(value_item, vItems) {
-                                if (!first_value) {
-                                    fputc('\t', output);
-                                }
-                                first_value = 0;
-
-                                cJSON* val_node = value_item->child;
-                                if (!val_node) {
-                                    fputs("\\N", output);
-                                    continue;
-                                }
-                                cJSON* a_Const = cJSON_GetObjectItem(value_item,"A_Const");
-                                if (a_Const) {                                    
-                                       
-                                      if (cJSON_GetObjectItem(a_Const, "ival")) {
-                                            cJSON* ival = cJSON_GetObjectItem(a_Const, "ival");
-                                            int int_val = cJSON_GetObjectItem(ival, "ival")->valueint;
-                                            fprintf(output, "%d", int_val);
-                                       }                                        
-                                       else if (cJSON_GetObjectItem(a_Const, "fval")) {
-                                            cJSON* fval = cJSON_GetObjectItem(a_Const, "fval");
-                                            const char* float_val = cJSON_GetObjectItem(fval, "fval")->valuestring;
-                                            fprintf(output, "%s", float_val);
-                                        }
-                                        else if (cJSON_GetObjectItem(a_Const, "sval")) {
-                                            cJSON* sval = cJSON_GetObjectItem(a_Const, "sval");
-                                            const char* str_val = cJSON_GetObjectItem(sval, "sval")->valuestring;
-                                            // Desfazer escape de aspas simples
-                                            char* unescaped_str = unescape_single_quotes(str_val);
-                                            // Escapar tabulações e quebras de linha
-                                            for (char* p = unescaped_str; *p; p++) {
-                                                if (*p == '\t') {
-                                                    fputs("\\t", output);
-                                                }
-                                                else if (*p == '\n') {
-                                                    fputs("\\n", output);
-                                                }
-                                                else {
-                                                    fputc(*p, output);
-                                                }
-                                            }
-                                            free(unescaped_str);
-                                        }
-                                        else if (cJSON_GetObjectItem(a_Const, "Null")) {
-                                            fputs("\\N", output);
-                                        }
-                                        else {
-                                            // Tipo de valor não suportado
-                                            fputs("\\N", output);
-                                        }
-                                    
-                                }
-                                else if (strcmp(val_node->string, "Null") == 0) {
-                                    fputs("\\N", output);
-                                }
-                                else {
-                                    // Tipo de nó não suportado
-                                    fputs("\\N", output);
-                                }
-                            }
-                            // Fim da linha
-                            fputc('\n', output);
-                        }
-                    }
-                }
+            else {
+                const char* values = result->fallback_insert + result->fallback_values_offset;
+                byte_buffer_append(&copy_output->fallback, ", ", 2);
+                byte_buffer_append(&copy_output->fallback, values, strlen(values));
             }
+            if (copy_output->stats) {
+                stats_record_buffered(copy_output->stats, copy_output->relation, copy_output->fallback.len);
+            }
+            if (copy_output->fallback.len >= FALLBACK_BATCH_BYTES) {
+                close_copy_block(copy_output);
+            }
+        }
+    }
 
-            // Finalizar o comando COPY
-            fprintf(output, "\\.\n");
+    pg_query_free_insert_to_copy_result(*result);
+    memset(result, 0, sizeof(PgQueryInsertToCopyResult));
+}
 
-            if (colnames) {
-                cJSON_Delete(colnames);
+// Com input_mapped os trechos da entrada são escritos como referências, que precisam
+// continuar válidas até o fim
+void set_input_mapped(CopyOutput* output, bool mapped) {
+    output->input_mapped = mapped;
+    if (output->directory) {
+        output->directory->input_mapped = mapped;
+    }
+    if (output->shards) {
+        output->shards->input_mapped = mapped;
+    }
+}
+
+// INSERT longo sendo escrito um lote de linhas por vez
+typedef struct {
+    ConvertedStatement* converted;
+    CopyOutput* output;
+    int n_batches;                      // Lotes já escritos
+    uint64_t batch_start;               // Início da conversão do lote (--stats)
+} LongInsert;
+
+// Escreve um lote de linhas do INSERT longo como se fosse um INSERT só com elas. Os
+// lotes seguintes continuam o bloco COPY aberto pelo primeiro, e quando um lote não
+// pode ser convertido as linhas que restam são escritas como um INSERT.
+void write_insert_batch(PgQueryInsertToCopyResult* rows, void* context) {
+    LongInsert* insert = (LongInsert*)context;
+    CopyOutput* output = insert->output;
+    ConvertedStatement batch = *insert->converted;
+    bool converted = rows->relation && !rows->error;
+    char* remaining = NULL;
+
+    batch.long_insert = false;
+    batch.result = *rows;
+    memset(rows, 0, sizeof(PgQueryInsertToCopyResult));
+    if (batch.timed) {
+        batch.convert_ns = stats_now_ns() - insert->batch_start;
+    }
+
+    if (!converted) {
+        remaining = batch.result.fallback_insert;
+        batch.result.fallback_insert = NULL;
+        if (insert->n_batches > 0) {
+            // As linhas já escritas ficam, o INSERT com as outras vem depois delas
+            size_t len = strlen(remaining);
+            remaining = realloc(remaining, len + 2);
+            if (!remaining) {
+                fprintf(stderr, "Erro de alocação de memória\n");
+                exit(1);
             }
+            strcpy(remaining + len, ";");
+            batch.statement.data = remaining;
+            batch.statement.len = len + 1;
+            batch.statement_trimmed = remaining;
+        }
+        if (batch.classify) {
+            batch.info = pg_query_statement_info_len(batch.statement.data, batch.statement.len, PG_QUERY_PARSE_DEFAULT);
+        }
+    }
+    else if (insert->n_batches > 0) {
+        // Sem os comentários que precedem o INSERT, que já foram escritos
+        batch.statement.len -= batch.statement_trimmed - batch.statement.data;
+        batch.statement.data = batch.statement_trimmed;
+    }
+
+    uint64_t start = 0;
+    if (output->stats) {
+        if (insert->n_batches == 0) {
+            stats_record_statement(output->stats, batch.statement.len, true, &batch.result, batch.convert_ns);
         }
         else {
-            // Não é um INSERT, pode ser processado conforme necessário
+            stats_record_rows(output->stats, &batch.result, batch.convert_ns);
         }
+        start = stats_now_ns();
+    }
+
+    if (!converted && insert->n_batches > 0) {
+        // O INSERT não é um trecho da entrada, e é liberado logo depois
+        bool mapped = output->input_mapped;
+        set_input_mapped(output, false);
+        write_statement(&batch, output);
+        set_input_mapped(output, mapped);
     }
+    else {
+        write_statement(&batch, output);
+    }
+    free(remaining);
+    insert->n_batches++;
 
-    cJSON_Delete(root);
+    if (output->stats) {
+        uint64_t end = stats_now_ns();
+        stats_add_phase(output->stats, STATS_WRITE, end - start);
+        insert->batch_start = end;
+    }
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Uso: %s <input.sql> <output.sql>\n", argv[0]);
-        exit(1);
+// Converte e escreve o INSERT longo um lote de linhas por vez, para que a memória
+// usada não dependa do tamanho dele. O INSERT que não é só uma lista de VALUES
+// (ON CONFLICT, RETURNING) é convertido de uma vez, e retorna false para ser
+// escrito como os outros.
+bool write_long_insert(ConvertedStatement* converted, CopyOutput* output) {
+    LongInsert insert = { converted, output, 0, converted->timed ? stats_now_ns() : 0 };
+
+    if (pg_query_insert_to_copy_rows(converted->statement.data, converted->statement.len, PG_QUERY_PARSE_DEFAULT,
+                                     LONG_INSERT_BATCH_BYTES, write_insert_batch, &insert)) {
+        return true;
     }
+    converted->long_insert = false;
+    convert_whole_statement(converted);
+    return false;
+}
 
-    FILE* input = fopen(argv[1], "r");
-    if (!input) {
-        perror("Erro ao abrir o arquivo de entrada");
-        exit(1);
+// Próxima instrução da entrada que passa pelos filtros de tabela. Com --stats conta
+// o tempo de leitura e separação, e atualiza a linha de progresso.
+bool read_statement(CopyInput* input, CopyOutput* output, StatementSlice* statement) {
+    uint64_t start = output->stats ? stats_now_ns() : 0;
+    bool found;
+
+    while ((found = copy_input_next(input, statement)) &&
+           output->filter && table_filter_skip_data(output->filter, *statement)) {
+        // Tabela deixada de fora, sem passar pelo parser
     }
 
-    FILE* output = fopen(argv[2], "w");
-    if (!output) {
-        perror("Erro ao abrir o arquivo de saída");
-        fclose(input);
-        exit(1);
+    if (output->stats) {
+        stats_add_phase(output->stats, STATS_READ_SPLIT, stats_now_ns() - start);
+        stats_progress(output->stats, copy_input_offset(input));
+    }
+    return found;
+}
+
+// Escreve a instrução convertida, contando-a com --stats
+void write_converted(ConvertedStatement* converted, CopyOutput* output) {
+    if (converted->long_insert && write_long_insert(converted, output)) {
+        return;
+    }
+    if (!output->stats) {
+        write_statement(converted, output);
+        return;
+    }
+
+    stats_record_statement(output->stats, converted->statement.len, converted->statement_trimmed != NULL, &converted->result, converted->convert_ns);
+    stats_add_phase(output->stats, STATS_CLASSIFY, converted->classify_ns);
+    uint64_t start = stats_now_ns();
+    write_statement(converted, output);
+    stats_add_phase(output->stats, STATS_WRITE, stats_now_ns() - start);
+}
+
+// Escreve um ponto de retomada depois da instrução, se já é hora. Só entre instruções
+// fora dos dados de um COPY e sem linhas não constantes esperando o fim do bloco,
+// para que o bloco aberto seja todo o estado a guardar.
+void write_checkpoint(CopyOutput* output, const ConvertedStatement* converted) {
+    StatementKind kind = converted->statement.kind;
+
+    if (!output->checkpoint_path || converted->input_end < output->next_checkpoint ||
+        kind == STATEMENT_COPY_FROM_STDIN || kind == STATEMENT_COPY_DATA || output->fallback.len > 0) {
+        return;
+    }
+
+    output_sink_sync(&output->sink);
+    Checkpoint checkpoint = { converted->input_end, output->sink.bytes_written, output->relation, output->column_list, output->default_block };
+    if (!checkpoint_write(output->checkpoint_path, &checkpoint)) {
+        perror("Aviso: Erro ao escrever o ponto de retomada");
+    }
+    output->next_checkpoint = converted->input_end + output->checkpoint_interval;
+}
+
+#ifndef _WIN32
+
+// Modo paralelo (--jobs N): a thread principal lê e separa as instruções em
+// lotes, N threads convertem os lotes, e uma thread de escrita grava os lotes
+// na ordem da entrada. Os lotes ficam em um anel de tamanho fixo, que limita
+// quanto a leitura pode se adiantar em relação à escrita, e a saída é idêntica
+// à do modo sequencial.
+
+#define BATCH_STATEMENTS 512
+#define BATCH_BYTES (1024 * 1024)
+#define BATCHES_PER_JOB 4
+
+typedef struct {
+    ConvertedStatement statements[BATCH_STATEMENTS];
+    int count;
+    size_t bytes;
+    // Cópia das instruções quando a entrada não está mapeada na memória
+    char* text;
+    size_t text_len;
+    size_t text_capacity;
+    bool converted;
+} StatementBatch;
+
+typedef struct {
+    StatementBatch* batches;
+    uint64_t n_batches;
+    uint64_t next_fill;      // Próximo lote a ser preenchido pela leitura
+    uint64_t next_convert;   // Próximo lote a ser convertido
+    uint64_t next_write;     // Próximo lote a ser escrito
+    bool done;               // Leitura terminada
+    pthread_mutex_t lock;
+    pthread_cond_t can_fill;
+    pthread_cond_t can_convert;
+    pthread_cond_t can_write;
+    CopyOutput* output;
+} Pipeline;
+
+void* pipeline_convert_thread(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&pipeline->lock);
+        while (pipeline->next_convert == pipeline->next_fill && !pipeline->done) {
+            pthread_cond_wait(&pipeline->can_convert, &pipeline->lock);
+        }
+        if (pipeline->next_convert == pipeline->next_fill) {
+            pthread_mutex_unlock(&pipeline->lock);
+            break;
+        }
+        StatementBatch* batch = &pipeline->batches[pipeline->next_convert++ % pipeline->n_batches];
+        pthread_mutex_unlock(&pipeline->lock);
+
+        for (int i = 0; i < batch->count; i++) {
+            convert_statement(&batch->statements[i]);
+        }
+
+        pthread_mutex_lock(&pipeline->lock);
+        batch->converted = true;
+        pthread_cond_signal(&pipeline->can_write);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+
+    return NULL;
+}
+
+void* pipeline_write_thread(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&pipeline->lock);
+        StatementBatch* batch = &pipeline->batches[pipeline->next_write % pipeline->n_batches];
+        while (!(pipeline->next_write < pipeline->next_fill && batch->converted) &&
+               !(pipeline->done && pipeline->next_write == pipeline->next_fill)) {
+            pthread_cond_wait(&pipeline->can_write, &pipeline->lock);
+        }
+        if (pipeline->next_write == pipeline->next_fill) {
+            pthread_mutex_unlock(&pipeline->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pipeline->lock);
+
+        for (int i = 0; i < batch->count; i++) {
+            write_converted(&batch->statements[i], pipeline->output);
+        }
+        // Lote inteiro escrito na ordem da entrada: ponto de retomada consistente
+        if (batch->count > 0) {
+            write_checkpoint(pipeline->output, &batch->statements[batch->count - 1]);
+        }
+        batch->count = 0;
+        batch->bytes = 0;
+        batch->text_len = 0;
+        batch->converted = false;
+
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->next_write++;
+        pthread_cond_signal(&pipeline->can_fill);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+
+    return NULL;
+}
+
+// Espera até que o próximo lote do anel esteja livre para a leitura
+StatementBatch* pipeline_acquire_batch(Pipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    while (pipeline->next_fill - pipeline->next_write >= pipeline->n_batches) {
+        pthread_cond_wait(&pipeline->can_fill, &pipeline->lock);
+    }
+    StatementBatch* batch = &pipeline->batches[pipeline->next_fill % pipeline->n_batches];
+    pthread_mutex_unlock(&pipeline->lock);
+    return batch;
+}
+
+void pipeline_publish_batch(Pipeline* pipeline, StatementBatch* batch) {
+    // Agora que a cópia não cresce mais, apontar as instruções para ela
+    if (batch->text) {
+        for (int i = 0; i < batch->count; i++) {
+            batch->statements[i].statement.data = batch->text + batch->statements[i].text_offset;
+        }
     }
 
-    char* statement_buffer = malloc(INITIAL_BUFFER_CAPACITY);
-    if (!statement_buffer) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->next_fill++;
+    pthread_cond_signal(&pipeline->can_convert);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+void run_parallel(CopyInput* input, CopyOutput* output, int jobs) {
+    Pipeline pipeline = {0};
+    pipeline.n_batches = (uint64_t)jobs * BATCHES_PER_JOB;
+    pipeline.batches = calloc(pipeline.n_batches, sizeof(StatementBatch));
+    if (!pipeline.batches) {
         fprintf(stderr, "Erro de alocação de memória\n");
-        fclose(input);
-        fclose(output);
         exit(1);
     }
-    size_t statement_buffer_size = 0;
-    size_t statement_buffer_capacity = INITIAL_BUFFER_CAPACITY;
+    pipeline.output = output;
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.can_fill, NULL);
+    pthread_cond_init(&pipeline.can_convert, NULL);
+    pthread_cond_init(&pipeline.can_write, NULL);
 
-    bool in_string = false;
-    bool in_line_comment = false;
-    bool in_block_comment = false;
+    pthread_t* workers = malloc(sizeof(pthread_t) * jobs);
+    pthread_t writer;
+    for (int i = 0; i < jobs; i++) {
+        pthread_create(&workers[i], NULL, pipeline_convert_thread, &pipeline);
+    }
+    pthread_create(&writer, NULL, pipeline_write_thread, &pipeline);
 
-    char line[8192];
+    StatementBatch* batch = NULL;
+    StatementSlice statement;
+    while (read_statement(input, output, &statement)) {
+        if (!batch) {
+            batch = pipeline_acquire_batch(&pipeline);
+        }
 
-    while (fgets(line, sizeof(line), input)) {
-        size_t line_length = strlen(line);
+        ConvertedStatement* converted = &batch->statements[batch->count++];
+        converted->statement = statement;
+        converted->input_end = copy_input_offset(input);
+        converted->classify = output->reorder != NULL || (output->filter && output->filter->filter_ddl);
+        converted->timed = output->stats != NULL;
+        converted->convert_ns = converted->classify_ns = 0;
+        if (!input->mapped) {
+            // A fatia só é válida até a próxima leitura
+            if (batch->text_len + statement.len > batch->text_capacity) {
+                size_t new_capacity = batch->text_capacity ? batch->text_capacity : BATCH_BYTES;
+                while (batch->text_len + statement.len > new_capacity) {
+                    new_capacity *= 2;
+                }
+                char* new_text = realloc(batch->text, new_capacity);
+                if (!new_text) {
+                    fprintf(stderr, "Erro de alocação de memória\n");
+                    exit(1);
+                }
+                batch->text = new_text;
+                batch->text_capacity = new_capacity;
+            }
+            memcpy(batch->text + batch->text_len, statement.data, statement.len);
+            converted->text_offset = batch->text_len;
+            batch->text_len += statement.len;
+        }
+        batch->bytes += statement.len;
+
+        if (batch->count == BATCH_STATEMENTS || batch->bytes >= BATCH_BYTES) {
+            pipeline_publish_batch(&pipeline, batch);
+            batch = NULL;
+        }
+    }
+    if (batch) {
+        pipeline_publish_batch(&pipeline, batch);
+    }
+
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.done = true;
+    pthread_cond_broadcast(&pipeline.can_convert);
+    pthread_cond_broadcast(&pipeline.can_write);
+    pthread_mutex_unlock(&pipeline.lock);
+
+    for (int i = 0; i < jobs; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_join(writer, NULL);
+
+    for (uint64_t i = 0; i < pipeline.n_batches; i++) {
+        free(pipeline.batches[i].text);
+    }
+    free(pipeline.batches);
+    free(workers);
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.can_fill);
+    pthread_cond_destroy(&pipeline.can_convert);
+    pthread_cond_destroy(&pipeline.can_write);
+}
 
-        // Anexar a linha ao buffer
-        if (statement_buffer_size + line_length >= statement_buffer_capacity) {
-            // Expandir o buffer se necessário
-            size_t new_capacity = statement_buffer_capacity * 2;
-            while (statement_buffer_size + line_length >= new_capacity) {
-                new_capacity *= 2;
+#endif
+
+void run_serial(CopyInput* input, CopyOutput* output) {
+    // Cada instrução é uma fatia da entrada, terminando no ';' (inclusive)
+    ConvertedStatement converted = {0};
+    converted.classify = output->reorder != NULL || (output->filter && output->filter->filter_ddl);
+    converted.timed = output->stats != NULL;
+    while (read_statement(input, output, &converted.statement)) {
+        converted.input_end = copy_input_offset(input);
+        converted.convert_ns = converted.classify_ns = 0;
+        convert_statement(&converted);
+        write_converted(&converted, output);
+        write_checkpoint(output, &converted);
+    }
+}
+
+// Tamanho como "64M", "1G" ou "512k", ou um número de bytes
+bool parse_size(const char* text, size_t* size) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+
+    if (end == text) {
+        return false;
+    }
+    switch (toupper((unsigned char)*end)) {
+    case 'K': value <<= 10; end++; break;
+    case 'M': value <<= 20; end++; break;
+    case 'G': value <<= 30; end++; break;
+    case 'T': value <<= 40; end++; break;
+    default: break;
+    }
+    if (toupper((unsigned char)*end) == 'B') {
+        end++;
+    }
+    *size = (size_t)value;
+    return *end == '\0';
+}
+
+void usage(const char* program) {
+    fprintf(stderr, "Uso: %s [--no-mmap] [--jobs N] [--format=text|binary] [--data-dir DIR] [--io-uring] <input.sql|-> <output.sql>\n", program);
+    fprintf(stderr, "     %s [--no-mmap] [--jobs N] [--format=text|binary] --connect CONNINFO <input.sql|->\n", program);
+    fprintf(stderr, "     %s [--no-mmap] [--jobs N] --reorder [--io-uring] <input.sql|-> <output.sql>\n", program);
+    fprintf(stderr, "     %s [--no-mmap] [--jobs N] --reorder --connect CONNINFO <input.sql|->\n", program);
+    fprintf(stderr, "     %s [--no-mmap] [--jobs N] --format=directory [--chunk-size SIZE] <input.sql|-> <output_dir>\n", program);
+    fprintf(stderr, "Filtros: [--include-table PADRÃO]... [--exclude-table PADRÃO]... [--filter-ddl]\n");
+    fprintf(stderr, "Retomada (formato texto em arquivo): [--checkpoint] [--checkpoint-interval SIZE] [--resume]\n");
+    fprintf(stderr, "Medição: [--stats REPORT.json] [--progress]\n");
+    fprintf(stderr, "Shards (formato texto): --shards N [--shard-key TABELA=COLUNA]... e <output.sql> ou N vezes --connect CONNINFO\n");
+    fprintf(stderr, "Colunas na ordem da tabela, com verificação dos valores: [--catalog]\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    bool use_mmap = true;
+    int jobs = 1;
+    OutputFormat format = OUTPUT_TEXT;
+    const char* format_name = NULL;
+    const char* data_dir = NULL;
+    bool use_io_uring = false;
+    const char* conninfo = NULL;
+    const char** conninfos = NULL;
+    int n_conninfos = 0;
+    int n_shards = 0;
+    ShardOutput shards;
+    size_t chunk_size = 64 * 1024 * 1024;
+    bool reorder = false;
+    TableFilter filter;
+    bool checkpoint = false;
+    uint64_t checkpoint_interval = CHECKPOINT_INTERVAL;
+    bool resume = false;
+    const char* stats_path = NULL;
+    bool progress = false;
+    bool map_columns = false;
+    int argi;
+
+    table_filter_init(&filter);
+    shard_output_init(&shards);
+
+    for (argi = 1; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+        if (strcmp(argv[argi], "--no-mmap") == 0) {
+            // Ler a entrada em blocos em vez de mapeá-la na memória
+            use_mmap = false;
+        }
+        else if (strcmp(argv[argi], "--jobs") == 0 && argi + 1 < argc) {
+            jobs = atoi(argv[++argi]);
+        }
+        else if (strncmp(argv[argi], "--jobs=", 7) == 0) {
+            jobs = atoi(argv[argi] + 7);
+        }
+        else if (strcmp(argv[argi], "--format") == 0 && argi + 1 < argc) {
+            format_name = argv[++argi];
+        }
+        else if (strncmp(argv[argi], "--format=", 9) == 0) {
+            format_name = argv[argi] + 9;
+        }
+        else if (strcmp(argv[argi], "--data-dir") == 0 && argi + 1 < argc) {
+            // Diretório dos arquivos de dados do formato binário (padrão: <output.sql>.data)
+            data_dir = argv[++argi];
+        }
+        else if (strncmp(argv[argi], "--data-dir=", 11) == 0) {
+            data_dir = argv[argi] + 11;
+        }
+        else if (strcmp(argv[argi], "--io-uring") == 0) {
+            // Escrever a saída com io_uring, vários buffers em andamento (Linux)
+            use_io_uring = true;
+        }
+        else if (strcmp(argv[argi], "--chunk-size") == 0 && argi + 1 < argc) {
+            // Tamanho dos arquivos de dados do formato diretório (padrão: 64M)
+            if (!parse_size(argv[++argi], &chunk_size)) {
+                usage(argv[0]);
+            }
+        }
+        else if (strncmp(argv[argi], "--chunk-size=", 13) == 0) {
+            if (!parse_size(argv[argi] + 13, &chunk_size)) {
+                usage(argv[0]);
             }
-            char* new_buffer = realloc(statement_buffer, new_capacity);
-            if (!new_buffer) {
+        }
+        else if (strcmp(argv[argi], "--reorder") == 0) {
+            // Dados logo após o CREATE TABLE com COPY FREEZE, índices e restrições no fim
+            reorder = true;
+        }
+        else if ((strcmp(argv[argi], "--connect") == 0 && argi + 1 < argc) || strncmp(argv[argi], "--connect=", 10) == 0) {
+            // Enviar ao servidor ("host=/var/run/postgresql dbname=teste") em vez de escrever o script,
+            // um --connect por shard com --shards
+            conninfos = realloc(conninfos, sizeof(char*) * (n_conninfos + 1));
+            if (!conninfos) {
                 fprintf(stderr, "Erro de alocação de memória\n");
-                free(statement_buffer);
-                fclose(input);
-                fclose(output);
                 exit(1);
             }
-            statement_buffer = new_buffer;
-            statement_buffer_capacity = new_capacity;
+            conninfos[n_conninfos++] = argv[argi][9] == '=' ? argv[argi] + 10 : argv[++argi];
+            conninfo = conninfos[0];
+        }
+        else if (strcmp(argv[argi], "--shards") == 0 && argi + 1 < argc) {
+            // Dividir as linhas entre N saídas pelo hash da chave (--shard-key)
+            n_shards = atoi(argv[++argi]);
+            if (n_shards < 1) {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[argi], "--shard-key") == 0 && argi + 1 < argc) {
+            // Coluna da chave de uma tabela ("public.pedidos=cliente_id"), as tabelas sem chave vão para todos os shards
+            if (!shard_output_add_key(&shards, argv[++argi])) {
+                usage(argv[0]);
+            }
+        }
+        else if (strncmp(argv[argi], "--shard-key=", 12) == 0) {
+            if (!shard_output_add_key(&shards, argv[argi] + 12)) {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[argi], "--include-table") == 0 && argi + 1 < argc) {
+            // Só as tabelas com nome como o padrão ("public.pedidos", "log_*"), pode repetir
+            table_filter_add(&filter, argv[++argi], true);
+        }
+        else if (strncmp(argv[argi], "--include-table=", 16) == 0) {
+            table_filter_add(&filter, argv[argi] + 16, true);
+        }
+        else if (strcmp(argv[argi], "--exclude-table") == 0 && argi + 1 < argc) {
+            table_filter_add(&filter, argv[++argi], false);
+        }
+        else if (strncmp(argv[argi], "--exclude-table=", 16) == 0) {
+            table_filter_add(&filter, argv[argi] + 16, false);
+        }
+        else if (strcmp(argv[argi], "--checkpoint") == 0) {
+            // Pontos de retomada em <output.sql>.checkpoint (padrão: a cada 1G da entrada)
+            checkpoint = true;
+        }
+        else if (strcmp(argv[argi], "--checkpoint-interval") == 0 && argi + 1 < argc) {
+            size_t size;
+            if (!parse_size(argv[++argi], &size) || size == 0) {
+                usage(argv[0]);
+            }
+            checkpoint = true;
+            checkpoint_interval = size;
+        }
+        else if (strncmp(argv[argi], "--checkpoint-interval=", 22) == 0) {
+            size_t size;
+            if (!parse_size(argv[argi] + 22, &size) || size == 0) {
+                usage(argv[0]);
+            }
+            checkpoint = true;
+            checkpoint_interval = size;
+        }
+        else if (strcmp(argv[argi], "--resume") == 0) {
+            // Continuar do último ponto de retomada de uma conversão interrompida
+            checkpoint = true;
+            resume = true;
+        }
+        else if (strcmp(argv[argi], "--stats") == 0 && argi + 1 < argc) {
+            // Relatório JSON com o tempo de cada fase, linhas e bytes por tabela
+            stats_path = argv[++argi];
         }
-        memcpy(statement_buffer + statement_buffer_size, line, line_length);
-        statement_buffer_size += line_length;
-        statement_buffer[statement_buffer_size] = '\0';
+        else if (strncmp(argv[argi], "--stats=", 8) == 0) {
+            stats_path = argv[argi] + 8;
+        }
+        else if (strcmp(argv[argi], "--progress") == 0) {
+            // Linha de progresso no stderr, uma vez por segundo
+            progress = true;
+        }
+        else if (strcmp(argv[argi], "--catalog") == 0) {
+            // Linhas na ordem das colunas dos CREATE TABLE, avisos dos valores que não cabem nelas
+            map_columns = true;
+        }
+        else if (strcmp(argv[argi], "--filter-ddl") == 0) {
+            // Descartar também CREATE TABLE, ALTER TABLE, índices, setval... das tabelas filtradas
+            filter.filter_ddl = true;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - argi != (conninfo ? 1 : 2) || jobs < 1) {
+        usage(argv[0]);
+    }
+    if (format_name && strcmp(format_name, "binary") == 0) {
+        format = OUTPUT_BINARY;
+    }
+    else if (format_name && strcmp(format_name, "directory") == 0 && !conninfo) {
+        format = OUTPUT_DIRECTORY;
+    }
+    else if (format_name && strcmp(format_name, "text") != 0) {
+        usage(argv[0]);
+    }
+    if (reorder && format != OUTPUT_TEXT) {
+        usage(argv[0]);
+    }
+    if (filter.filter_ddl && !table_filter_active(&filter)) {
+        usage(argv[0]);
+    }
+    // Só a saída texto tem todo o estado no bloco COPY aberto
+    if (checkpoint && (format != OUTPUT_TEXT || conninfo || reorder || filter.filter_ddl || n_shards > 0 || map_columns || strcmp(argv[argi + 1], "-") == 0)) {
+        usage(argv[0]);
+    }
+    // Com --shards, um arquivo (não o stdout) ou uma conexão por shard
+    if (n_shards > 0 ? format != OUTPUT_TEXT || reorder || (conninfo ? n_conninfos != n_shards : strcmp(argv[argi + 1], "-") == 0)
+                     : n_conninfos > 1 || shards.n_keys > 0) {
+        usage(argv[0]);
+    }
 
-        // Atualizar o estado de acordo com o conteúdo da linha
-        for (size_t i = 0; i < line_length; i++) {
-            char c = line[i];
-            char next_c = (i + 1 < line_length) ? line[i + 1] : '\0';
+    CopyInput input;
+    if (!copy_input_open(&input, argv[argi], use_mmap)) {
+        perror("Erro ao abrir o arquivo de entrada");
+        exit(1);
+    }
 
-            if (in_line_comment) {
-                if (c == '\n') {
-                    in_line_comment = false;
-                }
+    CopyOutput output = {0};
+    output.format = format;
+    output.input_mapped = input.mapped;
+    ConversionStats stats;
+    if (stats_path || progress) {
+        stats_init(&stats, copy_input_total_size(&input), progress);
+        output.stats = &stats;
+    }
+    char* checkpoint_path = NULL;
+    Checkpoint resume_point = {0};
+    if (checkpoint) {
+        checkpoint_path = malloc(strlen(argv[argi + 1]) + 12);
+        if (!checkpoint_path) {
+            fprintf(stderr, "Erro de alocação de memória\n");
+            exit(1);
+        }
+        sprintf(checkpoint_path, "%s.checkpoint", argv[argi + 1]);
+        output.checkpoint_path = checkpoint_path;
+        output.checkpoint_interval = checkpoint_interval;
+        output.next_checkpoint = checkpoint_interval;
+    }
+    if (resume) {
+        if (!checkpoint_read(checkpoint_path, &resume_point)) {
+            if (errno) {
+                perror("Erro ao ler o ponto de retomada");
             }
-            else if (in_block_comment) {
-                if (c == '*' && next_c == '/') {
-                    in_block_comment = false;
-                    i++;
-                }
+            else {
+                fprintf(stderr, "Erro ao ler o ponto de retomada: %s não é um ponto de retomada\n", checkpoint_path);
             }
-            else if (in_string) {
-                if (c == '\'') {
-                    if (next_c == '\'') {
-                        i++; // Pular aspas escapadas
-                    }
-                    else {
-                        in_string = false;
-                    }
-                }
-                continue; // Continuar dentro da string
+            copy_input_close(&input);
+            exit(1);
+        }
+        if (!copy_input_seek(&input, resume_point.input_offset)) {
+            fprintf(stderr, "Erro: a entrada é menor que a posição do ponto de retomada\n");
+            copy_input_close(&input);
+            exit(1);
+        }
+        // Continuar o bloco COPY que estava aberto
+        output.relation = resume_point.relation;
+        output.column_list = resume_point.column_list;
+        output.default_block = resume_point.default_block;
+        resume_point.relation = NULL;
+        resume_point.column_list = NULL;
+        output.next_checkpoint = resume_point.input_offset + checkpoint_interval;
+    }
+    PgWire wire;
+    PgWire* shard_wires = NULL;
+    DirectoryOutput directory;
+    if (n_shards > 0) {
+        shard_output_set_streams(&shards, n_shards, input.mapped);
+        output.shards = &shards;
+        if (conninfo) {
+            shard_wires = calloc(n_shards, sizeof(PgWire));
+            if (!shard_wires) {
+                fprintf(stderr, "Erro de alocação de memória\n");
+                exit(1);
             }
-            else {
-                if (c == '-' && next_c == '-') {
-                    in_line_comment = true;
-                    i++;
-                }
-                else if (c == '/' && next_c == '*') {
-                    in_block_comment = true;
-                    i++;
-                }
-                else if (c == '\'') {
-                    in_string = true;
-                }
-                else if (c == ';') {
-                    // Fim da instrução
-
-                    // Temos uma instrução completa
-                    // Remover comentários e espaços em branco iniciais
-                    char* statement_trimmed = skip_comments_and_whitespace(statement_buffer);
-
-                    if (strncasecmp(statement_trimmed, "INSERT INTO", 11) == 0) {
-                        // É um INSERT, tentar analisar e converter
-                        PgQueryParseResult result = pg_query_parse(statement_buffer);
-
-                        if (result.error) {
-                            fprintf(stderr, "Aviso: Erro ao analisar SQL: %s\n", result.error->message);
-                            pg_query_free_parse_result(result);
-                            // Escrever a instrução original no arquivo de saída
-                            fprintf(output, "%s", statement_buffer);
-                        }
-                        else {
-                            // Processar o resultado analisado
-                            process_parsed_statement(result.parse_tree, output);
-                            pg_query_free_parse_result(result);
-                        }
-                    }
-                    else {
-                        // Não é um INSERT, escrever a instrução original no arquivo de saída
-                        fprintf(output, "%s", statement_buffer);
-                    }
-
-                    // Ajustar o índice para continuar após o ponto e vírgula
-                    i++; // Avançar para o próximo caractere
-                    if (i < line_length) {
-                        // Processar o restante da linha
-                        statement_buffer_size = 0;
-                        statement_buffer[0] = '\0';
-
-                        // Copiar o restante da linha para o buffer de instrução
-                        size_t remaining_length = line_length - i;
-                        memcpy(statement_buffer, line + i, remaining_length);
-                        statement_buffer_size = remaining_length;
-                        statement_buffer[statement_buffer_size] = '\0';
-
-                        // Como já atualizamos o índice, continuamos o loop
-                        continue;
-                    }
-                    else {
-                        // Reiniciar o buffer
-                        statement_buffer_size = 0;
-                        statement_buffer[0] = '\0';
-                        break;
-                    }
+            for (int i = 0; i < n_shards; i++) {
+                if (!pgwire_connect(&shard_wires[i], conninfos[i])) {
+                    copy_input_close(&input);
+                    exit(1);
                 }
             }
+            shard_output_use_wires(&shards, shard_wires);
+        }
+        else if (!shard_output_open_files(&shards, argv[argi + 1], use_io_uring)) {
+            perror("Erro ao abrir o arquivo de saída");
+            copy_input_close(&input);
+            exit(1);
+        }
+    }
+    else if (format == OUTPUT_DIRECTORY) {
+        if (!directory_output_open(&directory, argv[argi + 1], chunk_size, input.mapped)) {
+            perror("Erro ao criar o diretório de saída");
+            copy_input_close(&input);
+            exit(1);
+        }
+        output.directory = &directory;
+    }
+    else if (conninfo) {
+        if (!pgwire_connect(&wire, conninfo)) {
+            copy_input_close(&input);
+            exit(1);
         }
+        output.wire = &wire;
+    }
+    else if (resume ? !output_sink_open_at(&output.sink, argv[argi + 1], resume_point.output_offset, use_io_uring)
+                    : !output_sink_open(&output.sink, argv[argi + 1], use_io_uring)) {
+        perror("Erro ao abrir o arquivo de saída");
+        copy_input_close(&input);
+        exit(1);
     }
 
-    // Processar qualquer instrução restante
-    if (statement_buffer_size > 0) {
-        char* statement_trimmed = skip_comments_and_whitespace(statement_buffer);
+    if (table_filter_active(&filter)) {
+        output.filter = &filter;
+    }
 
-        if (strncasecmp(statement_trimmed, "INSERT INTO", 11) == 0) {
-            PgQueryParseResult result = pg_query_parse(statement_buffer);
+    ReorderOutput reorder_output;
+    if (reorder) {
+        ReorderWriter writer = { reorder_write_statement, reorder_write_begin_copy, reorder_write_copy_data, reorder_write_end_copy, &output };
+        reorder_output_init(&reorder_output, writer);
+        output.reorder = &reorder_output;
+    }
 
-            if (result.error) {
-                fprintf(stderr, "Aviso: Erro ao analisar SQL: %s\n", result.error->message);
-                pg_query_free_parse_result(result);
-                fprintf(output, "%s", statement_buffer);
-            }
-            else {
-                process_parsed_statement(result.parse_tree, output);
-                pg_query_free_parse_result(result);
+    char* default_data_dir = NULL;
+    table_catalog_init(&output.catalog);
+    output.map_columns = map_columns;
+    if (format == OUTPUT_BINARY) {
+        if (!data_dir && !conninfo) {
+            default_data_dir = malloc(strlen(argv[argi + 1]) + 6);
+            if (!default_data_dir) {
+                fprintf(stderr, "Erro de alocação de memória\n");
+                exit(1);
             }
+            sprintf(default_data_dir, "%s.data", argv[argi + 1]);
+            data_dir = default_data_dir;
         }
-        else {
-            fprintf(output, "%s", statement_buffer);
+        output.data_dir = data_dir;
+    }
+
+#ifndef _WIN32
+    if (jobs > 1) {
+        run_parallel(&input, &output, jobs);
+    }
+    else
+#endif
+    {
+        run_serial(&input, &output);
+    }
+
+    if (output.reorder) {
+        reorder_output_close(output.reorder);
+    }
+
+    // A saída pode apontar para a entrada mapeada, fechá-la antes
+    close_copy_block(&output);
+    bool ok = true;
+    shard_output_close(&shards);
+    if (output.shards) {
+        for (int i = 0; shard_wires && i < n_shards; i++) {
+            // Esperar cada servidor terminar todas as instruções
+            ok = pgwire_finish(&shard_wires[i]) && ok;
         }
+        free(shard_wires);
+    }
+    else if (output.directory) {
+        directory_output_close(output.directory);
     }
+    else if (output.wire) {
+        // Esperar o servidor terminar todas as instruções
+        ok = pgwire_finish(output.wire);
+    }
+    else {
+        output_sink_close(&output.sink);
+    }
+    byte_buffer_free(&output.fallback);
+    copy_input_close(&input);
+    table_filter_free(&filter);
+    free(conninfos);
 
-    free(statement_buffer);
-    fclose(input);
-    fclose(output);
+    if (output.stats) {
+        if (stats_path && !stats_write_report(output.stats, stats_path)) {
+            perror("Erro ao escrever o relatório");
+            ok = false;
+        }
+        stats_free(output.stats);
+    }
+
+    // Conversão completa, o ponto de retomada não serve mais
+    if (checkpoint_path) {
+        remove(checkpoint_path);
+        free(checkpoint_path);
+    }
+
+    table_catalog_free(&output.catalog);
+    if (format == OUTPUT_BINARY) {
+        byte_buffer_free(&output.tuples);
+        free(default_data_dir);
+    }
 
-    return 0;
+    return ok ? 0 : 1;
 }
@@ -5,135 +5,131 @@
 #include <ctype.h>
 
 #include <pg_query.h>
-#include "cJSON.h"
+
+#include "insert_to_copy_input.h"
+#include "insert_to_copy_output.h"
 
 #ifdef _WIN32
-#define strncasecmp _strnicmp
+#include <io.h>
+#define fseeko _fseeki64
+#define ftruncate _chsize_s
+#define fileno _fileno
+#else
+#include <unistd.h>
 #endif
 
-#define INITIAL_BUFFER_CAPACITY 8192
-#define MAX_BUFFERED_ROWS 10000  // Adjust this value as needed
-
-// Structures to accumulate data per table
-typedef struct DataRow {
-    char* data;              // The data row as a string
-    struct DataRow* next;    // Pointer to the next data row
-} DataRow;
-
+#define MAX_BUFFERED_ROWS 10000  // Adjust this value as needed, only used without --max-buffer-mem
+
+#define ROW_ARENA_INITIAL_CAPACITY (64 * 1024)
+
+// Size at which the INSERT of a table's rows that aren't constant is flushed
+#define FALLBACK_BATCH_BYTES (1024 * 1024)
+
+// Size from which an INSERT is converted a batch of rows at a time, and the size of the batches
+#define LONG_INSERT_BYTES (1024 * 1024)
+#define LONG_INSERT_BATCH_BYTES (64 * 1024)
+
+// Rows of a table in the spill file
+typedef struct {
+    long long offset;
+    size_t len;
+} SpillExtent;
+
+// Structure to accumulate data per table. The rows are appended in place to one
+// growable arena that already holds the COPY command, so a flush is a single
+// write and resetting the arena keeps its memory for the next rows.
+//
+// Arena layout: "\n" "COPY target FROM stdin;\n" rows... ("\.\n" is added on flush)
+//
+// With --max-buffer-mem, the arenas of all tables together stay within a byte
+// budget: when it is exceeded, the rows of the largest arenas are moved to a
+// temp file shared by all tables and the arenas are freed, so that thousands
+// of tables don't take a file descriptor each. Each table keeps the extents of
+// its rows in the file, and on flush they are streamed back before the rows
+// still in memory, so each table still ends up in one COPY block. The file is
+// emptied whenever no table has rows in it.
+//
+// Rows with values that aren't constants (now(), nextval(...)) are gathered in
+// one INSERT per table, written right after its COPY block.
+//
+// Other statements only flush the tables they refer to (pg_query_statement_info):
+// a CREATE INDEX, an ALTER TABLE or a COMMENT ON a table writes the rows of that
+// table and leaves the others buffered, so the COPY blocks stay large. Statements
+// that may touch any table (functions, transaction control, psql meta-commands)
+// and settings that change how rows are read still flush everything.
 typedef struct TableData {
-    char* table_name;        // The full table name (schema.table)
-    DataRow* head;           // Head of the linked list of data rows
-    DataRow* tail;           // Tail of the linked list for efficient appending
-    int row_count;           // Number of accumulated rows
+    char* table_name;        // The full table name (schema.table) and column list
+    size_t relation_len;     // Length of the table name at the start of table_name
+    bool has_default;        // Rows have DEFAULT values, the COPY command has the DEFAULT option
+    char* arena;             // Leading newline, COPY command and accumulated rows, or NULL
+    size_t arena_len;        // Bytes used in the arena, 0 until the COPY command is written
+    size_t arena_capacity;
+    size_t header_len;       // Length of the newline and COPY command at the start of the arena
+    SpillExtent* spill_extents; // Rows moved out of memory, older than the ones in the arena
+    int n_spill_extents;
+    int spill_extents_capacity;
+    int row_count;           // Number of accumulated rows, spilled ones included
+    char* fallback;          // "INSERT INTO ... VALUES (...), ..." of the rows that aren't constant, or NULL
+    size_t fallback_len;
     struct TableData* next;  // Pointer to the next table data in the hash map
 } TableData;
 
 #define TABLE_HASH_SIZE 1024
 TableData* table_hash[TABLE_HASH_SIZE] = { NULL };
 
-// Function prototypes
-char* unescape_single_quotes(const char* input);
-char* escape_special_chars(const char* input);
-char* skip_comments_and_whitespace(char* input);
-void process_parsed_statement(const char* parse_tree_json);
-void append_data_row_to_table(TableData* table_data, char* data_row);
-void flush_table_data(FILE* output, TableData* table_data);
-void flush_accumulated_data(FILE* output);
-unsigned int hash_table_name(const char* table_name);
-TableData* get_or_create_table_data(const char* table_name);
-char* build_data_row(cJSON* row_values);
-const char* extract_value_as_string(cJSON* value_item);
-bool detect_end_of_statement(const char* statement);
-void free_table_data(TableData* table_data);
+// Reused buffer for the COPY target of the statement being converted
+char* copy_target = NULL;
+size_t copy_target_capacity = 0;
 
-// Function to unescape single quotes
-char* unescape_single_quotes(const char* input) {
-    size_t len = strlen(input);
-    char* output = malloc(len + 1);
-    if (!output) {
-        fprintf(stderr, "Memory allocation error\n");
-        exit(1);
-    }
-    size_t j = 0;
-    for (size_t i = 0; i < len; i++) {
-        if (input[i] == '\'' && input[i + 1] == '\'') {
-            output[j++] = '\'';
-            i++; // Skip the second quote
-        }
-        else {
-            output[j++] = input[i];
-        }
-    }
-    output[j] = '\0';
-    return output;
-}
+// Byte budget for all arenas (0 = no budget) and what they currently take
+size_t max_buffer_mem = 0;
+size_t buffered_bytes = 0;
 
-// Function to escape tabs and newlines
-char* escape_special_chars(const char* input) {
-    size_t len = strlen(input);
-    // Worst case: every character needs escaping
-    char* output = malloc(len * 2 + 1);
-    if (!output) {
-        fprintf(stderr, "Memory allocation error\n");
-        exit(1);
-    }
-    size_t j = 0;
-    for (size_t i = 0; i < len; i++) {
-        if (input[i] == '\t') {
-            output[j++] = '\\';
-            output[j++] = 't';
-        }
-        else if (input[i] == '\n') {
-            output[j++] = '\\';
-            output[j++] = 'n';
-        }
-        else {
-            output[j++] = input[i];
-        }
-    }
-    output[j] = '\0';
-    return output;
-}
+// Temp file with the spilled rows of all tables, its length and the number of tables with rows in it
+FILE* spill_file = NULL;
+long long spill_len = 0;
+int spilled_tables = 0;
 
-// Function to skip comments and whitespace at the beginning
-char* skip_comments_and_whitespace(char* input) {
-    char* ptr = input;
+OutputSink output_sink;
 
-    while (*ptr) {
-        // Skip leading whitespace
-        while (isspace((unsigned char)*ptr)) {
-            ptr++;
-        }
+// Whether the output ends with a newline, COPY commands have to start on their own line
+bool output_at_line_start = true;
 
-        // Line comment
-        if (ptr[0] == '-' && ptr[1] == '-') {
-            // Skip until end of line
-            ptr += 2;
-            while (*ptr && *ptr != '\n') {
-                ptr++;
-            }
-            continue;
-        }
+// Relations named together in a statement (ALTER SEQUENCE ... OWNED BY, a nextval
+// default), so that a setval flushes the tables that may use the sequence
+typedef struct RelationLink {
+    char* relation;
+    char** related;
+    int n_related;
+    struct RelationLink* next;
+} RelationLink;
 
-        // Block comment
-        if (ptr[0] == '/' && ptr[1] == '*') {
-            // Skip until end of comment
-            ptr += 2;
-            while (*ptr && !(ptr[0] == '*' && ptr[1] == '/')) {
-                ptr++;
-            }
-            if (*ptr) {
-                ptr += 2; // Skip '*/'
-            }
-            continue;
-        }
+RelationLink* link_hash[TABLE_HASH_SIZE] = { NULL };
 
-        // Not whitespace or comment
-        break;
-    }
+// Settings that change how rows are read or which table a name is, rows buffered
+// before them are written first
+const char* const row_settings[] = {
+    "search_path", "client_encoding", "datestyle", "intervalstyle", "timezone", "lc_monetary", "xmloption",
+    "standard_conforming_strings", "session_replication_role", "row_security", "role", "session_authorization"
+};
 
-    return ptr;
-}
+// Function prototypes
+bool process_insert_statement(StatementSlice statement);
+void accumulate_rows(const PgQueryInsertToCopyResult* result);
+void accumulate_insert_batch(PgQueryInsertToCopyResult* rows, void* context);
+const char* build_copy_target(const PgQueryInsertToCopyResult* result);
+const char* copy_options(const TableData* table_data);
+void arena_reserve(TableData* table_data, size_t len);
+void append_data_row_to_table(TableData* table_data, const char* data, size_t len, int n_rows);
+void flush_table_data(OutputSink* output, TableData* table_data);
+void flush_accumulated_data(OutputSink* output);
+void spill_table_data(TableData* table_data);
+void enforce_buffer_budget(void);
+unsigned int hash_table_name(const char* table_name);
+TableData* get_or_create_table_data(const char* table_name, size_t relation_len, bool has_default);
+void append_fallback_to_table(TableData* table_data, const PgQueryInsertToCopyResult* result);
+void free_table_data(TableData* table_data);
+void flush_statement_tables(OutputSink* output, StatementSlice statement);
 
 // Hash function for table names
 unsigned int hash_table_name(const char* table_name) {
@@ -145,247 +141,355 @@ unsigned int hash_table_name(const char* table_name) {
 }
 
 // Get or create TableData for a table
-TableData* get_or_create_table_data(const char* table_name) {
+TableData* get_or_create_table_data(const char* table_name, size_t relation_len, bool has_default) {
     unsigned int hash = hash_table_name(table_name);
     TableData* entry = table_hash[hash];
     while (entry) {
-        if (strcmp(entry->table_name, table_name) == 0) {
+        if (strcmp(entry->table_name, table_name) == 0 && entry->has_default == has_default) {
             return entry; // Found existing table data
         }
         entry = entry->next;
     }
-    // Create new table data
-    TableData* new_entry = (TableData*)malloc(sizeof(TableData));
+    // Create new table data, its arena is allocated with the first rows
+    TableData* new_entry = (TableData*)calloc(1, sizeof(TableData));
+    if (!new_entry) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
     new_entry->table_name = strdup(table_name);
-    new_entry->head = new_entry->tail = NULL;
-    new_entry->row_count = 0;
+    new_entry->relation_len = relation_len;
+    new_entry->has_default = has_default;
     new_entry->next = table_hash[hash];
     table_hash[hash] = new_entry;
     return new_entry;
 }
 
-// Function to process a parsed statement
-void process_parsed_statement(const char* parse_tree_json) {
-    cJSON* root = cJSON_Parse(parse_tree_json);
-    if (!root) {
-        fprintf(stderr, "Error parsing JSON\n");
+// Make room for len more bytes in the table's arena
+void arena_reserve(TableData* table_data, size_t len) {
+    if (table_data->arena_len + len <= table_data->arena_capacity) {
         return;
     }
 
-    cJSON* stmts = cJSON_GetObjectItem(root, "stmts");
-    if (!stmts) {
-        cJSON_Delete(root);
-        return;
+    size_t new_capacity = table_data->arena_capacity ? table_data->arena_capacity : ROW_ARENA_INITIAL_CAPACITY;
+    while (table_data->arena_len + len > new_capacity) {
+        new_capacity *= 2;
     }
+    char* new_arena = (char*)realloc(table_data->arena, new_capacity);
+    if (!new_arena) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    buffered_bytes += new_capacity - table_data->arena_capacity;
+    table_data->arena = new_arena;
+    table_data->arena_capacity = new_capacity;
+}
 
-    cJSON* stmt_item;
-    cJSON_ArrayForEach(stmt_item, stmts) {
-        cJSON* stmt = cJSON_GetObjectItem(stmt_item, "stmt");
-        if (!stmt) continue;
+// Function to convert an INSERT statement and accumulate its rows
+// Returns false if the statement can't be converted and must be written as is
+bool process_insert_statement(StatementSlice statement) {
+    if (statement.len > LONG_INSERT_BYTES) {
+        // Converting a long INSERT at once takes memory in proportion to its size,
+        // its rows are accumulated a batch at a time instead
+        int n_batches = 0;
+        if (pg_query_insert_to_copy_rows(statement.data, statement.len, PG_QUERY_PARSE_DEFAULT, LONG_INSERT_BATCH_BYTES,
+                                         accumulate_insert_batch, &n_batches)) {
+            return n_batches > 0;
+        }
+    }
 
-        cJSON* insert_stmt = cJSON_GetObjectItem(stmt, "InsertStmt");
-        if (insert_stmt) {
-            // This is an INSERT command
+    PgQueryInsertToCopyResult result = pg_query_insert_to_copy_len(statement.data, statement.len, PG_QUERY_PARSE_DEFAULT);
 
-            // Extract the table name
-            cJSON* relation = cJSON_GetObjectItem(insert_stmt, "relation");
-            if (!relation) continue;
-            cJSON* schemaname = cJSON_GetObjectItem(relation, "schemaname");
-            cJSON* relname = cJSON_GetObjectItem(relation, "relname");
+    if (result.error) {
+        fprintf(stderr, "Warning: Error parsing SQL: %s\n", result.error->message);
+        pg_query_free_insert_to_copy_result(result);
+        return false;
+    }
+    if (!result.relation) {
+        // Non-constant values, ON CONFLICT, etc.
+        pg_query_free_insert_to_copy_result(result);
+        return false;
+    }
 
-            char full_table_name[512];
-            if (schemaname && schemaname->valuestring) {
-                snprintf(full_table_name, sizeof(full_table_name), "%s.%s", schemaname->valuestring, relname->valuestring);
-            }
-            else if (relname && relname->valuestring) {
-                snprintf(full_table_name, sizeof(full_table_name), "%s", relname->valuestring);
-            }
-            else {
-                fprintf(stderr, "Error: Table name is missing in the INSERT statement.\n");
-                cJSON_Delete(root);
-                return;
-            }
+    accumulate_rows(&result);
+    pg_query_free_insert_to_copy_result(result);
+    return true;
+}
 
-            // Get or create the TableData for this table
-            TableData* table_data = get_or_create_table_data(full_table_name);
-
-            // Process values
-            cJSON* select_stmt = cJSON_GetObjectItem(insert_stmt, "selectStmt");
-            if (select_stmt) {
-                cJSON* values = cJSON_GetObjectItem(select_stmt, "SelectStmt");
-                if (values) {
-                    cJSON* values_clause = cJSON_GetObjectItem(values, "valuesLists");
-
-                    if (values_clause) {
-                        cJSON* row_values;
-                        cJSON_ArrayForEach(row_values, values_clause) {
-                            // Build the data row string
-                            char* data_row = build_data_row(row_values);
-                            // Append the data row to the table's data list
-                            append_data_row_to_table(table_data, data_row);
-                        }
-                    }
-                }
-            }
-        }
-        else {
-            // Not an INSERT, handle as needed
-        }
+// Accumulate the rows of a converted INSERT
+void accumulate_rows(const PgQueryInsertToCopyResult* result) {
+    // Rows are grouped by table and column list, since both end up in the COPY command
+    TableData* table_data = get_or_create_table_data(build_copy_target(result), strlen(result->relation), result->has_default != 0);
+    if (result->fallback_insert) {
+        append_fallback_to_table(table_data, result);
+    }
+    if (result->n_rows > 0) {
+        append_data_row_to_table(table_data, result->copy_data, result->copy_data_len, result->n_rows);
     }
-
-    cJSON_Delete(root);
 }
 
-// Build a data row string from row_values
-char* build_data_row(cJSON* row_values) {
-    // Estimate initial buffer size
-    size_t buffer_size = 1024;
-    char* data_row = (char*)malloc(buffer_size);
-    size_t data_row_len = 0;
-
-    cJSON* vList = cJSON_GetObjectItem(row_values, "List");
-    cJSON* vItems = cJSON_GetObjectItem(vList, "items");
-
-    cJSON* value_item;
-    int first_value = 1;
-    cJSON_ArrayForEach(value_item, vItems) {
-        if (!first_value) {
-            if (data_row_len + 1 >= buffer_size) {
-                buffer_size *= 2;
-                data_row = (char*)realloc(data_row, buffer_size);
-            }
-            data_row[data_row_len++] = '\t';
-        }
-        first_value = 0;
+// Accumulate a batch of rows of a long INSERT, counting the batches in *context. When
+// a batch can't be converted after others were, the rows from it on are written as an
+// INSERT; if it is the first one, the whole statement is written as is.
+void accumulate_insert_batch(PgQueryInsertToCopyResult* rows, void* context) {
+    int* n_batches = (int*)context;
 
-        // Extract value as string
-        const char* value_str = extract_value_as_string(value_item);
+    if (rows->error) {
+        fprintf(stderr, "Warning: Error parsing SQL: %s\n", rows->error->message);
+    }
+    if (rows->relation && !rows->error) {
+        accumulate_rows(rows);
+        (*n_batches)++;
+    }
+    else if (*n_batches > 0) {
+        StatementSlice rest = { rows->fallback_insert, strlen(rows->fallback_insert), STATEMENT_SQL };
+        flush_statement_tables(&output_sink, rest);
+        output_sink_write(&output_sink, rest.data, rest.len);
+        output_sink_puts(&output_sink, ";");
+        output_at_line_start = false;
+    }
+}
 
-        // Ensure buffer is large enough
-        size_t value_len = strlen(value_str);
-        if (data_row_len + value_len + 1 >= buffer_size) {
-            while (data_row_len + value_len + 1 >= buffer_size) {
-                buffer_size *= 2;
-            }
-            data_row = (char*)realloc(data_row, buffer_size);
+// Build the "schema.table (col, ...)" target of the COPY command, in a buffer
+// that is reused by the next call
+const char* build_copy_target(const PgQueryInsertToCopyResult* result) {
+    size_t length = strlen(result->relation) + 4;
+    for (int i = 0; i < result->n_columns; i++) {
+        length += strlen(result->columns[i]) + 2;
+    }
+    if (length > copy_target_capacity) {
+        free(copy_target);
+        copy_target_capacity = length * 2;
+        copy_target = (char*)malloc(copy_target_capacity);
+        if (!copy_target) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
         }
+    }
 
-        // Copy value into data row
-        memcpy(data_row + data_row_len, value_str, value_len);
-        data_row_len += value_len;
+    char* ptr = copy_target;
+    ptr += sprintf(ptr, "%s", result->relation);
+    for (int i = 0; i < result->n_columns; i++) {
+        ptr += sprintf(ptr, "%s%s", i == 0 ? " (" : ", ", result->columns[i]);
+    }
+    if (result->n_columns > 0) {
+        strcpy(ptr, ")");
     }
+    return copy_target;
+}
 
-    // Add newline character
-    if (data_row_len + 1 >= buffer_size) {
-        buffer_size += 1;
-        data_row = (char*)realloc(data_row, buffer_size);
+// Options of the table's COPY command, the same in the arena and after a spill
+const char* copy_options(const TableData* table_data) {
+    return table_data->has_default ? " WITH (DEFAULT E'\\\\D')" : "";
+}
+
+// Append COPY text rows to the table's arena
+void append_data_row_to_table(TableData* table_data, const char* data, size_t len, int n_rows) {
+    if (table_data->arena_len == 0) {
+        // Start the arena with the COPY command
+        arena_reserve(table_data, strlen(table_data->table_name) + 44);
+        table_data->header_len = sprintf(table_data->arena, "\nCOPY %s FROM stdin%s;\n", table_data->table_name,
+                                         copy_options(table_data));
+        table_data->arena_len = table_data->header_len;
     }
-    data_row[data_row_len++] = '\n';
-    data_row[data_row_len] = '\0';
 
-    return data_row;
+    // Keep room for the "\.\n" that ends the COPY command on flush
+    arena_reserve(table_data, len + 3);
+    memcpy(table_data->arena + table_data->arena_len, data, len);
+    table_data->arena_len += len;
+    table_data->row_count += n_rows;
+
+    if (max_buffer_mem > 0) {
+        enforce_buffer_budget();
+    }
+    else if (table_data->row_count >= MAX_BUFFERED_ROWS) {
+        // Flush data for this table
+        flush_table_data(&output_sink, table_data);
+    }
 }
 
-// Extract value as string from value_item
-const char* extract_value_as_string(cJSON* value_item) {
-    static char buffer[1024];
-    cJSON* val_node = value_item->child;
+// Add the rows that aren't constant to the table's INSERT, which has the same
+// table and column list as its COPY command
+void append_fallback_to_table(TableData* table_data, const PgQueryInsertToCopyResult* result) {
+    const char* data = result->fallback_insert;
+    size_t len = strlen(data);
+
+    if (table_data->fallback_len > 0) {
+        data += result->fallback_values_offset;
+        len -= result->fallback_values_offset;
+    }
+    char* fallback = (char*)realloc(table_data->fallback, table_data->fallback_len + len + 5);
+    if (!fallback) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    if (table_data->fallback_len > 0) {
+        memcpy(fallback + table_data->fallback_len, ", ", 2);
+        table_data->fallback_len += 2;
+    }
+    memcpy(fallback + table_data->fallback_len, data, len);
+    table_data->fallback = fallback;
+    table_data->fallback_len += len;
 
-    if (val_node && cJSON_GetObjectItem(val_node, "A_Const")) {
-        cJSON* a_Const = cJSON_GetObjectItem(val_node, "A_Const");
-        cJSON* val = cJSON_GetObjectItem(a_Const, "val");
+    if (table_data->fallback_len >= FALLBACK_BATCH_BYTES) {
+        flush_table_data(&output_sink, table_data);
+    }
+}
 
-        if (val && cJSON_GetObjectItem(val, "ival")) {
-            int int_val = cJSON_GetObjectItem(cJSON_GetObjectItem(val, "ival"), "ival")->valueint;
-            sprintf(buffer, "%d", int_val);
-            return buffer;
+// Move the rows in the table's arena to the spill file and free the arena
+void spill_table_data(TableData* table_data) {
+    if (table_data->arena_len > table_data->header_len) {
+        if (!spill_file) {
+            spill_file = tmpfile();
+            if (!spill_file) {
+                perror("Error creating temp file");
+                exit(1);
+            }
         }
-        else if (val && cJSON_GetObjectItem(val, "fval")) {
-            const char* float_str = cJSON_GetObjectItem(cJSON_GetObjectItem(val, "fval"), "fval")->valuestring;
-            return float_str;
+        // Reading spilled rows back moves the file position
+        size_t rows_len = table_data->arena_len - table_data->header_len;
+        if (fseeko(spill_file, spill_len, SEEK_SET) != 0 ||
+            fwrite(table_data->arena + table_data->header_len, 1, rows_len, spill_file) != rows_len) {
+            perror("Error writing temp file");
+            exit(1);
         }
-        else if (val && cJSON_GetObjectItem(val, "sval")) {
-            const char* str_val = cJSON_GetObjectItem(cJSON_GetObjectItem(val, "sval"), "str")->valuestring;
-            // Unescape and handle special characters
-            char* unescaped_str = unescape_single_quotes(str_val);
-            char* escaped_str = escape_special_chars(unescaped_str);
-            strncpy(buffer, escaped_str, sizeof(buffer));
-            buffer[sizeof(buffer) - 1] = '\0';
-            free(unescaped_str);
-            free(escaped_str);
-            return buffer;
+
+        // Rows right after the table's last extent make it longer
+        SpillExtent* last = table_data->n_spill_extents > 0 ? &table_data->spill_extents[table_data->n_spill_extents - 1] : NULL;
+        if (last && last->offset + (long long)last->len == spill_len) {
+            last->len += rows_len;
         }
-        else if (val && cJSON_GetObjectItem(val, "Null")) {
-            return "\\N";
+        else {
+            if (table_data->n_spill_extents == table_data->spill_extents_capacity) {
+                int capacity = table_data->spill_extents_capacity ? table_data->spill_extents_capacity * 2 : 8;
+                SpillExtent* extents = (SpillExtent*)realloc(table_data->spill_extents, sizeof(SpillExtent) * capacity);
+                if (!extents) {
+                    fprintf(stderr, "Memory allocation error\n");
+                    exit(1);
+                }
+                table_data->spill_extents = extents;
+                table_data->spill_extents_capacity = capacity;
+            }
+            if (table_data->n_spill_extents == 0) {
+                spilled_tables++;
+            }
+            table_data->spill_extents[table_data->n_spill_extents].offset = spill_len;
+            table_data->spill_extents[table_data->n_spill_extents].len = rows_len;
+            table_data->n_spill_extents++;
         }
-    }
-    else if (val_node && cJSON_GetObjectItem(val_node, "Null")) {
-        return "\\N";
+        spill_len += rows_len;
     }
 
-    // Unsupported value type
-    return "\\N";
+    free(table_data->arena);
+    buffered_bytes -= table_data->arena_capacity;
+    table_data->arena = NULL;
+    table_data->arena_len = 0;
+    table_data->arena_capacity = 0;
 }
 
-// Append a data row to the table's data list
-void append_data_row_to_table(TableData* table_data, char* data_row) {
-    DataRow* new_row = (DataRow*)malloc(sizeof(DataRow));
-    new_row->data = data_row;
-    new_row->next = NULL;
-
-    if (table_data->tail) {
-        table_data->tail->next = new_row;
-        table_data->tail = new_row;
-    }
-    else {
-        table_data->head = table_data->tail = new_row;
+// Spill the largest arenas until all of them fit in the budget again
+void enforce_buffer_budget(void) {
+    while (buffered_bytes > max_buffer_mem) {
+        TableData* largest = NULL;
+        for (int i = 0; i < TABLE_HASH_SIZE; i++) {
+            for (TableData* table_data = table_hash[i]; table_data; table_data = table_data->next) {
+                if (!largest || table_data->arena_capacity > largest->arena_capacity) {
+                    largest = table_data;
+                }
+            }
+        }
+        if (!largest || largest->arena_capacity == 0) {
+            return;
+        }
+        spill_table_data(largest);
     }
+}
 
-    table_data->row_count++;
+// Stream the spilled rows of a table back to the output, and empty the spill
+// file once no table has rows left in it
+void write_spilled_rows(OutputSink* output, TableData* table_data) {
+    char buffer[64 * 1024];
 
-    if (table_data->row_count >= MAX_BUFFERED_ROWS) {
-        // Flush data for this table
-        flush_table_data(stdout, table_data);
-        // Reset table data
-        table_data->head = table_data->tail = NULL;
-        table_data->row_count = 0;
-    }
-}
+    for (int i = 0; i < table_data->n_spill_extents; i++) {
+        const SpillExtent* extent = &table_data->spill_extents[i];
 
-// Flush data for a single table
-void flush_table_data(FILE* output, TableData* table_data) {
-    if (table_data->head == NULL) {
-        return; // Nothing to flush
+        if (fseeko(spill_file, extent->offset, SEEK_SET) != 0) {
+            perror("Error reading temp file");
+            exit(1);
+        }
+        for (size_t done = 0; done < extent->len;) {
+            size_t n = extent->len - done < sizeof(buffer) ? extent->len - done : sizeof(buffer);
+            if (fread(buffer, 1, n, spill_file) != n) {
+                perror("Error reading temp file");
+                exit(1);
+            }
+            output_sink_write(output, buffer, n);
+            done += n;
+        }
     }
+    table_data->n_spill_extents = 0;
 
-    // Write COPY command
-    fprintf(output, "COPY %s FROM stdin;\n", table_data->table_name);
+    if (--spilled_tables == 0) {
+        spill_len = 0;
+        if (fflush(spill_file) != 0 || ftruncate(fileno(spill_file), 0) != 0) {
+            perror("Error writing temp file");
+            exit(1);
+        }
+    }
+}
 
-    // Write data rows
-    DataRow* current_row = table_data->head;
-    while (current_row) {
-        fprintf(output, "%s", current_row->data);
-        current_row = current_row->next;
+// Write the INSERT of the rows that aren't constant, after the table's COPY block
+void flush_table_fallback(OutputSink* output, TableData* table_data) {
+    if (table_data->fallback_len == 0) {
+        return;
+    }
+    memcpy(table_data->fallback + table_data->fallback_len, ";\n", 2);
+    if (!output_at_line_start) {
+        output_sink_puts(output, "\n");
     }
+    output_sink_write(output, table_data->fallback, table_data->fallback_len + 2);
+    output_at_line_start = true;
+    table_data->fallback_len = 0;
+}
 
-    // End COPY command
-    fprintf(output, "\\.\n");
+// Flush data for a single table with one write of its arena, and reset the arena
+void flush_table_data(OutputSink* output, TableData* table_data) {
+    if (table_data->row_count == 0) {
+        flush_table_fallback(output, table_data);
+        return; // No rows to flush
+    }
 
-    // Free data rows
-    current_row = table_data->head;
-    while (current_row) {
-        DataRow* next_row = current_row->next;
-        free(current_row->data);
-        free(current_row);
-        current_row = next_row;
+    // The leading newline is only written when the output isn't at the start of a line
+    size_t start = output_at_line_start ? 1 : 0;
+
+    if (table_data->n_spill_extents > 0) {
+        // Spilled rows first, then the ones still in memory
+        output_sink_puts(output, start ? "COPY " : "\nCOPY ");
+        output_sink_puts(output, table_data->table_name);
+        output_sink_puts(output, " FROM stdin");
+        output_sink_puts(output, copy_options(table_data));
+        output_sink_puts(output, ";\n");
+        write_spilled_rows(output, table_data);
+        if (table_data->arena_len > table_data->header_len) {
+            output_sink_write(output, table_data->arena + table_data->header_len, table_data->arena_len - table_data->header_len);
+        }
+        output_sink_puts(output, "\\.\n");
+    }
+    else {
+        // End COPY command, append_data_row_to_table reserved the room for it
+        memcpy(table_data->arena + table_data->arena_len, "\\.\n", 3);
+        output_sink_write(output, table_data->arena + start, table_data->arena_len + 3 - start);
     }
+    output_at_line_start = true;
 
-    table_data->head = table_data->tail = NULL;
+    if (table_data->arena_len > 0) {
+        table_data->arena_len = table_data->header_len;
+    }
     table_data->row_count = 0;
+    flush_table_fallback(output, table_data);
 }
 
 // Flush accumulated data for all tables
-void flush_accumulated_data(FILE* output) {
+void flush_accumulated_data(OutputSink* output) {
     for (int i = 0; i < TABLE_HASH_SIZE; i++) {
         TableData* table_data = table_hash[i];
         while (table_data) {
@@ -395,210 +499,298 @@ void flush_accumulated_data(FILE* output) {
     }
 }
 
-// Free all table data structures
-void free_all_table_data() {
-    for (int i = 0; i < TABLE_HASH_SIZE; i++) {
-        TableData* table_data = table_hash[i];
-        while (table_data) {
-            free_table_data(table_data);
-            table_data = table_data->next;
+// Start of the table part of a quoted name, after the last "." outside quotes
+size_t relation_table_offset(const char* name, size_t len) {
+    size_t offset = 0;
+    bool quoted = false;
+    for (size_t i = 0; i < len; i++) {
+        if (name[i] == '"') {
+            quoted = !quoted;
+        }
+        else if (name[i] == '.' && !quoted) {
+            offset = i + 1;
         }
-        table_hash[i] = NULL;
     }
+    return offset;
 }
 
-// Free a single TableData structure
-void free_table_data(TableData* table_data) {
-    // Free any remaining data rows
-    DataRow* current_row = table_data->head;
-    while (current_row) {
-        DataRow* next_row = current_row->next;
-        free(current_row->data);
-        free(current_row);
-        current_row = next_row;
+// Whether two quoted names can be the same table: the same name, or the same table
+// part when one of them doesn't have the schema
+bool same_relation(const char* name, size_t len, const char* other) {
+    size_t other_len = strlen(other);
+    size_t offset = relation_table_offset(name, len);
+    size_t other_offset = relation_table_offset(other, other_len);
+
+    if (offset > 0 && other_offset > 0) {
+        return len == other_len && memcmp(name, other, len) == 0;
     }
-    free(table_data->table_name);
-    free(table_data);
+    return len - offset == other_len - other_offset && memcmp(name + offset, other + other_offset, len - offset) == 0;
 }
 
-// Detect end of statement (e.g., ';' not within a string or comment)
-bool detect_end_of_statement(const char* statement) {
-    bool in_string = false;
-    bool in_line_comment = false;
-    bool in_block_comment = false;
-
-    for (size_t i = 0; statement[i]; i++) {
-        char c = statement[i];
-        char next_c = statement[i + 1];
-
-        if (in_line_comment) {
-            if (c == '\n') {
-                in_line_comment = false;
+// Flush the rows of a table, for every column list they have
+void flush_relation(OutputSink* output, const char* relation) {
+    for (int i = 0; i < TABLE_HASH_SIZE; i++) {
+        for (TableData* table_data = table_hash[i]; table_data; table_data = table_data->next) {
+            if (same_relation(table_data->table_name, table_data->relation_len, relation)) {
+                flush_table_data(output, table_data);
             }
         }
-        else if (in_block_comment) {
-            if (c == '*' && next_c == '/') {
-                in_block_comment = false;
-                i++;
-            }
+    }
+}
+
+void add_link(const char* relation, const char* related) {
+    unsigned int hash = hash_table_name(relation);
+    RelationLink* link = link_hash[hash];
+    while (link && strcmp(link->relation, relation) != 0) {
+        link = link->next;
+    }
+    if (!link) {
+        link = (RelationLink*)calloc(1, sizeof(RelationLink));
+        if (!link) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
         }
-        else if (in_string) {
-            if (c == '\'') {
-                if (next_c == '\'') {
-                    i++; // Skip escaped quote
-                }
-                else {
-                    in_string = false;
+        link->relation = strdup(relation);
+        link->next = link_hash[hash];
+        link_hash[hash] = link;
+    }
+    for (int i = 0; i < link->n_related; i++) {
+        if (strcmp(link->related[i], related) == 0) {
+            return;
+        }
+    }
+    char** related_list = (char**)realloc(link->related, sizeof(char*) * (link->n_related + 1));
+    if (!related_list) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    link->related = related_list;
+    link->related[link->n_related++] = strdup(related);
+}
+
+// Flush the tables whose rows may take values from the sequence before a setval:
+// those named with it, and the rows with DEFAULT values or values that aren't
+// constants. If the sequence was never named with a table, the rows of a column
+// list that may leave out a column with a default too.
+void flush_sequence_users(OutputSink* output, const char* sequence) {
+    bool linked = false;
+
+    for (int i = 0; i < TABLE_HASH_SIZE; i++) {
+        for (RelationLink* link = link_hash[i]; link; link = link->next) {
+            if (same_relation(link->relation, strlen(link->relation), sequence)) {
+                for (int j = 0; j < link->n_related; j++) {
+                    flush_relation(output, link->related[j]);
                 }
+                linked = true;
             }
         }
-        else {
-            if (c == '-' && next_c == '-') {
-                in_line_comment = true;
-                i++;
-            }
-            else if (c == '/' && next_c == '*') {
-                in_block_comment = true;
-                i++;
-            }
-            else if (c == '\'') {
-                in_string = true;
-            }
-            else if (c == ';') {
-                return true; // End of statement detected
+    }
+    for (int i = 0; i < TABLE_HASH_SIZE; i++) {
+        for (TableData* table_data = table_hash[i]; table_data; table_data = table_data->next) {
+            if (table_data->has_default || table_data->fallback_len > 0 ||
+                (!linked && table_data->table_name[table_data->relation_len] != '\0')) {
+                flush_table_data(output, table_data);
             }
         }
     }
-    return false;
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <input.sql> <output.sql>\n", argv[0]);
-        exit(1);
+bool is_row_setting(const char* setting) {
+    for (size_t i = 0; i < sizeof(row_settings) / sizeof(row_settings[0]); i++) {
+        if (strcmp(setting, row_settings[i]) == 0) {
+            return true;
+        }
     }
+    return false;
+}
 
-    FILE* input = fopen(argv[1], "r");
-    if (!input) {
-        perror("Error opening input file");
-        exit(1);
+// Flush the buffered rows that have to come before a statement written as is: those
+// of the tables it refers to, or all of them when it's not known what it touches
+void flush_statement_tables(OutputSink* output, StatementSlice statement) {
+    if (statement.kind == STATEMENT_COPY_DATA || statement.kind == STATEMENT_COPY_END) {
+        // The COPY command of the section flushed its table
+        return;
     }
-
-    FILE* output = freopen(argv[2], "w", stdout);
-    if (!output) {
-        perror("Error opening output file");
-        fclose(input);
-        exit(1);
+    if (statement.kind == STATEMENT_META_COMMAND) {
+        // \connect and the like
+        flush_accumulated_data(output);
+        return;
     }
 
-    char* statement_buffer = malloc(INITIAL_BUFFER_CAPACITY);
-    if (!statement_buffer) {
-        fprintf(stderr, "Memory allocation error\n");
-        fclose(input);
-        fclose(output);
-        exit(1);
-    }
-    size_t statement_buffer_size = 0;
-    size_t statement_buffer_capacity = INITIAL_BUFFER_CAPACITY;
+    PgQueryStatementInfoResult info = pg_query_statement_info_len(statement.data, statement.len, PG_QUERY_PARSE_DEFAULT);
 
-    char line[8192];
+    if (info.error || info.uses_unlisted_relations) {
+        flush_accumulated_data(output);
+    }
+    else {
+        switch (info.kind) {
+        case PG_QUERY_STATEMENT_SETTING:
+            if (!info.setting || is_row_setting(info.setting)) {
+                flush_accumulated_data(output);
+            }
+            break;
+        case PG_QUERY_STATEMENT_TRANSACTION:
+        case PG_QUERY_STATEMENT_NO_TRANSACTION:
+            // The rows stay in the transaction they were in
+            flush_accumulated_data(output);
+            break;
+        case PG_QUERY_STATEMENT_SEQUENCE_VALUE:
+            flush_sequence_users(output, info.relations[0]);
+            break;
+        default:
+            for (int i = 0; i < info.n_relations; i++) {
+                flush_relation(output, info.relations[i]);
+            }
+            // A sequence named with its table, in either order
+            if (info.kind == PG_QUERY_STATEMENT_PRE_DATA || info.kind == PG_QUERY_STATEMENT_CREATE_TABLE) {
+                for (int i = 1; i < info.n_relations; i++) {
+                    add_link(info.relations[0], info.relations[i]);
+                    add_link(info.relations[i], info.relations[0]);
+                }
+            }
+            break;
+        }
+    }
+    pg_query_free_statement_info_result(info);
+}
 
-    while (fgets(line, sizeof(line), input)) {
-        size_t line_length = strlen(line);
+// Free all table data structures
+void free_all_table_data() {
+    for (int i = 0; i < TABLE_HASH_SIZE; i++) {
+        TableData* table_data = table_hash[i];
+        while (table_data) {
+            TableData* next = table_data->next;
+            free_table_data(table_data);
+            table_data = next;
+        }
+        table_hash[i] = NULL;
 
-        // Append the line to the buffer
-        if (statement_buffer_size + line_length >= statement_buffer_capacity) {
-            // Expand the buffer if necessary
-            size_t new_capacity = statement_buffer_capacity * 2;
-            while (statement_buffer_size + line_length >= new_capacity) {
-                new_capacity *= 2;
+        RelationLink* link = link_hash[i];
+        while (link) {
+            RelationLink* next = link->next;
+            for (int j = 0; j < link->n_related; j++) {
+                free(link->related[j]);
             }
-            char* new_buffer = realloc(statement_buffer, new_capacity);
-            if (!new_buffer) {
-                fprintf(stderr, "Memory allocation error\n");
-                free(statement_buffer);
-                fclose(input);
-                fclose(output);
-                exit(1);
-            }
-            statement_buffer = new_buffer;
-            statement_buffer_capacity = new_capacity;
+            free(link->related);
+            free(link->relation);
+            free(link);
+            link = next;
         }
-        memcpy(statement_buffer + statement_buffer_size, line, line_length);
-        statement_buffer_size += line_length;
-        statement_buffer[statement_buffer_size] = '\0';
+        link_hash[i] = NULL;
+    }
+    free(copy_target);
+    copy_target = NULL;
+    copy_target_capacity = 0;
+    if (spill_file) {
+        fclose(spill_file);
+        spill_file = NULL;
+    }
+    spill_len = 0;
+    spilled_tables = 0;
+}
+
+// Free a single TableData structure
+void free_table_data(TableData* table_data) {
+    free(table_data->spill_extents);
+    buffered_bytes -= table_data->arena_capacity;
+    free(table_data->arena);
+    free(table_data->fallback);
+    free(table_data->table_name);
+    free(table_data);
+}
 
-        // Detect end of statement
-        if (detect_end_of_statement(statement_buffer)) {
-            // We have a complete statement
-            // Remove comments and whitespace
-            char* statement_trimmed = skip_comments_and_whitespace(statement_buffer);
+// Parse a size like "2G", "512M", "64k" or a plain number of bytes
+bool parse_size(const char* text, size_t* size) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
 
-            if (strncasecmp(statement_trimmed, "INSERT INTO", 11) == 0) {
-                // Parse and accumulate INSERT statement
-                PgQueryParseResult result = pg_query_parse(statement_buffer);
+    if (end == text) {
+        return false;
+    }
+    switch (toupper((unsigned char)*end)) {
+    case 'K': value <<= 10; end++; break;
+    case 'M': value <<= 20; end++; break;
+    case 'G': value <<= 30; end++; break;
+    case 'T': value <<= 40; end++; break;
+    default: break;
+    }
+    if (toupper((unsigned char)*end) == 'B') {
+        end++;
+    }
+    *size = (size_t)value;
+    return *end == '\0';
+}
 
-                if (result.error) {
-                    fprintf(stderr, "Warning: Error parsing SQL: %s\n", result.error->message);
-                    pg_query_free_parse_result(result);
+void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [--max-buffer-mem SIZE] [--io-uring] <input.sql|-> <output.sql>\n", program);
+    exit(1);
+}
 
-                    // Flush accumulated data before writing the problematic statement
-                    flush_accumulated_data(output);
+int main(int argc, char* argv[]) {
+    bool use_io_uring = false;
+    int argi;
 
-                    // Write the problematic statement as is
-                    fprintf(output, "%s", statement_buffer);
-                }
-                else {
-                    // Accumulate data
-                    process_parsed_statement(result.parse_tree);
-                    pg_query_free_parse_result(result);
-                }
+    for (argi = 1; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+        if (strcmp(argv[argi], "--max-buffer-mem") == 0 && argi + 1 < argc) {
+            if (!parse_size(argv[++argi], &max_buffer_mem)) {
+                usage(argv[0]);
             }
-            else {
-                // Flush accumulated data before handling non-INSERT statement
-                flush_accumulated_data(output);
-
-                // Write non-INSERT statement to output
-                fprintf(output, "%s", statement_buffer);
+        }
+        else if (strncmp(argv[argi], "--max-buffer-mem=", 17) == 0) {
+            if (!parse_size(argv[argi] + 17, &max_buffer_mem)) {
+                usage(argv[0]);
             }
-
-            // Reset statement buffer
-            statement_buffer_size = 0;
-            statement_buffer[0] = '\0';
+        }
+        else if (strcmp(argv[argi], "--io-uring") == 0) {
+            // Write the output with io_uring, several buffers in flight (Linux)
+            use_io_uring = true;
+        }
+        else {
+            usage(argv[0]);
         }
     }
 
-    // Process any remaining statement
-    if (statement_buffer_size > 0) {
-        // Remove comments and whitespace
-        char* statement_trimmed = skip_comments_and_whitespace(statement_buffer);
+    if (argc - argi != 2) {
+        usage(argv[0]);
+    }
 
-        if (strncasecmp(statement_trimmed, "INSERT INTO", 11) == 0) {
-            // Parse and accumulate INSERT statement
-            PgQueryParseResult result = pg_query_parse(statement_buffer);
+    CopyInput input;
+    if (!copy_input_open(&input, argv[argi], true)) {
+        perror("Error opening input file");
+        exit(1);
+    }
 
-            if (result.error) {
-                fprintf(stderr, "Warning: Error parsing SQL: %s\n", result.error->message);
-                pg_query_free_parse_result(result);
+    OutputSink* output = &output_sink;
+    if (!output_sink_open(output, argv[argi + 1], use_io_uring)) {
+        perror("Error opening output file");
+        copy_input_close(&input);
+        exit(1);
+    }
 
-                // Flush accumulated data before writing the problematic statement
-                flush_accumulated_data(output);
+    // Statements are split by a resumable lexer, so each input byte is scanned once
+    // no matter how large a single statement gets
+    StatementSlice statement;
+    while (copy_input_next(&input, &statement)) {
+        const char* statement_trimmed;
 
-                // Write the problematic statement as is
-                fprintf(output, "%s", statement_buffer);
-            }
-            else {
-                // Accumulate data
-                process_parsed_statement(result.parse_tree);
-                pg_query_free_parse_result(result);
+        if (statement_is_insert(statement, &statement_trimmed)) {
+            // Convert and accumulate INSERT statement
+            if (process_insert_statement(statement)) {
+                continue;
             }
         }
-        else {
-            // Flush accumulated data before handling non-INSERT statement
-            flush_accumulated_data(output);
 
-            // Write non-INSERT statement to output
-            fprintf(output, "%s", statement_buffer);
+        // Flush the rows that have to be loaded before a non-INSERT or unconverted statement written as is
+        flush_statement_tables(output, statement);
+        // Mapped input stays valid until the end, so the statement is queued without a copy
+        if (input.mapped) {
+            output_sink_write_ref(output, statement.data, statement.len);
+        }
+        else {
+            output_sink_write(output, statement.data, statement.len);
+        }
+        if (statement.len > 0) {
+            output_at_line_start = statement.data[statement.len - 1] == '\n';
         }
     }
 
@@ -607,9 +799,8 @@ int main(int argc, char* argv[]) {
 
     // Free resources
     free_all_table_data();
-    free(statement_buffer);
-    fclose(input);
-    fclose(output);
+    output_sink_close(output);
+    copy_input_close(&input);
 
     return 0;
 }
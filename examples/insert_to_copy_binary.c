@@ -0,0 +1,831 @@
+#include "insert_to_copy_binary.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+
+#ifdef _WIN32
+#define strncasecmp _strnicmp
+#define strcasecmp _stricmp
+#endif
+
+#define BYTE_BUFFER_INITIAL_CAPACITY (64 * 1024)
+
+// Days between 1970-01-01 and 2000-01-01, the epoch of date and timestamp values
+#define POSTGRES_EPOCH_DAYS 10957
+#define USECS_PER_SEC INT64_C(1000000)
+#define USECS_PER_DAY INT64_C(86400000000)
+
+#define NUMERIC_POS 0x0000
+#define NUMERIC_NEG 0x4000
+#define NUMERIC_NAN 0xC000
+#define NUMERIC_PINF 0xD000
+#define NUMERIC_NINF 0xF000
+#define NUMERIC_MAX_SCALE 1000
+
+static const char copy_binary_signature[11] = "PGCOPY\n\377\r\n\0";
+
+void byte_buffer_reserve(ByteBuffer* buffer, size_t len) {
+    if (buffer->len + len <= buffer->capacity) {
+        return;
+    }
+
+    size_t new_capacity = buffer->capacity ? buffer->capacity : BYTE_BUFFER_INITIAL_CAPACITY;
+    while (buffer->len + len > new_capacity) {
+        new_capacity *= 2;
+    }
+    char* new_data = realloc(buffer->data, new_capacity);
+    if (!new_data) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    buffer->data = new_data;
+    buffer->capacity = new_capacity;
+}
+
+void byte_buffer_append(ByteBuffer* buffer, const void* data, size_t len) {
+    byte_buffer_reserve(buffer, len);
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+}
+
+void byte_buffer_free(ByteBuffer* buffer) {
+    free(buffer->data);
+    memset(buffer, 0, sizeof(ByteBuffer));
+}
+
+// Integers are sent in network byte order
+static void append_uint16(ByteBuffer* buffer, uint16_t value) {
+    unsigned char bytes[2] = { value >> 8, value };
+    byte_buffer_append(buffer, bytes, 2);
+}
+
+static void append_uint32(ByteBuffer* buffer, uint32_t value) {
+    unsigned char bytes[4] = { value >> 24, value >> 16, value >> 8, value };
+    byte_buffer_append(buffer, bytes, 4);
+}
+
+static void append_uint64(ByteBuffer* buffer, uint64_t value) {
+    append_uint32(buffer, (uint32_t)(value >> 32));
+    append_uint32(buffer, (uint32_t)value);
+}
+
+CopyBinaryType copy_binary_type(const char* type_name, bool is_array) {
+    static const struct {
+        const char* name;
+        CopyBinaryType type;
+    } types[] = {
+        { "bool", COPY_BINARY_BOOL },
+        { "int2", COPY_BINARY_INT2 },
+        { "smallint", COPY_BINARY_INT2 },
+        { "smallserial", COPY_BINARY_INT2 },
+        { "int4", COPY_BINARY_INT4 },
+        { "int", COPY_BINARY_INT4 },
+        { "integer", COPY_BINARY_INT4 },
+        { "serial", COPY_BINARY_INT4 },
+        { "int8", COPY_BINARY_INT8 },
+        { "bigint", COPY_BINARY_INT8 },
+        { "bigserial", COPY_BINARY_INT8 },
+        { "float4", COPY_BINARY_FLOAT4 },
+        { "float8", COPY_BINARY_FLOAT8 },
+        { "numeric", COPY_BINARY_NUMERIC },
+        { "text", COPY_BINARY_TEXT },
+        { "varchar", COPY_BINARY_TEXT },
+        { "bpchar", COPY_BINARY_TEXT },
+        { "json", COPY_BINARY_TEXT },
+        { "bytea", COPY_BINARY_BYTEA },
+        { "date", COPY_BINARY_DATE },
+        { "time", COPY_BINARY_TIME },
+        { "timestamp", COPY_BINARY_TIMESTAMP },
+        { "timestamptz", COPY_BINARY_TIMESTAMPTZ },
+        { "uuid", COPY_BINARY_UUID },
+        { "jsonb", COPY_BINARY_JSONB },
+    };
+
+    if (type_name == NULL || is_array) {
+        return COPY_BINARY_UNSUPPORTED;
+    }
+
+    // Built-in types are either unqualified or in pg_catalog, anything else is a user-defined type
+    if (strncmp(type_name, "pg_catalog.", 11) == 0) {
+        type_name += 11;
+    }
+    else if (strchr(type_name, '.')) {
+        return COPY_BINARY_UNSUPPORTED;
+    }
+
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (strcmp(type_name, types[i].name) == 0) {
+            return types[i].type;
+        }
+    }
+    return COPY_BINARY_UNSUPPORTED;
+}
+
+static const char* skip_spaces(const char* p) {
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    return p;
+}
+
+// Accepts the same spellings as boolin
+static bool parse_bool(const char* value, bool* result) {
+    value = skip_spaces(value);
+    size_t len = strlen(value);
+    while (len > 0 && isspace((unsigned char)value[len - 1])) {
+        len--;
+    }
+    if (len == 0) {
+        return false;
+    }
+
+    switch (tolower((unsigned char)value[0])) {
+    case 't':
+        *result = true;
+        return len <= 4 && strncasecmp(value, "true", len) == 0;
+    case 'y':
+        *result = true;
+        return len <= 3 && strncasecmp(value, "yes", len) == 0;
+    case 'f':
+        *result = false;
+        return len <= 5 && strncasecmp(value, "false", len) == 0;
+    case 'n':
+        *result = false;
+        return len <= 2 && strncasecmp(value, "no", len) == 0;
+    case 'o':
+        if (len == 2 && strncasecmp(value, "on", 2) == 0) {
+            *result = true;
+            return true;
+        }
+        *result = false;
+        return len >= 2 && len <= 3 && strncasecmp(value, "off", len) == 0;
+    case '1':
+    case '0':
+        *result = value[0] == '1';
+        return len == 1;
+    default:
+        return false;
+    }
+}
+
+// Plain decimal integers only, other input syntaxes are left to the server
+static bool parse_int(const char* value, int64_t min, int64_t max, int64_t* result) {
+    const char* p = skip_spaces(value);
+    bool negative = false;
+    uint64_t magnitude = 0;
+
+    if (*p == '-' || *p == '+') {
+        negative = *p == '-';
+        p++;
+    }
+    if (!isdigit((unsigned char)*p)) {
+        return false;
+    }
+    for (; isdigit((unsigned char)*p); p++) {
+        magnitude = magnitude * 10 + (*p - '0');
+        if (magnitude > (uint64_t)INT64_MAX + 1) {
+            return false;
+        }
+    }
+    if (*skip_spaces(p) != '\0') {
+        return false;
+    }
+
+    if (negative) {
+        if (magnitude > (uint64_t)-(min + 1) + 1) {
+            return false;
+        }
+        *result = magnitude == 0 ? 0 : -(int64_t)(magnitude - 1) - 1;
+    }
+    else {
+        if (magnitude > (uint64_t)max) {
+            return false;
+        }
+        *result = (int64_t)magnitude;
+    }
+    return true;
+}
+
+// Like float8in / float4in, which also use strtod / strtof
+static bool parse_double(const char* value, bool single, double* result) {
+    const char* p = skip_spaces(value);
+    char* end;
+
+    if (*p == '\0') {
+        return false;
+    }
+    errno = 0;
+    *result = single ? strtof(p, &end) : strtod(p, &end);
+    if (end == p) {
+        return false;
+    }
+    if (errno == ERANGE && (*result == 0.0 || isinf(*result))) {
+        return false;
+    }
+    return *skip_spaces(end) == '\0';
+}
+
+static bool encode_numeric(ByteBuffer* buffer, const char* value) {
+    const char* p = skip_spaces(value);
+    uint16_t sign = NUMERIC_POS;
+
+    if (*p == '+' || *p == '-') {
+        sign = *p == '-' ? NUMERIC_NEG : NUMERIC_POS;
+        p++;
+    }
+
+    // Special values
+    const char* special = p;
+    uint16_t special_sign = 0;
+    if (strncasecmp(special, "infinity", 8) == 0) {
+        special += 8;
+        special_sign = sign == NUMERIC_NEG ? NUMERIC_NINF : NUMERIC_PINF;
+    }
+    else if (strncasecmp(special, "inf", 3) == 0) {
+        special += 3;
+        special_sign = sign == NUMERIC_NEG ? NUMERIC_NINF : NUMERIC_PINF;
+    }
+    else if (p == skip_spaces(value) && strncasecmp(special, "nan", 3) == 0) {
+        special += 3;
+        special_sign = NUMERIC_NAN;
+    }
+    if (special_sign != 0) {
+        if (*skip_spaces(special) != '\0') {
+            return false;
+        }
+        append_uint32(buffer, 8);
+        append_uint16(buffer, 0);
+        append_uint16(buffer, 0);
+        append_uint16(buffer, special_sign);
+        append_uint16(buffer, 0);
+        return true;
+    }
+
+    // Digits before and after the decimal point, and the exponent
+    const char* int_digits = p;
+    while (isdigit((unsigned char)*p)) {
+        p++;
+    }
+    int n_int = (int)(p - int_digits);
+    const char* frac_digits = p;
+    int n_frac = 0;
+    if (*p == '.') {
+        frac_digits = ++p;
+        while (isdigit((unsigned char)*p)) {
+            p++;
+        }
+        n_frac = (int)(p - frac_digits);
+    }
+    if (n_int + n_frac == 0) {
+        return false;
+    }
+    long exponent = 0;
+    if (*p == 'e' || *p == 'E') {
+        char* end;
+        p++;
+        if (!isdigit((unsigned char)*p) && !((*p == '+' || *p == '-') && isdigit((unsigned char)p[1]))) {
+            return false;
+        }
+        errno = 0;
+        exponent = strtol(p, &end, 10);
+        if (errno != 0 || exponent > NUMERIC_MAX_SCALE || exponent < -NUMERIC_MAX_SCALE) {
+            return false;
+        }
+        p = end;
+    }
+    if (*skip_spaces(p) != '\0') {
+        return false;
+    }
+
+    long dscale = n_frac - exponent;
+    if (dscale < 0) {
+        dscale = 0;
+    }
+    if (dscale > NUMERIC_MAX_SCALE) {
+        return false;
+    }
+
+    // Digit i (counting int digits, then fraction digits) has the decimal power point - 1 - i.
+    // Base 10000 digit g holds the decimal powers 4g to 4g + 3.
+    long point = n_int + exponent;
+    long first = -1;
+    long last = -1;
+    for (long i = 0; i < n_int + n_frac; i++) {
+        char c = i < n_int ? int_digits[i] : frac_digits[i - n_int];
+        if (c != '0') {
+            if (first < 0) {
+                first = i;
+            }
+            last = i;
+        }
+    }
+
+    if (first < 0) {
+        // Zero keeps its display scale, the sign is dropped like make_result does
+        append_uint32(buffer, 8);
+        append_uint16(buffer, 0);
+        append_uint16(buffer, 0);
+        append_uint16(buffer, NUMERIC_POS);
+        append_uint16(buffer, (uint16_t)dscale);
+        return true;
+    }
+
+#define FLOOR_DIV4(x) ((x) >= 0 ? (x) / 4 : -((-(x) + 3) / 4))
+    long weight = FLOOR_DIV4(point - 1 - first);
+    long lowest = FLOOR_DIV4(point - 1 - last);
+    long ndigits = weight - lowest + 1;
+    if (weight > INT16_MAX || weight < INT16_MIN || ndigits > INT16_MAX) {
+        return false;
+    }
+
+    uint16_t* digits = calloc(ndigits, sizeof(uint16_t));
+    if (!digits) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    static const uint16_t powers[4] = { 1, 10, 100, 1000 };
+    for (long i = first; i <= last; i++) {
+        char c = i < n_int ? int_digits[i] : frac_digits[i - n_int];
+        long power = point - 1 - i;
+        long group = FLOOR_DIV4(power);
+        digits[weight - group] += (uint16_t)((c - '0') * powers[power - group * 4]);
+    }
+#undef FLOOR_DIV4
+
+    append_uint32(buffer, (uint32_t)(8 + 2 * ndigits));
+    append_uint16(buffer, (uint16_t)ndigits);
+    append_uint16(buffer, (uint16_t)(int16_t)weight);
+    append_uint16(buffer, sign);
+    append_uint16(buffer, (uint16_t)dscale);
+    for (long i = 0; i < ndigits; i++) {
+        append_uint16(buffer, digits[i]);
+    }
+    free(digits);
+    return true;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Both bytea input formats: "\x" followed by hex digits, or the escape format
+static bool encode_bytea(ByteBuffer* buffer, const char* value, size_t len) {
+    size_t length_pos = buffer->len;
+    append_uint32(buffer, 0);
+
+    if (len >= 2 && value[0] == '\\' && value[1] == 'x') {
+        for (size_t i = 2; i < len;) {
+            if (value[i] == ' ' || value[i] == '\n' || value[i] == '\t' || value[i] == '\r') {
+                i++;
+                continue;
+            }
+            if (i + 1 >= len || hex_value(value[i]) < 0 || hex_value(value[i + 1]) < 0) {
+                return false;
+            }
+            unsigned char byte = (unsigned char)(hex_value(value[i]) << 4 | hex_value(value[i + 1]));
+            byte_buffer_append(buffer, &byte, 1);
+            i += 2;
+        }
+    }
+    else {
+        for (size_t i = 0; i < len;) {
+            unsigned char byte;
+            if (value[i] != '\\') {
+                byte = (unsigned char)value[i++];
+            }
+            else if (i + 1 < len && value[i + 1] == '\\') {
+                byte = '\\';
+                i += 2;
+            }
+            else if (i + 3 < len && value[i + 1] >= '0' && value[i + 1] <= '3' &&
+                     value[i + 2] >= '0' && value[i + 2] <= '7' && value[i + 3] >= '0' && value[i + 3] <= '7') {
+                byte = (unsigned char)((value[i + 1] - '0') << 6 | (value[i + 2] - '0') << 3 | (value[i + 3] - '0'));
+                i += 4;
+            }
+            else {
+                return false;
+            }
+            byte_buffer_append(buffer, &byte, 1);
+        }
+    }
+
+    uint32_t data_len = (uint32_t)(buffer->len - length_pos - 4);
+    unsigned char bytes[4] = { data_len >> 24, data_len >> 16, data_len >> 8, data_len };
+    memcpy(buffer->data + length_pos, bytes, 4);
+    return true;
+}
+
+static bool parse_digits(const char** p, int min_digits, int max_digits, int* result) {
+    int n = 0;
+    *result = 0;
+    while (n < max_digits && isdigit((unsigned char)(*p)[n])) {
+        *result = *result * 10 + ((*p)[n] - '0');
+        n++;
+    }
+    if (n < min_digits || isdigit((unsigned char)(*p)[n])) {
+        return false;
+    }
+    *p += n;
+    return true;
+}
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar
+static int64_t days_from_civil(int64_t year, int month, int day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+// ISO dates ("YYYY-MM-DD", the DateStyle pg_dump sets), AD only
+static bool parse_date(const char** p, int64_t* days) {
+    static const int month_days[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    int year, month, day;
+
+    if (!parse_digits(p, 4, 6, &year) || **p != '-') {
+        return false;
+    }
+    (*p)++;
+    if (!parse_digits(p, 2, 2, &month) || **p != '-') {
+        return false;
+    }
+    (*p)++;
+    if (!parse_digits(p, 2, 2, &day)) {
+        return false;
+    }
+
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    if (year < 1 || month < 1 || month > 12 || day < 1 || day > month_days[month - 1] ||
+        (month == 2 && day == 29 && !leap)) {
+        return false;
+    }
+
+    *days = days_from_civil(year, month, day) - POSTGRES_EPOCH_DAYS;
+    return true;
+}
+
+// "HH:MM:SS[.ffffff]", in microseconds
+static bool parse_time(const char** p, int64_t* usecs) {
+    int hour, minute, second;
+    int64_t fraction = 0;
+
+    if (!parse_digits(p, 2, 2, &hour) || **p != ':') {
+        return false;
+    }
+    (*p)++;
+    if (!parse_digits(p, 2, 2, &minute) || **p != ':') {
+        return false;
+    }
+    (*p)++;
+    if (!parse_digits(p, 2, 2, &second)) {
+        return false;
+    }
+    if (**p == '.') {
+        // More than microsecond precision would need the server's rounding
+        int n = 0;
+        for ((*p)++; isdigit((unsigned char)**p); (*p)++, n++) {
+            if (n == 6) {
+                return false;
+            }
+            fraction = fraction * 10 + (**p - '0');
+        }
+        if (n == 0) {
+            return false;
+        }
+        for (; n < 6; n++) {
+            fraction *= 10;
+        }
+    }
+
+    if (minute > 59 || second > 59 || hour > 24 || (hour == 24 && (minute > 0 || second > 0 || fraction > 0))) {
+        return false;
+    }
+    *usecs = ((hour * INT64_C(60) + minute) * 60 + second) * USECS_PER_SEC + fraction;
+    return true;
+}
+
+// Time zone offset as written by the server ("+05", "-03:30", "+05:45:30"), in seconds east of UTC
+static bool parse_offset(const char** p, int64_t* seconds) {
+    int sign, hours, minutes = 0, secs = 0;
+
+    if (**p != '+' && **p != '-') {
+        return false;
+    }
+    sign = **p == '-' ? -1 : 1;
+    (*p)++;
+    if (!parse_digits(p, 2, 2, &hours)) {
+        return false;
+    }
+    if (**p == ':') {
+        (*p)++;
+        if (!parse_digits(p, 2, 2, &minutes)) {
+            return false;
+        }
+        if (**p == ':') {
+            (*p)++;
+            if (!parse_digits(p, 2, 2, &secs)) {
+                return false;
+            }
+        }
+    }
+    if (hours > 15 || minutes > 59 || secs > 59) {
+        return false;
+    }
+    *seconds = sign * ((hours * INT64_C(60) + minutes) * 60 + secs);
+    return true;
+}
+
+static bool encode_datetime(ByteBuffer* buffer, CopyBinaryType type, const char* value) {
+    const char* p = skip_spaces(value);
+    int64_t days = 0;
+    int64_t usecs = 0;
+    int64_t offset = 0;
+    bool has_offset = false;
+
+    if (type != COPY_BINARY_TIME) {
+        // Special values map to the ends of the range
+        bool infinity = strncasecmp(p, "infinity", 8) == 0 && *skip_spaces(p + 8) == '\0';
+        bool minus_infinity = strncasecmp(p, "-infinity", 9) == 0 && *skip_spaces(p + 9) == '\0';
+        if (infinity || minus_infinity) {
+            if (type == COPY_BINARY_DATE) {
+                append_uint32(buffer, 4);
+                append_uint32(buffer, infinity ? (uint32_t)INT32_MAX : (uint32_t)INT32_MIN);
+            }
+            else {
+                append_uint32(buffer, 8);
+                append_uint64(buffer, infinity ? (uint64_t)INT64_MAX : (uint64_t)INT64_MIN);
+            }
+            return true;
+        }
+
+        if (!parse_date(&p, &days)) {
+            return false;
+        }
+    }
+
+    if (type == COPY_BINARY_TIME) {
+        if (!parse_time(&p, &usecs)) {
+            return false;
+        }
+    }
+    else if (type != COPY_BINARY_DATE && (*p == ' ' || *p == 'T')) {
+        p++;
+        if (!parse_time(&p, &usecs)) {
+            return false;
+        }
+        has_offset = parse_offset(&p, &offset);
+    }
+
+    if (*skip_spaces(p) != '\0') {
+        return false;
+    }
+
+    switch (type) {
+    case COPY_BINARY_DATE:
+        append_uint32(buffer, 4);
+        append_uint32(buffer, (uint32_t)(int32_t)days);
+        return true;
+    case COPY_BINARY_TIME:
+        append_uint32(buffer, 8);
+        append_uint64(buffer, (uint64_t)usecs);
+        return true;
+    case COPY_BINARY_TIMESTAMPTZ:
+        // Without an offset the value depends on the session's TimeZone
+        if (!has_offset) {
+            return false;
+        }
+        usecs -= offset * USECS_PER_SEC;
+        // fallthrough
+    default:
+        // timestamp without time zone ignores an offset, like timestamp_in
+        append_uint32(buffer, 8);
+        append_uint64(buffer, (uint64_t)(days * USECS_PER_DAY + usecs));
+        return true;
+    }
+}
+
+// Like uuid_in: 32 hex digits, optionally in braces and with a hyphen after any group of four
+static bool encode_uuid(ByteBuffer* buffer, const char* value) {
+    unsigned char uuid[16];
+    const char* p = value;
+    bool braces = *p == '{';
+
+    if (braces) {
+        p++;
+    }
+    for (int i = 0; i < 16; i++) {
+        if (hex_value(p[0]) < 0 || hex_value(p[1]) < 0) {
+            return false;
+        }
+        uuid[i] = (unsigned char)(hex_value(p[0]) << 4 | hex_value(p[1]));
+        p += 2;
+        if (*p == '-' && i % 2 == 1 && i < 15) {
+            p++;
+        }
+    }
+    if (braces) {
+        if (*p != '}') {
+            return false;
+        }
+        p++;
+    }
+    if (*p != '\0') {
+        return false;
+    }
+
+    append_uint32(buffer, 16);
+    byte_buffer_append(buffer, uuid, 16);
+    return true;
+}
+
+// Encodes one non-NULL value, given as a NUL-terminated string of len bytes
+static bool encode_value(ByteBuffer* buffer, CopyBinaryType type, const char* value, size_t len) {
+    switch (type) {
+    case COPY_BINARY_BOOL: {
+        bool result;
+        if (!parse_bool(value, &result)) {
+            return false;
+        }
+        append_uint32(buffer, 1);
+        byte_buffer_append(buffer, result ? "\1" : "\0", 1);
+        return true;
+    }
+    case COPY_BINARY_INT2:
+    case COPY_BINARY_INT4:
+    case COPY_BINARY_INT8: {
+        int64_t result;
+        if (type == COPY_BINARY_INT2) {
+            if (!parse_int(value, INT16_MIN, INT16_MAX, &result)) {
+                return false;
+            }
+            append_uint32(buffer, 2);
+            append_uint16(buffer, (uint16_t)result);
+        }
+        else if (type == COPY_BINARY_INT4) {
+            if (!parse_int(value, INT32_MIN, INT32_MAX, &result)) {
+                return false;
+            }
+            append_uint32(buffer, 4);
+            append_uint32(buffer, (uint32_t)result);
+        }
+        else {
+            if (!parse_int(value, INT64_MIN, INT64_MAX, &result)) {
+                return false;
+            }
+            append_uint32(buffer, 8);
+            append_uint64(buffer, (uint64_t)result);
+        }
+        return true;
+    }
+    case COPY_BINARY_FLOAT4: {
+        double result;
+        float single;
+        uint32_t bits;
+        if (!parse_double(value, true, &result)) {
+            return false;
+        }
+        single = (float)result;
+        memcpy(&bits, &single, 4);
+        append_uint32(buffer, 4);
+        append_uint32(buffer, bits);
+        return true;
+    }
+    case COPY_BINARY_FLOAT8: {
+        double result;
+        uint64_t bits;
+        if (!parse_double(value, false, &result)) {
+            return false;
+        }
+        memcpy(&bits, &result, 8);
+        append_uint32(buffer, 8);
+        append_uint64(buffer, bits);
+        return true;
+    }
+    case COPY_BINARY_NUMERIC:
+        return encode_numeric(buffer, value);
+    case COPY_BINARY_TEXT:
+        append_uint32(buffer, (uint32_t)len);
+        byte_buffer_append(buffer, value, len);
+        return true;
+    case COPY_BINARY_JSONB:
+        // Version 1 of the jsonb binary format is the text representation
+        append_uint32(buffer, (uint32_t)len + 1);
+        byte_buffer_append(buffer, "\1", 1);
+        byte_buffer_append(buffer, value, len);
+        return true;
+    case COPY_BINARY_BYTEA:
+        return encode_bytea(buffer, value, len);
+    case COPY_BINARY_DATE:
+    case COPY_BINARY_TIME:
+    case COPY_BINARY_TIMESTAMP:
+    case COPY_BINARY_TIMESTAMPTZ:
+        return encode_datetime(buffer, type, value);
+    case COPY_BINARY_UUID:
+        return encode_uuid(buffer, value);
+    default:
+        return false;
+    }
+}
+
+// Undoes the COPY text format escaping of a single field
+static void unescape_field(ByteBuffer* field, const char* data, size_t len) {
+    field->len = 0;
+    byte_buffer_reserve(field, len + 1);
+
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        if (c == '\\' && i + 1 < len) {
+            c = data[++i];
+            switch (c) {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'v': c = '\v'; break;
+            default: break;
+            }
+        }
+        field->data[field->len++] = c;
+    }
+    field->data[field->len] = '\0';
+}
+
+bool copy_binary_append_rows(ByteBuffer* buffer, const CopyBinaryType* types, int n_types, const char* copy_data, size_t len) {
+    size_t start_len = buffer->len;
+    ByteBuffer field = { 0 };
+    const char* p = copy_data;
+    const char* end = copy_data + len;
+    bool ok = true;
+
+    while (ok && p < end) {
+        const char* line_end = memchr(p, '\n', end - p);
+        if (!line_end) {
+            line_end = end;
+        }
+
+        append_uint16(buffer, (uint16_t)n_types);
+        for (int i = 0; ok && i < n_types; i++) {
+            const char* field_end = p <= line_end ? memchr(p, '\t', line_end - p) : NULL;
+            if (!field_end) {
+                field_end = line_end;
+            }
+
+            // The row has to have exactly one field per column
+            if (p > line_end || (i == n_types - 1) != (field_end == line_end)) {
+                ok = false;
+            }
+            else if (field_end - p == 2 && p[0] == '\\' && p[1] == 'N') {
+                append_uint32(buffer, UINT32_MAX);
+            }
+            else {
+                unescape_field(&field, p, field_end - p);
+                ok = encode_value(buffer, types[i], field.data, field.len);
+            }
+            p = field_end + 1;
+        }
+        p = line_end + 1;
+    }
+
+    if (!ok) {
+        buffer->len = start_len;
+    }
+    byte_buffer_free(&field);
+    return ok;
+}
+
+void copy_binary_append_header(ByteBuffer* buffer) {
+    byte_buffer_append(buffer, copy_binary_signature, sizeof(copy_binary_signature));
+    append_uint32(buffer, 0);   // Flags
+    append_uint32(buffer, 0);   // Header extension length
+}
+
+void copy_binary_append_trailer(ByteBuffer* buffer) {
+    byte_buffer_append(buffer, "\377\377", 2);
+}
+
+void copy_binary_write_header(FILE* file) {
+    ByteBuffer header = { 0 };
+    copy_binary_append_header(&header);
+    fwrite(header.data, 1, header.len, file);
+    byte_buffer_free(&header);
+}
+
+void copy_binary_write_trailer(FILE* file) {
+    fwrite("\377\377", 1, 2, file);
+}
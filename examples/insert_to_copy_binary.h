@@ -0,0 +1,58 @@
+#ifndef INSERT_TO_COPY_BINARY_H
+#define INSERT_TO_COPY_BINARY_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Encoding of COPY text format rows as PostgreSQL binary COPY ("PGCOPY") tuples.
+//
+// Values are converted the way the server's input functions read them, for the
+// built-in types whose binary format is simple and doesn't depend on session
+// settings. Anything else (other types, arrays, values in a form that isn't
+// handled here like BC dates or timestamptz without an offset) makes the
+// encoding fail, and the caller keeps using the text format for those rows.
+
+typedef enum {
+    COPY_BINARY_UNSUPPORTED,
+    COPY_BINARY_BOOL,
+    COPY_BINARY_INT2,
+    COPY_BINARY_INT4,
+    COPY_BINARY_INT8,
+    COPY_BINARY_FLOAT4,
+    COPY_BINARY_FLOAT8,
+    COPY_BINARY_NUMERIC,
+    COPY_BINARY_TEXT,        // text, varchar, bpchar, json
+    COPY_BINARY_BYTEA,
+    COPY_BINARY_DATE,
+    COPY_BINARY_TIME,
+    COPY_BINARY_TIMESTAMP,
+    COPY_BINARY_TIMESTAMPTZ,
+    COPY_BINARY_UUID,
+    COPY_BINARY_JSONB
+} CopyBinaryType;
+
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+} ByteBuffer;
+
+void byte_buffer_reserve(ByteBuffer* buffer, size_t len);
+void byte_buffer_append(ByteBuffer* buffer, const void* data, size_t len);
+void byte_buffer_free(ByteBuffer* buffer);
+
+// Maps a type name from a CREATE TABLE (e.g. "pg_catalog.int4", "text") to its encoder
+CopyBinaryType copy_binary_type(const char* type_name, bool is_array);
+
+// Appends the rows in copy_data (COPY text format) as binary tuples. Returns false and
+// leaves the buffer as it was if any value can't be encoded.
+bool copy_binary_append_rows(ByteBuffer* buffer, const CopyBinaryType* types, int n_types, const char* copy_data, size_t len);
+
+// File header (signature, flags, header extension length) and trailer
+void copy_binary_write_header(FILE* file);
+void copy_binary_write_trailer(FILE* file);
+void copy_binary_append_header(ByteBuffer* buffer);
+void copy_binary_append_trailer(ByteBuffer* buffer);
+
+#endif
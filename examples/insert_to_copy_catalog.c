@@ -0,0 +1,578 @@
+#include "insert_to_copy_catalog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <pg_query.h>
+
+#ifdef _WIN32
+#define strncasecmp _strnicmp
+#endif
+
+static unsigned int hash_relation(const char* relation) {
+    unsigned int hash = 5381;
+    int c;
+    while ((c = (unsigned char)*relation++))
+        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+    return hash % CATALOG_HASH_SIZE;
+}
+
+static char* strdup_or_null(const char* str) {
+    if (!str) {
+        return NULL;
+    }
+    char* copy = strdup(str);
+    if (!copy) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    return copy;
+}
+
+static void* checked_realloc(void* ptr, size_t size) {
+    void* new_ptr = realloc(ptr, size);
+    if (!new_ptr) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    return new_ptr;
+}
+
+static void free_copy_columns(CatalogTable* table) {
+    for (int i = 0; i < table->n_copy_columns; i++) {
+        free(table->copy_columns[i]);
+    }
+    free(table->copy_columns);
+    table->copy_columns = NULL;
+    table->n_copy_columns = 0;
+}
+
+static void free_table(CatalogTable* table) {
+    for (int i = 0; i < table->n_columns; i++) {
+        free(table->columns[i].name);
+        free(table->columns[i].type_name);
+    }
+    free(table->columns);
+    free_copy_columns(table);
+    free(table->relation);
+    free(table);
+}
+
+static void set_column(CatalogColumn* column, const PgQueryColumnDef* def) {
+    column->name = strdup_or_null(def->name);
+    column->type_name = strdup_or_null(def->type_name);
+    column->is_array = def->is_array;
+    column->has_default = def->has_default;
+    column->is_generated = def->is_generated;
+    column->value_type = def->type_name ? copy_binary_type(def->type_name, def->is_array) : COPY_BINARY_UNSUPPORTED;
+    column->warned = false;
+}
+
+void table_catalog_init(TableCatalog* catalog) {
+    memset(catalog, 0, sizeof(TableCatalog));
+}
+
+// Skips a keyword followed by whitespace, case-insensitively
+static bool skip_keyword(const char** ptr, const char* end, const char* keyword) {
+    size_t len = strlen(keyword);
+    if ((size_t)(end - *ptr) <= len || strncasecmp(*ptr, keyword, len) != 0 || !isspace((unsigned char)(*ptr)[len])) {
+        return false;
+    }
+    *ptr += len;
+    while (*ptr < end && isspace((unsigned char)**ptr)) {
+        (*ptr)++;
+    }
+    return true;
+}
+
+// Cheap check so that only CREATE [UNLOGGED | TEMP ...] TABLE and ALTER TABLE statements get parsed
+static bool statement_defines_table(StatementSlice statement) {
+    const char* end = statement.data + statement.len;
+    const char* ptr = statement_skip_comments(statement.data, end);
+
+    if (skip_keyword(&ptr, end, "ALTER")) {
+        return skip_keyword(&ptr, end, "TABLE");
+    }
+    if (!skip_keyword(&ptr, end, "CREATE")) {
+        return false;
+    }
+    while (skip_keyword(&ptr, end, "UNLOGGED") || skip_keyword(&ptr, end, "TEMPORARY") ||
+           skip_keyword(&ptr, end, "TEMP") || skip_keyword(&ptr, end, "GLOBAL") || skip_keyword(&ptr, end, "LOCAL")) {
+    }
+    return skip_keyword(&ptr, end, "TABLE");
+}
+
+// Applies the changes of an ALTER TABLE to the columns of the table, if it is known
+static void alter_table(TableCatalog* catalog, const PgQueryTableDefResult* result) {
+    CatalogTable* table = table_catalog_find(catalog, result->relation);
+    if (!table) {
+        return;
+    }
+
+    for (int i = 0; i < result->n_columns; i++) {
+        const PgQueryColumnDef* change = &result->columns[i];
+        int column = catalog_table_column(table, change->name);
+
+        switch (change->change) {
+        case PG_QUERY_COLUMN_DEFINE:
+            // ADD COLUMN IF NOT EXISTS of a column the table has leaves it as it is
+            if (column < 0) {
+                table->columns = checked_realloc(table->columns, sizeof(CatalogColumn) * (table->n_columns + 1));
+                set_column(&table->columns[table->n_columns++], change);
+            }
+            break;
+        case PG_QUERY_COLUMN_SET_DEFAULT:
+        case PG_QUERY_COLUMN_DROP_DEFAULT:
+            if (column >= 0) {
+                table->columns[column].has_default = change->change == PG_QUERY_COLUMN_SET_DEFAULT;
+            }
+            break;
+        case PG_QUERY_COLUMN_DROP_EXPRESSION:
+            if (column >= 0) {
+                table->columns[column].is_generated = false;
+            }
+            break;
+        case PG_QUERY_COLUMN_DROP:
+            if (column >= 0) {
+                free(table->columns[column].name);
+                free(table->columns[column].type_name);
+                memmove(&table->columns[column], &table->columns[column + 1], sizeof(CatalogColumn) * (table->n_columns - column - 1));
+                table->n_columns--;
+            }
+            break;
+        }
+    }
+    free_copy_columns(table);
+}
+
+void table_catalog_add_statement(TableCatalog* catalog, StatementSlice statement) {
+    if (!statement_defines_table(statement)) {
+        return;
+    }
+
+    PgQueryTableDefResult result = pg_query_table_def_len(statement.data, statement.len, PG_QUERY_PARSE_DEFAULT);
+    if (result.error || !result.relation) {
+        pg_query_free_table_def_result(result);
+        return;
+    }
+    if (result.is_alter_table) {
+        alter_table(catalog, &result);
+        pg_query_free_table_def_result(result);
+        return;
+    }
+
+    CatalogTable* table = calloc(1, sizeof(CatalogTable));
+    if (!table) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    table->relation = strdup_or_null(result.relation);
+    table->complete = !result.has_inherited_columns;
+    table->n_columns = result.n_columns;
+    if (result.n_columns > 0) {
+        table->columns = calloc(result.n_columns, sizeof(CatalogColumn));
+        if (!table->columns) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < result.n_columns; i++) {
+        set_column(&table->columns[i], &result.columns[i]);
+    }
+    pg_query_free_table_def_result(result);
+
+    // Replace an earlier definition of the same table
+    unsigned int hash = hash_relation(table->relation);
+    CatalogTable** entry = &catalog->buckets[hash];
+    while (*entry && strcmp((*entry)->relation, table->relation) != 0) {
+        entry = &(*entry)->next;
+    }
+    if (*entry) {
+        CatalogTable* old = *entry;
+        table->next = old->next;
+        free_table(old);
+    }
+    else {
+        table->next = NULL;
+    }
+    *entry = table;
+}
+
+CatalogTable* table_catalog_find(TableCatalog* catalog, const char* relation) {
+    CatalogTable* table = catalog->buckets[hash_relation(relation)];
+    while (table && strcmp(table->relation, relation) != 0) {
+        table = table->next;
+    }
+    return table;
+}
+
+int catalog_table_column(const CatalogTable* table, const char* name) {
+    for (int i = 0; i < table->n_columns; i++) {
+        if (strcmp(table->columns[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Whether a value in COPY text format can be read by the input function of the
+// type. Only the syntax is checked, for the types with a fixed one; values with
+// escapes are left to the server.
+static bool is_digits(const char** ptr, const char* end, const char* digits) {
+    const char* start = *ptr;
+    // Underscores between digits, as in 1_000_000
+    while (*ptr < end && (strchr(digits, tolower((unsigned char)**ptr)) || (**ptr == '_' && *ptr > start && *ptr + 1 < end && (*ptr)[1] != '_'))) {
+        (*ptr)++;
+    }
+    return *ptr > start && (*ptr)[-1] != '_';
+}
+
+static bool integer_fits(const char* ptr, const char* end, CopyBinaryType type) {
+    bool negative = ptr < end && *ptr == '-';
+    if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+        ptr++;
+    }
+
+    // 0x1F, 0o17 and 0b101: only the digits are checked
+    if (end - ptr > 2 && ptr[0] == '0' && strchr("xob", tolower((unsigned char)ptr[1]))) {
+        const char* digits = tolower((unsigned char)ptr[1]) == 'x' ? "0123456789abcdef" : tolower((unsigned char)ptr[1]) == 'o' ? "01234567" : "01";
+        ptr += 2;
+        return is_digits(&ptr, end, digits) && ptr == end;
+    }
+
+    unsigned long long max = type == COPY_BINARY_INT2 ? 32767 : type == COPY_BINARY_INT4 ? 2147483647ULL : 9223372036854775807ULL;
+    unsigned long long value = 0;
+    const char* start = ptr;
+    if (!is_digits(&ptr, end, "0123456789") || ptr != end) {
+        return false;
+    }
+    for (ptr = start; ptr < end; ptr++) {
+        if (*ptr == '_') {
+            continue;
+        }
+        if (value > (max + 1 - (*ptr - '0')) / 10) {
+            return false;
+        }
+        value = value * 10 + (*ptr - '0');
+    }
+    return value <= max + (negative ? 1 : 0);
+}
+
+static bool word_is(const char* ptr, const char* end, const char* word) {
+    return (size_t)(end - ptr) == strlen(word) && strncasecmp(ptr, word, end - ptr) == 0;
+}
+
+static bool number_fits(const char* ptr, const char* end) {
+    if (word_is(ptr, end, "NaN")) {
+        return true;
+    }
+    if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+        ptr++;
+    }
+    if (word_is(ptr, end, "Infinity") || word_is(ptr, end, "inf")) {
+        return true;
+    }
+
+    bool integer_part = is_digits(&ptr, end, "0123456789");
+    bool fraction = false;
+    if (ptr < end && *ptr == '.') {
+        ptr++;
+        fraction = is_digits(&ptr, end, "0123456789");
+    }
+    if (!integer_part && !fraction) {
+        return false;
+    }
+    if (ptr < end && tolower((unsigned char)*ptr) == 'e') {
+        ptr++;
+        if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+            ptr++;
+        }
+        if (!is_digits(&ptr, end, "0123456789")) {
+            return false;
+        }
+    }
+    return ptr == end;
+}
+
+static bool bool_fits(const char* ptr, const char* end) {
+    size_t len = end - ptr;
+    const char* words[] = { "true", "false", "yes", "no", "on", "off" };
+
+    if (len == 1 && (*ptr == '1' || *ptr == '0')) {
+        return true;
+    }
+    // Any prefix of the words, but "o" alone could be "on" or "off"
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        size_t min_len = words[i][0] == 'o' ? 2 : 1;
+        if (len >= min_len && len <= strlen(words[i]) && strncasecmp(ptr, words[i], len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool uuid_fits(const char* ptr, const char* end) {
+    int digits = 0;
+    if (ptr < end && *ptr == '{') {
+        if (end[-1] != '}') {
+            return false;
+        }
+        ptr++;
+        end--;
+    }
+    for (; ptr < end; ptr++) {
+        if (isxdigit((unsigned char)*ptr)) {
+            digits++;
+        }
+        else if (*ptr != '-' || digits == 0 || digits % 4 != 0 || ptr[-1] == '-') {
+            return false;
+        }
+    }
+    return digits == 32 && end[-1] != '-';
+}
+
+static bool value_fits(CopyBinaryType type, const char* value, size_t len) {
+    const char* end = value + len;
+
+    if (memchr(value, '\\', len)) {
+        return true;
+    }
+    // The input functions of these types skip surrounding whitespace
+    while (value < end && isspace((unsigned char)*value)) {
+        value++;
+    }
+    while (end > value && isspace((unsigned char)end[-1])) {
+        end--;
+    }
+
+    switch (type) {
+    case COPY_BINARY_BOOL:
+        return bool_fits(value, end);
+    case COPY_BINARY_INT2:
+    case COPY_BINARY_INT4:
+    case COPY_BINARY_INT8:
+        return integer_fits(value, end, type);
+    case COPY_BINARY_FLOAT4:
+    case COPY_BINARY_FLOAT8:
+    case COPY_BINARY_NUMERIC:
+        return number_fits(value, end);
+    case COPY_BINARY_UUID:
+        return uuid_fits(value, end);
+    default:
+        return true;
+    }
+}
+
+static void reserve_values(TableCatalog* catalog, int n) {
+    if (n <= catalog->capacity) {
+        return;
+    }
+    catalog->value_columns = checked_realloc(catalog->value_columns, sizeof(int) * n);
+    catalog->column_values = checked_realloc(catalog->column_values, sizeof(int) * n);
+    catalog->fields = checked_realloc(catalog->fields, sizeof(const char*) * n);
+    catalog->field_lens = checked_realloc(catalog->field_lens, sizeof(size_t) * n);
+    catalog->capacity = n;
+}
+
+static void build_copy_columns(CatalogTable* table) {
+    table->copy_columns = checked_realloc(NULL, sizeof(char*) * (table->n_columns > 0 ? table->n_columns : 1));
+    table->n_copy_columns = 0;
+    for (int i = 0; i < table->n_columns; i++) {
+        if (!table->columns[i].is_generated) {
+            table->copy_columns[table->n_copy_columns++] = strdup_or_null(table->columns[i].name);
+        }
+    }
+}
+
+// Table column of each value of the INSERT, in value_columns, and the value of each
+// table column in column_values. Reports the INSERTs that don't match the table.
+static bool match_columns(TableCatalog* catalog, CatalogTable* table, const PgQueryInsertToCopyResult* result, int n_values) {
+    if (result->n_columns == 0 && n_values > table->n_columns) {
+        if (!table->warned) {
+            fprintf(stderr, "Warning: INSERT into %s has %d values, the table has %d columns\n", table->relation, n_values, table->n_columns);
+            table->warned = true;
+        }
+        return false;
+    }
+
+    reserve_values(catalog, n_values > table->n_columns ? n_values : table->n_columns);
+    for (int i = 0; i < table->n_columns; i++) {
+        catalog->column_values[i] = -1;
+    }
+    for (int i = 0; i < n_values; i++) {
+        int column = result->n_columns > 0 ? catalog_table_column(table, result->columns[i]) : i;
+        if (column < 0 || catalog->column_values[column] >= 0) {
+            if (!table->warned) {
+                fprintf(stderr, column < 0 ? "Warning: %s isn't a column of %s\n" : "Warning: column %s of %s is given more than once\n",
+                        result->columns[i], table->relation);
+                table->warned = true;
+            }
+            return false;
+        }
+        catalog->value_columns[i] = column;
+        catalog->column_values[column] = i;
+    }
+    return true;
+}
+
+// Fields of a row of COPY text data, returns the end of the row or NULL if it doesn't have n_values fields
+static const char* split_row(TableCatalog* catalog, const char* ptr, const char* end, int n_values) {
+    const char* row_end = memchr(ptr, '\n', end - ptr);
+    if (!row_end) {
+        row_end = end;
+    }
+    for (int i = 0; i < n_values; i++) {
+        const char* field_end = i + 1 < n_values ? memchr(ptr, '\t', row_end - ptr) : row_end;
+        if (!field_end) {
+            return NULL;
+        }
+        catalog->fields[i] = ptr;
+        catalog->field_lens[i] = field_end - ptr;
+        ptr = field_end + 1;
+    }
+    // More fields than values
+    if (memchr(catalog->fields[n_values - 1], '\t', catalog->field_lens[n_values - 1])) {
+        return NULL;
+    }
+    return row_end;
+}
+
+bool table_catalog_map_rows(TableCatalog* catalog, PgQueryInsertToCopyResult* result) {
+    CatalogTable* table = result->relation ? table_catalog_find(catalog, result->relation) : NULL;
+    if (!table || !table->complete || result->n_rows == 0 || table->n_columns == 0) {
+        return false;
+    }
+
+    const char* data = result->copy_data;
+    const char* data_end = data + result->copy_data_len;
+    int n_values = result->n_columns;
+    if (n_values == 0) {
+        const char* row_end = memchr(data, '\n', result->copy_data_len);
+        n_values = 1;
+        for (const char* ptr = data; ptr < row_end; ptr++) {
+            n_values += *ptr == '\t';
+        }
+    }
+    if (!match_columns(catalog, table, result, n_values)) {
+        return false;
+    }
+    if (!table->copy_columns) {
+        build_copy_columns(table);
+    }
+
+    // Rows already in table order are only checked
+    bool same_order = n_values == table->n_copy_columns;
+    for (int i = 0; same_order && i < n_values; i++) {
+        same_order = catalog->value_columns[i] == i && !table->columns[i].is_generated;
+    }
+    bool map = !same_order && !result->fallback_insert;
+    bool wrote_default = false;
+
+    catalog->rows.len = 0;
+    for (const char* ptr = data; ptr < data_end;) {
+        const char* row_end = split_row(catalog, ptr, data_end, n_values);
+        if (!row_end) {
+            return false;
+        }
+
+        for (int i = 0; i < n_values; i++) {
+            CatalogColumn* column = &table->columns[catalog->value_columns[i]];
+            const char* value = catalog->fields[i];
+            size_t len = catalog->field_lens[i];
+
+            bool is_default = len == 2 && memcmp(value, PG_QUERY_COPY_DEFAULT, 2) == 0;
+            bool is_null = len == 2 && memcmp(value, "\\N", 2) == 0;
+
+            if (column->is_generated) {
+                // DEFAULT is the only value it takes, and the rows in table order leave it out
+                if (is_default) {
+                    continue;
+                }
+                if (!column->warned) {
+                    fprintf(stderr, "Warning: %s of %s is a generated column, the INSERT can't give it a value\n", column->name, table->relation);
+                    column->warned = true;
+                }
+                return false;
+            }
+            if (!is_default && !is_null && !column->warned && column->value_type != COPY_BINARY_UNSUPPORTED && !value_fits(column->value_type, value, len)) {
+                fprintf(stderr, "Warning: '%.*s' isn't a valid %s for column %s of %s\n", (int)len, value, column->type_name, column->name, table->relation);
+                column->warned = true;
+            }
+        }
+
+        if (map) {
+            bool first = true;
+            for (int j = 0; j < table->n_columns; j++) {
+                if (table->columns[j].is_generated) {
+                    continue;
+                }
+                if (!first) {
+                    byte_buffer_append(&catalog->rows, "\t", 1);
+                }
+                first = false;
+
+                int value = catalog->column_values[j];
+                if (value >= 0) {
+                    byte_buffer_append(&catalog->rows, catalog->fields[value], catalog->field_lens[value]);
+                    wrote_default = wrote_default || (catalog->field_lens[value] == 2 && memcmp(catalog->fields[value], PG_QUERY_COPY_DEFAULT, 2) == 0);
+                }
+                else if (table->columns[j].has_default) {
+                    byte_buffer_append(&catalog->rows, PG_QUERY_COPY_DEFAULT, 2);
+                    wrote_default = true;
+                }
+                else {
+                    byte_buffer_append(&catalog->rows, "\\N", 2);
+                }
+            }
+            byte_buffer_append(&catalog->rows, "\n", 1);
+        }
+        ptr = row_end + 1;
+    }
+
+    if (result->fallback_insert) {
+        return false;
+    }
+
+    // The rows and the column list of the table take the place of those of the INSERT
+    if (map) {
+        free(result->copy_data);
+        result->copy_data = catalog->rows.data;
+        result->copy_data_len = catalog->rows.len;
+        result->has_default = wrote_default;
+        memset(&catalog->rows, 0, sizeof(ByteBuffer));
+    }
+    for (int i = 0; i < result->n_columns; i++) {
+        free(result->columns[i]);
+    }
+    free(result->columns);
+    result->columns = checked_realloc(NULL, sizeof(char*) * table->n_copy_columns);
+    for (int i = 0; i < table->n_copy_columns; i++) {
+        result->columns[i] = strdup_or_null(table->copy_columns[i]);
+    }
+    result->n_columns = table->n_copy_columns;
+    return true;
+}
+
+void table_catalog_free(TableCatalog* catalog) {
+    for (int i = 0; i < CATALOG_HASH_SIZE; i++) {
+        CatalogTable* table = catalog->buckets[i];
+        while (table) {
+            CatalogTable* next = table->next;
+            free_table(table);
+            table = next;
+        }
+        catalog->buckets[i] = NULL;
+    }
+    free(catalog->value_columns);
+    free(catalog->column_values);
+    free(catalog->fields);
+    free(catalog->field_lens);
+    byte_buffer_free(&catalog->rows);
+    catalog->value_columns = NULL;
+    catalog->column_values = NULL;
+    catalog->fields = NULL;
+    catalog->field_lens = NULL;
+    catalog->capacity = 0;
+}
@@ -0,0 +1,80 @@
+#ifndef INSERT_TO_COPY_CATALOG_H
+#define INSERT_TO_COPY_CATALOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <pg_query.h>
+
+#include "insert_to_copy_input.h"
+#include "insert_to_copy_binary.h"
+
+// Column definitions of the tables created earlier in the dump, looked up by the
+// quoted relation name that pg_query_insert_to_copy returns. ALTER TABLE ... ADD
+// COLUMN, DROP COLUMN and changes of the column defaults are applied to the table
+// as they come.
+//
+// With it the rows of INSERTs can be written in the column order of their table
+// (table_catalog_map_rows), so that INSERTs with different column lists, or
+// without one, continue the same COPY block, and the rows that the server would
+// reject are reported while converting instead of when loading.
+
+typedef struct {
+    char* name;              // Quoted like the column names of PgQueryInsertToCopyResult
+    char* type_name;         // NULL for columns of typed tables
+    bool is_array;
+    bool has_default;        // Left out of a row it gets its default, not NULL
+    bool is_generated;       // Not in the COPY column list
+    CopyBinaryType value_type; // Values are checked against the type when it is a known one
+    bool warned;             // A value of the column was reported
+} CatalogColumn;
+
+typedef struct CatalogTable {
+    char* relation;
+    CatalogColumn* columns;
+    int n_columns;
+    bool complete;           // False when columns come from elsewhere (INHERITS, LIKE, OF, PARTITION OF)
+    bool warned;             // An INSERT that doesn't match the columns was reported
+
+    // Column list of the rows written by table_catalog_map_rows, NULL until needed
+    // and after the columns change
+    char** copy_columns;
+    int n_copy_columns;
+
+    struct CatalogTable* next;
+} CatalogTable;
+
+#define CATALOG_HASH_SIZE 1024
+
+typedef struct {
+    CatalogTable* buckets[CATALOG_HASH_SIZE];
+
+    // Reused by table_catalog_map_rows
+    int* value_columns;      // Table column of each value of the INSERT
+    int* column_values;      // Value of each table column, -1 if the INSERT leaves it out
+    const char** fields;
+    size_t* field_lens;
+    int capacity;
+    ByteBuffer rows;
+} TableCatalog;
+
+void table_catalog_init(TableCatalog* catalog);
+// Records the table if the statement is a CREATE TABLE, a later definition replaces an earlier one,
+// or applies the changes to the columns of an ALTER TABLE of a table recorded before
+void table_catalog_add_statement(TableCatalog* catalog, StatementSlice statement);
+CatalogTable* table_catalog_find(TableCatalog* catalog, const char* relation);
+// Index of the column, or -1
+int catalog_table_column(const CatalogTable* table, const char* name);
+// Rewrites the rows of a converted INSERT into a table of the catalog in the
+// order of its columns, and sets the column list to all of its columns that
+// aren't generated. Columns the INSERT leaves out get PG_QUERY_COPY_DEFAULT
+// when they have a default and NULL otherwise. Values the server would reject
+// (more values than columns, unknown or generated columns, values that can't
+// be read as the type of their column) are reported on stderr, once per table
+// or column. Returns false and leaves the result as it was when the table
+// isn't known, the INSERT doesn't match it, or it has rows that aren't
+// constants (fallback_insert, which keeps its own column list).
+bool table_catalog_map_rows(TableCatalog* catalog, PgQueryInsertToCopyResult* result);
+void table_catalog_free(TableCatalog* catalog);
+
+#endif
@@ -0,0 +1,127 @@
+#include "insert_to_copy_checkpoint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#define CHECKPOINT_HEADER "insert_to_copy checkpoint 1\n"
+
+static bool write_string(FILE* file, const char* key, const char* value) {
+    return fprintf(file, "%s %zu\n", key, strlen(value)) > 0 && fputs(value, file) >= 0 && fputc('\n', file) != EOF;
+}
+
+bool checkpoint_write(const char* path, const Checkpoint* checkpoint) {
+    size_t path_len = strlen(path);
+    char* temp_path = malloc(path_len + 5);
+    if (!temp_path) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    memcpy(temp_path, path, path_len);
+    memcpy(temp_path + path_len, ".tmp", 5);
+
+    FILE* file = fopen(temp_path, "wb");
+    if (!file) {
+        free(temp_path);
+        return false;
+    }
+
+    bool ok = fputs(CHECKPOINT_HEADER, file) >= 0 &&
+              fprintf(file, "input_offset %" PRIu64 "\n", checkpoint->input_offset) > 0 &&
+              fprintf(file, "output_offset %" PRIu64 "\n", checkpoint->output_offset) > 0 &&
+              fprintf(file, "default_block %d\n", checkpoint->default_block ? 1 : 0) > 0;
+    if (ok && checkpoint->relation) {
+        ok = write_string(file, "relation", checkpoint->relation) &&
+             write_string(file, "column_list", checkpoint->column_list ? checkpoint->column_list : "");
+    }
+    ok = fflush(file) == 0 && ok;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(file)) == 0;
+#else
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = fclose(file) == 0 && ok;
+
+    if (ok) {
+#ifdef _WIN32
+        // rename doesn't replace an existing file on Windows
+        remove(path);
+#endif
+        ok = rename(temp_path, path) == 0;
+    }
+    if (!ok) {
+        int saved_errno = errno;
+        remove(temp_path);
+        errno = saved_errno;
+    }
+    free(temp_path);
+    return ok;
+}
+
+// Reads "<key> <length>\n<value>\n"
+static char* read_string(FILE* file, const char* key) {
+    char name[32];
+    size_t len;
+
+    if (fscanf(file, "%31s %zu", name, &len) != 2 || strcmp(name, key) != 0 || fgetc(file) != '\n') {
+        return NULL;
+    }
+    char* value = malloc(len + 1);
+    if (!value) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    if (fread(value, 1, len, file) != len || fgetc(file) != '\n') {
+        free(value);
+        return NULL;
+    }
+    value[len] = '\0';
+    return value;
+}
+
+bool checkpoint_read(const char* path, Checkpoint* checkpoint) {
+    char header[sizeof(CHECKPOINT_HEADER)];
+    int default_block;
+
+    memset(checkpoint, 0, sizeof(Checkpoint));
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    bool ok = fgets(header, sizeof(header), file) && strcmp(header, CHECKPOINT_HEADER) == 0 &&
+              fscanf(file, "input_offset %" SCNu64 "\n", &checkpoint->input_offset) == 1 &&
+              fscanf(file, "output_offset %" SCNu64 "\n", &checkpoint->output_offset) == 1 &&
+              fscanf(file, "default_block %d", &default_block) == 1 && fgetc(file) == '\n';
+    checkpoint->default_block = default_block != 0;
+
+    int c = ok ? fgetc(file) : EOF;
+    if (ok && c != EOF) {
+        ungetc(c, file);
+        checkpoint->relation = read_string(file, "relation");
+        checkpoint->column_list = checkpoint->relation ? read_string(file, "column_list") : NULL;
+        ok = checkpoint->column_list != NULL;
+    }
+    fclose(file);
+
+    if (!ok) {
+        checkpoint_free(checkpoint);
+        errno = 0;
+    }
+    return ok;
+}
+
+void checkpoint_free(Checkpoint* checkpoint) {
+    free(checkpoint->relation);
+    free(checkpoint->column_list);
+    checkpoint->relation = NULL;
+    checkpoint->column_list = NULL;
+}
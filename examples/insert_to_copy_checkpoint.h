@@ -0,0 +1,50 @@
+#ifndef INSERT_TO_COPY_CHECKPOINT_H
+#define INSERT_TO_COPY_CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Checkpoints of insert_to_copy (--checkpoint, --resume), kept next to the output
+// in "<output.sql>.checkpoint" so a conversion that was interrupted can go on
+// where it was instead of starting over.
+//
+// A checkpoint is taken between two statements once the output up to it is on
+// disk: it has the input offset the next statement starts at, the size of the
+// output at that point, and the COPY block that is open there (the rows of the
+// next INSERT into the same table continue it). Checkpoints are only taken
+// outside of COPY data and when no rows with non-constant values are waiting to
+// be written after the block, so that this is all the state there is. Resuming
+// truncates the output to its size and reads on from the input offset, and the
+// output ends up the same as that of an uninterrupted run.
+//
+// The file is a few lines of text, written to a temp file that is renamed over
+// the previous one so that a crash leaves one or the other:
+//
+//   insert_to_copy checkpoint 1
+//   input_offset 81230
+//   output_offset 40112
+//   default_block 0
+//   relation 12
+//   public.users
+//   column_list 10
+//    (id, name)
+//
+// relation and column_list are followed by their length and are left out when
+// no COPY block is open.
+
+typedef struct {
+    uint64_t input_offset;
+    uint64_t output_offset;
+    char* relation;              // Open COPY block, NULL if there is none
+    char* column_list;           // " (a, b)" or ""
+    bool default_block;          // The block has the DEFAULT option
+} Checkpoint;
+
+// Writes the checkpoint to path. Returns false with errno set on failure.
+bool checkpoint_write(const char* path, const Checkpoint* checkpoint);
+// Reads a checkpoint written by checkpoint_write. Returns false if it can't be
+// read (errno set) or isn't a checkpoint (errno 0).
+bool checkpoint_read(const char* path, Checkpoint* checkpoint);
+void checkpoint_free(Checkpoint* checkpoint);
+
+#endif
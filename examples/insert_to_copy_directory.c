@@ -0,0 +1,456 @@
+#include "insert_to_copy_directory.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define strncasecmp _strnicmp
+#else
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#endif
+
+#define DIRECTORY_FILE_BUFFER (64 * 1024)
+#define DIRECTORY_MAX_OPEN_FILES 1024
+
+struct DirectoryChunk {
+    DirectoryTarget* target;
+    int number;                        // data/NNNNNN.sql
+    long long rows;
+    size_t bytes;
+    FILE* file;                        // NULL while closed
+    unsigned long long last_used;
+    bool finished;                     // "\." written
+};
+
+struct DirectoryTarget {
+    char* key;                         // "relation (columns)" as in the COPY command
+    bool has_default;                  // Rows have DEFAULT values, the COPY command has the DEFAULT option
+    int chunk;                         // Index of the chunk rows go to, -1 when a new one is needed
+    DirectoryTarget* next;
+};
+
+static void* directory_realloc(void* ptr, size_t size) {
+    void* result = realloc(ptr, size);
+    if (!result) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    return result;
+}
+
+static char* directory_path(const DirectoryOutput* output, const char* name) {
+    char* path = directory_realloc(NULL, strlen(output->path) + strlen(name) + 2);
+    sprintf(path, "%s/%s", output->path, name);
+    return path;
+}
+
+static bool make_directory(const char* path) {
+#ifdef _WIN32
+    return _mkdir(path) == 0 || errno == EEXIST;
+#else
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+static FILE* open_file(const char* path, const char* mode) {
+    FILE* file = fopen(path, mode);
+    if (!file) {
+        perror("Error opening data file");
+        exit(1);
+    }
+    setvbuf(file, NULL, _IOFBF, DIRECTORY_FILE_BUFFER);
+    return file;
+}
+
+static void close_file(FILE* file) {
+    if (fclose(file) != 0) {
+        perror("Error writing data file");
+        exit(1);
+    }
+}
+
+// Finds the next keyword or identifier (dots included, so "pg_catalog.setval" is
+// one word), skipping comments, strings and quoted identifiers
+static bool next_word(const char** ptr, const char* end, const char** word, size_t* len) {
+    const char* p = *ptr;
+
+    while ((p = statement_skip_comments(p, end)) < end) {
+        if (isalpha((unsigned char)*p) || *p == '_') {
+            *word = p;
+            while (p < end && (isalnum((unsigned char)*p) || *p == '_' || *p == '.' || *p == '$')) {
+                p++;
+            }
+            *len = p - *word;
+            *ptr = p;
+            return true;
+        }
+        if (*p == '\'' || *p == '"') {
+            char quote = *p++;
+            while (p < end && *p != quote) {
+                p++;
+            }
+        }
+        p++;
+    }
+
+    *ptr = end;
+    return false;
+}
+
+static bool is_word(const char* word, size_t len, const char* keyword) {
+    return len == strlen(keyword) && strncasecmp(word, keyword, len) == 0;
+}
+
+// Whether the rest of the statement has the two keywords one after the other
+static bool has_words(const char* ptr, const char* end, const char* first, const char* second) {
+    const char* word;
+    size_t len;
+    bool previous = false;
+
+    while (next_word(&ptr, end, &word, &len)) {
+        if (previous && is_word(word, len, second)) {
+            return true;
+        }
+        previous = is_word(word, len, first);
+    }
+    return false;
+}
+
+// Statements pg_restore runs after the data: indexes, constraints, triggers, rules,
+// policies, statistics, publications, matview refreshes and sequence values
+static bool is_post_data(StatementSlice statement) {
+    const char* ptr = statement.data;
+    const char* end = statement.data + statement.len;
+    const char* word;
+    size_t len;
+
+    if (!next_word(&ptr, end, &word, &len)) {
+        return false;
+    }
+
+    if (is_word(word, len, "CREATE")) {
+        if (!next_word(&ptr, end, &word, &len)) {
+            return false;
+        }
+        if (is_word(word, len, "OR") && next_word(&ptr, end, &word, &len) && is_word(word, len, "REPLACE")) {
+            next_word(&ptr, end, &word, &len);
+        }
+        if (is_word(word, len, "UNIQUE") || is_word(word, len, "CONSTRAINT") || is_word(word, len, "EVENT")) {
+            next_word(&ptr, end, &word, &len);
+        }
+        return is_word(word, len, "INDEX") || is_word(word, len, "TRIGGER") || is_word(word, len, "RULE") ||
+               is_word(word, len, "POLICY") || is_word(word, len, "STATISTICS") ||
+               is_word(word, len, "PUBLICATION") || is_word(word, len, "SUBSCRIPTION");
+    }
+    if (is_word(word, len, "ALTER") && next_word(&ptr, end, &word, &len)) {
+        if (is_word(word, len, "TABLE")) {
+            return has_words(ptr, end, "ADD", "CONSTRAINT") || has_words(ptr, end, "CLUSTER", "ON") ||
+                   has_words(ptr, end, "REPLICA", "IDENTITY") || has_words(ptr, end, "LEVEL", "SECURITY");
+        }
+        return is_word(word, len, "INDEX") && has_words(ptr, end, "ATTACH", "PARTITION");
+    }
+    if (is_word(word, len, "COMMENT") && next_word(&ptr, end, &word, &len) && is_word(word, len, "ON") &&
+        next_word(&ptr, end, &word, &len)) {
+        return is_word(word, len, "INDEX") || is_word(word, len, "CONSTRAINT") || is_word(word, len, "TRIGGER") ||
+               is_word(word, len, "RULE") || is_word(word, len, "POLICY");
+    }
+    if (is_word(word, len, "SELECT") && next_word(&ptr, end, &word, &len)) {
+        return is_word(word, len, "pg_catalog.setval") || is_word(word, len, "setval");
+    }
+    return is_word(word, len, "REFRESH");
+}
+
+// SET and set_config() statements, which every data file repeats
+static bool is_setting(StatementSlice statement) {
+    const char* ptr = statement.data;
+    const char* end = statement.data + statement.len;
+    const char* word;
+    size_t len;
+
+    if (!next_word(&ptr, end, &word, &len)) {
+        return false;
+    }
+    if (is_word(word, len, "SET")) {
+        return true;
+    }
+    return is_word(word, len, "SELECT") && next_word(&ptr, end, &word, &len) &&
+           (is_word(word, len, "pg_catalog.set_config") || is_word(word, len, "set_config"));
+}
+
+static void write_statement_to(DirectoryOutput* output, OutputSink* sink, StatementSlice statement) {
+    if (output->input_mapped) {
+        output_sink_write_ref(sink, statement.data, statement.len);
+    }
+    else {
+        output_sink_write(sink, statement.data, statement.len);
+    }
+}
+
+static size_t write_settings(DirectoryOutput* output, FILE* file) {
+    fwrite(output->settings, 1, output->settings_len, file);
+    return output->settings_len;
+}
+
+bool directory_output_open(DirectoryOutput* output, const char* path, size_t chunk_size, bool input_mapped) {
+    memset(output, 0, sizeof(DirectoryOutput));
+    output->path = directory_realloc(NULL, strlen(path) + 1);
+    strcpy(output->path, path);
+    output->chunk_size = chunk_size;
+    output->input_mapped = input_mapped;
+    output->pre_data_line_start = true;
+    output->post_data_line_start = true;
+
+    // Leave half of the descriptors to everything else
+    output->max_open_files = DIRECTORY_MAX_OPEN_FILES;
+#ifndef _WIN32
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur / 2 < DIRECTORY_MAX_OPEN_FILES) {
+        output->max_open_files = limit.rlim_cur / 2 > 1 ? (int) (limit.rlim_cur / 2) : 1;
+    }
+#endif
+
+    char* data_path = directory_path(output, "data");
+    char* pre_data_path = directory_path(output, "pre-data.sql");
+    char* post_data_path = directory_path(output, "post-data.sql");
+    bool ok = make_directory(path) && make_directory(data_path) &&
+              output_sink_open(&output->pre_data, pre_data_path, false);
+    if (ok && !output_sink_open(&output->post_data, post_data_path, false)) {
+        output_sink_close(&output->pre_data);
+        ok = false;
+    }
+    free(data_path);
+    free(pre_data_path);
+    free(post_data_path);
+    if (!ok) {
+        free(output->path);
+    }
+    return ok;
+}
+
+void directory_output_statement(DirectoryOutput* output, StatementSlice statement) {
+    if (statement.kind == STATEMENT_COPY_FROM_STDIN || statement.kind == STATEMENT_COPY_DATA || statement.kind == STATEMENT_COPY_END) {
+        // COPY blocks of the input are data too
+        directory_output_insert(output, statement);
+    }
+    else if (is_setting(statement)) {
+        // Without its leading comments, the settings are repeated in every data file
+        const char* start = statement_skip_comments(statement.data, statement.data + statement.len);
+        size_t len = statement.data + statement.len - start;
+        if (output->settings_len + len + 1 > output->settings_capacity) {
+            output->settings_capacity = (output->settings_len + len + 1) * 2;
+            output->settings = directory_realloc(output->settings, output->settings_capacity);
+        }
+        memcpy(output->settings + output->settings_len, start, len);
+        output->settings_len += len;
+        output->settings[output->settings_len++] = '\n';
+
+        write_statement_to(output, &output->pre_data, statement);
+        output->pre_data_line_start = statement.len > 0 && statement.data[statement.len - 1] == '\n';
+        if (!output->post_data_line_start) {
+            output_sink_putc(&output->post_data, '\n');
+        }
+        output_sink_write(&output->post_data, output->settings + output->settings_len - len - 1, len + 1);
+        output->post_data_line_start = true;
+    }
+    else if (is_post_data(statement)) {
+        write_statement_to(output, &output->post_data, statement);
+        output->post_data_line_start = statement.len > 0 && statement.data[statement.len - 1] == '\n';
+    }
+    else {
+        if (statement.kind == STATEMENT_META_COMMAND && !output->pre_data_line_start && statement.data[0] != '\n') {
+            output_sink_putc(&output->pre_data, '\n');
+        }
+        write_statement_to(output, &output->pre_data, statement);
+        output->pre_data_line_start = statement.len > 0 && statement.data[statement.len - 1] == '\n';
+    }
+}
+
+void directory_output_insert(DirectoryOutput* output, StatementSlice statement) {
+    if (!output->inserts_file) {
+        char* path = directory_path(output, "data/inserts.sql");
+        output->inserts_file = open_file(path, "wb");
+        free(path);
+        write_settings(output, output->inserts_file);
+    }
+    fwrite(statement.data, 1, statement.len, output->inserts_file);
+}
+
+void directory_output_fallback(DirectoryOutput* output, const PgQueryInsertToCopyResult* result) {
+    StatementSlice statement = { result->fallback_insert, strlen(result->fallback_insert) };
+
+    directory_output_insert(output, statement);
+    fputs(";\n", output->inserts_file);
+}
+
+static unsigned int hash_key(const char* key) {
+    unsigned int hash = 5381;
+    for (const char* c = key; *c; c++) {
+        hash = hash * 33 + (unsigned char)*c;
+    }
+    return hash % DIRECTORY_HASH_SIZE;
+}
+
+// The COPY target of the INSERT, "relation (a, b)", in a reused buffer
+static const char* build_target_key(DirectoryOutput* output, const PgQueryInsertToCopyResult* result) {
+    size_t len = strlen(result->relation) + 3;
+    for (int i = 0; i < result->n_columns; i++) {
+        len += strlen(result->columns[i]) + 2;
+    }
+    if (len > output->key_capacity) {
+        output->key_capacity = len * 2;
+        output->key = directory_realloc(output->key, output->key_capacity);
+    }
+
+    char* ptr = output->key + sprintf(output->key, "%s", result->relation);
+    for (int i = 0; i < result->n_columns; i++) {
+        ptr += sprintf(ptr, "%s%s", i == 0 ? " (" : ", ", result->columns[i]);
+    }
+    if (result->n_columns > 0) {
+        *ptr++ = ')';
+    }
+    *ptr = '\0';
+    return output->key;
+}
+
+static DirectoryTarget* find_target(DirectoryOutput* output, const PgQueryInsertToCopyResult* result) {
+    const char* key = build_target_key(output, result);
+    unsigned int hash = hash_key(key);
+
+    for (DirectoryTarget* target = output->target_hash[hash]; target; target = target->next) {
+        if (strcmp(target->key, key) == 0 && target->has_default == (result->has_default != 0)) {
+            return target;
+        }
+    }
+
+    DirectoryTarget* target = directory_realloc(NULL, sizeof(DirectoryTarget));
+    target->key = directory_realloc(NULL, strlen(key) + 1);
+    strcpy(target->key, key);
+    target->has_default = result->has_default != 0;
+    target->chunk = -1;
+    target->next = output->target_hash[hash];
+    output->target_hash[hash] = target;
+    return target;
+}
+
+// Opens the file of a chunk, closing the least recently used one when too many are open
+static void open_chunk_file(DirectoryOutput* output, DirectoryChunk* chunk, const char* mode) {
+    if (output->n_open_files == output->max_open_files) {
+        DirectoryChunk* oldest = NULL;
+        for (int i = 0; i < output->n_chunks; i++) {
+            if (output->chunks[i].file && (!oldest || output->chunks[i].last_used < oldest->last_used)) {
+                oldest = &output->chunks[i];
+            }
+        }
+        close_file(oldest->file);
+        oldest->file = NULL;
+        output->n_open_files--;
+    }
+
+    char name[32];
+    sprintf(name, "data/%06d.sql", chunk->number);
+    char* path = directory_path(output, name);
+    chunk->file = open_file(path, mode);
+    free(path);
+    output->n_open_files++;
+}
+
+static void close_chunk_file(DirectoryOutput* output, DirectoryChunk* chunk) {
+    close_file(chunk->file);
+    chunk->file = NULL;
+    output->n_open_files--;
+}
+
+static void finish_chunk(DirectoryOutput* output, DirectoryChunk* chunk) {
+    if (!chunk->file) {
+        open_chunk_file(output, chunk, "ab");
+    }
+    fputs("\\.\n", chunk->file);
+    chunk->bytes += 3;
+    chunk->finished = true;
+    chunk->target->chunk = -1;
+    close_chunk_file(output, chunk);
+}
+
+void directory_output_rows(DirectoryOutput* output, const PgQueryInsertToCopyResult* result) {
+    DirectoryTarget* target = output->current;
+
+    if (!target || target->has_default != (result->has_default != 0) || strcmp(target->key, build_target_key(output, result)) != 0) {
+        target = find_target(output, result);
+        output->current = target;
+    }
+
+    if (target->chunk < 0) {
+        if (output->n_chunks == output->chunks_capacity) {
+            output->chunks_capacity = output->chunks_capacity ? output->chunks_capacity * 2 : 64;
+            output->chunks = directory_realloc(output->chunks, sizeof(DirectoryChunk) * output->chunks_capacity);
+        }
+        DirectoryChunk* chunk = &output->chunks[output->n_chunks];
+        memset(chunk, 0, sizeof(DirectoryChunk));
+        chunk->target = target;
+        chunk->number = output->n_chunks + 1;
+        target->chunk = output->n_chunks++;
+
+        open_chunk_file(output, chunk, "wb");
+        chunk->bytes = write_settings(output, chunk->file);
+        chunk->bytes += fprintf(chunk->file, "COPY %s FROM stdin%s;\n", target->key, target->has_default ? " WITH (DEFAULT E'\\\\D')" : "");
+    }
+
+    DirectoryChunk* chunk = &output->chunks[target->chunk];
+    if (!chunk->file) {
+        open_chunk_file(output, chunk, "ab");
+    }
+    chunk->last_used = ++output->clock;
+    fwrite(result->copy_data, 1, result->copy_data_len, chunk->file);
+    chunk->bytes += result->copy_data_len;
+    chunk->rows += result->n_rows;
+
+    if (chunk->bytes >= output->chunk_size) {
+        finish_chunk(output, chunk);
+    }
+}
+
+void directory_output_close(DirectoryOutput* output) {
+    for (int i = 0; i < output->n_chunks; i++) {
+        if (!output->chunks[i].finished) {
+            finish_chunk(output, &output->chunks[i]);
+        }
+    }
+    output_sink_close(&output->pre_data);
+    output_sink_close(&output->post_data);
+
+    char* path = directory_path(output, "manifest.tsv");
+    FILE* manifest = open_file(path, "wb");
+    free(path);
+    fprintf(manifest, "file\tsection\trelation\trows\tbytes\tdepends\n");
+    fprintf(manifest, "pre-data.sql\tpre-data\t\t\t%llu\t\n", (unsigned long long)output->pre_data.bytes_written);
+    for (int i = 0; i < output->n_chunks; i++) {
+        fprintf(manifest, "data/%06d.sql\tdata\t%s\t%lld\t%llu\tpre-data\n", output->chunks[i].number,
+                output->chunks[i].target->key, output->chunks[i].rows, (unsigned long long)output->chunks[i].bytes);
+    }
+    if (output->inserts_file) {
+        long size = ftell(output->inserts_file);
+        close_file(output->inserts_file);
+        output->inserts_file = NULL;
+        fprintf(manifest, "data/inserts.sql\tdata\t\t\t%ld\tpre-data\n", size);
+    }
+    fprintf(manifest, "post-data.sql\tpost-data\t\t\t%llu\tdata\n", (unsigned long long)output->post_data.bytes_written);
+    close_file(manifest);
+
+    for (int i = 0; i < DIRECTORY_HASH_SIZE; i++) {
+        while (output->target_hash[i]) {
+            DirectoryTarget* next = output->target_hash[i]->next;
+            free(output->target_hash[i]->key);
+            free(output->target_hash[i]);
+            output->target_hash[i] = next;
+        }
+    }
+    free(output->chunks);
+    free(output->key);
+    free(output->settings);
+    free(output->path);
+}
@@ -0,0 +1,81 @@
+#ifndef INSERT_TO_COPY_DIRECTORY_H
+#define INSERT_TO_COPY_DIRECTORY_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <pg_query.h>
+
+#include "insert_to_copy_input.h"
+#include "insert_to_copy_output.h"
+
+// Directory output of insert_to_copy (--format=directory), laid out so the data
+// can be restored with several COPY streams in parallel, like pg_restore -j does
+// for custom format dumps:
+//
+//   pre-data.sql    Everything that isn't data or post-data, in input order
+//   data/NNNNNN.sql One "COPY ... FROM stdin" block per file, each table (and
+//                   column list) cut into chunks of about --chunk-size bytes
+//   data/inserts.sql INSERTs that can't be converted to COPY rows, the rows
+//                   with values that aren't constants (now(), nextval(...)) and
+//                   the "COPY ... FROM stdin" blocks of the input
+//   post-data.sql   Indexes, constraints, triggers, rules, policies and setval
+//   manifest.tsv    The files with their section, table, rows, bytes and the
+//                   section they depend on
+//
+// Data files can be loaded in any order and at the same time once pre-data.sql
+// has run, and post-data.sql runs after all of them. SET statements are kept in
+// pre-data.sql and post-data.sql where they appear, and repeated at the top of
+// each data file so every file can be run in its own session.
+
+#define DIRECTORY_HASH_SIZE 1024
+
+typedef struct DirectoryTarget DirectoryTarget;
+typedef struct DirectoryChunk DirectoryChunk;
+
+typedef struct {
+    char* path;
+    size_t chunk_size;
+    bool input_mapped;
+
+    OutputSink pre_data;
+    OutputSink post_data;
+    bool pre_data_line_start;          // Meta-commands have to start on their own line
+    bool post_data_line_start;         // Settings are written there without their comments
+
+    // Statements every data file starts with (SET ...)
+    char* settings;
+    size_t settings_len;
+    size_t settings_capacity;
+
+    // COPY targets seen so far, by "relation (columns)"
+    DirectoryTarget* target_hash[DIRECTORY_HASH_SIZE];
+    char* key;                         // Reused buffer for the target of the INSERT at hand
+    size_t key_capacity;
+    DirectoryTarget* current;          // Target of the previous INSERT
+    int n_open_files;                  // Chunk files kept open, up to max_open_files
+    int max_open_files;
+    unsigned long long clock;          // To find the least recently used one
+
+    DirectoryChunk* chunks;            // In the order they were started
+    int n_chunks;
+    int chunks_capacity;
+
+    FILE* inserts_file;                // data/inserts.sql, opened when needed
+} DirectoryOutput;
+
+// Creates the directory (and its data subdirectory). Returns false with errno set on failure.
+bool directory_output_open(DirectoryOutput* output, const char* path, size_t chunk_size, bool input_mapped);
+// Writes a statement that isn't an INSERT to pre-data.sql or post-data.sql
+void directory_output_statement(DirectoryOutput* output, StatementSlice statement);
+// Writes an INSERT that couldn't be converted to data/inserts.sql
+void directory_output_insert(DirectoryOutput* output, StatementSlice statement);
+// Writes the rows of a converted INSERT whose values aren't constants to data/inserts.sql
+void directory_output_fallback(DirectoryOutput* output, const PgQueryInsertToCopyResult* result);
+// Appends the rows of a converted INSERT to the current chunk of its table
+void directory_output_rows(DirectoryOutput* output, const PgQueryInsertToCopyResult* result);
+// Ends the open COPY blocks and writes the manifest
+void directory_output_close(DirectoryOutput* output);
+
+#endif
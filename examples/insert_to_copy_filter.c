@@ -0,0 +1,293 @@
+#include "insert_to_copy_filter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#define strncasecmp _strnicmp
+#endif
+
+struct FilterName {
+    char* name;
+    FilterName* next;
+};
+
+static unsigned int hash_name(const char* name) {
+    unsigned int hash = 5381;
+    int c;
+    while ((c = (unsigned char)*name++))
+        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+    return hash % FILTER_HASH_SIZE;
+}
+
+static void* checked_realloc(void* ptr, size_t size) {
+    void* new_ptr = realloc(ptr, size);
+    if (!new_ptr) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    return new_ptr;
+}
+
+static bool name_set_contains(FilterName** hash, const char* name) {
+    for (FilterName* entry = hash[hash_name(name)]; entry; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void name_set_add(FilterName** hash, const char* name) {
+    if (name_set_contains(hash, name)) {
+        return;
+    }
+    unsigned int bucket = hash_name(name);
+    FilterName* entry = checked_realloc(NULL, sizeof(FilterName));
+    entry->name = strdup(name);
+    if (!entry->name) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    entry->next = hash[bucket];
+    hash[bucket] = entry;
+}
+
+static void name_set_free(FilterName** hash) {
+    for (int i = 0; i < FILTER_HASH_SIZE; i++) {
+        FilterName* entry = hash[i];
+        while (entry) {
+            FilterName* next = entry->next;
+            free(entry->name);
+            free(entry);
+            entry = next;
+        }
+        hash[i] = NULL;
+    }
+}
+
+void table_filter_init(TableFilter* filter) {
+    memset(filter, 0, sizeof(TableFilter));
+}
+
+void table_filter_add(TableFilter* filter, const char* pattern, bool include) {
+    char*** patterns = include ? &filter->include : &filter->exclude;
+    int* count = include ? &filter->n_include : &filter->n_exclude;
+
+    *patterns = checked_realloc(*patterns, sizeof(char*) * (*count + 1));
+    (*patterns)[*count] = strdup(pattern);
+    if (!(*patterns)[*count]) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    (*count)++;
+}
+
+bool table_filter_active(const TableFilter* filter) {
+    return filter->n_include > 0 || filter->n_exclude > 0;
+}
+
+// "*" matches any run of characters, "?" any one. Backtracks only to the last "*".
+static bool glob_match(const char* pattern, const char* name, size_t len) {
+    const char* star = NULL;
+    size_t star_pos = 0;
+    size_t pos = 0;
+
+    while (pos < len) {
+        if (*pattern == '*') {
+            star = pattern++;
+            star_pos = pos;
+        }
+        else if (*pattern && (*pattern == '?' || *pattern == name[pos])) {
+            pattern++;
+            pos++;
+        }
+        else if (star) {
+            pattern = star + 1;
+            pos = ++star_pos;
+        }
+        else {
+            return false;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+static void append_name_char(TableFilter* filter, size_t* len, char c) {
+    if (*len + 2 > filter->name_capacity) {
+        filter->name_capacity = filter->name_capacity ? filter->name_capacity * 2 : 256;
+        filter->name = checked_realloc(filter->name, filter->name_capacity);
+    }
+    filter->name[(*len)++] = c;
+}
+
+static bool is_ident_char(unsigned char c) {
+    return isalnum(c) || c == '_' || c == '$' || c >= 0x80;
+}
+
+// Reads a possibly qualified name into filter->name as it is stored (quotes
+// removed, unquoted identifiers in lower case), with *table_offset at the start
+// of its last part. Returns the end of the name, or NULL if there is none.
+static const char* read_name(TableFilter* filter, const char* ptr, const char* end, size_t* table_offset) {
+    size_t len = 0;
+
+    for (;;) {
+        *table_offset = len;
+        if (ptr < end && *ptr == '"') {
+            ptr++;
+            for (;;) {
+                if (ptr == end) {
+                    return NULL;
+                }
+                if (*ptr == '"') {
+                    if (ptr + 1 < end && ptr[1] == '"') {
+                        append_name_char(filter, &len, '"');
+                        ptr += 2;
+                        continue;
+                    }
+                    ptr++;
+                    break;
+                }
+                append_name_char(filter, &len, *ptr++);
+            }
+        }
+        else if (ptr < end && is_ident_char((unsigned char)*ptr) && !isdigit((unsigned char)*ptr) && *ptr != '$') {
+            while (ptr < end && is_ident_char((unsigned char)*ptr)) {
+                append_name_char(filter, &len, (char)tolower((unsigned char)*ptr));
+                ptr++;
+            }
+        }
+        else {
+            return NULL;
+        }
+
+        if (ptr < end && *ptr == '.') {
+            append_name_char(filter, &len, '.');
+            ptr++;
+        }
+        else {
+            break;
+        }
+    }
+    append_name_char(filter, &len, '\0');
+    return ptr;
+}
+
+static bool name_is_kept(const TableFilter* filter, const char* name, size_t table_offset) {
+    const char* table = name + table_offset;
+    bool kept = filter->n_include == 0;
+
+    for (int i = 0; i < filter->n_include && !kept; i++) {
+        const char* pattern = filter->include[i];
+        kept = strchr(pattern, '.') ? glob_match(pattern, name, strlen(name)) : glob_match(pattern, table, strlen(table));
+    }
+    for (int i = 0; i < filter->n_exclude && kept; i++) {
+        const char* pattern = filter->exclude[i];
+        kept = !(strchr(pattern, '.') ? glob_match(pattern, name, strlen(name)) : glob_match(pattern, table, strlen(table)));
+    }
+    return kept;
+}
+
+bool table_filter_keeps(TableFilter* filter, const char* relation, size_t len) {
+    size_t table_offset;
+    const char* end = read_name(filter, relation, relation + len, &table_offset);
+    return !end || name_is_kept(filter, filter->name, table_offset);
+}
+
+// Skips a keyword followed by whitespace, case-insensitively
+static bool skip_keyword(const char** ptr, const char* end, const char* keyword) {
+    size_t len = strlen(keyword);
+    if ((size_t)(end - *ptr) <= len || strncasecmp(*ptr, keyword, len) != 0 || !isspace((unsigned char)(*ptr)[len])) {
+        return false;
+    }
+    *ptr += len;
+    while (*ptr < end && isspace((unsigned char)**ptr)) {
+        (*ptr)++;
+    }
+    return true;
+}
+
+// Whether the table named at ptr is left out. Names that can't be read are kept,
+// the statement then goes on as usual.
+static bool skip_table_at(TableFilter* filter, const char* ptr, const char* end) {
+    size_t table_offset;
+    if (!read_name(filter, ptr, end, &table_offset)) {
+        return false;
+    }
+    return !name_is_kept(filter, filter->name, table_offset);
+}
+
+bool table_filter_skip_data(TableFilter* filter, StatementSlice statement) {
+    const char* end = statement.data + statement.len;
+    const char* ptr;
+    bool skip;
+
+    switch (statement.kind) {
+    case STATEMENT_COPY_DATA:
+        return filter->skip_copy_data;
+    case STATEMENT_COPY_END:
+        skip = filter->skip_copy_data;
+        filter->skip_copy_data = false;
+        return skip;
+    case STATEMENT_COPY_FROM_STDIN:
+        ptr = statement_skip_comments(statement.data, end);
+        filter->skip_copy_data = skip_keyword(&ptr, end, "COPY") && skip_table_at(filter, ptr, end);
+        return filter->skip_copy_data;
+    case STATEMENT_SQL:
+        if (!statement_is_insert(statement, &ptr)) {
+            return false;
+        }
+        return skip_keyword(&ptr, end, "INSERT") && skip_keyword(&ptr, end, "INTO") && skip_table_at(filter, ptr, end);
+    default:
+        return false;
+    }
+}
+
+bool table_filter_skip_statement(TableFilter* filter, const PgQueryStatementInfoResult* info) {
+    if (info->error || info->n_relations == 0) {
+        return false;
+    }
+
+    const char* first = info->relations[0];
+    if (info->kind == PG_QUERY_STATEMENT_CREATE_TABLE || info->kind == PG_QUERY_STATEMENT_DATA) {
+        // The first relation is a table, which the patterns apply to
+        if (!table_filter_keeps(filter, first, strlen(first))) {
+            name_set_add(filter->dropped_hash, first);
+            return true;
+        }
+        if (info->kind == PG_QUERY_STATEMENT_CREATE_TABLE) {
+            name_set_add(filter->tables_hash, first);
+        }
+    }
+
+    for (int i = 0; i < info->n_relations; i++) {
+        if (name_set_contains(filter->dropped_hash, info->relations[i])) {
+            // A sequence, view, ... defined in terms of a dropped table goes as well, but
+            // a kept table only loses the statement (a foreign key to a dropped table)
+            if (!name_set_contains(filter->tables_hash, first)) {
+                name_set_add(filter->dropped_hash, first);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void table_filter_free(TableFilter* filter) {
+    for (int i = 0; i < filter->n_include; i++) {
+        free(filter->include[i]);
+    }
+    for (int i = 0; i < filter->n_exclude; i++) {
+        free(filter->exclude[i]);
+    }
+    free(filter->include);
+    free(filter->exclude);
+    free(filter->name);
+    name_set_free(filter->dropped_hash);
+    name_set_free(filter->tables_hash);
+}
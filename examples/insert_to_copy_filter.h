@@ -0,0 +1,63 @@
+#ifndef INSERT_TO_COPY_FILTER_H
+#define INSERT_TO_COPY_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <pg_query.h>
+
+#include "insert_to_copy_input.h"
+
+// Table filters of insert_to_copy (--include-table, --exclude-table), with
+// patterns like those of pg_dump -t: "*" matches any run of characters and "?"
+// any one character, a pattern with a "." is matched against "schema.table" and
+// one without against the table name alone. Names are compared as they are
+// stored, without quotes and with unquoted identifiers in lower case. A table is
+// kept if it matches an --include-table pattern (or there are none) and no
+// --exclude-table pattern.
+//
+// The table of an INSERT or of a "COPY ... FROM stdin" is read from the first
+// tokens of the statement, so the data of the tables left out is skipped without
+// going through the parser (the data lines of such a COPY as well).
+//
+// With --filter-ddl the other statements are classified with
+// pg_query_statement_info, and those that refer to a table left out are dropped
+// too: its CREATE TABLE, ALTER TABLE, indexes, constraints, comments, grants,
+// and anything referring to a table they also were, or to a sequence or view
+// whose definition was dropped (ALTER SEQUENCE ... OWNED BY, setval).
+
+#define FILTER_HASH_SIZE 1024
+
+typedef struct FilterName FilterName;
+
+typedef struct {
+    char** include;
+    int n_include;
+    char** exclude;
+    int n_exclude;
+    bool filter_ddl;
+
+    bool skip_copy_data;               // The data lines of a COPY that was left out come next
+    char* name;                        // Reused buffer for the name at hand
+    size_t name_capacity;
+
+    FilterName* dropped_hash[FILTER_HASH_SIZE];  // Relations whose definition was dropped (--filter-ddl)
+    FilterName* tables_hash[FILTER_HASH_SIZE];   // Tables created in the dump that are kept
+} TableFilter;
+
+void table_filter_init(TableFilter* filter);
+void table_filter_add(TableFilter* filter, const char* pattern, bool include);
+// Whether any pattern was given
+bool table_filter_active(const TableFilter* filter);
+// Whether a table, by its quoted name ("public.users", "s.\"Mixed\""), is kept
+bool table_filter_keeps(TableFilter* filter, const char* relation, size_t len);
+// Cheap check on the text of a statement straight from the input, for INSERTs,
+// "COPY ... FROM stdin" and the data lines that follow it. Call it for every
+// slice in input order.
+bool table_filter_skip_data(TableFilter* filter, StatementSlice statement);
+// With filter_ddl, whether a statement classified by pg_query_statement_info is
+// dropped. Call it for the statements that get this far in input order.
+bool table_filter_skip_statement(TableFilter* filter, const PgQueryStatementInfoResult* info);
+void table_filter_free(TableFilter* filter);
+
+#endif
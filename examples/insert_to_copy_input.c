@@ -0,0 +1,639 @@
+#include "insert_to_copy_input.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <sys/stat.h>
+#define strncasecmp _strnicmp
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define INPUT_CHUNK_SIZE (1024 * 1024)
+
+void statement_lexer_reset(StatementLexer* lexer) {
+    memset(lexer, 0, sizeof(StatementLexer));
+}
+
+// Characters that continue an identifier or keyword (bytes >= 0x80 are part of multibyte characters)
+static bool is_ident_char(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '$' || c >= 0x80;
+}
+
+static bool is_dollar_tag_char(unsigned char c, bool first) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c >= 0x80 || (!first && c >= '0' && c <= '9');
+}
+
+// Handles a quote character that is either the end of a literal or the first half
+// of a doubled (escaped) quote. Returns false if the next character isn't available yet.
+static bool lexer_close_quote(StatementLexer* lexer, const char* data, size_t len, size_t* i, bool at_eof) {
+    if (*i + 1 >= len && !at_eof) {
+        return false;
+    }
+    if (*i + 1 < len && data[*i + 1] == data[*i]) {
+        *i += 2;
+    }
+    else {
+        lexer->state = LEXER_NORMAL;
+        *i += 1;
+    }
+    return true;
+}
+
+bool statement_lexer_scan(StatementLexer* lexer, const char* data, size_t len, size_t* pos, bool at_eof) {
+    size_t i = *pos;
+
+    while (i < len) {
+        switch (lexer->state) {
+        case LEXER_LINE_COMMENT: {
+            const char* newline = memchr(data + i, '\n', len - i);
+            if (!newline) {
+                i = len;
+                break;
+            }
+            i = newline - data + 1;
+            lexer->state = LEXER_NORMAL;
+            break;
+        }
+        case LEXER_BLOCK_COMMENT: {
+            while (i < len && data[i] != '*' && data[i] != '/') {
+                i++;
+            }
+            if (i >= len) {
+                break;
+            }
+            if (i + 1 >= len && !at_eof) {
+                goto need_more;
+            }
+            if (i + 1 < len && data[i] == '*' && data[i + 1] == '/') {
+                if (--lexer->comment_depth == 0) {
+                    lexer->state = LEXER_NORMAL;
+                }
+                i += 2;
+            }
+            else if (i + 1 < len && data[i] == '/' && data[i + 1] == '*') {
+                lexer->comment_depth++;
+                i += 2;
+            }
+            else {
+                i++;
+            }
+            break;
+        }
+        case LEXER_STRING:
+        case LEXER_QUOTED_IDENT: {
+            const char* quote = memchr(data + i, lexer->state == LEXER_STRING ? '\'' : '"', len - i);
+            if (!quote) {
+                i = len;
+                break;
+            }
+            i = quote - data;
+            if (!lexer_close_quote(lexer, data, len, &i, at_eof)) {
+                goto need_more;
+            }
+            break;
+        }
+        case LEXER_ESCAPE_STRING: {
+            while (i < len && data[i] != '\\' && data[i] != '\'') {
+                i++;
+            }
+            if (i >= len) {
+                break;
+            }
+            if (data[i] == '\\') {
+                if (i + 1 >= len && !at_eof) {
+                    goto need_more;
+                }
+                i += 2;
+            }
+            else if (!lexer_close_quote(lexer, data, len, &i, at_eof)) {
+                goto need_more;
+            }
+            break;
+        }
+        case LEXER_DOLLAR_QUOTE: {
+            const char* dollar = memchr(data + i, '$', len - i);
+            if (!dollar) {
+                i = len;
+                break;
+            }
+            i = dollar - data;
+            if (i + lexer->dollar_tag_len > len) {
+                if (!at_eof) {
+                    goto need_more;
+                }
+                i = len;
+                break;
+            }
+            if (memcmp(data + i, lexer->dollar_tag, lexer->dollar_tag_len) == 0) {
+                lexer->state = LEXER_NORMAL;
+                i += lexer->dollar_tag_len;
+            }
+            else {
+                i++;
+            }
+            break;
+        }
+        case LEXER_META_COMMAND: {
+            const char* newline = memchr(data + i, '\n', len - i);
+            if (!newline) {
+                if (!at_eof) {
+                    i = len;
+                    break;
+                }
+                newline = data + len - 1;
+            }
+            lexer->state = LEXER_NORMAL;
+            lexer->started = false;
+            lexer->meta_command = true;
+            *pos = newline - data + 1;
+            return true;
+        }
+        case LEXER_NORMAL: {
+            unsigned char c = data[i];
+
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v') {
+                lexer->ident_len = 0;
+                i++;
+                continue;
+            }
+            if (c == '\\' && !lexer->started) {
+                // Meta-commands are only recognized in place of a statement, here psql runs them
+                lexer->state = LEXER_META_COMMAND;
+                i++;
+                break;
+            }
+            if (c != '-' && c != '/') {
+                lexer->started = true;
+            }
+
+            if (c == '$' && lexer->ident_len == 0) {
+                // "$tag$" opens a dollar quote, anything else is a parameter ($1) or operator
+                size_t j = i + 1;
+                while (j < len && j - i <= LEXER_MAX_DOLLAR_TAG && is_dollar_tag_char(data[j], j == i + 1)) {
+                    j++;
+                }
+                if (j >= len && j - i <= LEXER_MAX_DOLLAR_TAG && !at_eof) {
+                    goto need_more;
+                }
+                if (j < len && data[j] == '$' && j - i <= LEXER_MAX_DOLLAR_TAG) {
+                    lexer->dollar_tag_len = j - i + 1;
+                    memcpy(lexer->dollar_tag, data + i, lexer->dollar_tag_len);
+                    lexer->state = LEXER_DOLLAR_QUOTE;
+                    i = j + 1;
+                    break;
+                }
+                i++;
+                continue;
+            }
+
+            if (is_ident_char(c)) {
+                lexer->ident_len++;
+                lexer->ident_last = c;
+                i++;
+                continue;
+            }
+
+            if (c == '\'') {
+                bool escape_string = lexer->ident_len == 1 && (lexer->ident_last == 'E' || lexer->ident_last == 'e');
+                lexer->state = escape_string ? LEXER_ESCAPE_STRING : LEXER_STRING;
+                i++;
+            }
+            else if (c == '"') {
+                lexer->state = LEXER_QUOTED_IDENT;
+                i++;
+            }
+            else if (c == '-' || c == '/') {
+                if (i + 1 >= len && !at_eof) {
+                    goto need_more;
+                }
+                if (c == '-' && i + 1 < len && data[i + 1] == '-') {
+                    lexer->state = LEXER_LINE_COMMENT;
+                    i += 2;
+                }
+                else if (c == '/' && i + 1 < len && data[i + 1] == '*') {
+                    lexer->state = LEXER_BLOCK_COMMENT;
+                    lexer->comment_depth = 1;
+                    i += 2;
+                }
+                else {
+                    lexer->started = true;
+                    i++;
+                }
+            }
+            else if (c == '(') {
+                lexer->paren_depth++;
+                i++;
+            }
+            else if (c == ')') {
+                if (lexer->paren_depth > 0) {
+                    lexer->paren_depth--;
+                }
+                i++;
+            }
+            else if (c == ';' && lexer->paren_depth == 0) {
+                lexer->ident_len = 0;
+                lexer->started = false;
+                lexer->meta_command = false;
+                *pos = i + 1;
+                return true;
+            }
+            else {
+                i++;
+            }
+            lexer->ident_len = 0;
+            break;
+        }
+        }
+    }
+
+need_more:
+    *pos = i;
+    return false;
+}
+
+#ifndef _WIN32
+static bool copy_input_map(CopyInput* input, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    input->mapped = true;
+    input->eof = true;
+    input->size = (size_t)st.st_size;
+    if (input->size == 0) {
+        input->data = "";
+        close(fd);
+        return true;
+    }
+
+    void* data = mmap(NULL, input->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        input->mapped = false;
+        input->eof = false;
+        input->size = 0;
+        return false;
+    }
+
+    // The dump is read front to back exactly once
+    madvise(data, input->size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(data, input->size, MADV_HUGEPAGE);
+#endif
+
+    input->data = data;
+    return true;
+}
+#endif
+
+bool copy_input_open(CopyInput* input, const char* path, bool use_mmap) {
+    memset(input, 0, sizeof(CopyInput));
+    statement_lexer_reset(&input->lexer);
+
+    if (strcmp(path, "-") == 0) {
+        input->file = stdin;
+    }
+    else {
+#ifndef _WIN32
+        if (use_mmap && copy_input_map(input, path)) {
+            return true;
+        }
+#endif
+        input->file = fopen(path, "rb");
+        if (!input->file) {
+            return false;
+        }
+    }
+
+    input->capacity = INPUT_CHUNK_SIZE;
+    input->buffer = malloc(input->capacity);
+    if (!input->buffer) {
+        if (input->file != stdin) {
+            fclose(input->file);
+        }
+        return false;
+    }
+    input->data = input->buffer;
+    return true;
+}
+
+// Streaming mode: drop consumed statements from the buffer and read more input
+static void copy_input_fill(CopyInput* input) {
+    if (input->pos > 0) {
+        memmove(input->buffer, input->buffer + input->pos, input->size - input->pos);
+        input->base_offset += input->pos;
+        input->size -= input->pos;
+        input->scan_pos -= input->pos;
+        input->pos = 0;
+    }
+
+    if (input->size == input->capacity) {
+        // A single statement is larger than the buffer
+        char* new_buffer = realloc(input->buffer, input->capacity * 2);
+        if (!new_buffer) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
+        }
+        input->buffer = new_buffer;
+        input->capacity *= 2;
+    }
+
+    size_t bytes_read = fread(input->buffer + input->size, 1, input->capacity - input->size, input->file);
+    if (bytes_read == 0) {
+        if (ferror(input->file)) {
+            perror("Error reading input");
+        }
+        input->eof = true;
+    }
+    input->size += bytes_read;
+    input->data = input->buffer;
+}
+
+// Whether the line at data[0, len) is the "\." that ends COPY data. Returns false
+// when that can't be told yet (more input may follow), with *incomplete set.
+static bool is_copy_end_line(const char* data, size_t len, bool at_eof, bool* incomplete) {
+    *incomplete = false;
+    if (len < 2 || data[0] != '\\' || data[1] != '.') {
+        *incomplete = !at_eof && (len == 0 || (len == 1 && data[0] == '\\'));
+        return false;
+    }
+    if (len == 2 || (len == 3 && data[2] == '\r')) {
+        *incomplete = !at_eof;
+        return at_eof;
+    }
+    return data[2] == '\n' || (data[2] == '\r' && data[3] == '\n');
+}
+
+// COPY data from input->pos, which is at a line start: the lines up to the "\." line
+// (as many as are in the buffer when streaming), or that line itself. Returns false
+// if more input is needed.
+static bool copy_input_next_data(CopyInput* input, StatementSlice* statement) {
+    const char* data = input->data;
+    size_t line = input->scan_pos;
+    bool incomplete = false;
+
+    while (line < input->size) {
+        if (is_copy_end_line(data + line, input->size - line, input->eof, &incomplete) || incomplete) {
+            break;
+        }
+        const char* newline = memchr(data + line, '\n', input->size - line);
+        if (!newline) {
+            incomplete = !input->eof;
+            line = input->eof ? input->size : line;
+            break;
+        }
+        line = newline - data + 1;
+    }
+    if (line >= input->size && !input->eof) {
+        incomplete = true;
+    }
+    input->scan_pos = line;
+
+    if (line > input->pos) {
+        // Data lines, handed out before the buffer has to grow
+        statement->kind = STATEMENT_COPY_DATA;
+    }
+    else if (incomplete) {
+        return false;
+    }
+    else {
+        // The "\." line, or nothing at all if the input ends without it
+        const char* newline = memchr(data + line, '\n', input->size - line);
+        line = newline ? (size_t)(newline - data) + 1 : input->size;
+        statement->kind = STATEMENT_COPY_END;
+        input->in_copy_data = false;
+        statement_lexer_reset(&input->lexer);
+    }
+
+    statement->data = data + input->pos;
+    statement->len = line - input->pos;
+    input->pos = input->scan_pos = line;
+    return true;
+}
+
+bool copy_input_next(CopyInput* input, StatementSlice* statement) {
+    for (;;) {
+        if (input->in_copy_data) {
+            if (copy_input_next_data(input, statement)) {
+                return true;
+            }
+        }
+        else if (statement_lexer_scan(&input->lexer, input->data, input->size, &input->scan_pos, input->eof)) {
+            statement->kind = input->lexer.meta_command ? STATEMENT_META_COMMAND : STATEMENT_SQL;
+            if (statement->kind == STATEMENT_SQL && statement_is_copy_from_stdin(input->data + input->pos, input->scan_pos - input->pos)) {
+                // The rest of the line goes with the command, the data starts on the next one
+                const char* newline;
+                while (!(newline = memchr(input->data + input->scan_pos, '\n', input->size - input->scan_pos)) && !input->eof) {
+                    copy_input_fill(input);
+                }
+                input->scan_pos = newline ? (size_t)(newline - input->data) + 1 : input->size;
+                input->in_copy_data = true;
+                statement->kind = STATEMENT_COPY_FROM_STDIN;
+            }
+            statement->data = input->data + input->pos;
+            statement->len = input->scan_pos - input->pos;
+            input->pos = input->scan_pos;
+            return true;
+        }
+        else if (input->eof) {
+            // Trailing comments and whitespace, or a statement without ";"
+            if (input->pos < input->size) {
+                statement->data = input->data + input->pos;
+                statement->len = input->size - input->pos;
+                statement->kind = input->lexer.state == LEXER_META_COMMAND ? STATEMENT_META_COMMAND : STATEMENT_SQL;
+                input->pos = input->scan_pos = input->size;
+                statement_lexer_reset(&input->lexer);
+                return true;
+            }
+            return false;
+        }
+
+        copy_input_fill(input);
+    }
+}
+
+uint64_t copy_input_total_size(const CopyInput* input) {
+    if (input->mapped) {
+        return input->size;
+    }
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_fstat64(_fileno(input->file), &st) == 0 && (st.st_mode & _S_IFREG)) {
+        return (uint64_t)st.st_size;
+    }
+#else
+    struct stat st;
+    if (fstat(fileno(input->file), &st) == 0 && S_ISREG(st.st_mode)) {
+        return (uint64_t)st.st_size;
+    }
+#endif
+    return 0;
+}
+
+bool copy_input_seek(CopyInput* input, uint64_t offset) {
+    statement_lexer_reset(&input->lexer);
+    input->in_copy_data = false;
+
+    if (input->mapped) {
+        if (offset > input->size) {
+            return false;
+        }
+        input->pos = input->scan_pos = (size_t)offset;
+        return true;
+    }
+
+    input->pos = input->scan_pos = input->size = 0;
+    input->eof = false;
+    input->base_offset = 0;
+#ifdef _WIN32
+    bool seekable = input->file != stdin && _fseeki64(input->file, (__int64)offset, SEEK_SET) == 0;
+#else
+    bool seekable = input->file != stdin && fseeko(input->file, (off_t)offset, SEEK_SET) == 0;
+#endif
+    if (seekable) {
+        input->base_offset = offset;
+        return true;
+    }
+
+    // A pipe: read up to offset and drop it
+    while (input->base_offset + input->size < offset) {
+        input->pos = input->scan_pos = input->size;
+        copy_input_fill(input);
+        if (input->eof) {
+            return false;
+        }
+    }
+    input->pos = input->scan_pos = (size_t)(offset - input->base_offset);
+    return true;
+}
+
+void copy_input_close(CopyInput* input) {
+#ifndef _WIN32
+    if (input->mapped && input->size > 0) {
+        munmap((void*)input->data, input->size);
+    }
+#endif
+    if (input->file && input->file != stdin) {
+        fclose(input->file);
+    }
+    free(input->buffer);
+    memset(input, 0, sizeof(CopyInput));
+}
+
+const char* statement_skip_comments(const char* ptr, const char* end) {
+    while (ptr < end) {
+        if (isspace((unsigned char)*ptr)) {
+            ptr++;
+        }
+        else if (ptr + 1 < end && ptr[0] == '-' && ptr[1] == '-') {
+            const char* newline = memchr(ptr, '\n', end - ptr);
+            ptr = newline ? newline + 1 : end;
+        }
+        else if (ptr + 1 < end && ptr[0] == '/' && ptr[1] == '*') {
+            // Block comments nest
+            int depth = 1;
+            ptr += 2;
+            while (ptr + 1 < end && depth > 0) {
+                if (ptr[0] == '*' && ptr[1] == '/') {
+                    depth--;
+                    ptr += 2;
+                }
+                else if (ptr[0] == '/' && ptr[1] == '*') {
+                    depth++;
+                    ptr += 2;
+                }
+                else {
+                    ptr++;
+                }
+            }
+            if (depth > 0) {
+                ptr = end;
+            }
+        }
+        else {
+            break;
+        }
+    }
+    return ptr;
+}
+
+bool statement_is_insert(StatementSlice statement, const char** start) {
+    const char* end = statement.data + statement.len;
+    const char* ptr = statement_skip_comments(statement.data, end);
+
+    *start = ptr;
+    if (statement.kind != STATEMENT_SQL) {
+        return false;
+    }
+    if (end - ptr < 12 || strncasecmp(ptr, "INSERT", 6) != 0 || !isspace((unsigned char)ptr[6])) {
+        return false;
+    }
+    ptr += 6;
+    while (ptr < end && isspace((unsigned char)*ptr)) {
+        ptr++;
+    }
+    return end - ptr > 4 && strncasecmp(ptr, "INTO", 4) == 0 && isspace((unsigned char)ptr[4]);
+}
+
+// Case-insensitive match of a lower case word, not followed by more identifier characters
+static const char* match_word(const char* ptr, const char* end, const char* word) {
+    size_t len = strlen(word);
+    if ((size_t)(end - ptr) < len || strncasecmp(ptr, word, len) != 0 || (ptr + len < end && is_ident_char(ptr[len]))) {
+        return NULL;
+    }
+    return ptr + len;
+}
+
+bool statement_is_copy_from_stdin(const char* data, size_t len) {
+    const char* end = data + len;
+    const char* ptr = match_word(statement_skip_comments(data, end), end, "copy");
+    bool from = false;
+
+    // COPY (query) TO ... has no data to read
+    ptr = ptr ? statement_skip_comments(ptr, end) : NULL;
+    if (!ptr || ptr == end || *ptr == '(') {
+        return false;
+    }
+
+    while (ptr < end) {
+        const char* next;
+
+        if (*ptr == '\'' || *ptr == '"') {
+            // Literals and quoted identifiers (options, or names like "from")
+            char quote = *ptr;
+            next = memchr(ptr + 1, quote, end - ptr - 1);
+            ptr = next ? next + 1 : end;
+            from = false;
+        }
+        else if (is_ident_char((unsigned char)*ptr)) {
+            if (from && match_word(ptr, end, "stdin")) {
+                return true;
+            }
+            from = match_word(ptr, end, "from") != NULL;
+            while (ptr < end && is_ident_char((unsigned char)*ptr)) {
+                ptr++;
+            }
+        }
+        else if (isspace((unsigned char)*ptr) || (ptr + 1 < end && ((ptr[0] == '-' && ptr[1] == '-') || (ptr[0] == '/' && ptr[1] == '*')))) {
+            ptr = statement_skip_comments(ptr, end);
+        }
+        else {
+            from = false;
+            ptr++;
+        }
+    }
+    return false;
+}
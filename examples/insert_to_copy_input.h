@@ -0,0 +1,113 @@
+#ifndef INSERT_TO_COPY_INPUT_H
+#define INSERT_TO_COPY_INPUT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Input reading and statement splitting shared by the insert_to_copy converters.
+//
+// Statements are handed out as (pointer, length) slices that point directly into
+// the memory-mapped input file, or into the read buffer when the input can't be
+// mapped (pipes, stdin, Windows). Each slice runs up to and including the
+// terminating ";" and starts with whatever whitespace and comments precede the
+// statement, so writing all slices back out reproduces the input byte for byte.
+//
+// Like psql, the data lines after "COPY ... FROM stdin;" and backslash
+// meta-commands (\connect, \restrict) at the start of a statement aren't SQL:
+// the data is found with memchr up to the "\." line without going through the
+// lexer, and a meta-command runs to the end of its line. Both come out as slices
+// of their own kind.
+
+typedef enum {
+    LEXER_NORMAL,
+    LEXER_STRING,            // '...' (also B'', X'', N'', U&'')
+    LEXER_ESCAPE_STRING,     // E'...', backslash escapes the next character
+    LEXER_QUOTED_IDENT,      // "..."
+    LEXER_DOLLAR_QUOTE,      // $tag$...$tag$
+    LEXER_LINE_COMMENT,
+    LEXER_BLOCK_COMMENT,     // /* ... */, these nest
+    LEXER_META_COMMAND       // \command up to the end of the line
+} StatementLexerState;
+
+#define LEXER_MAX_DOLLAR_TAG 64
+
+// Resumable scanner state, carried across reads so every byte is looked at once.
+// Follows the rules psql uses to find the end of a statement: a ";" outside of
+// strings, identifiers, comments and parentheses.
+typedef struct {
+    StatementLexerState state;
+    int comment_depth;
+    int paren_depth;
+    size_t ident_len;        // Length of the identifier / keyword just scanned
+    char ident_last;         // Its last character (to spot the E of E'...')
+    char dollar_tag[LEXER_MAX_DOLLAR_TAG + 2];   // "$tag$" of the open dollar quote
+    size_t dollar_tag_len;
+    bool started;            // The statement has more than whitespace and comments
+    bool meta_command;       // The statement found is a meta-command
+} StatementLexer;
+
+typedef enum {
+    STATEMENT_SQL,
+    STATEMENT_COPY_FROM_STDIN,   // "COPY ... FROM stdin;" and the rest of its line, its data follows
+    STATEMENT_COPY_DATA,         // Data lines of the COPY, in one or more slices
+    STATEMENT_COPY_END,          // The "\." line ending the data (empty if the input ends without it)
+    STATEMENT_META_COMMAND       // psql meta-command line, such as "\connect db"
+} StatementKind;
+
+typedef struct {
+    const char* data;
+    size_t len;
+    StatementKind kind;
+} StatementSlice;
+
+typedef struct {
+    const char* data;        // Mapped file, or the read buffer when streaming
+    size_t size;             // Bytes available in data
+    size_t pos;              // Start of the next statement
+    size_t scan_pos;         // Where the lexer continues scanning
+    StatementLexer lexer;
+    bool eof;                // No more input beyond data + size
+    bool in_copy_data;       // Between "COPY ... FROM stdin;" and the "\." line
+    uint64_t base_offset;    // Input offset of data[0]
+
+    // Streaming mode
+    FILE* file;
+    char* buffer;
+    size_t capacity;
+
+    // Memory-mapped mode
+    bool mapped;
+} CopyInput;
+
+// Opens path ("-" for stdin), memory-mapping it when possible and allowed
+bool copy_input_open(CopyInput* input, const char* path, bool use_mmap);
+// Returns the next statement, valid until the next call (or until close when mapped)
+bool copy_input_next(CopyInput* input, StatementSlice* statement);
+void copy_input_close(CopyInput* input);
+// Input offset of the next statement, that is of the end of the one returned last
+static inline uint64_t copy_input_offset(const CopyInput* input) {
+    return input->base_offset + input->pos;
+}
+// Size of the input file, 0 when it isn't known (a pipe)
+uint64_t copy_input_total_size(const CopyInput* input);
+// Moves to offset, which has to be where a statement starts outside of COPY data
+// (a checkpoint). Returns false if the input is shorter.
+bool copy_input_seek(CopyInput* input, uint64_t offset);
+
+void statement_lexer_reset(StatementLexer* lexer);
+// Scans data[*pos, len) for the ";" ending the current statement, or the end of
+// the line of a meta-command (lexer->meta_command is set then). Returns true with
+// *pos just past it if found, otherwise *pos is where scanning has to resume once
+// more data is available (at_eof tells there won't be any).
+bool statement_lexer_scan(StatementLexer* lexer, const char* data, size_t len, size_t* pos, bool at_eof);
+
+// Skips leading whitespace and comments of a statement
+const char* statement_skip_comments(const char* ptr, const char* end);
+// Whether the statement (after leading comments) is an INSERT INTO
+bool statement_is_insert(StatementSlice statement, const char** start);
+// Whether the statement is "COPY ... FROM stdin", whose data follows it in the input
+bool statement_is_copy_from_stdin(const char* data, size_t len);
+
+#endif
@@ -0,0 +1,465 @@
+#include "insert_to_copy_output.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING
+#endif
+#endif
+
+#define OUTPUT_BUFFER_ALIGNMENT 4096
+
+// Shorter data is cheaper to copy than to give its own iovec
+#define OUTPUT_MIN_REF_LEN (16 * 1024)
+
+static void output_error(void) {
+    perror("Error writing output file");
+    exit(1);
+}
+
+// Writes iov completely, starting skip bytes in. offset < 0 writes at the file position.
+static void write_iovecs(int fd, struct iovec* iov, int n_iov, size_t skip, int64_t offset) {
+    int i = 0;
+
+    while (i < n_iov) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            i++;
+            continue;
+        }
+
+#ifdef _WIN32
+        int n = _write(fd, (char*)iov[i].iov_base + skip, (unsigned int)(iov[i].iov_len - skip));
+        (void)offset;
+#else
+        struct iovec first = iov[i];
+        iov[i].iov_base = (char*)iov[i].iov_base + skip;
+        iov[i].iov_len -= skip;
+        int count = n_iov - i < 1024 ? n_iov - i : 1024;
+        ssize_t n = offset >= 0 ? pwritev(fd, iov + i, count, offset) : writev(fd, iov + i, count);
+        iov[i] = first;
+#endif
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            output_error();
+        }
+        if (offset >= 0) {
+            offset += n;
+        }
+        skip += n;
+    }
+}
+
+#ifdef HAVE_IO_URING
+
+// Minimal io_uring setup through the raw system calls, so there is no dependency on liburing
+struct OutputRing {
+    int fd;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+static OutputRing* ring_open(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    OutputRing* ring = calloc(1, sizeof(OutputRing));
+    if (!ring) {
+        close(fd);
+        return NULL;
+    }
+    ring->fd = fd;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        close(fd);
+        free(ring);
+        return NULL;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(fd);
+            free(ring);
+            return NULL;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ring != ring->sq_ring) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(fd);
+        free(ring);
+        return NULL;
+    }
+
+    char* sq = ring->sq_ring;
+    char* cq = ring->cq_ring;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+static void ring_close(OutputRing* ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    free(ring);
+}
+
+static void ring_submit_writev(OutputRing* ring, int fd, OutputBuffer* buffer, uint64_t offset, uint64_t user_data) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer->iov;
+    sqe->len = buffer->n_iov;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            output_error();
+        }
+    }
+}
+
+// Waits for one write to complete, finishing short writes synchronously
+static void ring_wait(OutputSink* sink) {
+    OutputRing* ring = sink->ring;
+    unsigned head = *ring->cq_head;
+
+    while (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+            output_error();
+        }
+    }
+
+    struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+    OutputBuffer* buffer = &sink->buffers[cqe->user_data >> 48];
+    uint64_t offset = cqe->user_data & ((UINT64_C(1) << 48) - 1);
+    int res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    if (res < 0) {
+        errno = -res;
+        output_error();
+    }
+    if ((size_t)res < buffer->iov_bytes) {
+        write_iovecs(sink->fd, buffer->iov, buffer->n_iov, res, offset + res);
+    }
+
+    buffer->in_flight = false;
+    buffer->len = 0;
+    buffer->iov_start = 0;
+    buffer->n_iov = 0;
+    buffer->iov_bytes = 0;
+}
+
+#endif
+
+static void add_iovec(OutputBuffer* buffer, const void* data, size_t len) {
+    buffer->iov[buffer->n_iov].iov_base = (void*)data;
+    buffer->iov[buffer->n_iov].iov_len = len;
+    buffer->n_iov++;
+    buffer->iov_bytes += len;
+}
+
+// Hands the current buffer to the kernel and moves on to a free one
+static void submit_buffer(OutputSink* sink) {
+    OutputBuffer* buffer = &sink->buffers[sink->current];
+
+    if (buffer->len > buffer->iov_start) {
+        add_iovec(buffer, buffer->data + buffer->iov_start, buffer->len - buffer->iov_start);
+        buffer->iov_start = buffer->len;
+    }
+    if (buffer->n_iov == 0) {
+        return;
+    }
+
+#ifdef HAVE_IO_URING
+    if (sink->ring) {
+        // The buffer index and the file offset travel in user_data
+        ring_submit_writev(sink->ring, sink->fd, buffer, sink->offset, (uint64_t)sink->current << 48 | sink->offset);
+        buffer->in_flight = true;
+        sink->offset += buffer->iov_bytes;
+        sink->bytes_written += buffer->iov_bytes;
+
+        sink->current = (sink->current + 1) % sink->n_buffers;
+        while (sink->buffers[sink->current].in_flight) {
+            ring_wait(sink);
+        }
+        return;
+    }
+#endif
+
+    write_iovecs(sink->fd, buffer->iov, buffer->n_iov, 0, -1);
+    sink->bytes_written += buffer->iov_bytes;
+    buffer->len = 0;
+    buffer->iov_start = 0;
+    buffer->n_iov = 0;
+    buffer->iov_bytes = 0;
+}
+
+static char* alloc_buffer(void) {
+#ifdef _WIN32
+    return _aligned_malloc(OUTPUT_BUFFER_SIZE, OUTPUT_BUFFER_ALIGNMENT);
+#else
+    void* data = NULL;
+    return posix_memalign(&data, OUTPUT_BUFFER_ALIGNMENT, OUTPUT_BUFFER_SIZE) == 0 ? data : NULL;
+#endif
+}
+
+// offset >= 0 keeps the file up to offset and writes from there
+static bool open_sink(OutputSink* sink, const char* path, bool use_io_uring, int64_t offset) {
+    memset(sink, 0, sizeof(OutputSink));
+
+    if (strcmp(path, "-") == 0) {
+        sink->fd = 1;
+#ifdef _WIN32
+        _setmode(1, _O_BINARY);
+#endif
+    }
+    else {
+#ifdef _WIN32
+        sink->fd = _open(path, _O_WRONLY | _O_CREAT | (offset < 0 ? _O_TRUNC : 0) | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        sink->fd = open(path, O_WRONLY | O_CREAT | (offset < 0 ? O_TRUNC : 0), 0666);
+#endif
+        if (sink->fd < 0) {
+            return false;
+        }
+        sink->close_fd = true;
+    }
+
+    if (offset >= 0) {
+#ifdef _WIN32
+        bool positioned = _chsize_s(sink->fd, offset) == 0 && _lseeki64(sink->fd, offset, SEEK_SET) == offset;
+#else
+        bool positioned = ftruncate(sink->fd, offset) == 0 && lseek(sink->fd, offset, SEEK_SET) == offset;
+#endif
+        if (!positioned) {
+            if (sink->close_fd) {
+#ifdef _WIN32
+                _close(sink->fd);
+#else
+                close(sink->fd);
+#endif
+            }
+            return false;
+        }
+        sink->bytes_written = offset;
+    }
+
+    sink->n_buffers = 1;
+#ifdef HAVE_IO_URING
+    struct stat st;
+    off_t position = lseek(sink->fd, 0, SEEK_CUR);
+    if (use_io_uring && fstat(sink->fd, &st) == 0 && S_ISREG(st.st_mode) && position >= 0) {
+        sink->ring = ring_open(OUTPUT_MAX_BUFFERS);
+        if (sink->ring) {
+            sink->n_buffers = OUTPUT_MAX_BUFFERS;
+            sink->offset = position;
+        }
+        else {
+            fprintf(stderr, "Warning: io_uring is not available (%s), using writev\n", strerror(errno));
+        }
+    }
+#else
+    if (use_io_uring) {
+        fprintf(stderr, "Warning: io_uring is not supported on this platform, using writev\n");
+    }
+#endif
+
+    for (int i = 0; i < sink->n_buffers; i++) {
+        sink->buffers[i].data = alloc_buffer();
+        if (!sink->buffers[i].data) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
+        }
+    }
+    return true;
+}
+
+bool output_sink_open(OutputSink* sink, const char* path, bool use_io_uring) {
+    return open_sink(sink, path, use_io_uring, -1);
+}
+
+bool output_sink_open_at(OutputSink* sink, const char* path, uint64_t offset, bool use_io_uring) {
+    return open_sink(sink, path, use_io_uring, (int64_t)offset);
+}
+
+void output_sink_write(OutputSink* sink, const void* data, size_t len) {
+    const char* ptr = data;
+
+    while (len > 0) {
+        OutputBuffer* buffer = &sink->buffers[sink->current];
+        size_t space = OUTPUT_BUFFER_SIZE - buffer->len;
+
+        if (space == 0) {
+            submit_buffer(sink);
+            continue;
+        }
+        if (space > len) {
+            space = len;
+        }
+        memcpy(buffer->data + buffer->len, ptr, space);
+        buffer->len += space;
+        ptr += space;
+        len -= space;
+    }
+}
+
+void output_sink_puts(OutputSink* sink, const char* str) {
+    output_sink_write(sink, str, strlen(str));
+}
+
+void output_sink_write_ref(OutputSink* sink, const void* data, size_t len) {
+    if (len < OUTPUT_MIN_REF_LEN) {
+        output_sink_write(sink, data, len);
+        return;
+    }
+
+    OutputBuffer* buffer = &sink->buffers[sink->current];
+    if (buffer->n_iov + 2 > OUTPUT_MAX_IOVECS) {
+        submit_buffer(sink);
+        buffer = &sink->buffers[sink->current];
+    }
+
+    // Whatever was copied into the buffer so far goes first
+    if (buffer->len > buffer->iov_start) {
+        add_iovec(buffer, buffer->data + buffer->iov_start, buffer->len - buffer->iov_start);
+        buffer->iov_start = buffer->len;
+    }
+    add_iovec(buffer, data, len);
+
+    if (buffer->iov_bytes >= OUTPUT_BUFFER_SIZE) {
+        submit_buffer(sink);
+    }
+}
+
+// Waits for the buffers handed to io_uring
+static void wait_in_flight(OutputSink* sink) {
+#ifdef HAVE_IO_URING
+    if (sink->ring) {
+        for (int i = 0; i < sink->n_buffers; i++) {
+            while (sink->buffers[i].in_flight) {
+                ring_wait(sink);
+            }
+        }
+    }
+#else
+    (void)sink;
+#endif
+}
+
+void output_sink_sync(OutputSink* sink) {
+    submit_buffer(sink);
+    wait_in_flight(sink);
+
+#ifdef _WIN32
+    int result = _commit(sink->fd);
+#else
+    int result = fdatasync(sink->fd);
+#endif
+    // Pipes and terminals have nothing to sync
+    if (result != 0 && errno != EINVAL && errno != EROFS) {
+        output_error();
+    }
+}
+
+void output_sink_close(OutputSink* sink) {
+    submit_buffer(sink);
+    wait_in_flight(sink);
+
+#ifdef HAVE_IO_URING
+    if (sink->ring) {
+        ring_close(sink->ring);
+        sink->ring = NULL;
+    }
+#endif
+
+    for (int i = 0; i < sink->n_buffers; i++) {
+#ifdef _WIN32
+        _aligned_free(sink->buffers[i].data);
+#else
+        free(sink->buffers[i].data);
+#endif
+        sink->buffers[i].data = NULL;
+    }
+
+    if (sink->close_fd) {
+#ifdef _WIN32
+        int result = _close(sink->fd);
+#else
+        int result = close(sink->fd);
+#endif
+        if (result != 0) {
+            output_error();
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef INSERT_TO_COPY_OUTPUT_H
+#define INSERT_TO_COPY_OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
+// Output sink shared by the insert_to_copy converters.
+//
+// Output is collected in large aligned buffers and handed to the kernel a whole
+// buffer at a time with writev, instead of going through stdio. Data that stays
+// valid until the sink is closed (like a memory-mapped input file) can be queued
+// by reference, so long passthrough statements are written straight from the
+// input without being copied.
+//
+// With the io_uring backend (Linux, --io-uring) several buffers are in flight at
+// once, so formatting the next buffer overlaps with writing the previous ones.
+// It is only used for regular files, and the sink falls back to writev when the
+// kernel doesn't allow it.
+
+#define OUTPUT_BUFFER_SIZE (4 * 1024 * 1024)
+#define OUTPUT_MAX_IOVECS 256
+#define OUTPUT_MAX_BUFFERS 4
+
+typedef struct {
+    char* data;                        // OUTPUT_BUFFER_SIZE bytes, page aligned
+    size_t len;                        // Bytes used in data
+    size_t iov_start;                  // Start of the bytes in data not yet added to iov
+    struct iovec iov[OUTPUT_MAX_IOVECS];
+    int n_iov;
+    size_t iov_bytes;                  // Total length of iov
+    bool in_flight;
+} OutputBuffer;
+
+typedef struct OutputRing OutputRing;
+
+typedef struct {
+    int fd;
+    bool close_fd;
+    OutputBuffer buffers[OUTPUT_MAX_BUFFERS];
+    int n_buffers;                     // 1 with writev, OUTPUT_MAX_BUFFERS with io_uring
+    int current;
+    uint64_t offset;                   // File offset of the next write (io_uring)
+    uint64_t bytes_written;            // Everything submitted so far
+    OutputRing* ring;                  // NULL with writev
+} OutputSink;
+
+// Opens path for writing ("-" for stdout). Returns false with errno set on failure.
+bool output_sink_open(OutputSink* sink, const char* path, bool use_io_uring);
+// Opens path to continue writing at offset, dropping what the file has beyond it
+bool output_sink_open_at(OutputSink* sink, const char* path, uint64_t offset, bool use_io_uring);
+// Copies data into the current buffer
+void output_sink_write(OutputSink* sink, const void* data, size_t len);
+void output_sink_puts(OutputSink* sink, const char* str);
+// Queues data by reference, it has to stay valid and unchanged until the sink is closed
+void output_sink_write_ref(OutputSink* sink, const void* data, size_t len);
+// Writes everything queued and waits until it is on disk, bytes_written is then the file size
+void output_sink_sync(OutputSink* sink);
+// Writes everything queued, waits for it and closes the file
+void output_sink_close(OutputSink* sink);
+
+static inline void output_sink_putc(OutputSink* sink, char c) {
+    OutputBuffer* buffer = &sink->buffers[sink->current];
+    if (buffer->len < OUTPUT_BUFFER_SIZE) {
+        buffer->data[buffer->len++] = c;
+    }
+    else {
+        output_sink_write(sink, &c, 1);
+    }
+}
+
+#endif
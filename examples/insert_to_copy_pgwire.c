@@ -0,0 +1,584 @@
+#include "insert_to_copy_pgwire.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define PGWIRE_PROTOCOL_VERSION 196608           // 3.0
+#define PGWIRE_BUFFER_SIZE (256 * 1024)          // Outgoing bytes gathered before writing
+#define PGWIRE_MAX_COPY_DATA (1024 * 1024)       // Largest CopyData frame sent
+#define PGWIRE_DIRECT_SEND (64 * 1024)           // CopyData payloads sent from the caller's memory
+#define PGWIRE_READ_SIZE (64 * 1024)
+
+typedef struct {
+    char* host;
+    char* port;
+    char* user;
+    char* dbname;
+    char* password;
+} ConnInfo;
+
+static void* pgwire_realloc(void* ptr, size_t size) {
+    void* result = realloc(ptr, size);
+    if (!result) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    return result;
+}
+
+static char* pgwire_strdup(const char* str) {
+    return str ? strcpy(pgwire_realloc(NULL, strlen(str) + 1), str) : NULL;
+}
+
+// Parses "keyword=value keyword='quoted value'", like libpq's conninfo strings
+static bool parse_conninfo(const char* conninfo, ConnInfo* info) {
+    const char* ptr = conninfo;
+
+    for (;;) {
+        while (isspace((unsigned char)*ptr)) {
+            ptr++;
+        }
+        if (*ptr == '\0') {
+            return true;
+        }
+
+        const char* key = ptr;
+        while (*ptr && *ptr != '=' && !isspace((unsigned char)*ptr)) {
+            ptr++;
+        }
+        size_t key_len = ptr - key;
+        while (isspace((unsigned char)*ptr)) {
+            ptr++;
+        }
+        if (*ptr != '=') {
+            fprintf(stderr, "Error: missing \"=\" after \"%.*s\" in connection string\n", (int)key_len, key);
+            return false;
+        }
+        ptr++;
+        while (isspace((unsigned char)*ptr)) {
+            ptr++;
+        }
+
+        char* value = pgwire_realloc(NULL, strlen(ptr) + 1);
+        size_t len = 0;
+        if (*ptr == '\'') {
+            for (ptr++; *ptr && *ptr != '\''; ptr++) {
+                if (*ptr == '\\' && ptr[1]) {
+                    ptr++;
+                }
+                value[len++] = *ptr;
+            }
+            if (*ptr != '\'') {
+                fprintf(stderr, "Error: unterminated quoted string in connection string\n");
+                free(value);
+                return false;
+            }
+            ptr++;
+        }
+        else {
+            for (; *ptr && !isspace((unsigned char)*ptr); ptr++) {
+                if (*ptr == '\\' && ptr[1]) {
+                    ptr++;
+                }
+                value[len++] = *ptr;
+            }
+        }
+        value[len] = '\0';
+
+        char** field = NULL;
+        if (key_len == 4 && strncmp(key, "host", 4) == 0) {
+            field = &info->host;
+        }
+        else if (key_len == 4 && strncmp(key, "port", 4) == 0) {
+            field = &info->port;
+        }
+        else if (key_len == 4 && strncmp(key, "user", 4) == 0) {
+            field = &info->user;
+        }
+        else if (key_len == 6 && strncmp(key, "dbname", 6) == 0) {
+            field = &info->dbname;
+        }
+        else if (key_len == 8 && strncmp(key, "password", 8) == 0) {
+            field = &info->password;
+        }
+        else {
+            fprintf(stderr, "Error: invalid connection option \"%.*s\"\n", (int)key_len, key);
+            free(value);
+            return false;
+        }
+        free(*field);
+        *field = value;
+    }
+}
+
+static void free_conninfo(ConnInfo* info) {
+    free(info->host);
+    free(info->port);
+    free(info->user);
+    free(info->dbname);
+    free(info->password);
+}
+
+static int open_socket(const ConnInfo* info) {
+    int fd = -1;
+
+    if (info->host[0] == '/') {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if ((size_t)snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/.s.PGSQL.%s", info->host, info->port) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Error: Unix socket path \"%s/.s.PGSQL.%s\" is too long\n", info->host, info->port);
+            return -1;
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            fprintf(stderr, "Error: could not connect to server on socket \"%s\": %s\n", addr.sun_path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    else {
+        struct addrinfo hints;
+        struct addrinfo* addrs;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        int rc = getaddrinfo(info->host, info->port, &hints, &addrs);
+        if (rc != 0) {
+            fprintf(stderr, "Error: could not resolve host \"%s\": %s\n", info->host, gai_strerror(rc));
+            return -1;
+        }
+        for (struct addrinfo* addr = addrs; addr; addr = addr->ai_next) {
+            fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+            if (fd >= 0 && connect(fd, addr->ai_addr, addr->ai_addrlen) == 0) {
+                break;
+            }
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addrs);
+        if (fd < 0) {
+            fprintf(stderr, "Error: could not connect to server at \"%s\", port %s: %s\n", info->host, info->port, strerror(errno));
+            return -1;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    if (fd < 0) {
+        perror("Error creating socket");
+        return -1;
+    }
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static void out_reserve(PgWire* wire, size_t len) {
+    if (wire->out_len + len > wire->out_capacity) {
+        size_t capacity = wire->out_capacity ? wire->out_capacity : PGWIRE_BUFFER_SIZE;
+        while (wire->out_len + len > capacity) {
+            capacity *= 2;
+        }
+        wire->out = pgwire_realloc(wire->out, capacity);
+        wire->out_capacity = capacity;
+    }
+}
+
+static void put_bytes(PgWire* wire, const void* data, size_t len) {
+    out_reserve(wire, len);
+    memcpy(wire->out + wire->out_len, data, len);
+    wire->out_len += len;
+}
+
+static void put_int32(PgWire* wire, uint32_t value) {
+    unsigned char bytes[4] = { value >> 24, value >> 16, value >> 8, value };
+    put_bytes(wire, bytes, 4);
+}
+
+static void put_string(PgWire* wire, const char* str) {
+    put_bytes(wire, str, strlen(str) + 1);
+}
+
+// Starts a message, type 0 for the startup message which has no type byte
+static void begin_message(PgWire* wire, char type) {
+    if (type) {
+        put_bytes(wire, &type, 1);
+    }
+    wire->message_start = wire->out_len;
+    put_int32(wire, 0);
+}
+
+static void end_message(PgWire* wire) {
+    uint32_t len = (uint32_t)(wire->out_len - wire->message_start);
+    unsigned char* ptr = (unsigned char*)wire->out + wire->message_start;
+    ptr[0] = len >> 24;
+    ptr[1] = len >> 16;
+    ptr[2] = len >> 8;
+    ptr[3] = len;
+}
+
+static uint32_t get_int32(const char* ptr) {
+    const unsigned char* bytes = (const unsigned char*)ptr;
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+// Prints an ErrorResponse or NoticeResponse the way psql does ("ERROR:  message")
+static void print_server_message(const char* fields, size_t len) {
+    const char* severity = "ERROR";
+    const char* message = "";
+    const char* detail = NULL;
+    const char* hint = NULL;
+    const char* end = fields + len;
+
+    while (fields < end && *fields) {
+        char type = *fields++;
+        const char* value = fields;
+        fields += strnlen(fields, end - fields) + 1;
+        switch (type) {
+        case 'S': severity = value; break;
+        case 'M': message = value; break;
+        case 'D': detail = value; break;
+        case 'H': hint = value; break;
+        default: break;
+        }
+    }
+
+    fprintf(stderr, "%s:  %s\n", severity, message);
+    if (detail) {
+        fprintf(stderr, "DETAIL:  %s\n", detail);
+    }
+    if (hint) {
+        fprintf(stderr, "HINT:  %s\n", hint);
+    }
+}
+
+static void handle_message(PgWire* wire, char type, const char* payload, size_t len, const char* password) {
+    switch (type) {
+    case 'R':   // Authentication request
+        if (len >= 4 && get_int32(payload) == 0) {
+            break;
+        }
+        if (len >= 4 && get_int32(payload) == 3 && password) {
+            begin_message(wire, 'p');
+            put_string(wire, password);
+            end_message(wire);
+            break;
+        }
+        if (len >= 4 && get_int32(payload) == 3) {
+            fprintf(stderr, "Error: the server requested a password but none was given\n");
+        }
+        else {
+            fprintf(stderr, "Error: authentication method %u is not supported, use trust, peer or password authentication\n", len >= 4 ? get_int32(payload) : 0);
+        }
+        wire->failed = true;
+        break;
+    case 'E':   // ErrorResponse
+        print_server_message(payload, len);
+        wire->n_errors++;
+        if (!wire->startup_done) {
+            wire->failed = true;
+        }
+        break;
+    case 'N':   // NoticeResponse
+        print_server_message(payload, len);
+        break;
+    case 'Z':   // ReadyForQuery
+        if (wire->startup_done) {
+            wire->queries_done++;
+        }
+        wire->startup_done = true;
+        break;
+    default:
+        // CommandComplete, CopyInResponse, ParameterStatus, BackendKeyData, ...
+        break;
+    }
+}
+
+// Reads what the server has sent and handles the complete messages. Returns false
+// when the connection is closed.
+static bool read_incoming(PgWire* wire, const char* password) {
+    for (;;) {
+        if (wire->in_len + PGWIRE_READ_SIZE > wire->in_capacity) {
+            wire->in_capacity = wire->in_len + PGWIRE_READ_SIZE;
+            wire->in = pgwire_realloc(wire->in, wire->in_capacity);
+        }
+        ssize_t n = recv(wire->fd, wire->in + wire->in_len, wire->in_capacity - wire->in_len, 0);
+        if (n == 0) {
+            return false;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        wire->in_len += n;
+
+        size_t pos = 0;
+        while (wire->in_len - pos >= 5) {
+            size_t len = get_int32(wire->in + pos + 1);
+            if (wire->in_len - pos < 1 + len) {
+                break;
+            }
+            handle_message(wire, wire->in[pos], wire->in + pos + 5, len - 4, password);
+            pos += 1 + len;
+        }
+        memmove(wire->in, wire->in + pos, wire->in_len - pos);
+        wire->in_len -= pos;
+    }
+}
+
+static void connection_lost(void) {
+    fprintf(stderr, "Error: the server closed the connection unexpectedly\n");
+    exit(1);
+}
+
+// Waits until the socket is writable (or readable when want_write is false),
+// handling the server's messages meanwhile
+static void wait_socket(PgWire* wire, bool want_write) {
+    struct pollfd pfd;
+    pfd.fd = wire->fd;
+    pfd.events = POLLIN | (want_write ? POLLOUT : 0);
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, -1) < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+        perror("Error waiting for the server");
+        exit(1);
+    }
+    if ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) && !read_incoming(wire, NULL)) {
+        connection_lost();
+    }
+}
+
+// Writes data to the socket, waiting while it is full
+static void send_all(PgWire* wire, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(wire->fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                wait_socket(wire, true);
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EPIPE || errno == ECONNRESET) {
+                connection_lost();
+            }
+            perror("Error writing to the server");
+            exit(1);
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static void flush_out(PgWire* wire) {
+    // Answers that piled up are read first, so the server never blocks on them
+    if (!read_incoming(wire, NULL)) {
+        connection_lost();
+    }
+    send_all(wire, wire->out, wire->out_len);
+    wire->out_len = 0;
+}
+
+static void message_done(PgWire* wire) {
+    end_message(wire);
+    if (wire->out_len >= PGWIRE_BUFFER_SIZE) {
+        flush_out(wire);
+    }
+}
+
+bool pgwire_connect(PgWire* wire, const char* conninfo) {
+    ConnInfo info = { 0 };
+    memset(wire, 0, sizeof(PgWire));
+    wire->fd = -1;
+
+    if (!parse_conninfo(conninfo, &info)) {
+        free_conninfo(&info);
+        return false;
+    }
+    if (!info.host) {
+        info.host = pgwire_strdup(getenv("PGHOST") ? getenv("PGHOST") : "/tmp");
+    }
+    if (!info.port) {
+        info.port = pgwire_strdup(getenv("PGPORT") ? getenv("PGPORT") : "5432");
+    }
+    if (!info.user) {
+        struct passwd* pw = getpwuid(geteuid());
+        info.user = pgwire_strdup(getenv("PGUSER") ? getenv("PGUSER") : pw ? pw->pw_name : "postgres");
+    }
+    if (!info.dbname) {
+        info.dbname = pgwire_strdup(getenv("PGDATABASE") ? getenv("PGDATABASE") : info.user);
+    }
+    if (!info.password) {
+        info.password = pgwire_strdup(getenv("PGPASSWORD"));
+    }
+
+    wire->fd = open_socket(&info);
+    if (wire->fd < 0) {
+        free_conninfo(&info);
+        return false;
+    }
+
+    begin_message(wire, 0);
+    put_int32(wire, PGWIRE_PROTOCOL_VERSION);
+    put_string(wire, "user");
+    put_string(wire, info.user);
+    put_string(wire, "database");
+    put_string(wire, info.dbname);
+    put_string(wire, "application_name");
+    put_string(wire, "insert_to_copy");
+    put_bytes(wire, "", 1);
+    end_message(wire);
+
+    // Authentication and session setup, until the first ReadyForQuery
+    while (!wire->startup_done && !wire->failed) {
+        if (wire->out_len > 0) {
+            send_all(wire, wire->out, wire->out_len);
+            wire->out_len = 0;
+        }
+        struct pollfd pfd = { wire->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+            perror("Error waiting for the server");
+            wire->failed = true;
+        }
+        else if (pfd.revents && !read_incoming(wire, info.password)) {
+            if (!wire->failed) {
+                fprintf(stderr, "Error: the server closed the connection unexpectedly\n");
+            }
+            wire->failed = true;
+        }
+    }
+    free_conninfo(&info);
+
+    if (wire->failed) {
+        close(wire->fd);
+        free(wire->out);
+        free(wire->in);
+        return false;
+    }
+    wire->n_errors = 0;
+    return true;
+}
+
+void pgwire_begin_query(PgWire* wire) {
+    begin_message(wire, 'Q');
+}
+
+void pgwire_append(PgWire* wire, const void* data, size_t len) {
+    put_bytes(wire, data, len);
+}
+
+void pgwire_end_query(PgWire* wire) {
+    put_bytes(wire, "", 1);
+    wire->queries_sent++;
+    message_done(wire);
+}
+
+void pgwire_query(PgWire* wire, const char* sql, size_t len) {
+    pgwire_begin_query(wire);
+    pgwire_append(wire, sql, len);
+    pgwire_end_query(wire);
+}
+
+void pgwire_copy_data(PgWire* wire, const void* data, size_t len) {
+    const char* ptr = data;
+
+    while (len > 0) {
+        size_t chunk = len < PGWIRE_MAX_COPY_DATA ? len : PGWIRE_MAX_COPY_DATA;
+
+        begin_message(wire, 'd');
+        if (chunk < PGWIRE_DIRECT_SEND) {
+            put_bytes(wire, ptr, chunk);
+            message_done(wire);
+        }
+        else {
+            // Large payloads go to the socket straight from the conversion buffer
+            wire->out_len += chunk;
+            end_message(wire);
+            wire->out_len -= chunk;
+            flush_out(wire);
+            send_all(wire, ptr, chunk);
+        }
+        ptr += chunk;
+        len -= chunk;
+    }
+}
+
+void pgwire_copy_done(PgWire* wire) {
+    begin_message(wire, 'c');
+    message_done(wire);
+}
+
+bool pgwire_finish(PgWire* wire) {
+    flush_out(wire);
+    while (wire->queries_done < wire->queries_sent) {
+        wait_socket(wire, false);
+    }
+
+    // Terminate, then wait for the server to close its side
+    begin_message(wire, 'X');
+    end_message(wire);
+    send_all(wire, wire->out, wire->out_len);
+    wire->out_len = 0;
+    shutdown(wire->fd, SHUT_WR);
+    for (;;) {
+        struct pollfd pfd = { wire->fd, POLLIN, 0 };
+        if ((poll(&pfd, 1, -1) < 0 && errno != EINTR) || (pfd.revents && !read_incoming(wire, NULL))) {
+            break;
+        }
+    }
+
+    close(wire->fd);
+    free(wire->out);
+    free(wire->in);
+    return wire->n_errors == 0;
+}
+
+#else
+
+bool pgwire_connect(PgWire* wire, const char* conninfo) {
+    (void)conninfo;
+    memset(wire, 0, sizeof(PgWire));
+    fprintf(stderr, "Error: --connect is not supported on Windows\n");
+    return false;
+}
+
+void pgwire_begin_query(PgWire* wire) { (void)wire; }
+void pgwire_append(PgWire* wire, const void* data, size_t len) { (void)wire; (void)data; (void)len; }
+void pgwire_end_query(PgWire* wire) { (void)wire; }
+void pgwire_query(PgWire* wire, const char* sql, size_t len) { (void)wire; (void)sql; (void)len; }
+void pgwire_copy_data(PgWire* wire, const void* data, size_t len) { (void)wire; (void)data; (void)len; }
+void pgwire_copy_done(PgWire* wire) { (void)wire; }
+bool pgwire_finish(PgWire* wire) { (void)wire; return false; }
+
+#endif
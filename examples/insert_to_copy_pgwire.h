@@ -0,0 +1,64 @@
+#ifndef INSERT_TO_COPY_PGWIRE_H
+#define INSERT_TO_COPY_PGWIRE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Minimal PostgreSQL frontend/backend protocol (v3) client, so insert_to_copy can
+// load a dump straight into a server instead of writing a script for psql.
+//
+// Statements are sent as simple Query messages and rows as CopyData frames,
+// pipelined without waiting for the server's answers: the server executes the
+// messages in order, and ignores CopyData / CopyDone that arrive after a COPY
+// command failed. Outgoing messages are gathered in a buffer and written to the
+// non-blocking socket as it becomes writable, and the server's answers are read
+// in the meantime, so a slow server slows the conversion down instead of the
+// buffer growing without limit. Errors and notices are printed as they arrive,
+// and like psql without ON_ERROR_STOP the load carries on after an error.
+//
+// Only trust/peer and cleartext password authentication are supported.
+
+typedef struct {
+    int fd;
+
+    // Outgoing messages not written to the socket yet
+    char* out;
+    size_t out_len;
+    size_t out_capacity;
+    size_t message_start;    // Start of the message being built
+
+    // Incoming data not processed yet
+    char* in;
+    size_t in_len;
+    size_t in_capacity;
+
+    uint64_t queries_sent;
+    uint64_t queries_done;   // ReadyForQuery messages received
+    int n_errors;
+    bool startup_done;
+    bool failed;             // Fatal error, the connection is unusable
+} PgWire;
+
+// Connects according to a libpq style "keyword=value ..." string (host, port,
+// user, dbname, password), falling back to PGHOST, PGPORT, PGUSER, PGDATABASE and
+// PGPASSWORD. A host starting with "/" is the directory of the Unix socket.
+// Prints the reason and returns false on failure.
+bool pgwire_connect(PgWire* wire, const char* conninfo);
+
+// Simple query with the statement text, which is built with pgwire_append
+void pgwire_begin_query(PgWire* wire);
+void pgwire_append(PgWire* wire, const void* data, size_t len);
+void pgwire_end_query(PgWire* wire);
+void pgwire_query(PgWire* wire, const char* sql, size_t len);
+
+// Data for the COPY ... FROM STDIN started by the previous query. The data has
+// been copied or sent when this returns.
+void pgwire_copy_data(PgWire* wire, const void* data, size_t len);
+void pgwire_copy_done(PgWire* wire);
+
+// Waits for the server to finish all queries and closes the connection. Returns
+// false if any of them failed.
+bool pgwire_finish(PgWire* wire);
+
+#endif
@@ -0,0 +1,651 @@
+#include "insert_to_copy_reorder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define fseeko _fseeki64
+#define strncasecmp _strnicmp
+#else
+#include <strings.h>
+#endif
+
+#define REORDER_SPILL_BUFFER (1024 * 1024)
+
+// A column list of a relation's COPY commands
+struct ReorderColumnList {
+    char* list;                        // " (a, b)" or "", as in insert_to_copy
+    bool has_default;                  // Rows with DEFAULT values, the COPY command has the DEFAULT option
+    char* options;                     // Options of a "COPY ... FROM stdin" of the input, or NULL
+};
+
+struct ReorderRelation {
+    char* name;
+    bool created;                      // CREATE TABLE in the open transaction, COPY FREEZE is allowed
+    int stream;                        // Stream new data goes to, -1 when a new one is needed
+    int last_reference;                // Last statement of the open transaction that refers to it, or -1
+    ReorderRelation* owner;            // The first relation it was mentioned together with: for a
+                                       // sequence, the table whose data its setval goes with
+    ReorderColumnList** column_lists;
+    int n_column_lists;
+    ReorderRelation* next;             // Hash chain
+    ReorderRelation* next_all;
+};
+
+struct ReorderStream {
+    ReorderRelation* relation;
+    int anchor;                        // Written after this pre-data statement, -1 after all of them
+    int first_extent;
+    int last_extent;
+};
+
+// A piece of the spill file: rows for COPY, or a statement (column_list NULL)
+struct ReorderExtent {
+    long long offset;
+    size_t len;
+    const ReorderColumnList* column_list;
+    int next;
+};
+
+static void* reorder_realloc(void* ptr, size_t size) {
+    void* result = realloc(ptr, size);
+    if (!result) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    return result;
+}
+
+static char* reorder_strdup(const char* str) {
+    char* copy = reorder_realloc(NULL, strlen(str) + 1);
+    strcpy(copy, str);
+    return copy;
+}
+
+static unsigned int hash_relation(const char* relation) {
+    unsigned int hash = 5381;
+    int c;
+    while ((c = (unsigned char)*relation++))
+        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+    return hash % REORDER_HASH_SIZE;
+}
+
+static ReorderRelation* find_relation(ReorderOutput* output, const char* name) {
+    unsigned int bucket = hash_relation(name);
+    ReorderRelation* relation;
+
+    for (relation = output->relation_hash[bucket]; relation; relation = relation->next) {
+        if (strcmp(relation->name, name) == 0) {
+            return relation;
+        }
+    }
+
+    relation = reorder_realloc(NULL, sizeof(ReorderRelation));
+    memset(relation, 0, sizeof(ReorderRelation));
+    relation->name = reorder_strdup(name);
+    relation->stream = -1;
+    relation->last_reference = -1;
+    relation->next = output->relation_hash[bucket];
+    output->relation_hash[bucket] = relation;
+    relation->next_all = output->relations;
+    output->relations = relation;
+    return relation;
+}
+
+static const ReorderColumnList* add_column_list(ReorderRelation* relation, char* list, bool has_default, char* options) {
+    ReorderColumnList* column_list = reorder_realloc(NULL, sizeof(ReorderColumnList));
+    column_list->list = list;
+    column_list->has_default = has_default;
+    column_list->options = options;
+    relation->column_lists = reorder_realloc(relation->column_lists, sizeof(ReorderColumnList*) * (relation->n_column_lists + 1));
+    relation->column_lists[relation->n_column_lists++] = column_list;
+    return column_list;
+}
+
+// The column list of the INSERT, from those the relation has had so far
+static const ReorderColumnList* find_column_list(ReorderRelation* relation, const PgQueryInsertToCopyResult* result) {
+    for (int i = 0; i < relation->n_column_lists; i++) {
+        const char* ptr = relation->column_lists[i]->list;
+        bool same = relation->column_lists[i]->has_default == (result->has_default != 0) && !relation->column_lists[i]->options;
+
+        for (int j = 0; same && j < result->n_columns; j++) {
+            size_t len = strlen(result->columns[j]);
+            same = strncmp(ptr, j == 0 ? " (" : ", ", 2) == 0 && strncmp(ptr + 2, result->columns[j], len) == 0;
+            ptr += same ? 2 + len : 0;
+        }
+        if (same && strcmp(ptr, result->n_columns > 0 ? ")" : "") == 0) {
+            return relation->column_lists[i];
+        }
+    }
+
+    size_t len = 1;
+    for (int i = 0; i < result->n_columns; i++) {
+        len += strlen(result->columns[i]) + 4;
+    }
+    char* list = reorder_realloc(NULL, len);
+    char* ptr = list;
+    for (int i = 0; i < result->n_columns; i++) {
+        ptr += sprintf(ptr, "%s%s", i == 0 ? " (" : ", ", result->columns[i]);
+    }
+    if (result->n_columns > 0) {
+        *ptr++ = ')';
+    }
+    *ptr = '\0';
+
+    return add_column_list(relation, list, result->has_default != 0, NULL);
+}
+
+static bool is_word_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '$' || (unsigned char)c >= 0x80;
+}
+
+static const char* skip_word(const char* ptr, const char* end, const char* word) {
+    size_t len = strlen(word);
+    ptr = statement_skip_comments(ptr, end);
+    if ((size_t)(end - ptr) < len || strncasecmp(ptr, word, len) != 0 || (ptr + len < end && is_word_char(ptr[len]))) {
+        return NULL;
+    }
+    return ptr + len;
+}
+
+// Past the plain or double-quoted name at ptr
+static const char* skip_name(const char* ptr, const char* end) {
+    if (ptr < end && *ptr == '"') {
+        for (ptr++; ptr < end; ptr++) {
+            if (*ptr == '"' && !(ptr + 1 < end && ptr[1] == '"')) {
+                return ptr + 1;
+            }
+            ptr += *ptr == '"';
+        }
+        return NULL;
+    }
+    const char* start = ptr;
+    while (ptr < end && is_word_char(*ptr)) {
+        ptr++;
+    }
+    return ptr > start ? ptr : NULL;
+}
+
+// The column list and options of "COPY relation [(columns)] FROM stdin [options];"
+// as written, without comments in between. Returns false for anything else.
+static bool parse_copy_command(StatementSlice statement, const char** columns, size_t* columns_len, const char** options, size_t* options_len) {
+    const char* end = statement.data + statement.len;
+    const char* ptr = skip_word(statement.data, end, "COPY");
+
+    while (end > statement.data && end[-1] != ';') {
+        end--;
+    }
+    if (!ptr || end == statement.data) {
+        return false;
+    }
+    end--;
+
+    // [schema.]table
+    for (;;) {
+        ptr = skip_name(statement_skip_comments(ptr, end), end);
+        if (!ptr || ptr == end || *ptr != '.') {
+            break;
+        }
+        ptr++;
+    }
+    if (!ptr) {
+        return false;
+    }
+
+    ptr = statement_skip_comments(ptr, end);
+    *columns = ptr;
+    *columns_len = 0;
+    if (ptr < end && *ptr == '(') {
+        for (ptr++; ptr < end && *ptr != ')';) {
+            if (*ptr == ',' || *ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r') {
+                ptr++;
+            }
+            else if (!(ptr = skip_name(ptr, end))) {
+                return false;
+            }
+        }
+        if (ptr == end) {
+            return false;
+        }
+        *columns_len = ++ptr - *columns;
+    }
+
+    ptr = skip_word(ptr, end, "FROM");
+    ptr = ptr ? skip_word(ptr, end, "stdin") : NULL;
+    if (!ptr) {
+        return false;
+    }
+    while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r')) {
+        ptr++;
+    }
+    while (end > ptr && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r')) {
+        end--;
+    }
+    *options = ptr;
+    *options_len = end - ptr;
+    return true;
+}
+
+// The column list and options of a "COPY ... FROM stdin" from the input
+static const ReorderColumnList* find_copy_column_list(ReorderRelation* relation, const char* columns, size_t columns_len, const char* options, size_t options_len) {
+    char* list = reorder_realloc(NULL, columns_len + 2);
+    list[0] = '\0';
+    if (columns_len > 0) {
+        list[0] = ' ';
+        memcpy(list + 1, columns, columns_len);
+        list[columns_len + 1] = '\0';
+    }
+
+    for (int i = 0; i < relation->n_column_lists; i++) {
+        const ReorderColumnList* column_list = relation->column_lists[i];
+        if (!column_list->has_default && strcmp(column_list->list, list) == 0 &&
+            (column_list->options ? strlen(column_list->options) == options_len + 1 && strncmp(column_list->options + 1, options, options_len) == 0 : options_len == 0)) {
+            free(list);
+            return column_list;
+        }
+    }
+
+    char* copy_options = NULL;
+    if (options_len > 0) {
+        copy_options = reorder_realloc(NULL, options_len + 2);
+        copy_options[0] = ' ';
+        memcpy(copy_options + 1, options, options_len);
+        copy_options[options_len + 1] = '\0';
+    }
+    return add_column_list(relation, list, false, copy_options);
+}
+
+static void statements_append(ReorderStatements* statements, const char* data, size_t len) {
+    if (statements->count == statements->capacity) {
+        statements->capacity = statements->capacity ? statements->capacity * 2 : 64;
+        statements->ends = reorder_realloc(statements->ends, sizeof(size_t) * statements->capacity);
+    }
+    byte_buffer_append(&statements->text, data, len);
+    statements->ends[statements->count++] = statements->text.len;
+}
+
+static void write_text(ReorderOutput* output, const char* data, size_t len) {
+    if (len > 0) {
+        output->writer.statement(output->writer.context, data, len);
+        output->line_start = data[len - 1] == '\n';
+    }
+}
+
+// Writes a statement that has been moved, with one empty line before it
+static void write_moved(ReorderOutput* output, const char* data, size_t len) {
+    while (len > 0 && (*data == '\n' || *data == '\r' || *data == ' ' || *data == '\t')) {
+        data++;
+        len--;
+    }
+    if (len > 0) {
+        write_text(output, "\n\n", output->line_start ? 1 : 2);
+        write_text(output, data, len);
+    }
+}
+
+static void statements_write(ReorderOutput* output, const ReorderStatements* statements, int index) {
+    size_t start = index > 0 ? statements->ends[index - 1] : 0;
+    write_moved(output, statements->text.data + start, statements->ends[index] - start);
+}
+
+static void statements_clear(ReorderStatements* statements) {
+    statements->text.len = 0;
+    statements->count = 0;
+}
+
+static void statements_free(ReorderStatements* statements) {
+    byte_buffer_free(&statements->text);
+    free(statements->ends);
+}
+
+// The stream a table's data goes to now, started after the statements that refer to the table
+static ReorderStream* current_stream(ReorderOutput* output, ReorderRelation* relation) {
+    if (relation->stream < 0) {
+        if (output->n_streams == output->streams_capacity) {
+            output->streams_capacity = output->streams_capacity ? output->streams_capacity * 2 : 64;
+            output->streams = reorder_realloc(output->streams, sizeof(ReorderStream) * output->streams_capacity);
+        }
+        ReorderStream* stream = &output->streams[output->n_streams];
+        stream->relation = relation;
+        stream->anchor = relation->last_reference;
+        stream->first_extent = -1;
+        stream->last_extent = -1;
+        relation->stream = output->n_streams++;
+    }
+    return &output->streams[relation->stream];
+}
+
+static void append_extent(ReorderOutput* output, ReorderStream* stream, const char* data, size_t len, const ReorderColumnList* column_list) {
+    if (!output->spill) {
+        output->spill = tmpfile();
+        if (!output->spill) {
+            perror("Error creating temp file");
+            exit(1);
+        }
+        setvbuf(output->spill, NULL, _IOFBF, REORDER_SPILL_BUFFER);
+    }
+    if (fwrite(data, 1, len, output->spill) != len) {
+        perror("Error writing temp file");
+        exit(1);
+    }
+
+    // Rows right after rows of the same COPY make the extent longer
+    ReorderExtent* last = stream->last_extent >= 0 ? &output->extents[stream->last_extent] : NULL;
+    if (column_list && last && last->column_list == column_list && last->offset + (long long)last->len == output->spill_len) {
+        last->len += len;
+        output->spill_len += len;
+        return;
+    }
+
+    if (output->n_extents == output->extents_capacity) {
+        output->extents_capacity = output->extents_capacity ? output->extents_capacity * 2 : 1024;
+        output->extents = reorder_realloc(output->extents, sizeof(ReorderExtent) * output->extents_capacity);
+    }
+    ReorderExtent* extent = &output->extents[output->n_extents];
+    extent->offset = output->spill_len;
+    extent->len = len;
+    extent->column_list = column_list;
+    extent->next = -1;
+    if (stream->last_extent >= 0) {
+        output->extents[stream->last_extent].next = output->n_extents;
+    }
+    else {
+        stream->first_extent = output->n_extents;
+    }
+    stream->last_extent = output->n_extents++;
+    output->spill_len += len;
+}
+
+static void flush_rows(ReorderOutput* output) {
+    if (output->read_len > 0) {
+        output->writer.copy_data(output->writer.context, output->read_buffer, output->read_len);
+        output->read_len = 0;
+    }
+}
+
+static void end_copy(ReorderOutput* output) {
+    flush_rows(output);
+    output->writer.end_copy(output->writer.context);
+    output->line_start = true;
+}
+
+static void write_extent(ReorderOutput* output, const ReorderExtent* extent) {
+    if (fseeko(output->spill, extent->offset, SEEK_SET) != 0) {
+        perror("Error reading temp file");
+        exit(1);
+    }
+
+    // Statements go out whole, rows in pieces
+    if (!extent->column_list) {
+        char* statement = reorder_realloc(NULL, extent->len);
+        if (fread(statement, 1, extent->len, output->spill) != extent->len) {
+            perror("Error reading temp file");
+            exit(1);
+        }
+        write_moved(output, statement, extent->len);
+        free(statement);
+        return;
+    }
+
+    // Rows of short extents (tables interleaved in the input) are gathered into full buffers
+    for (size_t done = 0; done < extent->len;) {
+        size_t room = REORDER_SPILL_BUFFER - output->read_len;
+        size_t n = extent->len - done < room ? extent->len - done : room;
+        if (fread(output->read_buffer + output->read_len, 1, n, output->spill) != n) {
+            perror("Error reading temp file");
+            exit(1);
+        }
+        output->read_len += n;
+        done += n;
+        if (output->read_len == REORDER_SPILL_BUFFER) {
+            flush_rows(output);
+        }
+    }
+}
+
+static const char* copy_options(const ReorderRelation* relation, const ReorderColumnList* column_list) {
+    if (column_list->options) {
+        return column_list->options;
+    }
+    if (column_list->has_default) {
+        return relation->created ? " WITH (FREEZE, DEFAULT E'\\\\D')" : " WITH (DEFAULT E'\\\\D')";
+    }
+    return relation->created ? " WITH (FREEZE)" : "";
+}
+
+static void write_stream(ReorderOutput* output, const ReorderStream* stream) {
+    const ReorderColumnList* open_list = NULL;
+
+    for (int i = stream->first_extent; i >= 0; i = output->extents[i].next) {
+        const ReorderExtent* extent = &output->extents[i];
+
+        if (open_list && extent->column_list != open_list) {
+            end_copy(output);
+            open_list = NULL;
+        }
+        if (extent->column_list && !open_list) {
+            write_text(output, "\n\n", output->line_start ? 1 : 2);
+            output->writer.begin_copy(output->writer.context, stream->relation->name, extent->column_list->list, copy_options(stream->relation, extent->column_list));
+            open_list = extent->column_list;
+        }
+        write_extent(output, extent);
+    }
+    if (open_list) {
+        end_copy(output);
+    }
+}
+
+// Streams by the statement they follow (-1 last), then in the order they started
+static int compare_streams(const void* a, const void* b) {
+    const ReorderStream* left = *(const ReorderStream* const*)a;
+    const ReorderStream* right = *(const ReorderStream* const*)b;
+    unsigned int left_anchor = (unsigned int)left->anchor;
+    unsigned int right_anchor = (unsigned int)right->anchor;
+
+    if (left_anchor != right_anchor) {
+        return left_anchor < right_anchor ? -1 : 1;
+    }
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+// Writes the open transaction with the data in place, then the post-data statements
+static void flush(ReorderOutput* output) {
+    if (output->pre_data.count > 0 || output->n_streams > 0) {
+        ReorderStream** order = reorder_realloc(NULL, sizeof(ReorderStream*) * (output->n_streams + 1));
+        for (int i = 0; i < output->n_streams; i++) {
+            order[i] = &output->streams[i];
+        }
+        qsort(order, output->n_streams, sizeof(ReorderStream*), compare_streams);
+
+        if (output->spill && fflush(output->spill) != 0) {
+            perror("Error writing temp file");
+            exit(1);
+        }
+        if (!output->read_buffer) {
+            output->read_buffer = reorder_realloc(NULL, REORDER_SPILL_BUFFER);
+        }
+
+        write_moved(output, "BEGIN;", 6);
+        int next = 0;
+        for (int i = 0; i < output->pre_data.count; i++) {
+            statements_write(output, &output->pre_data, i);
+            for (; next < output->n_streams && order[next]->anchor == i; next++) {
+                write_stream(output, order[next]);
+            }
+        }
+        for (; next < output->n_streams; next++) {
+            write_stream(output, order[next]);
+        }
+        write_moved(output, "COMMIT;", 7);
+        free(order);
+    }
+
+    for (int i = 0; i < output->post_data.count; i++) {
+        statements_write(output, &output->post_data, i);
+    }
+
+    statements_clear(&output->pre_data);
+    statements_clear(&output->post_data);
+    output->n_streams = 0;
+    output->n_extents = 0;
+    output->spill_len = 0;
+    if (output->spill) {
+        rewind(output->spill);
+    }
+    for (ReorderRelation* relation = output->relations; relation; relation = relation->next_all) {
+        relation->created = false;
+        relation->stream = -1;
+        relation->last_reference = -1;
+    }
+}
+
+void reorder_output_init(ReorderOutput* output, ReorderWriter writer) {
+    memset(output, 0, sizeof(ReorderOutput));
+    output->writer = writer;
+    output->line_start = true;
+}
+
+// A schema statement: the data that comes after it follows it
+static void add_pre_data(ReorderOutput* output, StatementSlice statement, const PgQueryStatementInfoResult* info) {
+    statements_append(&output->pre_data, statement.data, statement.len);
+
+    ReorderRelation* first = NULL;
+    for (int i = 0; i < info->n_relations; i++) {
+        ReorderRelation* relation = find_relation(output, info->relations[i]);
+        relation->stream = -1;
+        relation->last_reference = output->pre_data.count - 1;
+
+        // A sequence and the table it belongs to (OWNED BY, column default)
+        if (i == 0) {
+            first = relation;
+        }
+        else {
+            if (!relation->owner) {
+                relation->owner = first;
+            }
+            if (!first->owner) {
+                first->owner = relation;
+            }
+        }
+    }
+    if (info->kind == PG_QUERY_STATEMENT_CREATE_TABLE && first) {
+        first->created = true;
+    }
+}
+
+void reorder_output_statement(ReorderOutput* output, StatementSlice statement, const PgQueryStatementInfoResult* info) {
+    const char* end = statement.data + statement.len;
+    bool empty = output->pre_data.count == 0 && output->n_streams == 0;
+    const char* columns;
+    const char* options;
+    size_t columns_len;
+    size_t options_len;
+
+    if (statement.kind == STATEMENT_COPY_FROM_STDIN) {
+        if (!info->error && info->kind == PG_QUERY_STATEMENT_DATA && info->n_relations == 1 &&
+            parse_copy_command(statement, &columns, &columns_len, &options, &options_len)) {
+            // The rows go to the table's stream, and the COPY command is written with them
+            output->copy_relation = find_relation(output, info->relations[0]);
+            output->copy_column_list = find_copy_column_list(output->copy_relation, columns, columns_len, options, options_len);
+        }
+        else {
+            flush(output);
+            write_text(output, "\n", output->line_start ? 0 : 1);
+            write_text(output, statement.data, statement.len);
+            output->copy_raw = true;
+        }
+    }
+    else if (statement.kind == STATEMENT_META_COMMAND || info->error || info->kind == PG_QUERY_STATEMENT_NO_TRANSACTION) {
+        flush(output);
+        // Meta-commands start right after the line before them
+        if (statement.kind == STATEMENT_META_COMMAND && statement.data[0] != '\n') {
+            write_text(output, "\n", output->line_start ? 0 : 1);
+        }
+        write_text(output, statement.data, statement.len);
+    }
+    else if (info->kind == PG_QUERY_STATEMENT_TRANSACTION) {
+        // The transaction is ours to manage
+    }
+    else if (empty && (info->kind == PG_QUERY_STATEMENT_SETTING || statement_skip_comments(statement.data, end) == end)) {
+        // Settings and comments at the top stay out of the transaction, so they last if it fails
+        write_text(output, statement.data, statement.len);
+    }
+    else if (info->kind == PG_QUERY_STATEMENT_POST_DATA) {
+        statements_append(&output->post_data, statement.data, statement.len);
+    }
+    else if (info->kind == PG_QUERY_STATEMENT_SEQUENCE_VALUE && info->n_relations == 1) {
+        // setval goes with the rows of the table that owns the sequence, which may take values from it
+        ReorderRelation* relation = find_relation(output, info->relations[0]);
+        append_extent(output, current_stream(output, relation->owner ? relation->owner : relation), statement.data, statement.len, NULL);
+    }
+    else if (info->kind == PG_QUERY_STATEMENT_DATA && info->n_relations == 1) {
+        ReorderRelation* relation = find_relation(output, info->relations[0]);
+        append_extent(output, current_stream(output, relation), statement.data, statement.len, NULL);
+    }
+    else {
+        add_pre_data(output, statement, info);
+    }
+}
+
+void reorder_output_rows(ReorderOutput* output, const PgQueryInsertToCopyResult* result) {
+    ReorderRelation* relation = find_relation(output, result->relation);
+    ReorderStream* stream = current_stream(output, relation);
+
+    if (result->n_rows > 0) {
+        append_extent(output, stream, result->copy_data, result->copy_data_len, find_column_list(relation, result));
+    }
+    if (result->fallback_insert) {
+        // Rows with values that aren't constants stay an INSERT, in their place in the stream
+        size_t len = strlen(result->fallback_insert);
+        char* statement = reorder_realloc(NULL, len + 2);
+        memcpy(statement, result->fallback_insert, len);
+        memcpy(statement + len, ";\n", 2);
+        append_extent(output, stream, statement, len + 2, NULL);
+        free(statement);
+    }
+}
+
+void reorder_output_copy_data(ReorderOutput* output, StatementSlice data) {
+    if (output->copy_relation && data.kind == STATEMENT_COPY_DATA) {
+        append_extent(output, current_stream(output, output->copy_relation), data.data, data.len, output->copy_column_list);
+    }
+    else if (output->copy_raw) {
+        write_text(output, data.data, data.len);
+    }
+
+    // The end of the block is written with the rows
+    if (data.kind == STATEMENT_COPY_END) {
+        output->copy_relation = NULL;
+        output->copy_column_list = NULL;
+        output->copy_raw = false;
+    }
+}
+
+void reorder_output_close(ReorderOutput* output) {
+    flush(output);
+    if (!output->line_start) {
+        write_text(output, "\n", 1);
+    }
+
+    ReorderRelation* relation = output->relations;
+    while (relation) {
+        ReorderRelation* next = relation->next_all;
+        for (int i = 0; i < relation->n_column_lists; i++) {
+            free(relation->column_lists[i]->list);
+            free(relation->column_lists[i]->options);
+            free(relation->column_lists[i]);
+        }
+        free(relation->column_lists);
+        free(relation->name);
+        free(relation);
+        relation = next;
+    }
+    statements_free(&output->pre_data);
+    statements_free(&output->post_data);
+    free(output->streams);
+    free(output->extents);
+    free(output->read_buffer);
+    if (output->spill) {
+        fclose(output->spill);
+    }
+}
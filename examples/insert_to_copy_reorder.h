@@ -0,0 +1,100 @@
+#ifndef INSERT_TO_COPY_REORDER_H
+#define INSERT_TO_COPY_REORDER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <pg_query.h>
+
+#include "insert_to_copy_input.h"
+#include "insert_to_copy_binary.h"
+
+// Restore order for insert_to_copy (--reorder): the statements are classified with
+// pg_query_statement_info and written back as
+//
+//   SET statements from the top of the dump
+//   BEGIN;
+//   schema, in input order, each table's data right after the last statement
+//     that the data depends on (its CREATE TABLE, column defaults, OWNED BY),
+//     as "COPY ... WITH (FREEZE)" when the table is created in the transaction
+//   COMMIT;
+//   indexes, constraints, triggers, rules and policies, in input order
+//
+// COPY FREEZE writes the rows already frozen, and with wal_level=minimal a table
+// created in the same transaction is loaded without writing WAL. "COPY ... FROM
+// stdin" blocks of the input become rows of their table like converted INSERTs,
+// with the options they had instead of FREEZE if any. Rows and
+// statements of a table (UPDATE, INSERTs that aren't converted, setval of the
+// sequences it owns) keep their order; statements that write to several tables
+// keep their place among the schema statements. Statements that can't run in a
+// transaction block (CREATE DATABASE, psql meta-commands that don't parse)
+// commit what came before them and start over.
+//
+// All data is held in a temp file until the transaction is written, so nothing is
+// written before the end of the input (or such a statement).
+
+#define REORDER_HASH_SIZE 1024
+
+typedef struct ReorderRelation ReorderRelation;
+typedef struct ReorderStream ReorderStream;
+typedef struct ReorderExtent ReorderExtent;
+typedef struct ReorderColumnList ReorderColumnList;
+
+// Where the reordered statements and COPY data go
+typedef struct {
+    void (*statement)(void* context, const char* data, size_t len);
+    void (*begin_copy)(void* context, const char* relation, const char* column_list, const char* options);
+    void (*copy_data)(void* context, const char* data, size_t len);
+    void (*end_copy)(void* context);
+    void* context;
+} ReorderWriter;
+
+// Statement texts one after the other
+typedef struct {
+    ByteBuffer text;
+    size_t* ends;
+    int count;
+    int capacity;
+} ReorderStatements;
+
+typedef struct {
+    ReorderWriter writer;
+
+    ReorderStatements pre_data;        // Statements of the open transaction
+    ReorderStatements post_data;
+
+    ReorderRelation* relation_hash[REORDER_HASH_SIZE];
+    ReorderRelation* relations;        // All of them, to free them
+
+    ReorderStream* streams;            // Data of the open transaction, in the order it started
+    int n_streams;
+    int streams_capacity;
+
+    ReorderExtent* extents;
+    int n_extents;
+    int extents_capacity;
+
+    FILE* spill;                       // Rows and statements of the streams
+    long long spill_len;
+    char* read_buffer;                 // Rows on their way to the writer
+    size_t read_len;
+    bool line_start;                   // The output ends with a newline
+
+    // "COPY ... FROM stdin" of the input whose data comes next, its rows join the stream of the table
+    ReorderRelation* copy_relation;
+    const ReorderColumnList* copy_column_list;
+    bool copy_raw;                     // A COPY that couldn't be taken apart, its data is written as is
+} ReorderOutput;
+
+void reorder_output_init(ReorderOutput* output, ReorderWriter writer);
+// A statement that isn't a converted INSERT, classified by pg_query_statement_info
+void reorder_output_statement(ReorderOutput* output, StatementSlice statement, const PgQueryStatementInfoResult* info);
+// Rows of a converted INSERT
+void reorder_output_rows(ReorderOutput* output, const PgQueryInsertToCopyResult* result);
+// Data lines of the "COPY ... FROM stdin" passed to reorder_output_statement before
+void reorder_output_copy_data(ReorderOutput* output, StatementSlice data);
+// Writes out what is left
+void reorder_output_close(ReorderOutput* output);
+
+#endif
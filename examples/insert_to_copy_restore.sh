@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+# Restores the output of insert_to_copy --format=directory with parallel COPY
+# streams: pre-data.sql first, then up to N data files at a time (largest
+# first, as listed in manifest.tsv), then post-data.sql once all data is in.
+#
+# Usage: examples/insert_to_copy_restore.sh [-j N] DIR [psql options...]
+#
+# The psql options (e.g. -d dbname, -h host) are passed to every psql run.
+# Each file runs with ON_ERROR_STOP, and post-data.sql is skipped when any
+# data file failed.
+
+set -e
+
+JOBS=1
+if [ "$1" = "-j" ]; then
+	JOBS=$2
+	shift 2
+fi
+if [ $# -lt 1 ] || [ ! -f "$1/manifest.tsv" ]; then
+	echo "Usage: $0 [-j N] DIR [psql options...]" >&2
+	exit 1
+fi
+DIR=$1
+shift
+
+psql -X -q -v ON_ERROR_STOP=1 "$@" -f "$DIR/pre-data.sql"
+
+awk -F '\t' 'NR > 1 && $2 == "data" { print $5 "\t" $1 }' "$DIR/manifest.tsv" | sort -rn | cut -f 2 |
+	xargs -P "$JOBS" -I {} psql -X -q -v ON_ERROR_STOP=1 "$@" -f "$DIR/{}"
+
+psql -X -q -v ON_ERROR_STOP=1 "$@" -f "$DIR/post-data.sql"
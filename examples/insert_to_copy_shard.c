@@ -0,0 +1,953 @@
+#include "insert_to_copy_shard.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "xxhash/xxhash.h"
+
+#ifdef _WIN32
+#define strncasecmp _strnicmp
+#endif
+
+// Size from which the INSERT of the rows that aren't constants ends the block
+#define SHARD_FALLBACK_BYTES (1024 * 1024)
+
+// Where the rows of a block or a COPY section go, besides a key field
+#define SHARD_ALL_STREAMS -1           // The table has no shard key
+#define SHARD_FIRST_STREAM -2          // The key isn't known
+
+struct ShardTable {
+    char* relation;                    // Normalized
+    const ShardKey* key;               // NULL if the rows go to every stream
+    int key_position;                  // Field of the key in rows without a column list, -1 if not seen
+    bool warned;
+    ShardTable* next;
+};
+
+static void* checked_realloc(void* ptr, size_t size) {
+    void* new_ptr = realloc(ptr, size);
+    if (!new_ptr) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    return new_ptr;
+}
+
+static char* checked_strdup(const char* str) {
+    char* copy = strdup(str);
+    if (!copy) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    return copy;
+}
+
+static unsigned int hash_name(const char* name) {
+    unsigned int hash = 5381;
+    int c;
+    while ((c = (unsigned char)*name++))
+        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+    return hash % SHARD_HASH_SIZE;
+}
+
+static void append_name_char(ShardOutput* output, size_t* len, char c) {
+    if (*len + 2 > output->name_capacity) {
+        output->name_capacity = output->name_capacity ? output->name_capacity * 2 : 256;
+        output->name = checked_realloc(output->name, output->name_capacity);
+    }
+    output->name[(*len)++] = c;
+}
+
+static bool is_ident_char(unsigned char c) {
+    return isalnum(c) || c == '_' || c == '$' || c >= 0x80;
+}
+
+// Reads a possibly qualified name into output->name as it is stored (quotes
+// removed, unquoted identifiers in lower case), with *table_offset at the start
+// of its last part. Returns the end of the name, or NULL if there is none.
+static const char* read_name(ShardOutput* output, const char* ptr, const char* end, size_t* table_offset) {
+    size_t len = 0;
+
+    for (;;) {
+        *table_offset = len;
+        if (ptr < end && *ptr == '"') {
+            ptr++;
+            for (;;) {
+                if (ptr == end) {
+                    return NULL;
+                }
+                if (*ptr == '"') {
+                    if (ptr + 1 < end && ptr[1] == '"') {
+                        append_name_char(output, &len, '"');
+                        ptr += 2;
+                        continue;
+                    }
+                    ptr++;
+                    break;
+                }
+                append_name_char(output, &len, *ptr++);
+            }
+        }
+        else if (ptr < end && is_ident_char((unsigned char)*ptr) && !isdigit((unsigned char)*ptr) && *ptr != '$') {
+            while (ptr < end && is_ident_char((unsigned char)*ptr)) {
+                append_name_char(output, &len, (char)tolower((unsigned char)*ptr));
+                ptr++;
+            }
+        }
+        else {
+            return NULL;
+        }
+
+        if (ptr < end && *ptr == '.') {
+            append_name_char(output, &len, '.');
+            ptr++;
+        }
+        else {
+            break;
+        }
+    }
+    append_name_char(output, &len, '\0');
+    return ptr;
+}
+
+// Whether a column name as pg_query quotes it is the normalized name
+static bool same_column(const char* quoted, const char* name) {
+    if (*quoted != '"') {
+        return strcmp(quoted, name) == 0;
+    }
+    for (quoted++; *quoted; quoted++, name++) {
+        if (*quoted == '"' && quoted[1] != '"') {
+            break;
+        }
+        if (*quoted == '"') {
+            quoted++;
+        }
+        if (*quoted != *name) {
+            return false;
+        }
+    }
+    return *name == '\0';
+}
+
+// Skips a keyword followed by whitespace, case-insensitively
+static bool skip_keyword(const char** ptr, const char* end, const char* keyword) {
+    size_t len = strlen(keyword);
+    if ((size_t)(end - *ptr) <= len || strncasecmp(*ptr, keyword, len) != 0 || !isspace((unsigned char)(*ptr)[len])) {
+        return false;
+    }
+    *ptr += len;
+    while (*ptr < end && isspace((unsigned char)**ptr)) {
+        (*ptr)++;
+    }
+    return true;
+}
+
+static void skip_spaces(const char** ptr, const char* end) {
+    while (*ptr < end && isspace((unsigned char)**ptr)) {
+        (*ptr)++;
+    }
+}
+
+// The table of the normalized name in output->name, with its shard key
+static ShardTable* find_table(ShardOutput* output, size_t table_offset) {
+    const char* relation = output->name;
+
+    if (output->last_table && strcmp(output->last_table->relation, relation) == 0) {
+        return output->last_table;
+    }
+
+    unsigned int bucket = hash_name(relation);
+    ShardTable* table = output->table_hash[bucket];
+    while (table && strcmp(table->relation, relation) != 0) {
+        table = table->next;
+    }
+    if (!table) {
+        table = checked_realloc(NULL, sizeof(ShardTable));
+        table->relation = checked_strdup(relation);
+        table->key = NULL;
+        table->key_position = -1;
+        table->warned = false;
+        for (int i = 0; i < output->n_keys && !table->key; i++) {
+            const ShardKey* key = &output->keys[i];
+            if (strcmp(key->table, strchr(key->table, '.') ? relation : relation + table_offset) == 0) {
+                table->key = key;
+            }
+        }
+        table->next = output->table_hash[bucket];
+        output->table_hash[bucket] = table;
+    }
+    output->last_table = table;
+    return table;
+}
+
+static ShardTable* find_quoted_table(ShardOutput* output, const char* relation) {
+    size_t table_offset;
+    if (!read_name(output, relation, relation + strlen(relation), &table_offset)) {
+        return NULL;
+    }
+    return find_table(output, table_offset);
+}
+
+static void warn_unknown_key(ShardTable* table) {
+    if (!table->warned) {
+        fprintf(stderr, "Warning: %s of rows of %s isn't known or isn't a constant, they go to shard 0\n", table->key->column, table->relation);
+        table->warned = true;
+    }
+}
+
+// Field of the key in rows with the given columns (all of the table's without any)
+static int key_field(ShardTable* table, char** columns, int n_columns) {
+    if (!table || !table->key) {
+        return SHARD_ALL_STREAMS;
+    }
+    if (n_columns == 0) {
+        return table->key_position >= 0 ? table->key_position : SHARD_FIRST_STREAM;
+    }
+    for (int i = 0; i < n_columns; i++) {
+        if (same_column(columns[i], table->key->column)) {
+            return i;
+        }
+    }
+    return SHARD_FIRST_STREAM;
+}
+
+static int hash_stream(ShardOutput* output, const char* value, size_t len) {
+    return (int)(XXH3_64bits(value, len) % (XXH64_hash_t)output->n_streams);
+}
+
+static int hex_digit(char c) {
+    return isdigit((unsigned char)c) ? c - '0' : tolower((unsigned char)c) - 'a' + 10;
+}
+
+// Stream of a row in COPY text format, by the value of its field-th field as COPY
+// reads it
+static int copy_row_stream(ShardOutput* output, ShardTable* table, int field, const char* row, const char* end) {
+    const char* value = row;
+    for (int i = 0; i < field; i++) {
+        value = memchr(value, '\t', end - value);
+        if (!value) {
+            warn_unknown_key(table);
+            return 0;
+        }
+        value++;
+    }
+    const char* value_end = value;
+    while (value_end < end && *value_end != '\t' && *value_end != '\n' && *value_end != '\r') {
+        value_end++;
+    }
+
+    size_t len = value_end - value;
+    if (len == 2 && value[0] == '\\' && value[1] == 'N') {
+        return 0;
+    }
+    if (len == 2 && value[0] == '\\' && value[1] == 'D') {
+        warn_unknown_key(table);
+        return 0;
+    }
+    if (!memchr(value, '\\', len)) {
+        return hash_stream(output, value, len);
+    }
+
+    ByteBuffer* buffer = &output->value;
+    buffer->len = 0;
+    byte_buffer_reserve(buffer, len);
+    for (const char* c = value; c < value_end; c++) {
+        char out = *c;
+        if (*c == '\\' && c + 1 < value_end) {
+            c++;
+            switch (*c) {
+            case 'b': out = '\b'; break;
+            case 'f': out = '\f'; break;
+            case 'n': out = '\n'; break;
+            case 'r': out = '\r'; break;
+            case 't': out = '\t'; break;
+            case 'v': out = '\v'; break;
+            case 'x':
+                if (c + 1 < value_end && isxdigit((unsigned char)c[1])) {
+                    int n = hex_digit(*++c);
+                    if (c + 1 < value_end && isxdigit((unsigned char)c[1])) {
+                        n = n * 16 + hex_digit(*++c);
+                    }
+                    out = (char)n;
+                }
+                else {
+                    out = 'x';
+                }
+                break;
+            default:
+                if (*c >= '0' && *c <= '7') {
+                    int n = *c - '0';
+                    for (int i = 0; i < 2 && c + 1 < value_end && c[1] >= '0' && c[1] <= '7'; i++) {
+                        n = n * 8 + (*++c - '0');
+                    }
+                    out = (char)n;
+                }
+                else {
+                    out = *c;
+                }
+                break;
+            }
+        }
+        buffer->data[buffer->len++] = out;
+    }
+    return hash_stream(output, (const char*)buffer->data, buffer->len);
+}
+
+// Adds the COPY rows to the rows buffer of the streams they go to
+static void route_copy_rows(ShardOutput* output, ShardTable* table, int field, const char* data, size_t len) {
+    if (field == SHARD_ALL_STREAMS || field == SHARD_FIRST_STREAM) {
+        int n = field == SHARD_ALL_STREAMS ? output->n_streams : 1;
+        for (int i = 0; i < n; i++) {
+            byte_buffer_append(&output->streams[i].rows, data, len);
+        }
+        return;
+    }
+
+    const char* end = data + len;
+    while (data < end) {
+        const char* newline = memchr(data, '\n', end - data);
+        const char* row_end = newline ? newline + 1 : end;
+        int stream = copy_row_stream(output, table, field, data, row_end);
+        byte_buffer_append(&output->streams[stream].rows, data, row_end - data);
+        data = row_end;
+    }
+}
+
+// Skips a string literal, quoted identifier or parenthesized expression starting at ptr
+static const char* skip_value_token(const char* ptr, const char* end) {
+    char quote = *ptr;
+    bool backslashes = false;
+
+    if (quote == '(' || quote == '[') {
+        char close = quote == '(' ? ')' : ']';
+        ptr++;
+        while (ptr < end && *ptr != close) {
+            ptr = skip_value_token(ptr, end);
+        }
+        return ptr < end ? ptr + 1 : end;
+    }
+    if ((quote == 'E' || quote == 'e') && ptr + 1 < end && ptr[1] == '\'') {
+        backslashes = true;
+        quote = *++ptr;
+    }
+    if (quote != '\'' && quote != '"') {
+        return ptr + 1;
+    }
+    for (ptr++; ptr < end; ptr++) {
+        if (backslashes && *ptr == '\\') {
+            ptr++;
+        }
+        else if (*ptr == quote) {
+            if (ptr + 1 < end && ptr[1] == quote) {
+                ptr++;
+            }
+            else {
+                return ptr + 1;
+            }
+        }
+    }
+    return end;
+}
+
+// Stream of a row of VALUES, "(1, 'a', now())", by its field-th value. Only
+// numbers and string literals (with or without a cast) can be hashed.
+static int values_row_stream(ShardOutput* output, ShardTable* table, int field, const char* row, const char* end) {
+    const char* ptr = row + 1;
+    for (int i = 0; i < field && ptr < end; i++) {
+        while (ptr < end && *ptr != ',' && *ptr != ')') {
+            ptr = skip_value_token(ptr, end);
+        }
+        ptr++;
+    }
+    skip_spaces(&ptr, end);
+    if (ptr >= end) {
+        warn_unknown_key(table);
+        return 0;
+    }
+
+    const char* value = ptr;
+    const char* value_end;
+    ByteBuffer* buffer = &output->value;
+    buffer->len = 0;
+    if (*ptr == '\'') {
+        // Unescape the doubled quotes
+        value_end = skip_value_token(ptr, end);
+        for (const char* c = value + 1; c < value_end - 1; c++) {
+            byte_buffer_append(buffer, c, 1);
+            if (*c == '\'') {
+                c++;
+            }
+        }
+        value = buffer->data ? (const char*)buffer->data : "";
+    }
+    else if (*ptr == '-' || *ptr == '+' || *ptr == '.' || isdigit((unsigned char)*ptr)) {
+        value_end = ptr + 1;
+        while (value_end < end && (isalnum((unsigned char)*value_end) || *value_end == '.' ||
+                                   ((*value_end == '-' || *value_end == '+') && tolower((unsigned char)value_end[-1]) == 'e'))) {
+            value_end++;
+        }
+        // "+5" is 5 to COPY
+        if (*value == '+') {
+            value++;
+        }
+        byte_buffer_append(buffer, value, value_end - value);
+        value = (const char*)buffer->data;
+    }
+    else if (end - ptr >= 4 && strncasecmp(ptr, "NULL", 4) == 0 && (end - ptr == 4 || !is_ident_char((unsigned char)ptr[4]))) {
+        return 0;
+    }
+    else {
+        warn_unknown_key(table);
+        return 0;
+    }
+
+    // Only a cast can follow the literal
+    const char* after = value_end;
+    skip_spaces(&after, end);
+    if (after < end && *after != ',' && *after != ')' && !(after + 1 < end && after[0] == ':' && after[1] == ':')) {
+        warn_unknown_key(table);
+        return 0;
+    }
+    return hash_stream(output, value, buffer->len);
+}
+
+static void stream_write(ShardOutput* output, ShardStream* stream, const char* data, size_t len, bool from_input) {
+    if (from_input && output->input_mapped) {
+        output_sink_write_ref(&stream->sink, data, len);
+    }
+    else {
+        output_sink_write(&stream->sink, data, len);
+    }
+}
+
+static void begin_block(ShardOutput* output, ShardStream* stream) {
+    const char* options = output->default_block ? " WITH (DEFAULT E'\\\\D')" : "";
+
+    if (stream->wire) {
+        pgwire_begin_query(stream->wire);
+        pgwire_append(stream->wire, "COPY ", 5);
+        pgwire_append(stream->wire, output->relation, strlen(output->relation));
+        pgwire_append(stream->wire, output->column_list, strlen(output->column_list));
+        pgwire_append(stream->wire, " FROM stdin", 11);
+        pgwire_append(stream->wire, options, strlen(options));
+        pgwire_end_query(stream->wire);
+    }
+    else {
+        output_sink_puts(&stream->sink, "COPY ");
+        output_sink_puts(&stream->sink, output->relation);
+        output_sink_puts(&stream->sink, output->column_list);
+        output_sink_puts(&stream->sink, " FROM stdin");
+        output_sink_puts(&stream->sink, options);
+        output_sink_puts(&stream->sink, ";\n");
+    }
+    stream->block_open = true;
+}
+
+// Writes the rows routed to each stream, starting the COPY command where needed
+static void flush_block_rows(ShardOutput* output) {
+    for (int i = 0; i < output->n_streams; i++) {
+        ShardStream* stream = &output->streams[i];
+        if (stream->rows.len == 0) {
+            continue;
+        }
+        if (!stream->block_open) {
+            begin_block(output, stream);
+        }
+        if (stream->wire) {
+            pgwire_copy_data(stream->wire, stream->rows.data, stream->rows.len);
+        }
+        else {
+            output_sink_write(&stream->sink, stream->rows.data, stream->rows.len);
+        }
+        stream->rows.len = 0;
+    }
+}
+
+// Data of a COPY section of the input, its COPY command already sent
+static void flush_copy_rows(ShardOutput* output) {
+    for (int i = 0; i < output->n_streams; i++) {
+        ShardStream* stream = &output->streams[i];
+        if (stream->rows.len == 0) {
+            continue;
+        }
+        if (stream->wire) {
+            pgwire_copy_data(stream->wire, stream->rows.data, stream->rows.len);
+        }
+        else {
+            output_sink_write(&stream->sink, stream->rows.data, stream->rows.len);
+        }
+        stream->rows.len = 0;
+    }
+}
+
+static void stream_statement(ShardOutput* output, ShardStream* stream, StatementSlice statement) {
+    if (!stream->wire) {
+        stream_write(output, stream, statement.data, statement.len, true);
+        return;
+    }
+
+    switch (statement.kind) {
+    case STATEMENT_COPY_DATA:
+        pgwire_copy_data(stream->wire, statement.data, statement.len);
+        break;
+    case STATEMENT_COPY_END:
+        pgwire_copy_done(stream->wire);
+        break;
+    case STATEMENT_META_COMMAND:
+        // Only psql can run them (\connect, \restrict)
+        if (!output->meta_command_warned) {
+            const char* start = statement_skip_comments(statement.data, statement.data + statement.len);
+            int len = (int)(statement.data + statement.len - start);
+            while (len > 0 && (start[len - 1] == '\n' || start[len - 1] == '\r')) {
+                len--;
+            }
+            fprintf(stderr, "Warning: psql meta-command skipped: %.*s\n", len, start);
+            output->meta_command_warned = true;
+        }
+        break;
+    default:
+        // Comments and whitespace alone (the end of the dump) aren't sent
+        if (statement_skip_comments(statement.data, statement.data + statement.len) != statement.data + statement.len) {
+            pgwire_query(stream->wire, statement.data, statement.len);
+        }
+        break;
+    }
+}
+
+void shard_output_init(ShardOutput* output) {
+    memset(output, 0, sizeof(ShardOutput));
+    output->copy_key = SHARD_ALL_STREAMS;
+}
+
+bool shard_output_add_key(ShardOutput* output, const char* spec) {
+    const char* equals = strrchr(spec, '=');
+
+    if (!equals || equals == spec || equals[1] == '\0') {
+        return false;
+    }
+    output->keys = checked_realloc(output->keys, sizeof(ShardKey) * (output->n_keys + 1));
+    output->keys[output->n_keys].table = checked_realloc(NULL, equals - spec + 1);
+    memcpy(output->keys[output->n_keys].table, spec, equals - spec);
+    output->keys[output->n_keys].table[equals - spec] = '\0';
+    output->keys[output->n_keys].column = checked_strdup(equals + 1);
+    output->n_keys++;
+    return true;
+}
+
+// "out.sql" -> "out.3.sql", "out_%d.sql" -> "out_3.sql"
+static char* stream_path(const char* path, int number) {
+    char* result = checked_realloc(NULL, strlen(path) + 16);
+    const char* placeholder = strstr(path, "%d");
+    const char* slash = strrchr(path, '/');
+    const char* dot = strrchr(path, '.');
+
+    if (placeholder) {
+        sprintf(result, "%.*s%d%s", (int)(placeholder - path), path, number, placeholder + 2);
+    }
+    else if (dot && dot != path && (!slash || dot > slash + 1)) {
+        sprintf(result, "%.*s.%d%s", (int)(dot - path), path, number, dot);
+    }
+    else {
+        sprintf(result, "%s.%d", path, number);
+    }
+    return result;
+}
+
+void shard_output_set_streams(ShardOutput* output, int n_streams, bool input_mapped) {
+    output->n_streams = n_streams;
+    output->input_mapped = input_mapped;
+    output->streams = checked_realloc(NULL, sizeof(ShardStream) * n_streams);
+    memset(output->streams, 0, sizeof(ShardStream) * n_streams);
+}
+
+bool shard_output_open_files(ShardOutput* output, const char* path, bool use_io_uring) {
+    for (int i = 0; i < output->n_streams; i++) {
+        char* stream_file = stream_path(path, i);
+        bool ok = output_sink_open(&output->streams[i].sink, stream_file, use_io_uring);
+        free(stream_file);
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void shard_output_use_wires(ShardOutput* output, PgWire* wires) {
+    for (int i = 0; i < output->n_streams; i++) {
+        output->streams[i].wire = &wires[i];
+    }
+}
+
+void shard_output_close_block(ShardOutput* output) {
+    for (int i = 0; i < output->n_streams; i++) {
+        ShardStream* stream = &output->streams[i];
+        if (stream->block_open) {
+            if (stream->wire) {
+                pgwire_copy_done(stream->wire);
+            }
+            else {
+                output_sink_puts(&stream->sink, "\\.\n");
+            }
+            stream->block_open = false;
+        }
+
+        // The rows that aren't constants, after the COPY rows
+        if (stream->fallback.len > 0) {
+            byte_buffer_append(&stream->fallback, ";\n", 2);
+            if (stream->wire) {
+                pgwire_query(stream->wire, (const char*)stream->fallback.data, stream->fallback.len);
+            }
+            else {
+                output_sink_write(&stream->sink, stream->fallback.data, stream->fallback.len);
+            }
+            stream->fallback.len = 0;
+        }
+    }
+
+    free(output->relation);
+    free(output->column_list);
+    output->relation = NULL;
+    output->column_list = NULL;
+    output->default_block = false;
+    output->block_table = NULL;
+}
+
+// Learns where the shard key is in the tables created without a column list in their INSERTs
+static void add_table_definition(ShardOutput* output, StatementSlice statement) {
+    const char* end = statement.data + statement.len;
+    const char* ptr = statement_skip_comments(statement.data, end);
+
+    if (!skip_keyword(&ptr, end, "CREATE")) {
+        return;
+    }
+    while (skip_keyword(&ptr, end, "UNLOGGED") || skip_keyword(&ptr, end, "TEMPORARY") ||
+           skip_keyword(&ptr, end, "TEMP") || skip_keyword(&ptr, end, "GLOBAL") || skip_keyword(&ptr, end, "LOCAL")) {
+    }
+    if (!skip_keyword(&ptr, end, "TABLE")) {
+        return;
+    }
+
+    PgQueryTableDefResult result = pg_query_table_def_len(statement.data, statement.len, PG_QUERY_PARSE_DEFAULT);
+    ShardTable* table = !result.error && result.relation ? find_quoted_table(output, result.relation) : NULL;
+    if (table && table->key) {
+        // Field of the key in rows without a column list, which don't have the generated columns
+        table->key_position = -1;
+        for (int i = 0, field = 0; i < result.n_columns && !result.has_inherited_columns; i++) {
+            if (result.columns[i].is_generated) {
+                continue;
+            }
+            if (same_column(result.columns[i].name, table->key->column)) {
+                table->key_position = field;
+            }
+            field++;
+        }
+    }
+    pg_query_free_table_def_result(result);
+}
+
+// Field of the key in the rows of the table, by the column list at *ptr (after
+// the table name) if there is one, which is skipped
+static int read_key_field(ShardOutput* output, ShardTable* table, const char** ptr, const char* end) {
+    int field = table->key_position >= 0 ? table->key_position : SHARD_FIRST_STREAM;
+    size_t table_offset;
+
+    skip_spaces(ptr, end);
+    if (*ptr < end && **ptr == '(') {
+        field = SHARD_FIRST_STREAM;
+        for (int i = 0; *ptr < end && **ptr != ')'; i++) {
+            (*ptr)++;
+            skip_spaces(ptr, end);
+            if (!(*ptr = read_name(output, *ptr, end, &table_offset))) {
+                *ptr = end;
+                return SHARD_FIRST_STREAM;
+            }
+            if (strcmp(output->name, table->key->column) == 0) {
+                field = i;
+            }
+            skip_spaces(ptr, end);
+        }
+        if (*ptr < end) {
+            (*ptr)++;
+        }
+        skip_spaces(ptr, end);
+    }
+    return field;
+}
+
+// Table and key field of "COPY name [(columns)] FROM stdin"
+static void begin_copy_section(ShardOutput* output, StatementSlice statement) {
+    const char* end = statement.data + statement.len;
+    const char* ptr = statement_skip_comments(statement.data, end);
+    size_t table_offset;
+
+    output->copy_key = SHARD_ALL_STREAMS;
+    output->copy_table = NULL;
+    if (!skip_keyword(&ptr, end, "COPY") || !(ptr = read_name(output, ptr, end, &table_offset))) {
+        return;
+    }
+    ShardTable* table = find_table(output, table_offset);
+    if (!table->key) {
+        return;
+    }
+    output->copy_table = table;
+    output->copy_key = read_key_field(output, table, &ptr, end);
+    if (output->copy_key == SHARD_FIRST_STREAM) {
+        warn_unknown_key(table);
+    }
+}
+
+void shard_output_statement(ShardOutput* output, StatementSlice statement) {
+    switch (statement.kind) {
+    case STATEMENT_COPY_DATA:
+        route_copy_rows(output, output->copy_table, output->copy_key, statement.data, statement.len);
+        flush_copy_rows(output);
+        return;
+    case STATEMENT_COPY_FROM_STDIN:
+        shard_output_close_block(output);
+        begin_copy_section(output, statement);
+        break;
+    case STATEMENT_COPY_END:
+        output->copy_key = SHARD_ALL_STREAMS;
+        output->copy_table = NULL;
+        break;
+    case STATEMENT_SQL:
+        shard_output_close_block(output);
+        if (output->n_keys > 0) {
+            add_table_definition(output, statement);
+        }
+        break;
+    default:
+        shard_output_close_block(output);
+        break;
+    }
+
+    for (int i = 0; i < output->n_streams; i++) {
+        stream_statement(output, &output->streams[i], statement);
+    }
+}
+
+void shard_output_insert(ShardOutput* output, StatementSlice statement) {
+    const char* end = statement.data + statement.len;
+    const char* ptr = statement_skip_comments(statement.data, end);
+    size_t table_offset;
+    ShardTable* table = NULL;
+
+    shard_output_close_block(output);
+    if (skip_keyword(&ptr, end, "INSERT") && skip_keyword(&ptr, end, "INTO") && (ptr = read_name(output, ptr, end, &table_offset))) {
+        table = find_table(output, table_offset);
+    }
+    if (!table || !table->key) {
+        for (int i = 0; i < output->n_streams; i++) {
+            stream_statement(output, &output->streams[i], statement);
+        }
+        return;
+    }
+
+    // Split the VALUES between the streams, each with the rest of the statement
+    // (ON CONFLICT ..., RETURNING ...)
+    int field = read_key_field(output, table, &ptr, end);
+    if (field < 0 || !skip_keyword(&ptr, end, "VALUES") || ptr >= end || *ptr != '(') {
+        warn_unknown_key(table);
+        stream_statement(output, &output->streams[0], statement);
+        return;
+    }
+    const char* values = ptr;
+    const char* rest = ptr;
+    while (ptr < end && *ptr == '(') {
+        const char* row_end = skip_value_token(ptr, end);
+        ByteBuffer* rows = &output->streams[values_row_stream(output, table, field, ptr, row_end)].rows;
+        if (rows->len == 0) {
+            byte_buffer_append(rows, statement.data, values - statement.data);
+        }
+        else {
+            byte_buffer_append(rows, ", ", 2);
+        }
+        byte_buffer_append(rows, ptr, row_end - ptr);
+
+        ptr = rest = row_end;
+        skip_spaces(&ptr, end);
+        if (ptr + 1 < end && *ptr == ',' && (ptr[1] == '(' || isspace((unsigned char)ptr[1]))) {
+            ptr++;
+            skip_spaces(&ptr, end);
+        }
+        else {
+            break;
+        }
+    }
+    for (int i = 0; i < output->n_streams; i++) {
+        ShardStream* stream = &output->streams[i];
+        if (stream->rows.len == 0) {
+            continue;
+        }
+        byte_buffer_append(&stream->rows, rest, end - rest);
+        if (stream->wire) {
+            pgwire_query(stream->wire, stream->rows.data, stream->rows.len);
+        }
+        else {
+            output_sink_write(&stream->sink, stream->rows.data, stream->rows.len);
+        }
+        stream->rows.len = 0;
+    }
+}
+
+// " (a, b)" or "" without columns
+static char* format_column_list(const PgQueryInsertToCopyResult* result) {
+    size_t len = 1;
+    for (int i = 0; i < result->n_columns; i++) {
+        len += strlen(result->columns[i]) + 4;
+    }
+    char* list = checked_realloc(NULL, len);
+    char* ptr = list;
+    for (int i = 0; i < result->n_columns; i++) {
+        ptr += sprintf(ptr, "%s%s", i == 0 ? " (" : ", ", result->columns[i]);
+    }
+    if (result->n_columns > 0) {
+        *ptr++ = ')';
+    }
+    *ptr = '\0';
+    return list;
+}
+
+// Whether the open block has the table and columns of the INSERT, without building the column list
+static bool same_target(const ShardOutput* output, const PgQueryInsertToCopyResult* result) {
+    if (!output->relation || strcmp(output->relation, result->relation) != 0) {
+        return false;
+    }
+
+    const char* ptr = output->column_list;
+    for (int i = 0; i < result->n_columns; i++) {
+        size_t len = strlen(result->columns[i]);
+        if (strncmp(ptr, i == 0 ? " (" : ", ", 2) != 0 || strncmp(ptr + 2, result->columns[i], len) != 0) {
+            return false;
+        }
+        ptr += 2 + len;
+    }
+    return strcmp(ptr, result->n_columns > 0 ? ")" : "") == 0;
+}
+
+static bool only_whitespace(const char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!isspace((unsigned char)data[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Adds the rows of the INSERT whose values aren't constants to the INSERT of the
+// streams they go to
+static void route_fallback_rows(ShardOutput* output, const PgQueryInsertToCopyResult* result) {
+    const char* insert = result->fallback_insert;
+    const char* ptr = insert + result->fallback_values_offset;
+    const char* end = ptr + strlen(ptr);
+    bool reached_limit = false;
+
+    while (ptr < end) {
+        skip_spaces(&ptr, end);
+        if (ptr >= end || *ptr != '(') {
+            break;
+        }
+        const char* row_end = skip_value_token(ptr, end);
+
+        int first = 0;
+        int last = output->n_streams - 1;
+        if (output->block_key == SHARD_FIRST_STREAM) {
+            last = 0;
+        }
+        else if (output->block_key >= 0) {
+            first = last = values_row_stream(output, output->block_table, output->block_key, ptr, row_end);
+        }
+        for (int i = first; i <= last; i++) {
+            ByteBuffer* fallback = &output->streams[i].fallback;
+            if (fallback->len == 0) {
+                byte_buffer_append(fallback, insert, result->fallback_values_offset);
+            }
+            else {
+                byte_buffer_append(fallback, ", ", 2);
+            }
+            byte_buffer_append(fallback, ptr, row_end - ptr);
+            reached_limit = reached_limit || fallback->len >= SHARD_FALLBACK_BYTES;
+        }
+
+        ptr = row_end;
+        skip_spaces(&ptr, end);
+        if (ptr < end && *ptr == ',') {
+            ptr++;
+        }
+    }
+
+    if (reached_limit) {
+        shard_output_close_block(output);
+    }
+}
+
+void shard_output_rows(ShardOutput* output, StatementSlice statement, size_t prefix_len, const PgQueryInsertToCopyResult* result) {
+    // Continue the open block when the target is the same and there's only whitespace
+    // between the INSERTs (comments stay in place, and so start another block)
+    bool same_block = same_target(output, result) && only_whitespace(statement.data, prefix_len) &&
+                      (output->default_block || !result->has_default);
+
+    if (result->n_rows == 0 && !same_block) {
+        // Only rows that aren't constants, and no block to add them to: the INSERT as it is
+        shard_output_close_block(output);
+        shard_output_insert(output, statement);
+        return;
+    }
+
+    if (!same_block) {
+        shard_output_close_block(output);
+        for (int i = 0; i < output->n_streams; i++) {
+            stream_write(output, &output->streams[i], statement.data, prefix_len, true);
+        }
+        output->relation = checked_strdup(result->relation);
+        output->column_list = format_column_list(result);
+        output->default_block = result->has_default;
+        output->block_table = find_quoted_table(output, result->relation);
+        output->block_key = key_field(output->block_table, result->columns, result->n_columns);
+        if (output->block_key == SHARD_FIRST_STREAM) {
+            warn_unknown_key(output->block_table);
+        }
+    }
+
+    if (result->n_rows > 0) {
+        route_copy_rows(output, output->block_table, output->block_key, result->copy_data, result->copy_data_len);
+        flush_block_rows(output);
+    }
+    if (result->fallback_insert) {
+        route_fallback_rows(output, result);
+    }
+}
+
+void shard_output_close(ShardOutput* output) {
+    shard_output_close_block(output);
+    for (int i = 0; i < output->n_streams; i++) {
+        ShardStream* stream = &output->streams[i];
+        if (!stream->wire) {
+            output_sink_close(&stream->sink);
+        }
+        byte_buffer_free(&stream->rows);
+        byte_buffer_free(&stream->fallback);
+    }
+    free(output->streams);
+    output->streams = NULL;
+
+    for (int i = 0; i < SHARD_HASH_SIZE; i++) {
+        ShardTable* table = output->table_hash[i];
+        while (table) {
+            ShardTable* next = table->next;
+            free(table->relation);
+            free(table);
+            table = next;
+        }
+        output->table_hash[i] = NULL;
+    }
+    for (int i = 0; i < output->n_keys; i++) {
+        free(output->keys[i].table);
+        free(output->keys[i].column);
+    }
+    free(output->keys);
+    free(output->name);
+    byte_buffer_free(&output->value);
+}
@@ -0,0 +1,107 @@
+#ifndef INSERT_TO_COPY_SHARD_H
+#define INSERT_TO_COPY_SHARD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <pg_query.h>
+
+#include "insert_to_copy_input.h"
+#include "insert_to_copy_output.h"
+#include "insert_to_copy_pgwire.h"
+#include "insert_to_copy_binary.h"
+
+// Sharded output of insert_to_copy (--shards N, --shard-key TABLE=COLUMN), for
+// loading a dump into a hash-sharded cluster with one server per shard in a
+// single pass over it. The output is N streams, files or connections, each one
+// a complete script for its shard:
+//
+//   - Statements that aren't data (schema, settings, post-data) go to every
+//     stream, and so do the rows of the tables without a shard key.
+//   - Each row of a table with a shard key goes to the stream the hash of its key
+//     value picks: XXH3 (64 bits) of the value as text, the way COPY reads it
+//     (unescaped, so 'O''Brien' in an INSERT and O'Brien in COPY data hash the
+//     same), modulo N. NULL keys go to stream 0.
+//   - Rows come from converted INSERTs, from the COPY ... FROM stdin sections of
+//     the input and from the INSERT that holds the rows whose values aren't
+//     constants, where the key has to be a number or a string literal.
+//
+// Each stream has its own COPY framing: the COPY command is started on a stream
+// the first time a row goes there, and all streams end their block when the
+// target changes. The rows of a table whose key can't be found (an INSERT
+// without a column list before its CREATE TABLE, a key that isn't a constant,
+// INSERT ... SELECT) go to stream 0, with a warning.
+//
+// The key column is matched against the table the way the filters match names
+// (insert_to_copy_filter.h): "schema.table=column" or "table=column" for the
+// table in any schema, names as stored (without quotes, unquoted identifiers in
+// lower case).
+
+#define SHARD_HASH_SIZE 1024
+
+typedef struct ShardTable ShardTable;
+
+typedef struct {
+    char* table;                       // As stored, with or without the schema
+    char* column;
+} ShardKey;
+
+typedef struct {
+    OutputSink sink;
+    PgWire* wire;                      // Instead of the sink with --connect
+    bool block_open;                   // COPY command of the open block started here
+    ByteBuffer rows;                   // Rows of the statement at hand routed here
+    ByteBuffer fallback;               // INSERT with the rows that aren't constants, written after the block
+} ShardStream;
+
+typedef struct {
+    ShardStream* streams;
+    int n_streams;
+    bool input_mapped;
+
+    ShardKey* keys;
+    int n_keys;
+    ShardTable* table_hash[SHARD_HASH_SIZE];
+    ShardTable* last_table;            // Consecutive INSERTs are mostly into the same table
+
+    // Open COPY block, the same target on every stream (relation != NULL)
+    char* relation;
+    char* column_list;                 // " (a, b)" or ""
+    bool default_block;
+    ShardTable* block_table;
+    int block_key;                     // Field of the key in the rows, -1 to copy them to every stream
+
+    // COPY ... FROM stdin section of the input being routed
+    int copy_key;                      // Field of the key, -1 to copy the data to every stream
+    ShardTable* copy_table;
+
+    char* name;                        // Reused buffer for normalized names
+    size_t name_capacity;
+    ByteBuffer value;                  // Reused buffer for the unescaped key value
+    bool meta_command_warned;
+} ShardOutput;
+
+void shard_output_init(ShardOutput* output);
+// Adds "TABLE=COLUMN". Returns false if it isn't in that form.
+bool shard_output_add_key(ShardOutput* output, const char* spec);
+void shard_output_set_streams(ShardOutput* output, int n_streams, bool input_mapped);
+// Opens the file of each stream: path with "%d" replaced by the stream number, or
+// with the number inserted before the extension ("out.sql" -> "out.0.sql").
+// Returns false with errno set on failure.
+bool shard_output_open_files(ShardOutput* output, const char* path, bool use_io_uring);
+// Sends stream i to wire i instead, the connections stay owned by the caller
+void shard_output_use_wires(ShardOutput* output, PgWire* wires);
+// A statement that isn't a converted INSERT: written to every stream, or routed
+// when it is data of a COPY section of the input
+void shard_output_statement(ShardOutput* output, StatementSlice statement);
+// An INSERT that couldn't be converted (ON CONFLICT, RETURNING, ...): written to
+// every stream, or split by the key of its VALUES rows when its table has one
+void shard_output_insert(ShardOutput* output, StatementSlice statement);
+// The rows of a converted INSERT, the statement starting prefix_len bytes into it
+void shard_output_rows(ShardOutput* output, StatementSlice statement, size_t prefix_len, const PgQueryInsertToCopyResult* result);
+// Ends the open COPY block on every stream
+void shard_output_close_block(ShardOutput* output);
+// Ends the open block, closes the streams (but not the connections) and frees the rest
+void shard_output_close(ShardOutput* output);
+
+#endif
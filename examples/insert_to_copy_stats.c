@@ -0,0 +1,243 @@
+#include "insert_to_copy_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROGRESS_INTERVAL_NS 1000000000u
+
+struct StatsTable {
+    char* relation;
+    uint64_t statements;
+    uint64_t rows;
+    uint64_t input_bytes;
+    uint64_t copy_bytes;
+    uint64_t convert_ns;
+    size_t peak_buffered;
+    StatsTable* next_hash;
+    StatsTable* next;
+};
+
+static unsigned int hash_relation(const char* relation) {
+    unsigned int hash = 5381;
+    int c;
+    while ((c = (unsigned char)*relation++))
+        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+    return hash % STATS_HASH_SIZE;
+}
+
+static StatsTable* find_table(ConversionStats* stats, const char* relation) {
+    if (stats->last_table && strcmp(stats->last_table->relation, relation) == 0) {
+        return stats->last_table;
+    }
+
+    unsigned int bucket = hash_relation(relation);
+    StatsTable* table = stats->table_hash[bucket];
+    while (table && strcmp(table->relation, relation) != 0) {
+        table = table->next_hash;
+    }
+    if (!table) {
+        table = calloc(1, sizeof(StatsTable));
+        if (!table || !(table->relation = strdup(relation))) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
+        }
+        table->next_hash = stats->table_hash[bucket];
+        stats->table_hash[bucket] = table;
+        *stats->tables_tail = table;
+        stats->tables_tail = &table->next;
+    }
+    stats->last_table = table;
+    return table;
+}
+
+void stats_init(ConversionStats* stats, uint64_t input_size, bool progress) {
+    memset(stats, 0, sizeof(ConversionStats));
+    stats->tables_tail = &stats->tables;
+    stats->input_size = input_size;
+    stats->progress = progress;
+    stats->start_ns = stats_now_ns();
+    stats->next_progress_ns = stats->start_ns + PROGRESS_INTERVAL_NS;
+}
+
+// "1.5 GB", "12.0 MB", ...
+static void format_bytes(char* text, size_t size, double bytes) {
+    const char* units[] = { "B", "kB", "MB", "GB", "TB" };
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4) {
+        bytes /= 1024;
+        unit++;
+    }
+    snprintf(text, size, unit == 0 ? "%.0f %s" : "%.1f %s", bytes, units[unit]);
+}
+
+static void print_progress(ConversionStats* stats, uint64_t now) {
+    char done[32], total[32], rate[32];
+    double seconds = (double)(now - stats->start_ns) / 1e9;
+
+    format_bytes(done, sizeof(done), (double)stats->input_bytes);
+    format_bytes(rate, sizeof(rate), seconds > 0 ? stats->input_bytes / seconds : 0);
+    if (stats->input_size > 0) {
+        format_bytes(total, sizeof(total), (double)stats->input_size);
+        fprintf(stderr, "\r%s of %s (%.1f%%), %s/s   ", done, total, 100.0 * stats->input_bytes / stats->input_size, rate);
+    }
+    else {
+        fprintf(stderr, "\r%s, %s/s   ", done, rate);
+    }
+    fflush(stderr);
+}
+
+void stats_progress(ConversionStats* stats, uint64_t input_offset) {
+    stats->input_bytes = input_offset;
+    if (!stats->progress) {
+        return;
+    }
+    uint64_t now = stats_now_ns();
+    if (now >= stats->next_progress_ns) {
+        print_progress(stats, now);
+        stats->next_progress_ns = now + PROGRESS_INTERVAL_NS;
+    }
+}
+
+void stats_record_statement(ConversionStats* stats, size_t len, bool is_insert, const PgQueryInsertToCopyResult* result, uint64_t convert_ns) {
+    stats->statements++;
+    if (!is_insert) {
+        return;
+    }
+
+    stats->inserts++;
+    int bucket = 0;
+    for (uint64_t us = convert_ns / 1000; us > 0 && bucket < STATS_LATENCY_BUCKETS - 1; us >>= 1) {
+        bucket++;
+    }
+    stats->latency[bucket]++;
+
+    stats_record_rows(stats, result, convert_ns);
+    if (result->relation) {
+        StatsTable* table = find_table(stats, result->relation);
+        table->statements++;
+        table->input_bytes += len;
+    }
+}
+
+void stats_record_rows(ConversionStats* stats, const PgQueryInsertToCopyResult* result, uint64_t convert_ns) {
+    stats_add_phase(stats, STATS_CONVERT, convert_ns);
+    if (result->error) {
+        stats->parse_errors++;
+    }
+    if (!result->relation) {
+        stats->unconverted_inserts++;
+        return;
+    }
+
+    stats->rows += result->n_rows;
+    stats->copy_bytes += result->copy_data_len;
+    stats->fallback_rows += result->n_fallback_rows;
+
+    StatsTable* table = find_table(stats, result->relation);
+    table->rows += result->n_rows;
+    table->copy_bytes += result->copy_data_len;
+    table->convert_ns += convert_ns;
+}
+
+void stats_record_buffered(ConversionStats* stats, const char* relation, size_t bytes) {
+    StatsTable* table = find_table(stats, relation);
+    if (bytes > table->peak_buffered) {
+        table->peak_buffered = bytes;
+    }
+}
+
+static void write_json_string(FILE* file, const char* str) {
+    fputc('"', file);
+    for (const unsigned char* c = (const unsigned char*)str; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        }
+        else if (*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        }
+        else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static double per_second(uint64_t count, uint64_t ns) {
+    return ns > 0 ? count / ((double)ns / 1e9) : 0;
+}
+
+bool stats_write_report(ConversionStats* stats, const char* path) {
+    uint64_t elapsed = stats_now_ns() - stats->start_ns;
+
+    if (stats->progress) {
+        print_progress(stats, stats->start_ns + elapsed);
+        fputc('\n', stderr);
+    }
+
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"input_bytes\": %llu,\n", (unsigned long long)stats->input_bytes);
+    fprintf(file, "  \"elapsed_seconds\": %.6f,\n", elapsed / 1e9);
+    fprintf(file, "  \"bytes_per_second\": %.0f,\n", per_second(stats->input_bytes, elapsed));
+    fprintf(file, "  \"rows_per_second\": %.0f,\n", per_second(stats->rows, elapsed));
+    fprintf(file, "  \"statements\": %llu,\n", (unsigned long long)stats->statements);
+    fprintf(file, "  \"inserts\": %llu,\n", (unsigned long long)stats->inserts);
+    fprintf(file, "  \"rows\": %llu,\n", (unsigned long long)stats->rows);
+    fprintf(file, "  \"copy_bytes\": %llu,\n", (unsigned long long)stats->copy_bytes);
+    fprintf(file, "  \"fallback_rows\": %llu,\n", (unsigned long long)stats->fallback_rows);
+    fprintf(file, "  \"unconverted_inserts\": %llu,\n", (unsigned long long)stats->unconverted_inserts);
+    fprintf(file, "  \"parse_errors\": %llu,\n", (unsigned long long)stats->parse_errors);
+
+    const char* phases[STATS_N_PHASES] = { "read_split", "convert", "classify", "write" };
+    fprintf(file, "  \"phase_seconds\": {");
+    for (int i = 0; i < STATS_N_PHASES; i++) {
+        fprintf(file, "%s\"%s\": %.6f", i > 0 ? ", " : "", phases[i], stats->phase_ns[i] / 1e9);
+    }
+    fprintf(file, "},\n");
+
+    // Upper bound of each bucket in microseconds, "inf" for the last one
+    fprintf(file, "  \"convert_latency_us\": {");
+    int last = STATS_LATENCY_BUCKETS - 1;
+    while (last > 0 && stats->latency[last] == 0) {
+        last--;
+    }
+    for (int i = 0; i <= last; i++) {
+        if (i == STATS_LATENCY_BUCKETS - 1) {
+            fprintf(file, "%s\"inf\": %llu", i > 0 ? ", " : "", (unsigned long long)stats->latency[i]);
+        }
+        else {
+            fprintf(file, "%s\"%llu\": %llu", i > 0 ? ", " : "", 1ULL << i, (unsigned long long)stats->latency[i]);
+        }
+    }
+    fprintf(file, "},\n");
+
+    fprintf(file, "  \"tables\": [");
+    for (StatsTable* table = stats->tables; table; table = table->next) {
+        fprintf(file, "%s\n    {\"relation\": ", table == stats->tables ? "" : ",");
+        write_json_string(file, table->relation);
+        fprintf(file, ", \"statements\": %llu, \"rows\": %llu, \"input_bytes\": %llu, \"copy_bytes\": %llu, \"peak_buffered_bytes\": %llu,\n",
+                (unsigned long long)table->statements, (unsigned long long)table->rows, (unsigned long long)table->input_bytes,
+                (unsigned long long)table->copy_bytes, (unsigned long long)table->peak_buffered);
+        fprintf(file, "     \"convert_seconds\": %.6f, \"bytes_per_second\": %.0f, \"rows_per_second\": %.0f}",
+                table->convert_ns / 1e9, per_second(table->input_bytes, table->convert_ns), per_second(table->rows, table->convert_ns));
+    }
+    fprintf(file, "%s]\n}\n", stats->tables ? "\n  " : "");
+
+    return fclose(file) == 0;
+}
+
+void stats_free(ConversionStats* stats) {
+    StatsTable* table = stats->tables;
+    while (table) {
+        StatsTable* next = table->next;
+        free(table->relation);
+        free(table);
+        table = next;
+    }
+    memset(stats, 0, sizeof(ConversionStats));
+}
@@ -0,0 +1,106 @@
+#ifndef INSERT_TO_COPY_STATS_H
+#define INSERT_TO_COPY_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pg_query.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Instrumentation of insert_to_copy (--stats, --progress): time spent in each
+// phase of the conversion, counted with a monotonic clock, rows and bytes per
+// table, a histogram of the time pg_query_insert_to_copy takes per INSERT, and
+// a JSON report at the end:
+//
+//   read_split  reading the input and splitting it into statements (and the
+//               table filters), on the reading thread
+//   convert     pg_query_insert_to_copy, summed over the worker threads
+//   classify    pg_query_statement_info (--reorder, --filter-ddl)
+//   write       writing the output, on the writer thread
+//
+// With --jobs the phases overlap, so their sum can be more than the elapsed time.
+// The reading thread only touches the read_split time and the progress line, the
+// rest is counted by the thread that writes the statements, in input order.
+
+typedef enum {
+    STATS_READ_SPLIT,
+    STATS_CONVERT,
+    STATS_CLASSIFY,
+    STATS_WRITE,
+    STATS_N_PHASES
+} StatsPhase;
+
+// Bucket i counts conversions that took less than 2^i microseconds, the last
+// one the rest
+#define STATS_LATENCY_BUCKETS 24
+#define STATS_HASH_SIZE 1024
+
+typedef struct StatsTable StatsTable;
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t phase_ns[STATS_N_PHASES];
+    uint64_t input_size;               // 0 when unknown (a pipe)
+    uint64_t input_bytes;              // Read so far
+
+    uint64_t statements;
+    uint64_t inserts;
+    uint64_t rows;                     // Written as COPY rows
+    uint64_t copy_bytes;
+    uint64_t fallback_rows;            // Rows with values that aren't constants, left as INSERT
+    uint64_t unconverted_inserts;      // INSERTs written as they are (ON CONFLICT, ...)
+    uint64_t parse_errors;
+    uint64_t latency[STATS_LATENCY_BUCKETS];
+
+    StatsTable* table_hash[STATS_HASH_SIZE];
+    StatsTable* tables;                // In the order they first came up
+    StatsTable** tables_tail;
+    StatsTable* last_table;            // Consecutive INSERTs are mostly into the same table
+
+    bool progress;                     // Progress line on stderr
+    uint64_t next_progress_ns;
+} ConversionStats;
+
+static inline uint64_t stats_now_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+void stats_init(ConversionStats* stats, uint64_t input_size, bool progress);
+
+static inline void stats_add_phase(ConversionStats* stats, StatsPhase phase, uint64_t ns) {
+    stats->phase_ns[phase] += ns;
+}
+
+// Updates the progress line with the input read so far, at most once a second
+void stats_progress(ConversionStats* stats, uint64_t input_offset);
+// A statement about to be written. is_insert tells an INSERT, convert_ns is the
+// time pg_query_insert_to_copy took on it.
+void stats_record_statement(ConversionStats* stats, size_t len, bool is_insert, const PgQueryInsertToCopyResult* result, uint64_t convert_ns);
+// A batch of rows of a long INSERT converted a batch at a time, after the first
+// one, which is recorded as the statement
+void stats_record_rows(ConversionStats* stats, const PgQueryInsertToCopyResult* result, uint64_t convert_ns);
+// Bytes of the table held back in memory (rows waiting for the end of the COPY block)
+void stats_record_buffered(ConversionStats* stats, const char* relation, size_t bytes);
+// Ends the progress line and writes the report. Returns false with errno set on failure.
+bool stats_write_report(ConversionStats* stats, const char* path);
+void stats_free(ConversionStats* stats);
+
+#endif
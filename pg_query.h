@@ -70,6 +70,79 @@ typedef struct {
   PgQueryError* error;
 } PgQueryNormalizeResult;
 
+typedef struct {
+  char* relation; // target table, quoted as needed; NULL if the statement can't be converted to COPY
+  char** columns; // quoted target column names, NULL if the INSERT has no column list
+  int n_columns;
+  char* copy_data; // rows in COPY text format, each terminated by a newline
+  size_t copy_data_len;
+  int n_rows; // rows in copy_data, 0 if all of them are in fallback_insert
+  int has_default; // DEFAULT values are written as PG_QUERY_COPY_DEFAULT, the COPY command needs WITH (DEFAULT '\D')
+  char* fallback_insert; // "INSERT INTO target VALUES (...), ..." with the rows whose values aren't constants, or NULL
+  size_t fallback_values_offset; // where the rows start in fallback_insert
+  int n_fallback_rows;
+  char* stderr_buffer;
+  PgQueryError* error;
+} PgQueryInsertToCopyResult;
+
+// COPY text of a DEFAULT value, for the DEFAULT option of COPY (PostgreSQL 16 and later)
+#define PG_QUERY_COPY_DEFAULT "\\D"
+
+// Called by pg_query_insert_to_copy_rows with the conversion of each batch of
+// rows, as if they were an INSERT of their own. The result is freed after the
+// call, unless the callback takes over its fields (setting them to NULL).
+// For a batch that can't be converted, fallback_insert is the INSERT of the
+// rows from that batch to the end of the statement.
+typedef void (*PgQueryInsertToCopyRowsCallback)(PgQueryInsertToCopyResult* rows, void* context);
+
+typedef enum {
+  PG_QUERY_COLUMN_DEFINE = 0, // column of a CREATE TABLE, or added by ALTER TABLE ... ADD COLUMN
+  PG_QUERY_COLUMN_SET_DEFAULT, // ALTER COLUMN ... SET DEFAULT or ADD GENERATED ... AS IDENTITY
+  PG_QUERY_COLUMN_DROP_DEFAULT, // ALTER COLUMN ... DROP DEFAULT or DROP IDENTITY
+  PG_QUERY_COLUMN_DROP_EXPRESSION, // ALTER COLUMN ... DROP EXPRESSION, the column is no longer generated
+  PG_QUERY_COLUMN_DROP // DROP COLUMN
+} PgQueryColumnChange;
+
+typedef struct {
+  char* name; // quoted column name
+  char* type_name; // type as written, with qualified names joined by "." (e.g. "pg_catalog.int4", "text"); NULL unless defined here
+  int is_array;
+  int has_default; // DEFAULT, identity or serial type: a row that leaves the column out gets that instead of NULL
+  int is_generated; // GENERATED ALWAYS AS (...) STORED, rows can't give it a value
+  PgQueryColumnChange change;
+} PgQueryColumnDef;
+
+typedef struct {
+  char* relation; // table name, quoted as needed; NULL if the statement isn't a CREATE TABLE or an ALTER TABLE changing columns
+  PgQueryColumnDef* columns; // columns in table order, or the changes of an ALTER TABLE in the order it makes them
+  int n_columns;
+  int is_alter_table; // ALTER TABLE: the columns are changes to those of the table
+  int has_inherited_columns; // INHERITS, PARTITION OF or OF type: columns are missing from the list
+  char* stderr_buffer;
+  PgQueryError* error;
+} PgQueryTableDefResult;
+
+typedef enum {
+  PG_QUERY_STATEMENT_PRE_DATA = 0, // schema objects, and anything not listed below
+  PG_QUERY_STATEMENT_CREATE_TABLE, // CREATE TABLE of a table that holds rows itself (not a partitioned table)
+  PG_QUERY_STATEMENT_DATA, // INSERT, UPDATE, DELETE, MERGE, TRUNCATE, COPY FROM
+  PG_QUERY_STATEMENT_POST_DATA, // indexes, constraints and triggers added later, rules, policies, extended statistics
+  PG_QUERY_STATEMENT_SETTING, // SET, RESET, SELECT set_config(...)
+  PG_QUERY_STATEMENT_TRANSACTION, // BEGIN, COMMIT, ROLLBACK, SAVEPOINT, ...
+  PG_QUERY_STATEMENT_NO_TRANSACTION, // can't run inside a transaction block (CREATE DATABASE, VACUUM, ...)
+  PG_QUERY_STATEMENT_SEQUENCE_VALUE // SELECT setval(...), relations[0] is the sequence
+} PgQueryStatementKind;
+
+typedef struct {
+  PgQueryStatementKind kind;
+  char** relations; // quoted names of the tables and sequences the statement refers to, the one it creates, alters or writes first
+  int n_relations;
+  int uses_unlisted_relations; // DO, CALL, REFRESH, a SELECT other than setval / set_config, statements on objects that tables may depend on (functions, types, schemas), or several statements
+  char* setting; // SETTING: name of the setting in lower case (e.g. "search_path"), NULL for RESET ALL or when it isn't known
+  char* stderr_buffer;
+  PgQueryError* error;
+} PgQueryStatementInfoResult;
+
 // Postgres parser options (parse mode and GUCs that affect parsing)
 
 typedef enum
@@ -119,6 +192,34 @@ PgQuerySplitResult pg_query_split_with_parser(const char *input);
 
 PgQueryDeparseResult pg_query_deparse_protobuf(PgQueryProtobuf parse_tree);
 
+// Converts a single "INSERT INTO ... VALUES (...)" statement into the rows of
+// an equivalent "COPY ... FROM stdin" in text format, without going through
+// the JSON parse tree output.
+PgQueryInsertToCopyResult pg_query_insert_to_copy(const char* input);
+PgQueryInsertToCopyResult pg_query_insert_to_copy_opts(const char* input, int parser_options);
+PgQueryInsertToCopyResult pg_query_insert_to_copy_len(const char* input, size_t len, int parser_options);
+
+// Converts an INSERT with a long VALUES list a batch of rows (about batch_size
+// bytes of the statement) at a time, so that only the parse tree of one batch
+// is held in memory, handing each batch to callback as soon as it is
+// converted. Conversion stops after a batch that can't be converted (relation
+// NULL, or error set). Returns 0 without calling callback if the statement is
+// not "INSERT ... VALUES (...), ..." with nothing after the rows.
+// pg_query_insert_to_copy_len does this by itself for long statements.
+int pg_query_insert_to_copy_rows(const char* input, size_t len, int parser_options, size_t batch_size,
+                                 PgQueryInsertToCopyRowsCallback callback, void* context);
+
+// Returns the column definitions of a single "CREATE TABLE" statement, or the
+// columns an "ALTER TABLE" adds, drops or changes the default of, e.g. to know
+// the column types when writing binary COPY data
+PgQueryTableDefResult pg_query_table_def(const char* input);
+PgQueryTableDefResult pg_query_table_def_len(const char* input, size_t len, int parser_options);
+
+// Classifies a single statement by the section of a dump it belongs to, and
+// lists the relations it depends on, e.g. to move index builds after the data
+PgQueryStatementInfoResult pg_query_statement_info(const char* input);
+PgQueryStatementInfoResult pg_query_statement_info_len(const char* input, size_t len, int parser_options);
+
 void pg_query_free_normalize_result(PgQueryNormalizeResult result);
 void pg_query_free_scan_result(PgQueryScanResult result);
 void pg_query_free_parse_result(PgQueryParseResult result);
@@ -127,6 +228,9 @@ void pg_query_free_deparse_result(PgQueryDeparseResult result);
 void pg_query_free_protobuf_parse_result(PgQueryProtobufParseResult result);
 void pg_query_free_plpgsql_parse_result(PgQueryPlpgsqlParseResult result);
 void pg_query_free_fingerprint_result(PgQueryFingerprintResult result);
+void pg_query_free_insert_to_copy_result(PgQueryInsertToCopyResult result);
+void pg_query_free_table_def_result(PgQueryTableDefResult result);
+void pg_query_free_statement_info_result(PgQueryStatementInfoResult result);
 
 // Optional, cleans up the top-level memory context (automatically done for threads that exit)
 void pg_query_exit(void);
@@ -1,5 +1,6 @@
 #include "pg_query.h"
 #include "pg_query_internal.h"
+#include "pg_query_copy.h"
 
 #include <mb/pg_wchar.h>
 #include <utils/memutils.h>
@@ -17,7 +18,13 @@ __thread sig_atomic_t pg_query_initialized = 0;
 
 #ifdef HAVE_PTHREAD
 static pthread_key_t pg_query_thread_exit_key;
+static pthread_once_t pg_query_thread_exit_key_once = PTHREAD_ONCE_INIT;
 static void pg_query_thread_exit(void *key);
+
+static void pg_query_create_thread_exit_key(void)
+{
+	pthread_key_create(&pg_query_thread_exit_key, pg_query_thread_exit);
+}
 #endif
 
 void pg_query_init(void)
@@ -29,7 +36,7 @@ void pg_query_init(void)
 	SetDatabaseEncoding(PG_UTF8);
 
 #ifdef HAVE_PTHREAD
-	pthread_key_create(&pg_query_thread_exit_key, pg_query_thread_exit);
+	pthread_once(&pg_query_thread_exit_key_once, pg_query_create_thread_exit_key);
 	pthread_setspecific(pg_query_thread_exit_key, TopMemoryContext);
 #endif
 }
@@ -46,20 +53,27 @@ void pg_query_free_top_memory_context(MemoryContext context)
 
 	MemoryContextDeleteChildren(context);
 
-	/* Clean up the aset.c freelist, to leave no unused context behind */
-	AllocSetDeleteFreeList(context);
-
+	/*
+	 * Deleting the context puts it on the aset.c freelist like its children,
+	 * so clean up the freelist afterwards: that frees them all, and leaves no
+	 * freed context for the next pg_query_init to pick up
+	 */
 	context->methods->delete_context(context);
 
-	VALGRIND_DESTROY_MEMPOOL(context);
+	AllocSetDeleteFreeList(context);
 
-	/* Without this, Valgrind will complain */
-	free(context);
+	VALGRIND_DESTROY_MEMPOOL(context);
 
 	/* Reset pointers */
 	TopMemoryContext = NULL;
 	CurrentMemoryContext = NULL;
 	ErrorContext = NULL;
+
+	/* Caches allocated under the context went with it */
+	pg_query_insert_to_copy_reset_cache();
+
+	/* The next call sets up the memory contexts again */
+	pg_query_initialized = 0;
 }
 
 #ifdef HAVE_PTHREAD
@@ -72,6 +86,11 @@ static void pg_query_thread_exit(void *key)
 
 void pg_query_exit(void)
 {
+	if (pg_query_initialized == 0) return;
+
+#ifdef HAVE_PTHREAD
+	pthread_setspecific(pg_query_thread_exit_key, NULL);
+#endif
 	pg_query_free_top_memory_context(TopMemoryContext);
 }
 
@@ -0,0 +1,760 @@
+#include "pg_query.h"
+#include "pg_query_internal.h"
+#include "pg_query_copy.h"
+
+#include "gramparse.h"
+#include "lib/stringinfo.h"
+#include "nodes/parsenodes.h"
+#include "parser/parser.h"
+#include "utils/builtins.h"
+
+#include <ctype.h>
+
+/*
+ * Conversion of "INSERT INTO ... VALUES (...)" statements into COPY text
+ * format rows, working directly on the raw parse tree.
+ *
+ * Only statements whose effect can be reproduced exactly by COPY are
+ * converted: a single INSERT with a plain VALUES list, no WITH, ON CONFLICT
+ * or RETURNING clause. Values are literals, casts of literals, signed
+ * numbers, ARRAY[...] and ROW(...) of those and DEFAULT; rows with any other
+ * value come back as a separate INSERT. Anything else is reported back as not
+ * converted (relation == NULL) so callers can pass the original statement
+ * through unchanged.
+ *
+ * Statements in the exact shape pg_dump writes are handled by the scanner in
+ * pg_query_copy_fast.c first, and only go through the parser if it gives up.
+ * Long statements go through the parser a batch of rows at a time
+ * (pg_query_copy_rows.c).
+ */
+
+/*
+ * Append a string value escaped for COPY text format, matching what
+ * CopyAttributeOutText in the server emits for the default delimiter.
+ */
+static void
+append_copy_text(StringInfo str, const char *s)
+{
+	size_t		len = strlen(s);
+	size_t		written;
+
+	enlargeStringInfo(str, (int) (len * 2));
+	pg_query_copy_escape(str->data + str->len, &written, s, len, 0);
+	str->len += written;
+	str->data[str->len] = '\0';
+}
+
+/*
+ * Type names a cast of a number keeps the number's text for: integer types
+ * take integer literals, the others any numeric literal
+ */
+typedef enum
+{
+	CAST_TARGET_OTHER,
+	CAST_TARGET_INTEGER,
+	CAST_TARGET_NUMERIC,
+	CAST_TARGET_BOOL
+} CastTarget;
+
+static CastTarget
+cast_target(TypeName *type_name)
+{
+	const char *name;
+
+	if (list_length(type_name->names) > 2 ||
+		(list_length(type_name->names) == 2 && strcmp(strVal(linitial(type_name->names)), "pg_catalog") != 0))
+		return CAST_TARGET_OTHER;
+
+	name = strVal(llast(type_name->names));
+	if (strcmp(name, "int2") == 0 || strcmp(name, "int4") == 0 || strcmp(name, "int8") == 0)
+		return CAST_TARGET_INTEGER;
+	if (strcmp(name, "numeric") == 0 || strcmp(name, "float4") == 0 || strcmp(name, "float8") == 0)
+		return CAST_TARGET_NUMERIC;
+	if (strcmp(name, "bool") == 0)
+		return CAST_TARGET_BOOL;
+	return CAST_TARGET_OTHER;
+}
+
+/*
+ * Whether casting the constant to the (element) type gives what the type's
+ * input function makes of the constant's text, which is what COPY calls.
+ * String literals are of unknown type, so their cast calls the input
+ * function itself; numbers and booleans only keep their text for the types
+ * they are read as anyway, e.g. 1.5::integer rounds while int4in rejects it.
+ */
+static bool
+constant_fits_cast(Node *node, CastTarget target)
+{
+	if (IsA(node, A_ArrayExpr))
+	{
+		ListCell   *lc;
+
+		foreach(lc, castNode(A_ArrayExpr, node)->elements)
+		{
+			if (!constant_fits_cast(lfirst(lc), target))
+				return false;
+		}
+		return true;
+	}
+
+	if (IsA(node, A_Const))
+	{
+		A_Const    *a_const = castNode(A_Const, node);
+
+		if (a_const->isnull)
+			return true;
+
+		switch (nodeTag(&a_const->val))
+		{
+			case T_String:
+				return true;
+			case T_Integer:
+				return target == CAST_TARGET_INTEGER || target == CAST_TARGET_NUMERIC;
+			case T_Float:
+				/* Integers too large for an int4 are Float nodes with just digits */
+				return target == CAST_TARGET_NUMERIC ||
+					(target == CAST_TARGET_INTEGER &&
+					 strspn(castNode(Float, &a_const->val)->fval, "-0123456789") == strlen(castNode(Float, &a_const->val)->fval));
+			case T_Boolean:
+				return target == CAST_TARGET_BOOL;
+			default:
+				return false;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Casts are taken to be to the column's type, as pg_dump and ORMs write
+ * them. Type modifiers are left to the server: an explicit cast to
+ * varchar(n) truncates where COPY into the column would fail.
+ */
+static bool
+cast_keeps_text(TypeCast *type_cast)
+{
+	TypeName   *type_name = type_cast->typeName;
+	CastTarget	target;
+
+	if (type_name->typmods != NIL || type_name->setof || type_name->pct_type)
+		return false;
+
+	/* A composite type's fields are read by their own input functions either way */
+	if (IsA(type_cast->arg, RowExpr))
+		return type_name->arrayBounds == NIL;
+
+	target = cast_target(type_name);
+	if (type_name->arrayBounds != NIL)
+	{
+		/* Array literals in a string are read by array_in, like COPY does */
+		if (IsA(type_cast->arg, A_Const))
+		{
+			A_Const    *a_const = castNode(A_Const, type_cast->arg);
+
+			return a_const->isnull || IsA(&a_const->val, String);
+		}
+		return IsA(type_cast->arg, A_ArrayExpr) && constant_fits_cast(type_cast->arg, target);
+	}
+
+	return IsA(type_cast->arg, A_Const) && constant_fits_cast(type_cast->arg, target);
+}
+
+static bool append_constant_text(StringInfo str, Node *node, bool *isnull);
+
+/* Room for the text of any Integer value */
+#define INTEGER_TEXT_LEN 12
+
+/*
+ * Returns the text of a literal that isn't NULL as the type's input function
+ * reads it, or NULL for a kind of value that isn't handled. Integers are
+ * formatted into buf, which needs INTEGER_TEXT_LEN bytes.
+ */
+static const char *
+a_const_text(A_Const *a_const, char *buf)
+{
+	switch (nodeTag(&a_const->val))
+	{
+		case T_Integer:
+			snprintf(buf, INTEGER_TEXT_LEN, "%d", intVal(&a_const->val));
+			return buf;
+		case T_Float:
+			return castNode(Float, &a_const->val)->fval;
+		case T_Boolean:
+			return boolVal(&a_const->val) ? "t" : "f";
+		case T_String:
+			return strVal(&a_const->val);
+		case T_BitString:
+			/* bit_in accepts the scanner's "b" / "x" prefixed form */
+			return castNode(BitString, &a_const->val)->bsval;
+		default:
+			return NULL;
+	}
+}
+
+/* Appends an array element or composite field, quoted like array_out and record_out do */
+static bool
+append_quoted_element(StringInfo str, StringInfo element, Node *node, bool array, bool *isnull)
+{
+	bool		quote;
+
+	resetStringInfo(element);
+	if (!append_constant_text(element, node, isnull))
+		return false;
+	if (*isnull)
+	{
+		/* A NULL field of a composite is left empty */
+		if (array)
+			appendStringInfoString(str, "NULL");
+		return true;
+	}
+
+	quote = element->len == 0 || (array && pg_strcasecmp(element->data, "NULL") == 0);
+	for (int i = 0; i < element->len && !quote; i++)
+	{
+		char		c = element->data[i];
+
+		quote = c == '"' || c == '\\' || c == ',' || isspace((unsigned char) c) ||
+			(array ? (c == '{' || c == '}') : (c == '(' || c == ')'));
+	}
+
+	if (!quote)
+	{
+		appendBinaryStringInfo(str, element->data, element->len);
+		return true;
+	}
+
+	appendStringInfoChar(str, '"');
+	for (int i = 0; i < element->len; i++)
+	{
+		char		c = element->data[i];
+
+		/* array_in takes a backslash before them, record_in a doubled character */
+		if (c == '"' || c == '\\')
+			appendStringInfoChar(str, array ? '\\' : c);
+		appendStringInfoChar(str, c);
+	}
+	appendStringInfoChar(str, '"');
+	return true;
+}
+
+/*
+ * Appends the text of a constant expression as the type's input function
+ * reads it, before COPY escaping, or returns false if the expression isn't
+ * one: casts of literals, signed numbers, ARRAY[...] and ROW(...) of
+ * constants. Sets *isnull if the value is NULL.
+ */
+static bool
+append_constant_text(StringInfo str, Node *node, bool *isnull)
+{
+	*isnull = false;
+
+	switch (nodeTag(node))
+	{
+		case T_A_Const:
+			{
+				A_Const    *a_const = castNode(A_Const, node);
+				char		buf[INTEGER_TEXT_LEN];
+				const char *text;
+
+				if (a_const->isnull)
+				{
+					*isnull = true;
+					return true;
+				}
+
+				text = a_const_text(a_const, buf);
+				if (text == NULL)
+					return false;
+				appendStringInfoString(str, text);
+				return true;
+			}
+
+		case T_TypeCast:
+			{
+				TypeCast   *type_cast = castNode(TypeCast, node);
+
+				if (!cast_keeps_text(type_cast))
+					return false;
+				return append_constant_text(str, type_cast->arg, isnull);
+			}
+
+		case T_A_Expr:
+			{
+				/* Unary minus or plus of a number, e.g. -1::integer, which the grammar doesn't fold */
+				A_Expr	   *a_expr = castNode(A_Expr, node);
+				Node	   *operand = a_expr->rexpr;
+				const char *op;
+				int			start = str->len;
+
+				if (a_expr->kind != AEXPR_OP || a_expr->lexpr != NULL || list_length(a_expr->name) != 1)
+					return false;
+				op = strVal(linitial(a_expr->name));
+				if (strcmp(op, "-") != 0 && strcmp(op, "+") != 0)
+					return false;
+
+				if (IsA(operand, TypeCast))
+				{
+					CastTarget	target = cast_target(castNode(TypeCast, operand)->typeName);
+
+					if (target != CAST_TARGET_INTEGER && target != CAST_TARGET_NUMERIC)
+						return false;
+				}
+				else if (!IsA(operand, A_Const) ||
+						 (!IsA(&castNode(A_Const, operand)->val, Integer) && !IsA(&castNode(A_Const, operand)->val, Float)))
+					return false;
+
+				if (!append_constant_text(str, operand, isnull))
+					return false;
+				if (*isnull)
+					return true;
+
+				if (str->data[start] != '-' && str->data[start] != '.' && !isdigit((unsigned char) str->data[start]))
+					return false;
+				if (op[0] == '+')
+					return true;
+
+				if (str->data[start] == '-')
+				{
+					memmove(str->data + start, str->data + start + 1, str->len - start);
+					str->len--;
+				}
+				else
+				{
+					enlargeStringInfo(str, 1);
+					memmove(str->data + start + 1, str->data + start, str->len - start + 1);
+					str->data[start] = '-';
+					str->len++;
+				}
+				return true;
+			}
+
+		case T_A_ArrayExpr:
+			{
+				StringInfoData element;
+				ListCell   *lc;
+				bool		element_isnull;
+
+				initStringInfo(&element);
+				appendStringInfoChar(str, '{');
+				foreach(lc, castNode(A_ArrayExpr, node)->elements)
+				{
+					Node	   *element_node = lfirst(lc);
+
+					if (foreach_current_index(lc) > 0)
+						appendStringInfoChar(str, ',');
+					/* Sub-arrays of a multidimensional array go in as they are */
+					if (IsA(element_node, A_ArrayExpr))
+					{
+						if (!append_constant_text(str, element_node, &element_isnull))
+							return false;
+					}
+					else if (!append_quoted_element(str, &element, element_node, true, &element_isnull))
+						return false;
+				}
+				appendStringInfoChar(str, '}');
+				return true;
+			}
+
+		case T_RowExpr:
+			{
+				StringInfoData field;
+				ListCell   *lc;
+				bool		field_isnull;
+
+				initStringInfo(&field);
+				appendStringInfoChar(str, '(');
+				foreach(lc, castNode(RowExpr, node)->args)
+				{
+					if (foreach_current_index(lc) > 0)
+						appendStringInfoChar(str, ',');
+					if (!append_quoted_element(str, &field, lfirst(lc), false, &field_isnull))
+						return false;
+				}
+				appendStringInfoChar(str, ')');
+				return true;
+			}
+
+		default:
+			return false;
+	}
+}
+
+/*
+ * Appends a value in COPY text format. DEFAULT is written as the marker the
+ * COPY command's DEFAULT option is set to, and counted in *n_defaults.
+ */
+static bool
+append_copy_value(StringInfo str, StringInfo scratch, Node *node, int *n_defaults)
+{
+	bool		isnull;
+
+	/* Literals are escaped straight from the parse tree, without the scratch copy */
+	if (IsA(node, A_Const))
+	{
+		A_Const    *a_const = castNode(A_Const, node);
+		char		buf[INTEGER_TEXT_LEN];
+		const char *text;
+
+		if (a_const->isnull)
+		{
+			appendStringInfoString(str, "\\N");
+			return true;
+		}
+
+		text = a_const_text(a_const, buf);
+		if (text == NULL)
+			return false;
+		append_copy_text(str, text);
+		return true;
+	}
+
+	if (IsA(node, SetToDefault))
+	{
+		appendStringInfoString(str, PG_QUERY_COPY_DEFAULT);
+		(*n_defaults)++;
+		return true;
+	}
+
+	resetStringInfo(scratch);
+	if (!append_constant_text(scratch, node, &isnull))
+		return false;
+	if (isnull)
+		appendStringInfoString(str, "\\N");
+	else
+		append_copy_text(str, scratch->data);
+	return true;
+}
+
+/*
+ * Finds the text of each row of the VALUES list in the statement, from its
+ * opening to its closing parenthesis: after the VALUES keyword, each
+ * parenthesis at the top level starts a row. Returns false if there aren't
+ * as many rows as expected.
+ */
+static bool
+find_row_locations(const char *statement, int parser_options, int *starts, int *ends, int n_rows)
+{
+	core_yyscan_t yyscanner;
+	core_yy_extra_type yyextra;
+	core_YYSTYPE yylval;
+	YYLTYPE		yylloc;
+	bool		values = false;
+	int			depth = 0;
+	int			row = 0;
+	int			token;
+
+	/* Same settings as the parse, without its warnings this time */
+	standard_conforming_strings = (parser_options & PG_QUERY_DISABLE_STANDARD_CONFORMING_STRINGS) != PG_QUERY_DISABLE_STANDARD_CONFORMING_STRINGS;
+	escape_string_warning = false;
+
+	yyscanner = scanner_init(statement, &yyextra, &ScanKeywords, ScanKeywordTokens);
+	while (row < n_rows && (token = core_yylex(&yylval, &yylloc, yyscanner)) != 0)
+	{
+		if (token == VALUES && depth == 0)
+			values = true;
+		else if (token == '(')
+		{
+			if (values && depth == 0)
+				starts[row] = yylloc;
+			depth++;
+		}
+		else if (token == ')')
+		{
+			depth--;
+			if (values && depth == 0)
+				ends[row++] = yylloc + 1;
+		}
+	}
+	scanner_finish(yyscanner);
+
+	standard_conforming_strings = true;
+	escape_string_warning = true;
+
+	return row == n_rows;
+}
+
+static void
+append_target(StringInfo str, PgQueryInsertToCopyResult *result)
+{
+	appendStringInfoString(str, result->relation);
+	for (int i = 0; i < result->n_columns; i++)
+		appendStringInfo(str, "%s%s", i == 0 ? " (" : ", ", result->columns[i]);
+	if (result->n_columns > 0)
+		appendStringInfoChar(str, ')');
+}
+
+/*
+ * Fills in the result for a single parsed InsertStmt, leaving it untouched
+ * if the statement can't be represented as COPY rows.
+ *
+ * Rows with values that aren't constants (now(), nextval(...), subqueries)
+ * are left out of the COPY rows and returned as an INSERT of their own, with
+ * their text from the statement, so the constant rows still go to COPY.
+ */
+static void
+insert_stmt_to_copy(InsertStmt *stmt, const char *statement, int parser_options, StringInfo data, PgQueryInsertToCopyResult *result)
+{
+	SelectStmt *select_stmt;
+	StringInfoData scratch;
+	ListCell   *lc;
+	int			n_values = list_length(stmt->cols);
+	bool	   *converted;
+	bool	   *all_default;
+	int			n_converted = 0;
+	int			n_defaults = 0;
+	int			n_dropped = 0;
+	int			n_rows;
+	int		   *starts = NULL;
+	int		   *ends = NULL;
+
+	if (stmt->withClause != NULL || stmt->onConflictClause != NULL ||
+		stmt->returningList != NIL || stmt->override == OVERRIDING_USER_VALUE)
+		return;
+
+	if (stmt->selectStmt == NULL || !IsA(stmt->selectStmt, SelectStmt))
+		return;
+
+	select_stmt = castNode(SelectStmt, stmt->selectStmt);
+	if (select_stmt->valuesLists == NIL || select_stmt->withClause != NULL ||
+		select_stmt->sortClause != NIL || select_stmt->limitCount != NULL ||
+		select_stmt->limitOffset != NULL || select_stmt->lockingClause != NIL)
+		return;
+
+	foreach(lc, stmt->cols)
+	{
+		ResTarget  *res_target = castNode(ResTarget, lfirst(lc));
+
+		/* Assignments to array elements or composite fields have no COPY equivalent */
+		if (res_target->indirection != NIL)
+			return;
+	}
+
+	initStringInfo(&scratch);
+	n_rows = list_length(select_stmt->valuesLists);
+	converted = palloc(sizeof(bool) * n_rows);
+	all_default = palloc(sizeof(bool) * (n_values > 0 ? n_values : 1));
+	for (int i = 0; i < n_values; i++)
+		all_default[i] = true;
+
+	foreach(lc, select_stmt->valuesLists)
+	{
+		List	   *row = castNode(List, lfirst(lc));
+		int			row_start = data->len;
+		int			row_defaults = 0;
+		ListCell   *lc2;
+
+		converted[foreach_current_index(lc)] = true;
+		foreach(lc2, row)
+		{
+			if (foreach_current_index(lc2) > 0)
+				appendStringInfoChar(data, '\t');
+			if (!append_copy_value(data, &scratch, lfirst(lc2), &row_defaults))
+			{
+				converted[foreach_current_index(lc)] = false;
+				break;
+			}
+		}
+
+		if (!converted[foreach_current_index(lc)])
+		{
+			data->len = row_start;
+			data->data[row_start] = '\0';
+			continue;
+		}
+		appendStringInfoChar(data, '\n');
+		n_converted++;
+		n_defaults += row_defaults;
+
+		if (list_length(row) != n_values)
+			n_values = 0;
+		for (int i = 0; i < n_values; i++)
+			all_default[i] = all_default[i] && IsA(list_nth(row, i), SetToDefault);
+	}
+
+	if (n_converted < n_rows)
+	{
+		/* The server adds OVERRIDING SYSTEM VALUE to COPY itself, but not to the INSERT */
+		if (stmt->override == OVERRIDING_SYSTEM_VALUE)
+			return;
+
+		starts = palloc(sizeof(int) * n_rows);
+		ends = palloc(sizeof(int) * n_rows);
+		if (!find_row_locations(statement, parser_options, starts, ends, n_rows))
+			return;
+	}
+
+	result->n_rows = n_converted;
+
+	if (stmt->relation->schemaname != NULL)
+	{
+		StringInfoData relation;
+
+		initStringInfo(&relation);
+		appendStringInfo(&relation, "%s.%s",
+						 quote_identifier(stmt->relation->schemaname),
+						 quote_identifier(stmt->relation->relname));
+		result->relation = strdup(relation.data);
+	}
+	else
+	{
+		result->relation = strdup(quote_identifier(stmt->relation->relname));
+	}
+
+	/*
+	 * Columns that are DEFAULT in every row are left out of the column list,
+	 * which needs no DEFAULT option (PostgreSQL 16) on the COPY command. The
+	 * INSERT with the other rows needs all of them, so that only works when
+	 * there is none.
+	 */
+	if (n_defaults > 0 && n_values > 0 && n_converted == n_rows)
+	{
+		for (int i = 0; i < n_values; i++)
+			n_dropped += all_default[i] ? 1 : 0;
+		if (n_dropped == n_values)
+			n_dropped = 0;
+	}
+
+	if (n_dropped > 0)
+	{
+		resetStringInfo(data);
+		n_defaults = 0;
+		foreach(lc, select_stmt->valuesLists)
+		{
+			ListCell   *lc2;
+			bool		first = true;
+
+			foreach(lc2, castNode(List, lfirst(lc)))
+			{
+				if (all_default[foreach_current_index(lc2)])
+					continue;
+				if (!first)
+					appendStringInfoChar(data, '\t');
+				append_copy_value(data, &scratch, lfirst(lc2), &n_defaults);
+				first = false;
+			}
+			appendStringInfoChar(data, '\n');
+		}
+	}
+
+	result->has_default = n_defaults > 0;
+
+	result->n_columns = list_length(stmt->cols) - n_dropped;
+	if (result->n_columns > 0)
+	{
+		int			column = 0;
+
+		result->columns = malloc(sizeof(char *) * result->n_columns);
+		foreach(lc, stmt->cols)
+		{
+			if (n_dropped == 0 || !all_default[foreach_current_index(lc)])
+				result->columns[column++] = strdup(quote_identifier(castNode(ResTarget, lfirst(lc))->name));
+		}
+	}
+
+	result->copy_data = malloc(data->len + 1);
+	memcpy(result->copy_data, data->data, data->len + 1);
+	result->copy_data_len = data->len;
+
+	if (n_converted < n_rows)
+	{
+		StringInfoData insert;
+
+		initStringInfo(&insert);
+		appendStringInfoString(&insert, "INSERT INTO ");
+		append_target(&insert, result);
+		appendStringInfoString(&insert, " VALUES ");
+		result->fallback_values_offset = insert.len;
+		for (int i = 0, n = 0; i < n_rows; i++)
+		{
+			if (converted[i])
+				continue;
+			if (n++ > 0)
+				appendStringInfoString(&insert, ", ");
+			appendBinaryStringInfo(&insert, statement + starts[i], ends[i] - starts[i]);
+		}
+		result->fallback_insert = strdup(insert.data);
+		result->n_fallback_rows = n_rows - n_converted;
+	}
+}
+
+PgQueryInsertToCopyResult pg_query_insert_to_copy(const char* input)
+{
+	return pg_query_insert_to_copy_opts(input, PG_QUERY_PARSE_DEFAULT);
+}
+
+PgQueryInsertToCopyResult pg_query_insert_to_copy_opts(const char* input, int parser_options)
+{
+	return pg_query_insert_to_copy_len(input, strlen(input), parser_options);
+}
+
+PgQueryInsertToCopyResult pg_query_insert_to_copy_len(const char* input, size_t len, int parser_options)
+{
+	PgQueryInsertToCopyResult result = {0};
+
+	// The fast path assumes the default parser settings (e.g. standard_conforming_strings)
+	if (parser_options == PG_QUERY_PARSE_DEFAULT && pg_query_insert_to_copy_fast(input, len, &result))
+		return result;
+
+	if (len > PG_QUERY_INSERT_TO_COPY_BATCH_THRESHOLD &&
+		pg_query_insert_to_copy_batched(input, len, parser_options, PG_QUERY_INSERT_TO_COPY_BATCH_SIZE, &result))
+		return result;
+
+	return pg_query_insert_to_copy_parser(input, len, parser_options);
+}
+
+PgQueryInsertToCopyResult pg_query_insert_to_copy_parser(const char* input, size_t len, int parser_options)
+{
+	MemoryContext ctx = NULL;
+	PgQueryInternalParsetreeAndError parsetree_and_error;
+	PgQueryInsertToCopyResult result = {0};
+	char	   *statement;
+
+	ctx = pg_query_enter_memory_context();
+
+	// The input doesn't need to be NUL-terminated (e.g. a slice of a memory-mapped file)
+	statement = palloc(len + 1);
+	memcpy(statement, input, len);
+	statement[len] = '\0';
+
+	parsetree_and_error = pg_query_raw_parse(statement, parser_options);
+
+	// These are all malloc-ed and will survive exiting the memory context, the caller is responsible to free them now
+	result.stderr_buffer = parsetree_and_error.stderr_buffer;
+	result.error = parsetree_and_error.error;
+
+	if (parsetree_and_error.tree != NULL && list_length(parsetree_and_error.tree) == 1)
+	{
+		RawStmt    *raw_stmt = linitial_node(RawStmt, parsetree_and_error.tree);
+
+		if (IsA(raw_stmt->stmt, InsertStmt))
+		{
+			StringInfoData data;
+
+			initStringInfo(&data);
+			insert_stmt_to_copy(castNode(InsertStmt, raw_stmt->stmt), statement, parser_options, &data, &result);
+		}
+	}
+
+	pg_query_exit_memory_context(ctx);
+
+	return result;
+}
+
+void pg_query_free_insert_to_copy_result(PgQueryInsertToCopyResult result)
+{
+	if (result.error) {
+		pg_query_free_error(result.error);
+	}
+
+	if (result.columns != NULL)
+	{
+		for (int i = 0; i < result.n_columns; i++)
+			free(result.columns[i]);
+		free(result.columns);
+	}
+
+	free(result.relation);
+	free(result.copy_data);
+	free(result.fallback_insert);
+	free(result.stderr_buffer);
+}
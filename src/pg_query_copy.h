@@ -0,0 +1,44 @@
+#ifndef PG_QUERY_COPY_H
+#define PG_QUERY_COPY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+extern bool pg_query_insert_to_copy_fast(const char* input, size_t len, PgQueryInsertToCopyResult* result);
+
+extern PgQueryInsertToCopyResult pg_query_insert_to_copy_parser(const char* input, size_t len, int parser_options);
+
+/*
+ * Forgets the caches of this thread that live in TopMemoryContext, called when
+ * it is freed (pg_query_exit, thread exit)
+ */
+extern void pg_query_insert_to_copy_reset_cache(void);
+
+/*
+ * Statements longer than this are converted in batches of about
+ * PG_QUERY_INSERT_TO_COPY_BATCH_SIZE bytes of rows when the fast path can't
+ * take them, see pg_query_copy_rows.c
+ */
+#define PG_QUERY_INSERT_TO_COPY_BATCH_THRESHOLD (1024 * 1024)
+#define PG_QUERY_INSERT_TO_COPY_BATCH_SIZE (64 * 1024)
+
+/*
+ * Converts the statement with pg_query_insert_to_copy_rows and puts the
+ * batches back together. Returns false if that isn't possible, or doesn't give
+ * the same result as converting the whole statement would.
+ */
+extern bool pg_query_insert_to_copy_batched(const char* input, size_t len, int parser_options, size_t batch_size, PgQueryInsertToCopyResult* result);
+
+/* Also stop at a single quote or NUL byte (escaping from within a string literal token) */
+#define PG_QUERY_COPY_ESCAPE_STOP_AT_QUOTE 1
+/* Stop at a backslash instead of escaping it (E'' strings, whose escapes the caller decodes) */
+#define PG_QUERY_COPY_ESCAPE_STOP_AT_BACKSLASH 2
+
+/*
+ * Writes src escaped for COPY text format to dst, which needs room for twice
+ * len bytes, until the end of src or a byte flags say to stop at. Returns the
+ * number of bytes of src consumed and sets *dst_len to the number written.
+ */
+extern size_t pg_query_copy_escape(char* dst, size_t* dst_len, const char* src, size_t len, int flags);
+
+#endif
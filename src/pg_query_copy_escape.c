@@ -0,0 +1,173 @@
+#include "pg_query.h"
+#include "pg_query_internal.h"
+#include "pg_query_copy.h"
+
+#include "port/pg_bitutils.h"
+#include "port/simd.h"
+
+/*
+ * Escaping kernel for COPY text format values, shared by the parse tree and
+ * the fast path conversions.
+ *
+ * Most bytes of a value are copied as they are, so the kernel looks for the
+ * next byte that needs attention a vector at a time (SSE2 on x86-64, AVX2
+ * when the CPU has it) and copies the run before it in one go. The bytes it
+ * looks for are the backslash and \b \f \n \r \t \v, which happen to be the
+ * contiguous range 0x08 - 0x0D, plus the single quote and NUL when escaping
+ * straight from a string literal token.
+ */
+
+#if defined(USE_SSE2) && defined(__GNUC__) && defined(HAVE__BUILTIN_CTZ)
+#include <immintrin.h>
+#define USE_AVX2_WITH_RUNTIME_CHECK
+#endif
+
+/* Character after the backslash for the bytes that COPY escapes, or 0 */
+static const char copy_escape_chars[256] = {
+	['\b'] = 'b', ['\f'] = 'f', ['\n'] = 'n', ['\r'] = 'r',
+	['\t'] = 't', ['\v'] = 'v', ['\\'] = '\\'
+};
+
+/* Bytes the kernel stops at, per flags (without / with PG_QUERY_COPY_ESCAPE_STOP_AT_QUOTE) */
+static const bool copy_special_chars[2][256] = {
+	{
+		['\b'] = true, ['\f'] = true, ['\n'] = true, ['\r'] = true,
+		['\t'] = true, ['\v'] = true, ['\\'] = true
+	},
+	{
+		['\b'] = true, ['\f'] = true, ['\n'] = true, ['\r'] = true,
+		['\t'] = true, ['\v'] = true, ['\\'] = true, ['\''] = true, ['\0'] = true
+	}
+};
+
+static size_t
+find_special_scalar(const char *s, size_t len, bool quote)
+{
+	const bool *special = copy_special_chars[quote ? 1 : 0];
+	size_t		i = 0;
+
+	while (i < len && !special[(unsigned char) s[i]])
+		i++;
+	return i;
+}
+
+#ifdef USE_SSE2
+
+/*
+ * 0x08 - 0x0D are moved to the bottom of the signed range by adding 0x78, so
+ * a single signed comparison finds all of them.
+ */
+static inline __m128i
+special_mask_sse2(__m128i v, bool quote)
+{
+	__m128i		controls = _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8(0x78)), _mm_set1_epi8(-128 + 6));
+	__m128i		mask = _mm_or_si128(controls, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+
+	if (quote)
+		mask = _mm_or_si128(mask, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\'')),
+											   _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+	return mask;
+}
+
+static size_t
+find_special_sse2(const char *s, size_t len, bool quote)
+{
+	size_t		i = 0;
+
+	for (; i + sizeof(__m128i) <= len; i += sizeof(__m128i))
+	{
+		__m128i		v = _mm_loadu_si128((const __m128i *) (s + i));
+		uint32		bits = (uint32) _mm_movemask_epi8(special_mask_sse2(v, quote));
+
+		if (bits != 0)
+			return i + pg_rightmost_one_pos32(bits);
+	}
+
+	return i + find_special_scalar(s + i, len - i, quote);
+}
+
+#endif							/* USE_SSE2 */
+
+#ifdef USE_AVX2_WITH_RUNTIME_CHECK
+
+__attribute__((target("avx2")))
+static size_t
+find_special_avx2(const char *s, size_t len, bool quote)
+{
+	size_t		i = 0;
+
+	for (; i + sizeof(__m256i) <= len; i += sizeof(__m256i))
+	{
+		__m256i		v = _mm256_loadu_si256((const __m256i *) (s + i));
+		__m256i		controls = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 6), _mm256_add_epi8(v, _mm256_set1_epi8(0x78)));
+		__m256i		mask = _mm256_or_si256(controls, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+		uint32		bits;
+
+		if (quote)
+			mask = _mm256_or_si256(mask, _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')),
+														 _mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+		bits = (uint32) _mm256_movemask_epi8(mask);
+		if (bits != 0)
+			return i + pg_rightmost_one_pos32(bits);
+	}
+
+	return i + find_special_sse2(s + i, len - i, quote);
+}
+
+static size_t find_special_choose(const char *s, size_t len, bool quote);
+static size_t (*find_special) (const char *s, size_t len, bool quote) = find_special_choose;
+
+/*
+ * Picks the AVX2 version on the first call if the CPU supports it, like
+ * pg_popcount32_choose does for POPCNT. Threads racing here all store the
+ * same pointer.
+ */
+static size_t
+find_special_choose(const char *s, size_t len, bool quote)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		find_special = find_special_avx2;
+	else
+		find_special = find_special_sse2;
+
+	return find_special(s, len, quote);
+}
+
+#elif defined(USE_SSE2)
+#define find_special find_special_sse2
+#else
+#define find_special find_special_scalar
+#endif
+
+size_t
+pg_query_copy_escape(char *dst, size_t *dst_len, const char *src, size_t len, int flags)
+{
+	bool		quote = (flags & PG_QUERY_COPY_ESCAPE_STOP_AT_QUOTE) != 0;
+	bool		stop_at_backslash = (flags & PG_QUERY_COPY_ESCAPE_STOP_AT_BACKSLASH) != 0;
+	size_t		i = 0;
+	size_t		out = 0;
+
+	while (i < len)
+	{
+		size_t		run = find_special(src + i, len - i, quote);
+		unsigned char c;
+
+		memcpy(dst + out, src + i, run);
+		out += run;
+		i += run;
+		if (i == len)
+			break;
+
+		c = (unsigned char) src[i];
+		if (copy_escape_chars[c] == 0 || (c == '\\' && stop_at_backslash))
+			break;				/* Quote or NUL, or a backslash the caller decodes */
+
+		dst[out++] = '\\';
+		dst[out++] = copy_escape_chars[c];
+		i++;
+	}
+
+	*dst_len = out;
+	return i;
+}
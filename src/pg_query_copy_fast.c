@@ -0,0 +1,753 @@
+#include "pg_query.h"
+#include "pg_query_internal.h"
+#include "pg_query_copy.h"
+
+#include "xxhash/xxhash.h"
+
+#include "common/keywords.h"
+#include "lib/stringinfo.h"
+#include "parser/scansup.h"
+#include "utils/builtins.h"
+
+/*
+ * Fast path for the statements pg_dump writes with --inserts,
+ * --column-inserts and --rows-per-insert:
+ *
+ *   INSERT INTO schema.table (col, ...) VALUES (literal, ...), (...);
+ *
+ * The statement is recognized by a small hand-written scanner that follows
+ * the rules of the PostgreSQL scanner (scan.l) for the tokens it accepts, and
+ * the COPY rows are written straight from the input text without building a
+ * parse tree. The "INSERT INTO ... VALUES" prefix is the same for every
+ * statement of a table, so its parsed and quoted form is cached per thread.
+ *
+ * String literals and NULL may carry a "::type" cast, as ORMs write them:
+ * the parser keeps their text whatever the type, so they are sliced from the
+ * input just the same.
+ *
+ * Anything outside of that shape (other casts, expressions, comments within
+ * the statement, unusual literal syntax, keywords used as names, ...) makes the
+ * fast path give up, and the statement goes through the full parser instead.
+ * Whenever the fast path does convert a statement, the result has to be
+ * identical to what insert_stmt_to_copy produces from the parse tree.
+ */
+
+#define PREFIX_CACHE_SIZE 256
+
+typedef struct PrefixCacheEntry
+{
+	char	   *prefix;			/* "INSERT INTO ... VALUES" as written */
+	size_t		prefix_len;
+	char	   *relation;		/* Quoted, schema-qualified if it was */
+	char	  **columns;		/* Quoted */
+	int			n_columns;
+} PrefixCacheEntry;
+
+/*
+ * Lives in TopMemoryContext, so it is released together with it on thread exit
+ * and by pg_query_exit, which then resets these pointers
+ */
+static __thread MemoryContext prefix_cache_context = NULL;
+static __thread PrefixCacheEntry *prefix_cache = NULL;
+
+typedef struct CopyBuffer
+{
+	char	   *data;
+	size_t		len;
+	size_t		capacity;
+} CopyBuffer;
+
+/* Longest run of a string literal handed to the escaping kernel at once */
+#define ESCAPE_CHUNK_SIZE (64 * 1024)
+
+static inline bool
+is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static inline bool
+is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline bool
+is_ident_start(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || IS_HIGHBIT_SET(c);
+}
+
+static inline bool
+is_ident_cont(char c)
+{
+	return is_ident_start(c) || is_digit(c) || c == '$';
+}
+
+static void
+copy_buffer_reserve(CopyBuffer *buf, size_t needed)
+{
+	if (buf->len + needed <= buf->capacity)
+		return;
+
+	while (buf->len + needed > buf->capacity)
+		buf->capacity *= 2;
+	buf->data = realloc(buf->data, buf->capacity);
+}
+
+static inline void
+copy_buffer_append(CopyBuffer *buf, const char *data, size_t len)
+{
+	copy_buffer_reserve(buf, len);
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static inline void
+copy_buffer_append_char(CopyBuffer *buf, char c)
+{
+	copy_buffer_reserve(buf, 1);
+	buf->data[buf->len++] = c;
+}
+
+/* Appends a single character of a string value, escaped like append_copy_text does */
+static void
+copy_buffer_append_text_char(CopyBuffer *buf, char c)
+{
+	char		escaped;
+
+	switch (c)
+	{
+		case '\b': escaped = 'b'; break;
+		case '\f': escaped = 'f'; break;
+		case '\n': escaped = 'n'; break;
+		case '\r': escaped = 'r'; break;
+		case '\t': escaped = 't'; break;
+		case '\v': escaped = 'v'; break;
+		case '\\': escaped = '\\'; break;
+		default:
+			copy_buffer_append_char(buf, c);
+			return;
+	}
+
+	copy_buffer_reserve(buf, 2);
+	buf->data[buf->len++] = '\\';
+	buf->data[buf->len++] = escaped;
+}
+
+static const char *
+skip_space(const char *p, const char *end)
+{
+	while (p < end && is_space(*p))
+		p++;
+	return p;
+}
+
+/*
+ * Whitespace and comments, which are only accepted before and after the
+ * statement. Returns NULL for an unterminated block comment.
+ */
+static const char *
+skip_space_and_comments(const char *p, const char *end)
+{
+	while (p < end)
+	{
+		if (is_space(*p))
+			p++;
+		else if (p + 1 < end && p[0] == '-' && p[1] == '-')
+		{
+			while (p < end && *p != '\n' && *p != '\r')
+				p++;
+		}
+		else if (p + 1 < end && p[0] == '/' && p[1] == '*')
+		{
+			int			depth = 1;
+
+			for (p += 2; depth > 0; p++)
+			{
+				if (p + 1 >= end)
+					return NULL;
+				if (p[0] == '*' && p[1] == '/')
+				{
+					depth--;
+					p++;
+				}
+				else if (p[0] == '/' && p[1] == '*')
+				{
+					depth++;
+					p++;
+				}
+			}
+		}
+		else
+			break;
+	}
+	return p;
+}
+
+/* Matches a lower case keyword case-insensitively */
+static const char *
+match_keyword(const char *p, const char *end, const char *keyword)
+{
+	for (; *keyword; p++, keyword++)
+	{
+		if (p >= end || (*p != *keyword && *p != *keyword - 'a' + 'A'))
+			return NULL;
+	}
+	if (p < end && is_ident_cont(*p))
+		return NULL;
+	return p;
+}
+
+/* Returns the end of the plain or double-quoted identifier at p */
+static const char *
+scan_identifier(const char *p, const char *end)
+{
+	if (p >= end)
+		return NULL;
+
+	if (*p == '"')
+	{
+		for (p++; p < end; p++)
+		{
+			if (*p != '"')
+				continue;
+			if (p + 1 < end && p[1] == '"')
+				p++;
+			else
+				return p + 1;
+		}
+		return NULL;
+	}
+
+	if (!is_ident_start(*p))
+		return NULL;
+	for (p++; p < end && is_ident_cont(*p); p++)
+		;
+	return p;
+}
+
+/*
+ * Adds the identifier the way the parser sees it (quotes removed, or
+ * downcased) to names. Returns false for identifiers the parser would treat
+ * differently: keywords, names that get truncated, and empty quoted names.
+ */
+static bool
+add_identifier(List **names, const char *start, const char *end)
+{
+	char	   *ident;
+	size_t		len = end - start;
+
+	if (*start == '"')
+	{
+		char	   *dst = ident = palloc(len);
+
+		for (const char *p = start + 1; p < end - 1; p++)
+		{
+			if (*p == '\0')
+				return false;
+			*dst++ = *p;
+			if (*p == '"')
+				p++;
+		}
+		*dst = '\0';
+		len = dst - ident;
+		if (len == 0)
+			return false;
+	}
+	else
+	{
+		int			kwnum;
+
+		ident = downcase_truncate_identifier(start, len, false);
+		kwnum = ScanKeywordLookup(ident, &ScanKeywords);
+		if (kwnum >= 0 && ScanKeywordCategories[kwnum] != UNRESERVED_KEYWORD)
+			return false;
+	}
+
+	if (len >= NAMEDATALEN)
+		return false;
+
+	*names = lappend(*names, ident);
+	return true;
+}
+
+/*
+ * Scans "INSERT INTO [schema.]table [(column, ...)] VALUES" and returns the
+ * position after VALUES. When relation and columns are given, the names are
+ * collected too, which may reject a prefix that scans fine.
+ */
+static const char *
+scan_insert_prefix(const char *p, const char *end, List **relation, List **columns)
+{
+	const char *ident_end;
+
+	if ((p = match_keyword(p, end, "insert")) == NULL)
+		return NULL;
+	p = skip_space(p, end);
+	if ((p = match_keyword(p, end, "into")) == NULL)
+		return NULL;
+	p = skip_space(p, end);
+
+	/* [schema.]table, catalog-qualified names are left to the parser */
+	for (int i = 0;; i++)
+	{
+		if ((ident_end = scan_identifier(p, end)) == NULL)
+			return NULL;
+		if (relation != NULL && !add_identifier(relation, p, ident_end))
+			return NULL;
+		p = ident_end;
+		if (p >= end || *p != '.')
+			break;
+		if (i > 0)
+			return NULL;
+		p++;
+	}
+
+	p = skip_space(p, end);
+	if (p < end && *p == '(')
+	{
+		do
+		{
+			p = skip_space(p + 1, end);
+			if ((ident_end = scan_identifier(p, end)) == NULL)
+				return NULL;
+			if (columns != NULL && !add_identifier(columns, p, ident_end))
+				return NULL;
+			p = skip_space(ident_end, end);
+		} while (p < end && *p == ',');
+
+		if (p >= end || *p != ')')
+			return NULL;
+		p = skip_space(p + 1, end);
+	}
+
+	return match_keyword(p, end, "values");
+}
+
+static void
+clear_prefix_entry(PrefixCacheEntry *entry)
+{
+	if (entry->prefix == NULL)
+		return;
+
+	for (int i = 0; i < entry->n_columns; i++)
+		pfree(entry->columns[i]);
+	if (entry->columns != NULL)
+		pfree(entry->columns);
+	pfree(entry->relation);
+	pfree(entry->prefix);
+	memset(entry, 0, sizeof(PrefixCacheEntry));
+}
+
+static bool
+fill_prefix_entry(PrefixCacheEntry *entry, const char *prefix, size_t len)
+{
+	MemoryContext ctx = pg_query_enter_memory_context();
+	List	   *relation = NIL;
+	List	   *columns = NIL;
+	bool		ok = scan_insert_prefix(prefix, prefix + len, &relation, &columns) != NULL;
+
+	if (ok)
+	{
+		StringInfoData relname;
+		ListCell   *lc;
+
+		initStringInfo(&relname);
+		foreach(lc, relation)
+		{
+			if (foreach_current_index(lc) > 0)
+				appendStringInfoChar(&relname, '.');
+			appendStringInfoString(&relname, quote_identifier(lfirst(lc)));
+		}
+
+		clear_prefix_entry(entry);
+		entry->prefix = MemoryContextAlloc(prefix_cache_context, len);
+		memcpy(entry->prefix, prefix, len);
+		entry->prefix_len = len;
+		entry->relation = MemoryContextStrdup(prefix_cache_context, relname.data);
+		entry->n_columns = list_length(columns);
+		if (entry->n_columns > 0)
+		{
+			entry->columns = MemoryContextAlloc(prefix_cache_context, sizeof(char *) * entry->n_columns);
+			foreach(lc, columns)
+				entry->columns[foreach_current_index(lc)] = MemoryContextStrdup(prefix_cache_context, quote_identifier(lfirst(lc)));
+		}
+	}
+
+	pg_query_exit_memory_context(ctx);
+
+	return ok;
+}
+
+void
+pg_query_insert_to_copy_reset_cache(void)
+{
+	prefix_cache_context = NULL;
+	prefix_cache = NULL;
+}
+
+static PrefixCacheEntry *
+lookup_prefix(const char *prefix, size_t len)
+{
+	PrefixCacheEntry *entry;
+
+	if (prefix_cache == NULL)
+	{
+		pg_query_init();
+		prefix_cache_context = AllocSetContextCreate(TopMemoryContext,
+													 "pg_query insert_to_copy prefixes",
+													 ALLOCSET_SMALL_SIZES);
+		prefix_cache = MemoryContextAllocZero(prefix_cache_context,
+											  sizeof(PrefixCacheEntry) * PREFIX_CACHE_SIZE);
+	}
+
+	entry = &prefix_cache[XXH3_64bits(prefix, len) % PREFIX_CACHE_SIZE];
+	if (entry->prefix != NULL && entry->prefix_len == len && memcmp(entry->prefix, prefix, len) == 0)
+		return entry;
+
+	return fill_prefix_entry(entry, prefix, len) ? entry : NULL;
+}
+
+/*
+ * Scans a string literal starting after its opening quote, appending the
+ * value escaped for COPY. escape selects E'...' syntax, for which only the
+ * single character backslash escapes are handled here.
+ */
+static const char *
+scan_string(const char *p, const char *end, CopyBuffer *buf, bool escape)
+{
+	for (;;)
+	{
+		size_t		chunk = Min((size_t) (end - p), ESCAPE_CHUNK_SIZE);
+		size_t		consumed;
+		size_t		written;
+		char		c;
+
+		/* Copies and escapes everything up to a quote, NUL or (in E'') backslash */
+		copy_buffer_reserve(buf, chunk * 2);
+		consumed = pg_query_copy_escape(buf->data + buf->len, &written, p, chunk,
+										PG_QUERY_COPY_ESCAPE_STOP_AT_QUOTE |
+										(escape ? PG_QUERY_COPY_ESCAPE_STOP_AT_BACKSLASH : 0));
+		buf->len += written;
+		p += consumed;
+		if (consumed == chunk)
+		{
+			if (p >= end)
+				return NULL;
+			continue;
+		}
+
+		c = *p;
+		if (c == '\'')
+		{
+			if (p + 1 < end && p[1] == '\'')
+			{
+				copy_buffer_append_char(buf, '\'');
+				p += 2;
+				continue;
+			}
+			return p + 1;
+		}
+
+		if (c == '\0')
+			return NULL;
+
+		if (c == '\\' && escape)
+		{
+			if (p + 1 >= end)
+				return NULL;
+			c = p[1];
+			switch (c)
+			{
+				case 'b': c = '\b'; break;
+				case 'f': c = '\f'; break;
+				case 'n': c = '\n'; break;
+				case 'r': c = '\r'; break;
+				case 't': c = '\t'; break;
+				default:
+					/* Octal, hex and Unicode escapes, and escaped bytes the scanner verifies */
+					if ((c >= '0' && c <= '7') || c == 'x' || c == 'u' || c == 'U' || c == '\0' || IS_HIGHBIT_SET(c))
+						return NULL;
+					break;
+			}
+			p++;
+		}
+
+		copy_buffer_append_text_char(buf, c);
+		p++;
+	}
+}
+
+/*
+ * Scans a decimal numeric literal, which the parser turns into an Integer if
+ * it fits into 32 bits and into a Float that keeps the literal text otherwise.
+ * A leading minus is folded into the constant just like doNegate does.
+ */
+static const char *
+scan_number(const char *p, const char *end, CopyBuffer *buf, bool negative)
+{
+	const char *start = p;
+	bool		is_integer = true;
+	int64		value = 0;
+
+	while (p < end && is_digit(*p))
+	{
+		if (value <= PG_INT32_MAX)
+			value = value * 10 + (*p - '0');
+		p++;
+	}
+
+	if (p < end && *p == '.')
+	{
+		/* "1..10" is lexed as an integer followed by ".." */
+		if (p + 1 < end && p[1] == '.')
+			return NULL;
+		is_integer = false;
+		for (p++; p < end && is_digit(*p); p++)
+			;
+	}
+
+	if (p == start || (p - start == 1 && *start == '.'))
+		return NULL;
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		is_integer = false;
+		p++;
+		if (p < end && (*p == '+' || *p == '-'))
+			p++;
+		if (p >= end || !is_digit(*p))
+			return NULL;
+		while (p < end && is_digit(*p))
+			p++;
+	}
+
+	/* Trailing junk, non-decimal integers and digit separators are left to the parser */
+	if (p < end && (is_ident_cont(*p) || *p == '.'))
+		return NULL;
+
+	if (is_integer && value <= PG_INT32_MAX)
+	{
+		char		digits[16];
+		int			n = 0;
+
+		/* Printed the way "%d" does, so without leading zeros and "-0" as "0" */
+		do
+		{
+			digits[n++] = '0' + value % 10;
+			value /= 10;
+		} while (value > 0);
+		if (negative && !(n == 1 && digits[0] == '0'))
+			digits[n++] = '-';
+
+		copy_buffer_reserve(buf, n);
+		while (n > 0)
+			buf->data[buf->len++] = digits[--n];
+	}
+	else
+	{
+		if (negative)
+			copy_buffer_append_char(buf, '-');
+		copy_buffer_append(buf, start, p - start);
+	}
+
+	return p;
+}
+
+/*
+ * Whether the plain identifier names a type the way an identifier does in
+ * the grammar: not a keyword other than an unreserved one (those have their
+ * own type syntax, e.g. "integer", "time with time zone"), and not truncated.
+ */
+static bool
+is_type_identifier(const char *start, const char *end)
+{
+	char		name[NAMEDATALEN];
+	int			kwnum;
+
+	if (*start == '"' || end - start >= NAMEDATALEN)
+		return false;
+	memcpy(name, start, end - start);
+	name[end - start] = '\0';
+
+	kwnum = ScanKeywordLookup(name, &ScanKeywords);
+	return kwnum < 0 || ScanKeywordCategories[kwnum] == UNRESERVED_KEYWORD;
+}
+
+/*
+ * Skips a "::type" cast of the literal that ends at p, and returns p itself
+ * if there is none. The parser converts a cast of a string literal or NULL
+ * to the literal's text as long as the type has no modifiers
+ * (cast_keeps_text in pg_query_copy.c), so only [schema.]name with optional
+ * array brackets is taken here, NULL is returned for anything else.
+ */
+static const char *
+skip_cast(const char *p, const char *end)
+{
+	const char *q = skip_space(p, end);
+	const char *ident_end;
+
+	if (end - q < 2 || q[0] != ':' || q[1] != ':')
+		return p;
+	q = skip_space(q + 2, end);
+
+	for (int i = 0;; i++)
+	{
+		if ((ident_end = scan_identifier(q, end)) == NULL || !is_type_identifier(q, ident_end))
+			return NULL;
+		q = ident_end;
+		if (q >= end || *q != '.')
+			break;
+		if (i > 0)
+			return NULL;
+		q++;
+	}
+
+	q = skip_space(q, end);
+	while (q < end && *q == '[')
+	{
+		const char *digits;
+
+		q = skip_space(q + 1, end);
+		for (digits = q; q < end && is_digit(*q); q++)
+			;
+		if (q - digits > 9)
+			return NULL;
+		q = skip_space(q, end);
+		if (q >= end || *q != ']')
+			return NULL;
+		q = skip_space(q + 1, end);
+	}
+
+	return q;
+}
+
+/* Scans a single VALUES entry, appending it as a COPY field */
+static const char *
+scan_value(const char *p, const char *end, CopyBuffer *buf)
+{
+	const char *next;
+
+	switch (*p)
+	{
+		case '\'':
+			if ((next = scan_string(p + 1, end, buf, false)) != NULL)
+				next = skip_cast(next, end);
+			return next;
+		case 'E':
+		case 'e':
+			if (p + 1 >= end || p[1] != '\'')
+				return NULL;
+			if ((next = scan_string(p + 2, end, buf, true)) != NULL)
+				next = skip_cast(next, end);
+			return next;
+		case '-':
+			return scan_number(p + 1, end, buf, true);
+		case 'N':
+		case 'n':
+			if ((next = match_keyword(p, end, "null")) != NULL)
+			{
+				copy_buffer_append(buf, "\\N", 2);
+				next = skip_cast(next, end);
+			}
+			return next;
+		case 'T':
+		case 't':
+			if ((next = match_keyword(p, end, "true")) != NULL)
+				copy_buffer_append_char(buf, 't');
+			return next;
+		case 'F':
+		case 'f':
+			if ((next = match_keyword(p, end, "false")) != NULL)
+				copy_buffer_append_char(buf, 'f');
+			return next;
+		default:
+			if (is_digit(*p) || *p == '.')
+				return scan_number(p, end, buf, false);
+			return NULL;
+	}
+}
+
+bool
+pg_query_insert_to_copy_fast(const char* input, size_t len, PgQueryInsertToCopyResult* result)
+{
+	const char *end = input + len;
+	const char *prefix_start;
+	const char *p;
+	PrefixCacheEntry *entry;
+	CopyBuffer	buf;
+	int			n_rows = 0;
+
+	prefix_start = skip_space_and_comments(input, end);
+	if (prefix_start == NULL || (p = scan_insert_prefix(prefix_start, end, NULL, NULL)) == NULL)
+		return false;
+
+	entry = lookup_prefix(prefix_start, p - prefix_start);
+	if (entry == NULL)
+		return false;
+
+	buf.capacity = len + 64;
+	buf.data = malloc(buf.capacity);
+	buf.len = 0;
+
+	for (;;)
+	{
+		p = skip_space(p, end);
+		if (p >= end || *p != '(')
+			goto fail;
+
+		for (int column = 0;; column++)
+		{
+			p = skip_space(p + 1, end);
+			if (p >= end)
+				goto fail;
+			if (column > 0)
+				copy_buffer_append_char(&buf, '\t');
+			if ((p = scan_value(p, end, &buf)) == NULL)
+				goto fail;
+			p = skip_space(p, end);
+			if (p < end && *p == ',')
+				continue;
+			if (p < end && *p == ')')
+				break;
+			goto fail;
+		}
+		copy_buffer_append_char(&buf, '\n');
+		n_rows++;
+
+		p = skip_space(p + 1, end);
+		if (p >= end || *p != ',')
+			break;
+		p++;
+	}
+
+	/* Nothing but the terminating ";" and comments may follow */
+	if (p < end && *p == ';')
+		p++;
+	p = skip_space_and_comments(p, end);
+	if (p != end)
+		goto fail;
+
+	copy_buffer_reserve(&buf, 1);
+	buf.data[buf.len] = '\0';
+
+	result->n_rows = n_rows;
+	result->relation = strdup(entry->relation);
+	result->n_columns = entry->n_columns;
+	if (entry->n_columns > 0)
+	{
+		result->columns = malloc(sizeof(char *) * entry->n_columns);
+		for (int i = 0; i < entry->n_columns; i++)
+			result->columns[i] = strdup(entry->columns[i]);
+	}
+	result->copy_data = buf.data;
+	result->copy_data_len = buf.len;
+	result->stderr_buffer = strdup("");
+
+	return true;
+
+fail:
+	free(buf.data);
+	return false;
+}
@@ -0,0 +1,473 @@
+#include "pg_query.h"
+#include "pg_query_internal.h"
+#include "pg_query_copy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Conversion of INSERTs with a very long VALUES list (hand-written
+ * migrations, pg_dump --rows-per-insert with a large count) a batch of rows
+ * at a time.
+ *
+ * The parse tree of a VALUES list takes many times the size of its text, so
+ * parsing a statement with hundreds of thousands of rows at once needs a lot
+ * of memory. Instead, the rows are found by a scanner that only tells apart
+ * what can hide a parenthesis or a comma (strings, quoted identifiers,
+ * dollar quotes and comments), and each batch is converted as the statement
+ * "INSERT INTO ... VALUES <rows of the batch>", which gives the same rows as
+ * converting the whole statement. Only the parse tree of one batch exists at
+ * a time.
+ *
+ * That only holds when nothing follows the rows (ON CONFLICT, RETURNING,
+ * ORDER BY apply to all of them), so the whole statement is scanned before
+ * the first batch is converted.
+ */
+
+static inline bool
+is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static inline bool
+is_ident_start(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (unsigned char) c >= 0x80;
+}
+
+static inline bool
+is_ident_cont(char c)
+{
+	return is_ident_start(c) || (c >= '0' && c <= '9') || c == '$';
+}
+
+/* Whitespace and comments. Returns NULL for an unterminated block comment. */
+static const char *
+skip_blank(const char *p, const char *end)
+{
+	while (p < end)
+	{
+		if (is_space(*p))
+			p++;
+		else if (p + 1 < end && p[0] == '-' && p[1] == '-')
+		{
+			while (p < end && *p != '\n' && *p != '\r')
+				p++;
+		}
+		else if (p + 1 < end && p[0] == '/' && p[1] == '*')
+		{
+			int			depth = 1;
+
+			for (p += 2; depth > 0; p++)
+			{
+				if (p + 1 >= end)
+					return NULL;
+				if (p[0] == '*' && p[1] == '/')
+				{
+					depth--;
+					p++;
+				}
+				else if (p[0] == '/' && p[1] == '*')
+				{
+					depth++;
+					p++;
+				}
+			}
+		}
+		else
+			break;
+	}
+	return p;
+}
+
+/*
+ * Returns the end of the quoted string or identifier whose opening quote is
+ * at p, or NULL if it isn't terminated. Doubled quotes stand for one, and
+ * with backslash escapes (E'' strings, or all strings when
+ * standard_conforming_strings is off) a backslash escapes the next byte.
+ */
+static const char *
+quoted_end(const char *p, const char *end, bool backslash)
+{
+	char		quote = *p;
+
+	for (p++; p < end; p++)
+	{
+		if (backslash && *p == '\\')
+			p++;
+		else if (*p == quote)
+		{
+			if (p + 1 < end && p[1] == quote)
+				p++;
+			else
+				return p + 1;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Returns the end of the token at p, which isn't whitespace or a comment, or
+ * NULL if it is a string, identifier or dollar quote that isn't terminated.
+ * Operators and other punctuation are returned a byte at a time.
+ */
+static const char *
+token_end(const char *p, const char *end, bool standard_strings)
+{
+	if (*p == '\'')
+		return quoted_end(p, end, !standard_strings);
+	if (*p == '"')
+		return quoted_end(p, end, false);
+
+	if (p + 1 < end && p[1] == '\'')
+	{
+		if (*p == 'E' || *p == 'e')
+			return quoted_end(p + 1, end, true);
+		if (*p == 'B' || *p == 'b' || *p == 'X' || *p == 'x')
+			return quoted_end(p + 1, end, false);
+		if (*p == 'N' || *p == 'n')
+			return quoted_end(p + 1, end, !standard_strings);
+	}
+	if ((*p == 'U' || *p == 'u') && p + 2 < end && p[1] == '&' && (p[2] == '\'' || p[2] == '"'))
+		return quoted_end(p + 2, end, false);
+
+	if (*p == '$')
+	{
+		const char *tag_end = p + 1;
+
+		/* $tag$ opens a dollar quote, $1 is a parameter */
+		if (tag_end < end && is_ident_start(*tag_end))
+		{
+			while (tag_end < end && is_ident_cont(*tag_end) && *tag_end != '$')
+				tag_end++;
+		}
+		if (tag_end < end && *tag_end == '$')
+		{
+			size_t		tag_len = tag_end + 1 - p;
+
+			for (const char *q = tag_end + 1; q + tag_len <= end; q++)
+			{
+				q = memchr(q, '$', end - q);
+				if (q == NULL || q + tag_len > end)
+					return NULL;
+				if (memcmp(q, p, tag_len) == 0)
+					return q + tag_len;
+			}
+			return NULL;
+		}
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+			;
+		return p;
+	}
+
+	if (is_ident_cont(*p))
+	{
+		while (p < end && is_ident_cont(*p))
+			p++;
+		return p;
+	}
+	return p + 1;
+}
+
+/* Whether the token is the lower case keyword, case-insensitively */
+static bool
+is_keyword(const char *start, const char *end, const char *keyword)
+{
+	for (; start < end && *keyword; start++, keyword++)
+	{
+		if (*start != *keyword && *start != *keyword - 'a' + 'A')
+			return false;
+	}
+	return start == end && *keyword == '\0';
+}
+
+/*
+ * Finds the rows of an "INSERT ... VALUES (...), (...)" statement: *values_end
+ * is set just past the VALUES keyword, *rows_start to the first row and
+ * *rows_end past the last one. Returns false if the statement has another
+ * shape, or anything but ";" follows the rows.
+ */
+static bool
+find_rows(const char *input, const char *end, bool standard_strings,
+		  const char **values_end, const char **rows_start, const char **rows_end)
+{
+	const char *p = skip_blank(input, end);
+	const char *token;
+	int			depth = 0;
+
+	if (p == NULL || p >= end || (token = token_end(p, end, standard_strings)) == NULL ||
+		!is_keyword(p, token, "insert"))
+		return false;
+
+	/* The prefix, up to the VALUES keyword outside of parentheses */
+	for (p = token;;)
+	{
+		if ((p = skip_blank(p, end)) == NULL || p >= end || (token = token_end(p, end, standard_strings)) == NULL)
+			return false;
+		if (*p == '(')
+			depth++;
+		else if (*p == ')')
+			depth--;
+		else if (*p == ';')
+			return false;
+		else if (depth == 0 && is_keyword(p, token, "values"))
+			break;
+		p = token;
+	}
+	*values_end = token;
+
+	for (p = token;;)
+	{
+		if ((p = skip_blank(p, end)) == NULL || p >= end || *p != '(')
+			return false;
+		if (*rows_start == NULL)
+			*rows_start = p;
+
+		/* The row, up to its closing parenthesis */
+		depth = 0;
+		do
+		{
+			if ((token = token_end(p, end, standard_strings)) == NULL)
+				return false;
+			if (*p == '(')
+				depth++;
+			else if (*p == ')')
+				depth--;
+			else if (*p == ';')
+				return false;
+			if (depth > 0 && (p = skip_blank(token, end)) == NULL)
+				return false;
+		} while (depth > 0 && p < end);
+		if (depth > 0)
+			return false;
+		*rows_end = token;
+
+		if ((p = skip_blank(token, end)) == NULL)
+			return false;
+		if (p < end && *p == ',')
+		{
+			p++;
+			continue;
+		}
+		if (p < end && *p == ';')
+			p = skip_blank(p + 1, end);
+		return p == end;
+	}
+}
+
+/* End of the row starting at p, which find_rows has already gone through */
+static const char *
+row_end(const char *p, const char *end, bool standard_strings)
+{
+	int			depth = 0;
+
+	do
+	{
+		const char *token = token_end(p, end, standard_strings);
+
+		if (*p == '(')
+			depth++;
+		else if (*p == ')')
+			depth--;
+		p = depth > 0 ? skip_blank(token, end) : token;
+	} while (depth > 0);
+
+	return p;
+}
+
+static PgQueryInsertToCopyResult
+convert_batch(const char *input, size_t len, int parser_options)
+{
+	PgQueryInsertToCopyResult result = {0};
+
+	if (parser_options == PG_QUERY_PARSE_DEFAULT && pg_query_insert_to_copy_fast(input, len, &result))
+		return result;
+
+	return pg_query_insert_to_copy_parser(input, len, parser_options);
+}
+
+int pg_query_insert_to_copy_rows(const char* input, size_t len, int parser_options, size_t batch_size,
+								 PgQueryInsertToCopyRowsCallback callback, void* context)
+{
+	const char *end = input + len;
+	bool		standard_strings = (parser_options & PG_QUERY_DISABLE_STANDARD_CONFORMING_STRINGS) == 0;
+	const char *values_end;
+	const char *rows_start = NULL;
+	const char *rows_end;
+	const char *p;
+	char	   *batch;
+	size_t		prefix_len;
+	size_t		batch_capacity;
+
+	if (!find_rows(input, end, standard_strings, &values_end, &rows_start, &rows_end))
+		return 0;
+
+	/* "INSERT INTO ... VALUES " followed by the rows of the batch */
+	prefix_len = values_end - input + 1;
+	batch_capacity = prefix_len + batch_size + 1;
+	batch = malloc(batch_capacity);
+	memcpy(batch, input, prefix_len - 1);
+	batch[prefix_len - 1] = ' ';
+
+	for (p = rows_start; p < rows_end;)
+	{
+		const char *batch_start = p;
+		const char *batch_end;
+		PgQueryInsertToCopyResult result;
+		bool		converted;
+
+		do
+		{
+			batch_end = row_end(p, end, standard_strings);
+			p = skip_blank(batch_end, end);
+			if (p < rows_end)
+				p = skip_blank(p + 1, end);
+		} while (p < rows_end && (size_t) (batch_end - batch_start) < batch_size);
+
+		if (prefix_len + (batch_end - batch_start) + 1 > batch_capacity)
+		{
+			batch_capacity = prefix_len + (batch_end - batch_start) + 1;
+			batch = realloc(batch, batch_capacity);
+		}
+		memcpy(batch + prefix_len, batch_start, batch_end - batch_start);
+		batch[prefix_len + (batch_end - batch_start)] = '\0';
+
+		result = convert_batch(batch, prefix_len + (batch_end - batch_start), parser_options);
+		converted = result.error == NULL && result.relation != NULL;
+		if (!converted)
+		{
+			/*
+			 * The rows of this batch and all that follow, for the caller to
+			 * run as they are after the batches it already has
+			 */
+			free(result.fallback_insert);
+			result.fallback_insert = malloc(prefix_len + (rows_end - batch_start) + 1);
+			memcpy(result.fallback_insert, batch, prefix_len);
+			memcpy(result.fallback_insert + prefix_len, batch_start, rows_end - batch_start);
+			result.fallback_insert[prefix_len + (rows_end - batch_start)] = '\0';
+			result.fallback_values_offset = prefix_len;
+			result.n_fallback_rows = 0;
+		}
+		callback(&result, context);
+		pg_query_free_insert_to_copy_result(result);
+		if (!converted)
+			break;
+	}
+
+	free(batch);
+
+	return 1;
+}
+
+/* The batches of pg_query_insert_to_copy_batched put back together */
+typedef struct
+{
+	PgQueryInsertToCopyResult result;
+	size_t		data_capacity;
+	size_t		fallback_len;
+	size_t		fallback_capacity;
+	bool		failed;
+} MergedRows;
+
+static bool
+same_target(const PgQueryInsertToCopyResult *a, const PgQueryInsertToCopyResult *b)
+{
+	if (strcmp(a->relation, b->relation) != 0 || a->n_columns != b->n_columns)
+		return false;
+	for (int i = 0; i < a->n_columns; i++)
+	{
+		if (strcmp(a->columns[i], b->columns[i]) != 0)
+			return false;
+	}
+	return true;
+}
+
+static void
+append_merged(char **data, size_t *len, size_t *capacity, const char *src, size_t src_len)
+{
+	if (*len + src_len + 1 > *capacity)
+	{
+		*capacity = (*len + src_len + 1) * 2;
+		*data = realloc(*data, *capacity);
+	}
+	memcpy(*data + *len, src, src_len);
+	*len += src_len;
+	(*data)[*len] = '\0';
+}
+
+static void
+merge_rows(PgQueryInsertToCopyResult *rows, void *context)
+{
+	MergedRows *merged = (MergedRows *) context;
+
+	if (merged->failed)
+		return;
+
+	if (rows->error != NULL || rows->relation == NULL)
+	{
+		merged->failed = true;
+		return;
+	}
+
+	if (merged->result.relation == NULL)
+	{
+		/* Take over the first batch */
+		merged->result = *rows;
+		merged->data_capacity = rows->copy_data_len + 1;
+		merged->fallback_len = rows->fallback_insert ? strlen(rows->fallback_insert) : 0;
+		merged->fallback_capacity = merged->fallback_len + 1;
+		memset(rows, 0, sizeof(PgQueryInsertToCopyResult));
+		return;
+	}
+
+	/*
+	 * Columns that are DEFAULT in all rows of a batch are left out of its
+	 * column list, which the whole statement may not do
+	 */
+	if (!same_target(&merged->result, rows))
+	{
+		merged->failed = true;
+		return;
+	}
+
+	append_merged(&merged->result.copy_data, &merged->result.copy_data_len, &merged->data_capacity,
+				  rows->copy_data, rows->copy_data_len);
+	merged->result.n_rows += rows->n_rows;
+	merged->result.has_default = merged->result.has_default || rows->has_default;
+
+	if (rows->fallback_insert != NULL)
+	{
+		if (merged->result.fallback_insert == NULL)
+		{
+			merged->result.fallback_insert = rows->fallback_insert;
+			merged->result.fallback_values_offset = rows->fallback_values_offset;
+			merged->fallback_len = strlen(rows->fallback_insert);
+			merged->fallback_capacity = merged->fallback_len + 1;
+			rows->fallback_insert = NULL;
+		}
+		else
+		{
+			append_merged(&merged->result.fallback_insert, &merged->fallback_len, &merged->fallback_capacity, ", ", 2);
+			append_merged(&merged->result.fallback_insert, &merged->fallback_len, &merged->fallback_capacity,
+						  rows->fallback_insert + rows->fallback_values_offset,
+						  strlen(rows->fallback_insert + rows->fallback_values_offset));
+		}
+		merged->result.n_fallback_rows += rows->n_fallback_rows;
+	}
+}
+
+bool
+pg_query_insert_to_copy_batched(const char* input, size_t len, int parser_options, size_t batch_size, PgQueryInsertToCopyResult* result)
+{
+	MergedRows	merged = {0};
+
+	if (!pg_query_insert_to_copy_rows(input, len, parser_options, batch_size, merge_rows, &merged) || merged.failed)
+	{
+		pg_query_free_insert_to_copy_result(merged.result);
+		return false;
+	}
+
+	*result = merged.result;
+	return true;
+}
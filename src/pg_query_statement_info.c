@@ -0,0 +1,596 @@
+#include "pg_query.h"
+#include "pg_query_internal.h"
+
+#include "lib/stringinfo.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/parsenodes.h"
+#include "parser/scansup.h"
+#include "utils/builtins.h"
+
+/*
+ * Classification of a statement for tools that reorder a dump for a faster
+ * restore: which section it belongs to (schema before the data, the data, or
+ * indexes and constraints that are cheaper to build after it), and which
+ * relations it depends on, as written in the statement (no catalog lookups).
+ */
+
+typedef struct
+{
+	List	   *relations;		/* palloc-ed quoted names, without duplicates */
+	bool		uses_unlisted_relations;
+	const char *setting;
+} StatementInfoContext;
+
+static void
+add_relation_name(StatementInfoContext *context, const char *schemaname, const char *relname)
+{
+	StringInfoData str;
+	ListCell   *lc;
+
+	initStringInfo(&str);
+	if (schemaname != NULL)
+		appendStringInfo(&str, "%s.", quote_identifier(schemaname));
+	appendStringInfoString(&str, quote_identifier(relname));
+
+	foreach(lc, context->relations)
+	{
+		if (strcmp(lfirst(lc), str.data) == 0)
+			return;
+	}
+	context->relations = lappend(context->relations, str.data);
+}
+
+static void
+add_range_var(StatementInfoContext *context, RangeVar *relation)
+{
+	if (relation != NULL)
+		add_relation_name(context, relation->schemaname, relation->relname);
+}
+
+/* A qualified name given as a list of String nodes, of which the last skip ones aren't part of it */
+static void
+add_name_list(StatementInfoContext *context, List *names, int skip)
+{
+	int			n = list_length(names) - skip;
+
+	if (n == 1)
+		add_relation_name(context, NULL, strVal(linitial(names)));
+	else if (n >= 2)
+		add_relation_name(context, strVal(list_nth(names, n - 2)), strVal(list_nth(names, n - 1)));
+}
+
+/*
+ * A regclass literal like 'public.t_id_seq' or '"Mixed"."Seq"', the way
+ * nextval() and setval() take their sequence: unquoted parts are folded to
+ * lower case, quoted ones are kept as they are.
+ */
+static void
+add_regclass_literal(StatementInfoContext *context, const char *literal)
+{
+	List	   *names = NIL;
+	const char *ptr = literal;
+
+	for (;;)
+	{
+		StringInfoData part;
+
+		initStringInfo(&part);
+		if (*ptr == '"')
+		{
+			for (ptr++; *ptr != '\0'; ptr++)
+			{
+				if (*ptr == '"' && ptr[1] == '"')
+					ptr++;
+				else if (*ptr == '"')
+					break;
+				appendStringInfoChar(&part, *ptr);
+			}
+			if (*ptr != '"')
+				return;
+			ptr++;
+		}
+		else
+		{
+			const char *start = ptr;
+
+			while (*ptr != '\0' && *ptr != '.')
+				ptr++;
+			appendStringInfoString(&part, downcase_truncate_identifier(start, ptr - start, false));
+		}
+		if (part.len == 0)
+			return;
+		names = lappend(names, makeString(part.data));
+
+		if (*ptr == '\0')
+			break;
+		if (*ptr != '.')
+			return;
+		ptr++;
+	}
+
+	add_name_list(context, names, 0);
+}
+
+/* The sequence argument of nextval('seq'), setval('seq'::regclass, ...), ... */
+static bool
+is_sequence_function(FuncCall *func_call)
+{
+	const char *name = strVal(llast(func_call->funcname));
+
+	return strcmp(name, "nextval") == 0 || strcmp(name, "setval") == 0 || strcmp(name, "currval") == 0;
+}
+
+static void
+add_sequence_argument(StatementInfoContext *context, FuncCall *func_call)
+{
+	Node	   *arg;
+
+	if (!is_sequence_function(func_call) || func_call->args == NIL)
+		return;
+
+	arg = linitial(func_call->args);
+	if (IsA(arg, TypeCast))
+		arg = castNode(TypeCast, arg)->arg;
+	if (IsA(arg, A_Const) && !castNode(A_Const, arg)->isnull && IsA(&castNode(A_Const, arg)->val, String))
+		add_regclass_literal(context, strVal(&castNode(A_Const, arg)->val));
+}
+
+static bool
+relations_walker(Node *node, StatementInfoContext *context)
+{
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, RangeVar))
+	{
+		add_range_var(context, castNode(RangeVar, node));
+		return false;
+	}
+	if (IsA(node, FuncCall))
+		add_sequence_argument(context, castNode(FuncCall, node));
+
+	return raw_expression_tree_walker(node, relations_walker, (void *) context);
+}
+
+/* Expressions and the referenced table of column and table constraints */
+static void
+add_constraint(StatementInfoContext *context, Constraint *constraint)
+{
+	ListCell   *lc;
+
+	relations_walker(constraint->raw_expr, context);
+	add_range_var(context, constraint->pktable);
+
+	/* GENERATED ... AS IDENTITY (SEQUENCE NAME s) */
+	foreach(lc, constraint->options)
+	{
+		DefElem    *def_elem = lfirst_node(DefElem, lc);
+
+		if (strcmp(def_elem->defname, "sequence_name") == 0)
+			add_name_list(context, castNode(List, def_elem->arg), 0);
+	}
+}
+
+static void
+add_table_elements(StatementInfoContext *context, List *elements)
+{
+	ListCell   *lc;
+
+	foreach(lc, elements)
+	{
+		if (IsA(lfirst(lc), ColumnDef))
+		{
+			ColumnDef  *column_def = castNode(ColumnDef, lfirst(lc));
+			ListCell   *lc2;
+
+			relations_walker(column_def->raw_default, context);
+			foreach(lc2, column_def->constraints)
+				add_constraint(context, lfirst_node(Constraint, lc2));
+		}
+		else if (IsA(lfirst(lc), Constraint))
+			add_constraint(context, castNode(Constraint, lfirst(lc)));
+		else if (IsA(lfirst(lc), TableLikeClause))
+			add_range_var(context, castNode(TableLikeClause, lfirst(lc))->relation);
+	}
+}
+
+/* OWNED BY table.column of CREATE / ALTER SEQUENCE */
+static void
+add_sequence_options(StatementInfoContext *context, List *options)
+{
+	ListCell   *lc;
+
+	foreach(lc, options)
+	{
+		DefElem    *def_elem = lfirst_node(DefElem, lc);
+
+		if (strcmp(def_elem->defname, "owned_by") == 0)
+			add_name_list(context, castNode(List, def_elem->arg), 1);
+	}
+}
+
+/* Subcommands of ALTER TABLE that need the data or the post-data objects in place */
+static bool
+is_post_data_command(AlterTableCmd *cmd)
+{
+	switch (cmd->subtype)
+	{
+		case AT_AddConstraint:
+		case AT_AddIndexConstraint:
+		case AT_ValidateConstraint:
+		case AT_ClusterOn:
+		case AT_ReplicaIdentity:
+		case AT_EnableRowSecurity:
+		case AT_ForceRowSecurity:
+		case AT_EnableTrig:
+		case AT_EnableAlwaysTrig:
+		case AT_EnableReplicaTrig:
+		case AT_DisableTrig:
+		case AT_EnableTrigAll:
+		case AT_DisableTrigAll:
+		case AT_EnableTrigUser:
+		case AT_DisableTrigUser:
+		case AT_EnableRule:
+		case AT_EnableAlwaysRule:
+		case AT_EnableReplicaRule:
+		case AT_DisableRule:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static PgQueryStatementKind
+alter_table_stmt_info(AlterTableStmt *stmt, StatementInfoContext *context)
+{
+	bool		post_data = stmt->objtype == OBJECT_INDEX;
+	bool		pre_data = false;
+	ListCell   *lc;
+
+	add_range_var(context, stmt->relation);
+	foreach(lc, stmt->cmds)
+	{
+		AlterTableCmd *cmd = lfirst_node(AlterTableCmd, lc);
+
+		if (is_post_data_command(cmd))
+			post_data = true;
+		else
+			pre_data = true;
+
+		if (cmd->def == NULL)
+			continue;
+		if (IsA(cmd->def, Constraint))
+			add_constraint(context, castNode(Constraint, cmd->def));
+		else if (IsA(cmd->def, ColumnDef))
+			add_table_elements(context, list_make1(cmd->def));
+		else if (IsA(cmd->def, PartitionCmd))
+			add_range_var(context, castNode(PartitionCmd, cmd->def)->name);
+		else if (IsA(cmd->def, RangeVar))
+			add_range_var(context, castNode(RangeVar, cmd->def));
+		else if (cmd->subtype == AT_ColumnDefault)
+			relations_walker(cmd->def, context);
+	}
+
+	/* Commands that the data depends on (a column default) keep the whole statement in place */
+	return post_data && (!pre_data || stmt->objtype == OBJECT_INDEX) ? PG_QUERY_STATEMENT_POST_DATA : PG_QUERY_STATEMENT_PRE_DATA;
+}
+
+/* SELECT setval(...), SELECT set_config(...) as pg_dump writes them, or something else */
+static PgQueryStatementKind
+select_stmt_info(SelectStmt *stmt, StatementInfoContext *context)
+{
+	bool		only_setval = stmt->targetList != NIL && stmt->fromClause == NIL && stmt->valuesLists == NIL;
+	bool		only_set_config = only_setval;
+	ListCell   *lc;
+
+	foreach(lc, stmt->targetList)
+	{
+		Node	   *val = lfirst_node(ResTarget, lc)->val;
+		const char *name;
+
+		if (!IsA(val, FuncCall))
+		{
+			only_setval = only_set_config = false;
+			break;
+		}
+		name = strVal(llast(castNode(FuncCall, val)->funcname));
+		only_setval = only_setval && strcmp(name, "setval") == 0;
+		only_set_config = only_set_config && strcmp(name, "set_config") == 0;
+	}
+
+	relations_walker((Node *) stmt, context);
+	if (only_set_config)
+	{
+		/* The name of the setting, when there is one */
+		FuncCall   *func_call = castNode(FuncCall, linitial_node(ResTarget, stmt->targetList)->val);
+		Node	   *arg = func_call->args != NIL ? linitial(func_call->args) : NULL;
+
+		if (list_length(stmt->targetList) == 1 && arg != NULL && IsA(arg, A_Const) &&
+			!castNode(A_Const, arg)->isnull && IsA(&castNode(A_Const, arg)->val, String))
+			context->setting = strVal(&castNode(A_Const, arg)->val);
+		return PG_QUERY_STATEMENT_SETTING;
+	}
+	if (only_setval)
+		return PG_QUERY_STATEMENT_SEQUENCE_VALUE;
+
+	/* Functions in the query can do anything */
+	context->uses_unlisted_relations = true;
+	return PG_QUERY_STATEMENT_PRE_DATA;
+}
+
+/*
+ * DROP of tables and the objects that are loaded like them. Dropping a schema
+ * or a type, or anything with CASCADE, can take tables and columns with it.
+ */
+static void
+drop_stmt_info(DropStmt *stmt, StatementInfoContext *context)
+{
+	ListCell   *lc;
+
+	switch (stmt->removeType)
+	{
+		case OBJECT_TABLE:
+		case OBJECT_SEQUENCE:
+		case OBJECT_VIEW:
+		case OBJECT_MATVIEW:
+		case OBJECT_FOREIGN_TABLE:
+			foreach(lc, stmt->objects)
+				add_name_list(context, castNode(List, lfirst(lc)), 0);
+			break;
+		case OBJECT_SCHEMA:
+		case OBJECT_TYPE:
+		case OBJECT_DOMAIN:
+			context->uses_unlisted_relations = true;
+			break;
+		default:
+			if (stmt->behavior == DROP_CASCADE)
+				context->uses_unlisted_relations = true;
+			break;
+	}
+}
+
+/* A statement on a relation, or on another kind of object (relation NULL) that tables may depend on */
+static void
+add_range_var_or_unlisted(StatementInfoContext *context, RangeVar *relation)
+{
+	if (relation != NULL)
+		add_range_var(context, relation);
+	else
+		context->uses_unlisted_relations = true;
+}
+
+static PgQueryStatementKind
+comment_stmt_info(CommentStmt *stmt, StatementInfoContext *context)
+{
+	switch (stmt->objtype)
+	{
+		case OBJECT_TABLE:
+		case OBJECT_SEQUENCE:
+		case OBJECT_VIEW:
+		case OBJECT_MATVIEW:
+		case OBJECT_FOREIGN_TABLE:
+			add_name_list(context, castNode(List, stmt->object), 0);
+			return PG_QUERY_STATEMENT_PRE_DATA;
+		case OBJECT_COLUMN:
+			add_name_list(context, castNode(List, stmt->object), 1);
+			return PG_QUERY_STATEMENT_PRE_DATA;
+		case OBJECT_TABCONSTRAINT:
+		case OBJECT_TRIGGER:
+		case OBJECT_RULE:
+		case OBJECT_POLICY:
+			/* The table, then the name of the object on it */
+			add_name_list(context, castNode(List, stmt->object), 1);
+			return PG_QUERY_STATEMENT_POST_DATA;
+		case OBJECT_INDEX:
+		case OBJECT_STATISTIC_EXT:
+			return PG_QUERY_STATEMENT_POST_DATA;
+		default:
+			return PG_QUERY_STATEMENT_PRE_DATA;
+	}
+}
+
+static PgQueryStatementKind
+statement_info(Node *stmt, StatementInfoContext *context)
+{
+	ListCell   *lc;
+
+	switch (nodeTag(stmt))
+	{
+		case T_CreateStmt:
+			{
+				CreateStmt *create_stmt = castNode(CreateStmt, stmt);
+
+				add_range_var(context, create_stmt->relation);
+				foreach(lc, create_stmt->inhRelations)
+					add_range_var(context, lfirst_node(RangeVar, lc));
+				add_table_elements(context, create_stmt->tableElts);
+				add_table_elements(context, create_stmt->constraints);
+				/* Partitioned tables hold no rows themselves */
+				return create_stmt->partspec == NULL ? PG_QUERY_STATEMENT_CREATE_TABLE : PG_QUERY_STATEMENT_PRE_DATA;
+			}
+		case T_CreateTableAsStmt:
+			add_range_var(context, castNode(CreateTableAsStmt, stmt)->into->rel);
+			/* Not for CREATE TABLE ... AS EXECUTE */
+			if (IsA(castNode(CreateTableAsStmt, stmt)->query, SelectStmt))
+				relations_walker(castNode(CreateTableAsStmt, stmt)->query, context);
+			return PG_QUERY_STATEMENT_PRE_DATA;
+		case T_ViewStmt:
+			add_range_var(context, castNode(ViewStmt, stmt)->view);
+			relations_walker(castNode(ViewStmt, stmt)->query, context);
+			return PG_QUERY_STATEMENT_PRE_DATA;
+		case T_CreateSeqStmt:
+			add_range_var(context, castNode(CreateSeqStmt, stmt)->sequence);
+			add_sequence_options(context, castNode(CreateSeqStmt, stmt)->options);
+			return PG_QUERY_STATEMENT_PRE_DATA;
+		case T_AlterSeqStmt:
+			add_range_var(context, castNode(AlterSeqStmt, stmt)->sequence);
+			add_sequence_options(context, castNode(AlterSeqStmt, stmt)->options);
+			return PG_QUERY_STATEMENT_PRE_DATA;
+		case T_AlterTableStmt:
+			return alter_table_stmt_info(castNode(AlterTableStmt, stmt), context);
+		case T_CommentStmt:
+			return comment_stmt_info(castNode(CommentStmt, stmt), context);
+		case T_GrantStmt:
+			if (castNode(GrantStmt, stmt)->targtype == ACL_TARGET_OBJECT &&
+				(castNode(GrantStmt, stmt)->objtype == OBJECT_TABLE || castNode(GrantStmt, stmt)->objtype == OBJECT_SEQUENCE))
+			{
+				foreach(lc, castNode(GrantStmt, stmt)->objects)
+					add_range_var(context, lfirst_node(RangeVar, lc));
+			}
+			return PG_QUERY_STATEMENT_PRE_DATA;
+
+		case T_IndexStmt:
+			add_range_var(context, castNode(IndexStmt, stmt)->relation);
+			return PG_QUERY_STATEMENT_POST_DATA;
+		case T_CreateTrigStmt:
+			add_range_var(context, castNode(CreateTrigStmt, stmt)->relation);
+			add_range_var(context, castNode(CreateTrigStmt, stmt)->constrrel);
+			return PG_QUERY_STATEMENT_POST_DATA;
+		case T_RuleStmt:
+			add_range_var(context, castNode(RuleStmt, stmt)->relation);
+			return PG_QUERY_STATEMENT_POST_DATA;
+		case T_CreatePolicyStmt:
+			add_range_var(context, castNode(CreatePolicyStmt, stmt)->table);
+			return PG_QUERY_STATEMENT_POST_DATA;
+		case T_AlterPolicyStmt:
+			add_range_var(context, castNode(AlterPolicyStmt, stmt)->table);
+			return PG_QUERY_STATEMENT_POST_DATA;
+		case T_CreateStatsStmt:
+			foreach(lc, castNode(CreateStatsStmt, stmt)->relations)
+			{
+				if (IsA(lfirst(lc), RangeVar))
+					add_range_var(context, lfirst_node(RangeVar, lc));
+			}
+			return PG_QUERY_STATEMENT_POST_DATA;
+		case T_RefreshMatViewStmt:
+			/* Its query reads relations that only the catalog knows */
+			add_range_var(context, castNode(RefreshMatViewStmt, stmt)->relation);
+			context->uses_unlisted_relations = true;
+			return PG_QUERY_STATEMENT_POST_DATA;
+		case T_ClusterStmt:
+			add_range_var_or_unlisted(context, castNode(ClusterStmt, stmt)->relation);
+			return PG_QUERY_STATEMENT_POST_DATA;
+		case T_ReindexStmt:
+			add_range_var_or_unlisted(context, castNode(ReindexStmt, stmt)->relation);
+			return PG_QUERY_STATEMENT_POST_DATA;
+		case T_CreateEventTrigStmt:
+		case T_CreatePublicationStmt:
+		case T_AlterPublicationStmt:
+		case T_CreateSubscriptionStmt:
+			return PG_QUERY_STATEMENT_POST_DATA;
+
+		case T_InsertStmt:
+		case T_UpdateStmt:
+		case T_DeleteStmt:
+		case T_MergeStmt:
+			relations_walker(stmt, context);
+			return PG_QUERY_STATEMENT_DATA;
+		case T_TruncateStmt:
+			foreach(lc, castNode(TruncateStmt, stmt)->relations)
+				add_range_var(context, lfirst_node(RangeVar, lc));
+			return PG_QUERY_STATEMENT_DATA;
+		case T_CopyStmt:
+			add_range_var(context, castNode(CopyStmt, stmt)->relation);
+			return castNode(CopyStmt, stmt)->is_from ? PG_QUERY_STATEMENT_DATA : PG_QUERY_STATEMENT_PRE_DATA;
+		case T_SelectStmt:
+			return select_stmt_info(castNode(SelectStmt, stmt), context);
+
+		case T_DropStmt:
+			drop_stmt_info(castNode(DropStmt, stmt), context);
+			return PG_QUERY_STATEMENT_PRE_DATA;
+		case T_RenameStmt:
+			add_range_var_or_unlisted(context, castNode(RenameStmt, stmt)->relation);
+			return PG_QUERY_STATEMENT_PRE_DATA;
+		case T_AlterObjectSchemaStmt:
+			add_range_var_or_unlisted(context, castNode(AlterObjectSchemaStmt, stmt)->relation);
+			return PG_QUERY_STATEMENT_PRE_DATA;
+		case T_DoStmt:
+		case T_CallStmt:
+			context->uses_unlisted_relations = true;
+			return PG_QUERY_STATEMENT_PRE_DATA;
+
+		case T_VariableSetStmt:
+			if (castNode(VariableSetStmt, stmt)->kind != VAR_RESET_ALL)
+				context->setting = castNode(VariableSetStmt, stmt)->name;
+			return PG_QUERY_STATEMENT_SETTING;
+		case T_TransactionStmt:
+			return PG_QUERY_STATEMENT_TRANSACTION;
+		case T_CreatedbStmt:
+		case T_DropdbStmt:
+		case T_CreateTableSpaceStmt:
+		case T_DropTableSpaceStmt:
+		case T_AlterSystemStmt:
+		case T_VacuumStmt:
+			return PG_QUERY_STATEMENT_NO_TRANSACTION;
+
+		default:
+			/* Functions, types, schemas, ...: no telling which relations depend on them */
+			context->uses_unlisted_relations = true;
+			return PG_QUERY_STATEMENT_PRE_DATA;
+	}
+}
+
+PgQueryStatementInfoResult pg_query_statement_info(const char* input)
+{
+	return pg_query_statement_info_len(input, strlen(input), PG_QUERY_PARSE_DEFAULT);
+}
+
+PgQueryStatementInfoResult pg_query_statement_info_len(const char* input, size_t len, int parser_options)
+{
+	MemoryContext ctx = NULL;
+	PgQueryInternalParsetreeAndError parsetree_and_error;
+	PgQueryStatementInfoResult result = {0};
+	char	   *statement;
+
+	ctx = pg_query_enter_memory_context();
+
+	statement = palloc(len + 1);
+	memcpy(statement, input, len);
+	statement[len] = '\0';
+
+	parsetree_and_error = pg_query_raw_parse(statement, parser_options);
+
+	// These are all malloc-ed and will survive exiting the memory context, the caller is responsible to free them now
+	result.stderr_buffer = parsetree_and_error.stderr_buffer;
+	result.error = parsetree_and_error.error;
+
+	/* Several statements are only classified as a whole */
+	result.uses_unlisted_relations = parsetree_and_error.tree != NULL && list_length(parsetree_and_error.tree) > 1;
+
+	if (parsetree_and_error.tree != NULL && list_length(parsetree_and_error.tree) == 1)
+	{
+		RawStmt    *raw_stmt = linitial_node(RawStmt, parsetree_and_error.tree);
+		StatementInfoContext context = {NIL};
+		ListCell   *lc;
+
+		result.kind = statement_info(raw_stmt->stmt, &context);
+		result.uses_unlisted_relations = context.uses_unlisted_relations;
+		if (context.setting != NULL)
+			result.setting = strdup(downcase_truncate_identifier(context.setting, strlen(context.setting), false));
+		result.n_relations = list_length(context.relations);
+		if (result.n_relations > 0)
+		{
+			result.relations = malloc(sizeof(char *) * result.n_relations);
+			foreach(lc, context.relations)
+				result.relations[foreach_current_index(lc)] = strdup(lfirst(lc));
+		}
+	}
+
+	pg_query_exit_memory_context(ctx);
+
+	return result;
+}
+
+void pg_query_free_statement_info_result(PgQueryStatementInfoResult result)
+{
+	if (result.error) {
+		pg_query_free_error(result.error);
+	}
+
+	for (int i = 0; i < result.n_relations; i++)
+		free(result.relations[i]);
+	free(result.relations);
+	free(result.setting);
+
+	free(result.stderr_buffer);
+}
@@ -0,0 +1,233 @@
+#include "pg_query.h"
+#include "pg_query_internal.h"
+
+#include "lib/stringinfo.h"
+#include "nodes/parsenodes.h"
+#include "utils/builtins.h"
+
+/*
+ * Column definitions of CREATE TABLE statements, as written in the statement
+ * (no catalog lookups), so that converters can tell the column types of the
+ * tables that INSERT statements further down in a dump refer to. ALTER TABLE
+ * statements give the changes they make to the columns, for the caller to
+ * apply to the definition it has.
+ */
+
+static char *
+quoted_relation_name(RangeVar *relation)
+{
+	if (relation->schemaname != NULL)
+	{
+		StringInfoData str;
+
+		initStringInfo(&str);
+		appendStringInfo(&str, "%s.%s",
+						 quote_identifier(relation->schemaname),
+						 quote_identifier(relation->relname));
+		return strdup(str.data);
+	}
+
+	return strdup(quote_identifier(relation->relname));
+}
+
+static char *
+type_name_string(TypeName *type_name)
+{
+	StringInfoData str;
+	ListCell   *lc;
+
+	initStringInfo(&str);
+	foreach(lc, type_name->names)
+	{
+		if (foreach_current_index(lc) > 0)
+			appendStringInfoChar(&str, '.');
+		appendStringInfoString(&str, strVal(lfirst(lc)));
+	}
+
+	return strdup(str.data);
+}
+
+/* serial types are integers with a sequence default */
+static bool
+type_is_serial(TypeName *type_name)
+{
+	const char *name;
+
+	if (list_length(type_name->names) != 1 || type_name->arrayBounds != NIL)
+		return false;
+
+	name = strVal(linitial(type_name->names));
+	return strcmp(name, "serial") == 0 || strcmp(name, "serial4") == 0 ||
+		strcmp(name, "bigserial") == 0 || strcmp(name, "serial8") == 0 ||
+		strcmp(name, "smallserial") == 0 || strcmp(name, "serial2") == 0;
+}
+
+static void
+column_def_to_column(ColumnDef *column_def, PgQueryColumnDef *column)
+{
+	ListCell   *lc;
+
+	memset(column, 0, sizeof(PgQueryColumnDef));
+	column->name = strdup(quote_identifier(column_def->colname));
+	/* Typed tables (OF type) may list columns without a type */
+	column->type_name = column_def->typeName != NULL ? type_name_string(column_def->typeName) : NULL;
+	column->is_array = column_def->typeName != NULL && column_def->typeName->arrayBounds != NIL;
+	column->has_default = column_def->typeName != NULL && type_is_serial(column_def->typeName);
+
+	/* The raw parse tree has the defaults as constraints of the column */
+	foreach(lc, column_def->constraints)
+	{
+		Constraint *constraint = lfirst_node(Constraint, lc);
+
+		if (constraint->contype == CONSTR_DEFAULT || constraint->contype == CONSTR_IDENTITY)
+			column->has_default = true;
+		else if (constraint->contype == CONSTR_GENERATED)
+			column->is_generated = true;
+	}
+}
+
+static void
+create_stmt_to_table_def(CreateStmt *stmt, PgQueryTableDefResult *result)
+{
+	ListCell   *lc;
+	int			n_columns = 0;
+
+	result->relation = quoted_relation_name(stmt->relation);
+	result->has_inherited_columns = stmt->inhRelations != NIL || stmt->ofTypename != NULL || stmt->partbound != NULL;
+
+	foreach(lc, stmt->tableElts)
+	{
+		if (IsA(lfirst(lc), ColumnDef))
+			n_columns++;
+		else if (IsA(lfirst(lc), TableLikeClause))
+			result->has_inherited_columns = true;
+	}
+
+	if (n_columns == 0)
+		return;
+
+	result->columns = malloc(sizeof(PgQueryColumnDef) * n_columns);
+	foreach(lc, stmt->tableElts)
+	{
+		ColumnDef  *column_def;
+		PgQueryColumnDef *column;
+
+		if (!IsA(lfirst(lc), ColumnDef))
+			continue;
+
+		column_def = castNode(ColumnDef, lfirst(lc));
+		column = &result->columns[result->n_columns++];
+		column_def_to_column(column_def, column);
+	}
+}
+
+static void
+alter_table_stmt_to_table_def(AlterTableStmt *stmt, PgQueryTableDefResult *result)
+{
+	ListCell   *lc;
+
+	if (stmt->objtype != OBJECT_TABLE)
+		return;
+
+	result->columns = malloc(sizeof(PgQueryColumnDef) * list_length(stmt->cmds));
+	foreach(lc, stmt->cmds)
+	{
+		AlterTableCmd *cmd = lfirst_node(AlterTableCmd, lc);
+		PgQueryColumnDef column = {0};
+
+		switch (cmd->subtype)
+		{
+			case AT_AddColumn:
+				column_def_to_column(castNode(ColumnDef, cmd->def), &column);
+				break;
+			case AT_ColumnDefault:
+				column.change = cmd->def != NULL ? PG_QUERY_COLUMN_SET_DEFAULT : PG_QUERY_COLUMN_DROP_DEFAULT;
+				break;
+			case AT_AddIdentity:
+				column.change = PG_QUERY_COLUMN_SET_DEFAULT;
+				break;
+			case AT_DropIdentity:
+				column.change = PG_QUERY_COLUMN_DROP_DEFAULT;
+				break;
+			case AT_DropExpression:
+				column.change = PG_QUERY_COLUMN_DROP_EXPRESSION;
+				break;
+			case AT_DropColumn:
+				column.change = PG_QUERY_COLUMN_DROP;
+				break;
+			default:
+				/* Constraints, owner, storage and the like don't change what rows look like */
+				continue;
+		}
+
+		if (column.name == NULL)
+			column.name = strdup(quote_identifier(cmd->name));
+		result->columns[result->n_columns++] = column;
+	}
+
+	if (result->n_columns == 0)
+	{
+		free(result->columns);
+		result->columns = NULL;
+		return;
+	}
+
+	result->relation = quoted_relation_name(stmt->relation);
+	result->is_alter_table = true;
+}
+
+PgQueryTableDefResult pg_query_table_def(const char* input)
+{
+	return pg_query_table_def_len(input, strlen(input), PG_QUERY_PARSE_DEFAULT);
+}
+
+PgQueryTableDefResult pg_query_table_def_len(const char* input, size_t len, int parser_options)
+{
+	MemoryContext ctx = NULL;
+	PgQueryInternalParsetreeAndError parsetree_and_error;
+	PgQueryTableDefResult result = {0};
+	char	   *statement;
+
+	ctx = pg_query_enter_memory_context();
+
+	statement = palloc(len + 1);
+	memcpy(statement, input, len);
+	statement[len] = '\0';
+
+	parsetree_and_error = pg_query_raw_parse(statement, parser_options);
+
+	// These are all malloc-ed and will survive exiting the memory context, the caller is responsible to free them now
+	result.stderr_buffer = parsetree_and_error.stderr_buffer;
+	result.error = parsetree_and_error.error;
+
+	if (parsetree_and_error.tree != NULL && list_length(parsetree_and_error.tree) == 1)
+	{
+		RawStmt    *raw_stmt = linitial_node(RawStmt, parsetree_and_error.tree);
+
+		if (IsA(raw_stmt->stmt, CreateStmt))
+			create_stmt_to_table_def(castNode(CreateStmt, raw_stmt->stmt), &result);
+		else if (IsA(raw_stmt->stmt, AlterTableStmt))
+			alter_table_stmt_to_table_def(castNode(AlterTableStmt, raw_stmt->stmt), &result);
+	}
+
+	pg_query_exit_memory_context(ctx);
+
+	return result;
+}
+
+void pg_query_free_table_def_result(PgQueryTableDefResult result)
+{
+	if (result.error) {
+		pg_query_free_error(result.error);
+	}
+
+	for (int i = 0; i < result.n_columns; i++)
+	{
+		free(result.columns[i].name);
+		free(result.columns[i].type_name);
+	}
+	free(result.columns);
+
+	free(result.relation);
+	free(result.stderr_buffer);
+}
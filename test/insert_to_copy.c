@@ -0,0 +1,536 @@
+#include <pg_query.h>
+#include <pg_query_copy.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "insert_to_copy_tests.c"
+
+// Renders the result the same way the insert_to_copy example writes it out,
+// or as an empty string if the statement was not converted. Rows that stay an
+// INSERT follow the COPY block.
+char* copy_block(PgQueryInsertToCopyResult result)
+{
+  size_t len = 96 + strlen(result.relation) + result.copy_data_len;
+  char* buf;
+
+  for (int i = 0; i < result.n_columns; i++)
+    len += strlen(result.columns[i]) + 2;
+  if (result.fallback_insert)
+    len += strlen(result.fallback_insert);
+
+  buf = malloc(len);
+  buf[0] = '\0';
+  if (result.n_rows > 0)
+  {
+    strcat(buf, "COPY ");
+    strcat(buf, result.relation);
+    for (int i = 0; i < result.n_columns; i++)
+    {
+      strcat(buf, i == 0 ? " (" : ", ");
+      strcat(buf, result.columns[i]);
+    }
+    if (result.n_columns > 0)
+      strcat(buf, ")");
+    strcat(buf, result.has_default ? " FROM stdin WITH (DEFAULT '\\D');\n" : " FROM stdin;\n");
+    strcat(buf, result.copy_data);
+    strcat(buf, "\\.\n");
+  }
+  if (result.fallback_insert)
+  {
+    strcat(buf, result.fallback_insert);
+    strcat(buf, ";\n");
+  }
+
+  return buf;
+}
+
+// Statements converted by the fast path must come out exactly like they do from the parse tree
+size_t fast_path_count = 0;
+
+int check_fast_path(const char* query, size_t len)
+{
+  PgQueryInsertToCopyResult fast = {0};
+  PgQueryInsertToCopyResult parsed;
+  int ret_code = 0;
+
+  if (!pg_query_insert_to_copy_fast(query, len, &fast))
+    return 0;
+
+  fast_path_count++;
+  parsed = pg_query_insert_to_copy_parser(query, len, PG_QUERY_PARSE_DEFAULT);
+
+  if (parsed.error || !parsed.relation) {
+    ret_code = -1;
+    printf("FAST PATH converted \"%.*s\", the parser did not\n", (int) len, query);
+  } else {
+    char* fast_block = copy_block(fast);
+    char* parsed_block = copy_block(parsed);
+
+    if (strcmp(fast_block, parsed_block) != 0 || fast.n_rows != parsed.n_rows || fast.copy_data_len != parsed.copy_data_len) {
+      ret_code = -1;
+      printf("FAST PATH mismatch for \"%.*s\"\nparser: %s\nfast path: %s\n", (int) len, query, parsed_block, fast_block);
+    }
+
+    free(fast_block);
+    free(parsed_block);
+  }
+
+  pg_query_free_insert_to_copy_result(fast);
+  pg_query_free_insert_to_copy_result(parsed);
+
+  return ret_code;
+}
+
+// Statements converted a batch of rows at a time must come out exactly like they do in one go
+size_t batched_count = 0;
+
+int check_row_batches(const char* query, size_t len)
+{
+  PgQueryInsertToCopyResult batched = {0};
+  PgQueryInsertToCopyResult parsed;
+  int ret_code = 0;
+
+  // One row per batch
+  if (!pg_query_insert_to_copy_batched(query, len, PG_QUERY_PARSE_DEFAULT, 1, &batched))
+    return 0;
+
+  batched_count++;
+  parsed = pg_query_insert_to_copy_parser(query, len, PG_QUERY_PARSE_DEFAULT);
+
+  if (parsed.error || !parsed.relation) {
+    ret_code = -1;
+    printf("BATCHES converted \"%.*s\", the parser did not\n", (int) len, query);
+  } else {
+    char* batched_block = copy_block(batched);
+    char* parsed_block = copy_block(parsed);
+
+    if (strcmp(batched_block, parsed_block) != 0 || batched.n_rows != parsed.n_rows || batched.n_fallback_rows != parsed.n_fallback_rows) {
+      ret_code = -1;
+      printf("BATCHES mismatch for \"%.*s\"\nparser: %s\nbatches: %s\n", (int) len, query, parsed_block, batched_block);
+    }
+
+    free(batched_block);
+    free(parsed_block);
+  }
+
+  pg_query_free_insert_to_copy_result(batched);
+  pg_query_free_insert_to_copy_result(parsed);
+
+  return ret_code;
+}
+
+int check_fast_path_file(const char* filename)
+{
+  char* sample_buffer;
+  struct stat sample_stat;
+  int fd;
+  int ret_code = 0;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf("\nERROR opening regression test file: %s\n", filename);
+    return -1;
+  }
+  fstat(fd, &sample_stat);
+
+  sample_buffer = malloc(sample_stat.st_size + 1);
+  read(fd, sample_buffer, sample_stat.st_size);
+  sample_buffer[sample_stat.st_size] = 0;
+  close(fd);
+
+  PgQuerySplitResult split_result = pg_query_split_with_scanner(sample_buffer);
+  if (split_result.error != NULL) {
+    printf("\nERROR splitting file \"%s\"\n  error: %s\n", filename, split_result.error->message);
+    ret_code = -1;
+  }
+
+  for (int i = 0; i < split_result.n_stmts; i++) {
+    if (check_fast_path(sample_buffer + split_result.stmts[i]->stmt_location, split_result.stmts[i]->stmt_len) != 0)
+      ret_code = -1;
+    if (check_row_batches(sample_buffer + split_result.stmts[i]->stmt_location, split_result.stmts[i]->stmt_len) != 0)
+      ret_code = -1;
+  }
+
+  pg_query_free_split_result(split_result);
+  free(sample_buffer);
+
+  return ret_code;
+}
+
+// Generates pg_dump style INSERT statements with a deterministic mix of literals
+int check_fast_path_generated(size_t n_statements)
+{
+  const char* prefixes[] = {
+    "INSERT INTO public.items VALUES ",
+    "INSERT INTO public.items (id, name, price, flag, note) VALUES ",
+    "INSERT INTO \"Sales\".\"Order Items\" (\"Id\", \"name\", price, \"select\", note) VALUES ",
+    "\n-- Data for items\ninsert into items(id,name,price,flag,note)values",
+  };
+  const char* literals[] = {
+    "0", "-0", "007", "42", "-42", "2147483647", "-2147483647", "2147483648", "-2147483648",
+    "9223372036854775807", "1.50", "-1.50", ".5", "5.", "1e10", "1.5E-3", "-2e+4",
+    "NULL", "null", "TRUE", "false",
+    "''", "'plain'", "'it''s'", "'tab\there'", "'multi\nline\r\n'", "'back\\slash'", "'\\N'",
+    "'semi;colon'", "'ünïcödé'", "'\x01\x02\v\f'",
+    "E'esc\\'aped'", "E'\\n\\t\\r\\b\\f'", "E'\\\\'", "E'q''uote'", "e'\\z'",
+    "'2024-01-01'::date", "'12:00' :: pg_catalog.text", "'{a,\"b c\"}'::text[]", "'{{1}}'::int4[][2]",
+    "NULL::int8", "E'\\\\x01'::bytea", "'{}'::JSONB",
+  };
+  size_t n_prefixes = sizeof(prefixes) / sizeof(prefixes[0]);
+  size_t n_literals = sizeof(literals) / sizeof(literals[0]);
+  unsigned int state = 12345;
+  size_t expected_fast = 0;
+  int ret_code = 0;
+  char query[4096];
+
+  fast_path_count = 0;
+
+  for (size_t i = 0; i < n_statements; i++) {
+    int rows;
+    size_t len;
+
+    state = state * 1103515245 + 12345;
+    strcpy(query, prefixes[(state >> 16) % n_prefixes]);
+    rows = 1 + (state >> 8) % 3;
+
+    for (int row = 0; row < rows; row++) {
+      strcat(query, row == 0 ? "(" : ", (");
+      for (int column = 0; column < 5; column++) {
+        state = state * 1103515245 + 12345;
+        if (column > 0)
+          strcat(query, (state & 1) ? ", " : ",");
+        strcat(query, literals[(state >> 16) % n_literals]);
+      }
+      strcat(query, ")");
+    }
+    strcat(query, ";\n");
+    len = strlen(query);
+    expected_fast++;
+
+    if (check_fast_path(query, len) != 0)
+      ret_code = -1;
+    if (check_row_batches(query, len) != 0)
+      ret_code = -1;
+
+    // Variations the fast path has to leave to the parser
+    query[len - 2] = '\0';
+    strcat(query, " RETURNING *;");
+    if (check_fast_path(query, strlen(query)) != 0)
+      ret_code = -1;
+  }
+
+  if (fast_path_count != expected_fast) {
+    ret_code = -1;
+    printf("FAST PATH converted %zu of %zu generated statements\n", fast_path_count, expected_fast);
+  }
+
+  return ret_code;
+}
+
+// Compares pg_query_copy_escape with a byte at a time version, on random strings
+// of bytes it has to stop at or escape, at every alignment
+int check_escape_kernel(size_t n_strings)
+{
+  const char alphabet[] = { 'a', 'z', '\\', '\t', '\n', '\r', '\b', '\v', '\f', '\'', '\0', '\x07', '\x0e', '\xc3', '\x7f', '\x88' };
+  unsigned int state = 4242;
+  int ret_code = 0;
+  char src[600];
+  char expected[1200];
+  char actual[1200];
+
+  for (size_t i = 0; i < n_strings; i++) {
+    size_t offset, len, expected_len = 0, expected_consumed, actual_len, actual_consumed;
+    int flags;
+    bool plain;
+
+    state = state * 1103515245 + 12345;
+    offset = (state >> 16) % 64;
+    state = state * 1103515245 + 12345;
+    len = (state >> 16) % 300;
+    state = state * 1103515245 + 12345;
+    flags = (state >> 16) % 4;
+    state = state * 1103515245 + 12345;
+    plain = (state >> 16) % 2;
+    for (size_t j = 0; j < len; j++) {
+      state = state * 1103515245 + 12345;
+      // Mostly plain bytes half of the time, so that there are long runs to skip
+      src[offset + j] = plain && (state >> 16) % 64 != 0 ? 'p' : alphabet[(state >> 16) % sizeof(alphabet)];
+    }
+
+    for (expected_consumed = 0; expected_consumed < len; expected_consumed++) {
+      char c = src[offset + expected_consumed];
+      const char* escapes = "\bb\ff\nn\rr\tt\vv\\\\";
+      const char* escape = NULL;
+      if ((flags & PG_QUERY_COPY_ESCAPE_STOP_AT_QUOTE) && (c == '\'' || c == '\0'))
+        break;
+      if ((flags & PG_QUERY_COPY_ESCAPE_STOP_AT_BACKSLASH) && c == '\\')
+        break;
+      for (size_t k = 0; c != '\0' && k < strlen(escapes); k += 2)
+        if (escapes[k] == c)
+          escape = escapes + k + 1;
+      if (escape) {
+        expected[expected_len++] = '\\';
+        expected[expected_len++] = *escape;
+      } else {
+        expected[expected_len++] = c;
+      }
+    }
+
+    actual_consumed = pg_query_copy_escape(actual, &actual_len, src + offset, len, flags);
+    if (actual_consumed != expected_consumed || actual_len != expected_len || memcmp(actual, expected, expected_len) != 0) {
+      ret_code = -1;
+      printf("ESCAPE KERNEL mismatch for string %zu (flags %d): consumed %zu, expected %zu\n", i, flags, actual_consumed, expected_consumed);
+    }
+  }
+
+  return ret_code;
+}
+
+// Long string literals are escaped in chunks, with escapes right around the chunk boundaries
+int check_fast_path_long_string()
+{
+  const char* specials[] = { "\t", "\\", "''", "\n" };
+  size_t value_len = 200000;
+  char* query = malloc(value_len * 2 + 100);
+  int ret_code = 0;
+
+  for (size_t k = 0; k < 4; k++) {
+    char* ptr = query + sprintf(query, "INSERT INTO t VALUES (1, %s'", k == 3 ? "E" : "");
+    for (size_t j = 0; j < value_len; j++) {
+      size_t position = j % 65536;
+      if (position < 3 || position > 65533 || j % 1000 == 999)
+        ptr += sprintf(ptr, "%s", k == 3 ? "\\n" : specials[(j + k) % 3]);
+      else
+        *ptr++ = 'v';
+    }
+    ptr += sprintf(ptr, "');");
+    if (check_fast_path(query, ptr - query) != 0)
+      ret_code = -1;
+  }
+
+  free(query);
+  return ret_code;
+}
+
+// Batches handed to the callback of pg_query_insert_to_copy_rows
+typedef struct {
+  int n_batches;
+  int n_rows;
+  int n_failed;
+  char* rest;
+} BatchCount;
+
+void count_batch(PgQueryInsertToCopyResult* rows, void* context)
+{
+  BatchCount* count = (BatchCount*) context;
+
+  count->n_batches++;
+  count->n_rows += rows->n_rows + rows->n_fallback_rows;
+  if (!rows->relation || rows->error) {
+    count->n_failed++;
+    count->rest = rows->fallback_insert;
+    rows->fallback_insert = NULL;
+  }
+}
+
+// A statement long enough to be converted in batches, with rows that stay an INSERT
+// and DEFAULT columns, has to give the same result as the parser in one go, and be
+// handed to the callback of pg_query_insert_to_copy_rows in several batches
+int check_long_statement()
+{
+  const char* rows[] = {
+    "(%d, 'row %d', DEFAULT, '2024-01-01'::date)",
+    "(%d, E'row\\t%d', 1.5, NULL)",
+    "(%d, $$row (%d)$$, /* ) */ -2, '{a,b}'::text[])",
+    "(%d, 'row %d', now()::text, NULL)",
+  };
+  size_t capacity = 4 * PG_QUERY_INSERT_TO_COPY_BATCH_THRESHOLD;
+  char* query = malloc(capacity);
+  int ret_code = 0;
+
+  for (int k = 0; k < 2; k++) {
+    size_t len = sprintf(query, "INSERT INTO public.t (id, name, value, extra) VALUES\n");
+    PgQueryInsertToCopyResult result;
+    PgQueryInsertToCopyResult parsed;
+
+    for (int i = 0; len < 2 * PG_QUERY_INSERT_TO_COPY_BATCH_THRESHOLD; i++) {
+      if (i > 0)
+        len += sprintf(query + len, ",\n");
+      // Without the rows that stay an INSERT the second time
+      len += sprintf(query + len, rows[i % (k == 0 ? 4 : 3)], i, i);
+    }
+    len += sprintf(query + len, ";\n");
+
+    result = pg_query_insert_to_copy_len(query, len, PG_QUERY_PARSE_DEFAULT);
+    parsed = pg_query_insert_to_copy_parser(query, len, PG_QUERY_PARSE_DEFAULT);
+    if (!result.relation || !parsed.relation) {
+      ret_code = -1;
+      printf("LONG STATEMENT %d not converted\n", k);
+    } else {
+      char* result_block = copy_block(result);
+      char* parsed_block = copy_block(parsed);
+
+      if (strcmp(result_block, parsed_block) != 0 || result.n_rows != parsed.n_rows) {
+        ret_code = -1;
+        printf("LONG STATEMENT %d mismatch, %d rows instead of %d\n", k, result.n_rows, parsed.n_rows);
+      }
+
+      free(result_block);
+      free(parsed_block);
+    }
+
+    BatchCount count = {0};
+    pg_query_insert_to_copy_rows(query, len, PG_QUERY_PARSE_DEFAULT, PG_QUERY_INSERT_TO_COPY_BATCH_SIZE, count_batch, &count);
+    if (count.n_batches < 2 || count.n_failed != 0 || count.n_rows != parsed.n_rows + parsed.n_fallback_rows) {
+      ret_code = -1;
+      printf("LONG STATEMENT %d in %d batches, %d rows instead of %d\n", k, count.n_batches, count.n_rows, parsed.n_rows + parsed.n_fallback_rows);
+    }
+
+    pg_query_free_insert_to_copy_result(result);
+    pg_query_free_insert_to_copy_result(parsed);
+  }
+
+  // A row that can't be parsed stops the batches, and the rows from its batch on are left
+  {
+    BatchCount count = {0};
+    size_t len = sprintf(query, "INSERT INTO t VALUES (1), (2), (3 4), (5);");
+
+    pg_query_insert_to_copy_rows(query, len, PG_QUERY_PARSE_DEFAULT, 1, count_batch, &count);
+    if (count.n_batches != 3 || count.n_failed != 1 || count.n_rows != 2 ||
+        strcmp(count.rest ? count.rest : "", "INSERT INTO t VALUES (3 4), (5)") != 0) {
+      ret_code = -1;
+      printf("FAILED BATCH after %d batches, rest: %s\n", count.n_batches, count.rest ? count.rest : "(null)");
+    }
+    free(count.rest);
+  }
+
+  free(query);
+  return ret_code;
+}
+
+const char* regressFilenames[] = {
+  "alter_table.sql",
+  "arrays.sql",
+  "bit.sql",
+  "boolean.sql",
+  "char.sql",
+  "cluster.sql",
+  "constraints.sql",
+  "create_misc.sql",
+  "domain.sql",
+  "float4.sql",
+  "float8.sql",
+  "foreign_key.sql",
+  "generated.sql",
+  "identity.sql",
+  "inherit.sql",
+  "insert.sql",
+  "insert_conflict.sql",
+  "int2.sql",
+  "int4.sql",
+  "int8.sql",
+  "join.sql",
+  "numeric.sql",
+  "numeric_big.sql",
+  "rules.sql",
+  "text.sql",
+  "timestamp.sql",
+  "triggers.sql",
+  "updatable_views.sql",
+  "varchar.sql"
+};
+size_t regressFilenameCount = sizeof(regressFilenames) / sizeof(regressFilenames[0]);
+
+// pg_query_exit frees the cached statement prefixes with everything else, and
+// the conversions after it have to set them up again
+int check_after_exit()
+{
+  const char* query = "INSERT INTO public.t (id, name) VALUES (1, 'one'), (2, NULL);";
+  const char* expected = "COPY public.t (id, name) FROM stdin;\n1\tone\n2\t\\N\n\\.\n";
+  int ret_code = 0;
+
+  for (int i = 0; i < 3; i++) {
+    PgQueryInsertToCopyResult result = pg_query_insert_to_copy(query);
+    char* actual = result.relation ? copy_block(result) : strdup("");
+
+    if (result.error || strcmp(actual, expected) != 0) {
+      ret_code = -1;
+      printf("AFTER EXIT %d: %s\n", i, result.error ? result.error->message : actual);
+    }
+
+    free(actual);
+    pg_query_free_insert_to_copy_result(result);
+    pg_query_exit();
+  }
+
+  return ret_code;
+}
+
+int main() {
+  size_t i;
+  bool ret_code = 0;
+
+  for (i = 0; i < testsLength; i += 2) {
+    PgQueryInsertToCopyResult result = pg_query_insert_to_copy(tests[i]);
+
+    if (result.error) {
+      ret_code = -1;
+      printf("%s\n", result.error->message);
+    } else {
+      char* actual = result.relation ? copy_block(result) : strdup("");
+
+      if (strcmp(actual, tests[i + 1]) == 0) {
+        printf(".");
+      } else {
+        ret_code = -1;
+        printf("INVALID result for \"%s\"\nexpected: %s\nactual: %s\n", tests[i], tests[i + 1], actual);
+      }
+
+      free(actual);
+    }
+
+    pg_query_free_insert_to_copy_result(result);
+
+    if (check_row_batches(tests[i], strlen(tests[i])) != 0)
+      ret_code = -1;
+  }
+
+  printf("\n");
+
+  for (i = 0; i < regressFilenameCount; i += 1) {
+    char* filename = malloc(strlen("test/sql/postgres_regress/") + strlen(regressFilenames[i]) + 1);
+    strcpy(filename, "test/sql/postgres_regress/");
+    strcat(filename, regressFilenames[i]);
+    fast_path_count = 0;
+    batched_count = 0;
+    if (check_fast_path_file(filename) != 0)
+      ret_code = -1;
+    printf("%s: %zu statements converted by the fast path, %zu in batches\n", regressFilenames[i], fast_path_count, batched_count);
+    free(filename);
+  }
+
+  if (check_fast_path_generated(2000) != 0)
+    ret_code = -1;
+
+  if (check_escape_kernel(20000) != 0)
+    ret_code = -1;
+
+  if (check_fast_path_long_string() != 0)
+    ret_code = -1;
+
+  if (check_long_statement() != 0)
+    ret_code = -1;
+
+  if (check_after_exit() != 0)
+    ret_code = -1;
+
+  pg_query_exit();
+
+  return ret_code;
+}
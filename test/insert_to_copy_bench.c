@@ -0,0 +1,453 @@
+/*
+ * Throughput benchmark of the insert_to_copy converters. Generates dumps with
+ * test/insert_to_copy_gendump, runs each converter mode over them and reports
+ * the time, MB/s and rows/s (of the input dump) and the peak RSS of each run.
+ *
+ * The outputs of the modes that must give the same bytes (the I/O and threading
+ * variants of insert_to_copy, insert_to_copy --reorder with and without --jobs,
+ * insert_to_copy2 with a buffer budget it stays under and one it has to spill
+ * for) are compared with each other, and the benchmark fails when they differ
+ * or when a converter fails. The scripts of --format=binary have the path of
+ * their data directory in them, so those are compared by the files in it.
+ *
+ * Usage: test/insert_to_copy_bench [--rows N] [--tables N] [--jobs N] [--runs N]
+ *                                  [--bin DIR] [--keep DIR]
+ *
+ *   --rows N    rows per table of each dump (default 200000)
+ *   --tables N  tables in each dump (default 4)
+ *   --jobs N    --jobs of the parallel modes (default 4)
+ *   --runs N    runs of each mode, the fastest is reported (default 1)
+ *   --bin DIR   the source tree the converters and the generator are in
+ *               (default ".")
+ *   --keep DIR  writes the dumps and the outputs to DIR and leaves them there
+ *               instead of using a temporary directory
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_ARGS 32
+
+typedef struct
+{
+	const char *name;
+	const char *args;			/* gendump options, besides --rows and --tables */
+} Dump;
+
+static const Dump dumps[] = {
+	{"inserts", "--inserts"},
+	{"column-inserts", "--column-inserts"},
+	{"rows-per-insert", "--rows-per-insert 100"},
+	{"text-heavy", "--columns text,varchar,text --string-length 0:400 --string-distribution exponential "
+	 "--quote-rate 0.01 --newline-rate 0.005 --tab-rate 0.005 --backslash-rate 0.002 --null-rate 0.05"},
+	{"numeric", "--columns integer,bigint,numeric,float,date,boolean"},
+};
+
+typedef struct
+{
+	const char *name;
+	const char *converter;		/* under examples/ */
+	const char *args;			/* %d is replaced by --jobs */
+	char		group;			/* modes of a group must give the same output */
+} Mode;
+
+#define N_GROUPS 5
+
+static const Mode modes[] = {
+	{"default", "insert_to_copy", "", 'A'},
+	{"no-mmap", "insert_to_copy", "--no-mmap", 'A'},
+	{"jobs", "insert_to_copy", "--jobs %d", 'A'},
+	{"jobs no-mmap", "insert_to_copy", "--jobs %d --no-mmap", 'A'},
+	{"stdin", "insert_to_copy", "-", 'A'},
+	{"reorder", "insert_to_copy", "--reorder", 'B'},
+	{"reorder jobs", "insert_to_copy", "--reorder --jobs %d", 'B'},
+	{"binary", "insert_to_copy", "--format=binary", 'C'},
+	{"binary jobs", "insert_to_copy", "--format=binary --jobs %d", 'C'},
+	{"insert_to_copy2", "insert_to_copy2", "", 'D'},
+	{"insert_to_copy2 stdin", "insert_to_copy2", "-", 'D'},
+	{"insert_to_copy2 budget", "insert_to_copy2", "--max-buffer-mem 64G", 'E'},
+	{"insert_to_copy2 spill", "insert_to_copy2", "--max-buffer-mem 64k", 'E'},
+};
+
+#define N_DUMPS (sizeof(dumps) / sizeof(dumps[0]))
+#define N_MODES (sizeof(modes) / sizeof(modes[0]))
+
+typedef struct
+{
+	double		seconds;
+	long		peak_rss_kb;
+} RunResult;
+
+static double
+now_seconds(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Splits args on spaces into argv, from argv[*argc] on */
+static void
+split_args(char *args, char **argv, int *argc)
+{
+	for (char *arg = strtok(args, " "); arg && *argc < MAX_ARGS - 1; arg = strtok(NULL, " "))
+		argv[(*argc)++] = arg;
+	argv[*argc] = NULL;
+}
+
+/*
+ * Runs argv with stdin from stdin_path (unless NULL) and stdout to stdout_path
+ * (/dev/null if NULL), stderr to /dev/null. Returns false if it fails.
+ */
+static bool
+run(char **argv, const char *stdin_path, const char *stdout_path, RunResult *result)
+{
+	double		start = now_seconds();
+	pid_t		pid = fork();
+	struct rusage usage;
+	int			status;
+
+	if (pid < 0)
+	{
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0)
+	{
+		int			in = stdin_path ? open(stdin_path, O_RDONLY) : -1;
+		int			out = open(stdout_path ? stdout_path : "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		int			null = open("/dev/null", O_WRONLY);
+
+		if ((stdin_path && in < 0) || out < 0 || null < 0)
+			_exit(127);
+		if (in >= 0)
+			dup2(in, STDIN_FILENO);
+		dup2(out, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	if (wait4(pid, &status, 0, &usage) < 0)
+	{
+		perror("wait4");
+		exit(1);
+	}
+	result->seconds = now_seconds() - start;
+#ifdef __APPLE__
+	result->peak_rss_kb = usage.ru_maxrss / 1024;
+#else
+	result->peak_rss_kb = usage.ru_maxrss;
+#endif
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool
+generate_dump(const char *bin, const Dump *dump, long rows, int tables, const char *path)
+{
+	char		gendump[4096];
+	char		rows_arg[32];
+	char		tables_arg[32];
+	char	   *args = strdup(dump->args);
+	char	   *argv[MAX_ARGS];
+	int			argc = 0;
+	RunResult	result;
+	bool		ok;
+
+	snprintf(gendump, sizeof(gendump), "%s/test/insert_to_copy_gendump", bin);
+	snprintf(rows_arg, sizeof(rows_arg), "%ld", rows);
+	snprintf(tables_arg, sizeof(tables_arg), "%d", tables);
+	argv[argc++] = gendump;
+	argv[argc++] = "--rows";
+	argv[argc++] = rows_arg;
+	argv[argc++] = "--tables";
+	argv[argc++] = tables_arg;
+	split_args(args, argv, &argc);
+	argv[argc++] = (char *) path;
+	argv[argc] = NULL;
+
+	ok = run(argv, NULL, NULL, &result);
+	free(args);
+	return ok;
+}
+
+static bool
+run_mode(const char *bin, const Mode *mode, int jobs, const char *input, const char *output, RunResult *result)
+{
+	char		converter[4096];
+	char		args[256];
+	char	   *argv[MAX_ARGS];
+	int			argc = 0;
+	bool		from_stdin;
+
+	snprintf(converter, sizeof(converter), "%s/examples/%s", bin, mode->converter);
+	snprintf(args, sizeof(args), mode->args, jobs);
+	argv[argc++] = converter;
+	split_args(args, argv, &argc);
+
+	/* A "-" argument reads the dump from stdin */
+	from_stdin = argc > 1 && strcmp(argv[argc - 1], "-") == 0;
+	if (!from_stdin)
+		argv[argc++] = (char *) input;
+	argv[argc++] = (char *) output;
+	argv[argc] = NULL;
+
+	return run(argv, from_stdin ? input : NULL, NULL, result);
+}
+
+/* Returns 1 if the files are the same, 0 if they differ, -1 if one can't be read */
+static int
+same_files(const char *a, const char *b)
+{
+	FILE	   *fa = fopen(a, "rb");
+	FILE	   *fb = fopen(b, "rb");
+	char		buf_a[65536];
+	char		buf_b[65536];
+	int			same = 1;
+
+	if (!fa || !fb)
+		same = -1;
+	while (same == 1)
+	{
+		size_t		na = fread(buf_a, 1, sizeof(buf_a), fa);
+		size_t		nb = fread(buf_b, 1, sizeof(buf_b), fb);
+
+		if (na != nb || memcmp(buf_a, buf_b, na) != 0)
+			same = 0;
+		else if (na == 0)
+			break;
+	}
+	if (fa)
+		fclose(fa);
+	if (fb)
+		fclose(fb);
+	return same;
+}
+
+/* Same as same_files, for the files of two --format=binary data directories */
+static int
+same_data_dirs(const char *a, const char *b)
+{
+	DIR		   *dir = opendir(a);
+	struct dirent *entry;
+	int			files = 0;
+	int			same = 1;
+	char		file_a[4200];
+	char		file_b[4200];
+
+	if (!dir)
+		return -1;
+	while (same == 1 && (entry = readdir(dir)) != NULL)
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(file_a, sizeof(file_a), "%s/%s", a, entry->d_name);
+		snprintf(file_b, sizeof(file_b), "%s/%s", b, entry->d_name);
+		same = same_files(file_a, file_b);
+		files++;
+	}
+	closedir(dir);
+
+	/* And b has no other files */
+	if (same == 1 && (dir = opendir(b)) != NULL)
+	{
+		while ((entry = readdir(dir)) != NULL)
+			if (entry->d_name[0] != '.')
+				files--;
+		closedir(dir);
+		same = files == 0;
+	}
+	return same;
+}
+
+static void
+remove_dir(const char *path)
+{
+	DIR		   *dir = opendir(path);
+	struct dirent *entry;
+	char		file[4200];
+	struct stat st;
+
+	if (!dir)
+		return;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+		if (lstat(file, &st) == 0 && S_ISDIR(st.st_mode))
+			remove_dir(file);
+		else
+			unlink(file);
+	}
+	closedir(dir);
+	rmdir(path);
+}
+
+static void
+usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [--rows N] [--tables N] [--jobs N] [--runs N] [--bin DIR] [--keep DIR]\n", program);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	long		rows = 200000;
+	int			tables = 4;
+	int			jobs = 4;
+	int			runs = 1;
+	const char *bin = ".";
+	const char *keep = NULL;
+	char		dir[4096];
+	int			failures = 0;
+
+	for (int argi = 1; argi < argc; argi++)
+	{
+		const char *value = argi + 1 < argc ? argv[argi + 1] : NULL;
+
+		if (!value)
+			usage(argv[0]);
+		if (strcmp(argv[argi], "--rows") == 0)
+			rows = atol(value);
+		else if (strcmp(argv[argi], "--tables") == 0)
+			tables = atoi(value);
+		else if (strcmp(argv[argi], "--jobs") == 0)
+			jobs = atoi(value);
+		else if (strcmp(argv[argi], "--runs") == 0)
+			runs = atoi(value);
+		else if (strcmp(argv[argi], "--bin") == 0)
+			bin = value;
+		else if (strcmp(argv[argi], "--keep") == 0)
+			keep = value;
+		else
+			usage(argv[0]);
+		argi++;
+	}
+	if (rows < 1 || tables < 1 || jobs < 1 || runs < 1)
+		usage(argv[0]);
+
+	if (keep)
+	{
+		snprintf(dir, sizeof(dir), "%s", keep);
+		if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+		{
+			perror("Error creating the output directory");
+			return 1;
+		}
+	}
+	else
+	{
+		const char *tmp = getenv("TMPDIR");
+
+		snprintf(dir, sizeof(dir), "%s/insert_to_copy_bench.XXXXXX", tmp && *tmp ? tmp : "/tmp");
+		if (!mkdtemp(dir))
+		{
+			perror("Error creating a temporary directory");
+			return 1;
+		}
+	}
+
+	printf("%-16s %-22s %9s %9s %12s %10s  %s\n", "dump", "mode", "seconds", "MB/s", "rows/s", "peak RSS", "output");
+
+	for (size_t d = 0; d < N_DUMPS; d++)
+	{
+		char		input[4200];
+		struct stat st;
+		char		first_output[N_GROUPS][4200] = {{0}};
+
+		snprintf(input, sizeof(input), "%s/%s.sql", dir, dumps[d].name);
+		if (!generate_dump(bin, &dumps[d], rows, tables, input) || stat(input, &st) != 0)
+		{
+			fprintf(stderr, "Error generating the %s dump\n", dumps[d].name);
+			failures++;
+			continue;
+		}
+
+		for (size_t m = 0; m < N_MODES; m++)
+		{
+			const Mode *mode = &modes[m];
+			char		output[4200];
+			char		output_name[64];
+			RunResult	best = {0};
+			bool		ok = true;
+			const char *verdict;
+
+			snprintf(output_name, sizeof(output_name), "%s", mode->name);
+			for (char *c = output_name; *c; c++)
+				if (*c == ' ')
+					*c = '_';
+			snprintf(output, sizeof(output), "%s/%s.%s.out", dir, dumps[d].name, output_name);
+
+			for (int r = 0; r < runs && ok; r++)
+			{
+				RunResult	result;
+
+				ok = run_mode(bin, mode, jobs, input, output, &result);
+				if (r == 0 || result.seconds < best.seconds)
+					best.seconds = result.seconds;
+				if (result.peak_rss_kb > best.peak_rss_kb)
+					best.peak_rss_kb = result.peak_rss_kb;
+			}
+
+			char	   *reference = first_output[mode->group - 'A'];
+
+			if (!ok)
+				verdict = "FAILED";
+			else if (!reference[0])
+			{
+				snprintf(reference, sizeof(first_output[0]), "%s", output);
+				verdict = "reference";
+			}
+			else
+			{
+				int			same;
+
+				if (strstr(mode->args, "--format=binary"))
+				{
+					char		reference_data[4300];
+					char		output_data[4300];
+
+					snprintf(reference_data, sizeof(reference_data), "%s.data", reference);
+					snprintf(output_data, sizeof(output_data), "%s.data", output);
+					same = same_data_dirs(reference_data, output_data);
+				}
+				else
+					same = same_files(reference, output);
+
+				verdict = same == 1 ? "same" : same == 0 ? "DIFFERS" : "unreadable";
+				ok = same == 1;
+			}
+			if (!ok)
+				failures++;
+
+			printf("%-16s %-22s %9.3f %9.1f %12.0f %7.1f MB  %s\n", dumps[d].name, mode->name, best.seconds,
+				   best.seconds > 0 ? st.st_size / 1048576.0 / best.seconds : 0,
+				   best.seconds > 0 ? rows * tables / best.seconds : 0, best.peak_rss_kb / 1024.0, verdict);
+			fflush(stdout);
+		}
+	}
+
+	if (!keep)
+		remove_dir(dir);
+	if (failures > 0)
+	{
+		fprintf(stderr, "%d run(s) failed or gave a different output\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,409 @@
+/*
+ * Writes a synthetic dump in the shape pg_dump --inserts / --column-inserts
+ * gives, to benchmark and compare the insert_to_copy converters on data of any
+ * size. The output only depends on the options (and --seed), so the same
+ * command always gives the same dump.
+ *
+ * Usage: test/insert_to_copy_gendump [options] [output.sql]
+ *
+ *   --tables N              tables t1 .. tN (default 4)
+ *   --rows N                rows per table (default 10000)
+ *   --columns LIST          column types after the integer id, comma separated:
+ *                           integer, bigint, numeric, float, boolean, text,
+ *                           varchar, date, timestamp (default
+ *                           "text,integer,numeric,timestamp,boolean,text")
+ *   --inserts               INSERT INTO t VALUES (...) (the default)
+ *   --column-inserts        INSERT INTO t (id, ...) VALUES (...)
+ *   --rows-per-insert N     up to N rows per INSERT, like pg_dump's option
+ *   --string-length MIN:MAX length of text and varchar values (default 0:40)
+ *   --string-distribution uniform|exponential
+ *                           exponential makes most strings short and a few
+ *                           long, up to MAX
+ *   --quote-rate P          chance of each string character being a quote
+ *   --newline-rate P        ... a newline
+ *   --tab-rate P            ... a tab
+ *   --backslash-rate P      ... a backslash
+ *   --null-rate P           chance of a value (other than the id) being NULL
+ *   --seed N                random seed (default 1)
+ *
+ * The output goes to stdout without an output file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+#define MAX_COLUMNS 64
+
+typedef enum
+{
+	COL_INTEGER,
+	COL_BIGINT,
+	COL_NUMERIC,
+	COL_FLOAT,
+	COL_BOOLEAN,
+	COL_TEXT,
+	COL_VARCHAR,
+	COL_DATE,
+	COL_TIMESTAMP
+} ColumnType;
+
+static const struct
+{
+	const char *name;
+	const char *sql;
+	ColumnType	type;
+}			column_types[] = {
+	{"integer", "integer", COL_INTEGER},
+	{"bigint", "bigint", COL_BIGINT},
+	{"numeric", "numeric(12,2)", COL_NUMERIC},
+	{"float", "double precision", COL_FLOAT},
+	{"boolean", "boolean", COL_BOOLEAN},
+	{"text", "text", COL_TEXT},
+	{"varchar", "character varying", COL_VARCHAR},
+	{"date", "date", COL_DATE},
+	{"timestamp", "timestamp without time zone", COL_TIMESTAMP},
+};
+
+#define N_COLUMN_TYPES (sizeof(column_types) / sizeof(column_types[0]))
+
+typedef struct
+{
+	int			tables;
+	long		rows;
+	int			n_columns;
+	int			columns[MAX_COLUMNS];	/* indexes into column_types */
+	bool		column_inserts;
+	long		rows_per_insert;
+	int			min_length;
+	int			max_length;
+	bool		exponential;
+	double		quote_rate;
+	double		newline_rate;
+	double		tab_rate;
+	double		backslash_rate;
+	double		null_rate;
+	uint64_t	seed;
+} Options;
+
+static uint64_t rng_state;
+
+/* xorshift64*, the same sequence everywhere */
+static uint64_t
+next_random(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * UINT64_C(2685821657736338717);
+}
+
+/* Uniform in [0, 1) */
+static double
+random_double(void)
+{
+	return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static long
+random_range(long min, long max)
+{
+	return min + (long) (next_random() % (uint64_t) (max - min + 1));
+}
+
+static void
+usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [--tables N] [--rows N] [--columns LIST] [--inserts | --column-inserts] [--rows-per-insert N]\n"
+			"       [--string-length MIN:MAX] [--string-distribution uniform|exponential] [--quote-rate P]\n"
+			"       [--newline-rate P] [--tab-rate P] [--backslash-rate P] [--null-rate P] [--seed N] [output.sql]\n", program);
+	exit(1);
+}
+
+static bool
+parse_columns(Options *options, const char *list)
+{
+	char	   *copy = strdup(list);
+	char	   *saveptr = NULL;
+
+	options->n_columns = 0;
+	for (char *name = strtok_r(copy, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr))
+	{
+		size_t		i;
+
+		for (i = 0; i < N_COLUMN_TYPES && strcmp(column_types[i].name, name) != 0; i++)
+			;
+		if (i == N_COLUMN_TYPES || options->n_columns == MAX_COLUMNS)
+		{
+			free(copy);
+			return false;
+		}
+		options->columns[options->n_columns++] = (int) i;
+	}
+	free(copy);
+	return options->n_columns > 0;
+}
+
+static int
+string_length(const Options *options)
+{
+	if (options->exponential)
+	{
+		/* Mean at a quarter of the range, the tail cut at max */
+		double		length = options->min_length - log(1.0 - random_double()) * (options->max_length - options->min_length) / 4;
+
+		return length > options->max_length ? options->max_length : (int) length;
+	}
+	return (int) random_range(options->min_length, options->max_length);
+}
+
+static void
+write_string(FILE *out, const Options *options)
+{
+	static const char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789     ";
+	int			length = string_length(options);
+
+	putc('\'', out);
+	for (int i = 0; i < length; i++)
+	{
+		double		r = random_double();
+
+		if ((r -= options->quote_rate) < 0)
+			fputs("''", out);
+		else if ((r -= options->newline_rate) < 0)
+			putc('\n', out);
+		else if ((r -= options->tab_rate) < 0)
+			putc('\t', out);
+		else if ((r -= options->backslash_rate) < 0)
+			putc('\\', out);
+		else
+			putc(letters[next_random() % (sizeof(letters) - 1)], out);
+	}
+	putc('\'', out);
+}
+
+static void
+write_value(FILE *out, const Options *options, ColumnType type)
+{
+	if (options->null_rate > 0 && random_double() < options->null_rate)
+	{
+		fputs("NULL", out);
+		return;
+	}
+
+	switch (type)
+	{
+		case COL_INTEGER:
+			fprintf(out, "%ld", random_range(-1000000, 1000000));
+			break;
+		case COL_BIGINT:
+			fprintf(out, "%lld", (long long) (next_random() >> 2) - (long long) (UINT64_C(1) << 61));
+			break;
+		case COL_NUMERIC:
+			fprintf(out, "%ld.%02ld", random_range(0, 9999999), random_range(0, 99));
+			break;
+		case COL_FLOAT:
+			fprintf(out, "%.15g", (random_double() - 0.5) * 1e6);
+			break;
+		case COL_BOOLEAN:
+			fputs(next_random() & 1 ? "true" : "false", out);
+			break;
+		case COL_TEXT:
+		case COL_VARCHAR:
+			write_string(out, options);
+			break;
+		case COL_DATE:
+			fprintf(out, "'%04ld-%02ld-%02ld'", random_range(1990, 2030), random_range(1, 12), random_range(1, 28));
+			break;
+		case COL_TIMESTAMP:
+			fprintf(out, "'%04ld-%02ld-%02ld %02ld:%02ld:%02ld.%06ld'", random_range(1990, 2030), random_range(1, 12),
+					random_range(1, 28), random_range(0, 23), random_range(0, 59), random_range(0, 59), random_range(0, 999999));
+			break;
+	}
+}
+
+static void
+write_row(FILE *out, const Options *options, long id)
+{
+	fprintf(out, "(%ld", id);
+	for (int i = 0; i < options->n_columns; i++)
+	{
+		fputs(", ", out);
+		write_value(out, options, column_types[options->columns[i]].type);
+	}
+	putc(')', out);
+}
+
+static void
+write_insert_prefix(FILE *out, const Options *options, int table)
+{
+	fprintf(out, "INSERT INTO public.t%d ", table);
+	if (options->column_inserts)
+	{
+		fputs("(id", out);
+		for (int i = 0; i < options->n_columns; i++)
+			fprintf(out, ", c%d", i + 1);
+		fputs(") ", out);
+	}
+	fputs("VALUES", out);
+}
+
+static void
+write_dump(FILE *out, const Options *options)
+{
+	fputs("--\n-- PostgreSQL database dump\n--\n\n"
+		  "SET statement_timeout = 0;\n"
+		  "SET lock_timeout = 0;\n"
+		  "SET client_encoding = 'UTF8';\n"
+		  "SET standard_conforming_strings = on;\n"
+		  "SELECT pg_catalog.set_config('search_path', '', false);\n"
+		  "SET check_function_bodies = false;\n"
+		  "SET client_min_messages = warning;\n\n"
+		  "SET default_tablespace = '';\n\n"
+		  "SET default_table_access_method = heap;\n\n", out);
+
+	for (int t = 1; t <= options->tables; t++)
+	{
+		fprintf(out, "--\n-- Name: t%d; Type: TABLE; Schema: public; Owner: bench\n--\n\n", t);
+		fprintf(out, "CREATE TABLE public.t%d (\n    id integer NOT NULL", t);
+		for (int i = 0; i < options->n_columns; i++)
+			fprintf(out, ",\n    c%d %s", i + 1, column_types[options->columns[i]].sql);
+		fprintf(out, "\n);\n\n\nALTER TABLE public.t%d OWNER TO bench;\n\n", t);
+	}
+
+	for (int t = 1; t <= options->tables; t++)
+	{
+		fprintf(out, "--\n-- Data for Name: t%d; Type: TABLE DATA; Schema: public; Owner: bench\n--\n\n", t);
+		for (long id = 1; id <= options->rows;)
+		{
+			write_insert_prefix(out, options, t);
+			if (options->rows_per_insert > 0)
+			{
+				/* pg_dump --rows-per-insert puts each row on a line of its own */
+				for (long n = 0; n < options->rows_per_insert && id <= options->rows; n++, id++)
+				{
+					fputs(n > 0 ? ",\n\t" : "\n\t", out);
+					write_row(out, options, id);
+				}
+			}
+			else
+			{
+				putc(' ', out);
+				write_row(out, options, id++);
+			}
+			fputs(";\n", out);
+		}
+		fputs("\n\n", out);
+	}
+
+	for (int t = 1; t <= options->tables; t++)
+	{
+		fprintf(out, "--\n-- Name: t%d t%d_pkey; Type: CONSTRAINT; Schema: public; Owner: bench\n--\n\n", t, t);
+		fprintf(out, "ALTER TABLE ONLY public.t%d\n    ADD CONSTRAINT t%d_pkey PRIMARY KEY (id);\n\n\n", t, t);
+	}
+
+	fputs("--\n-- PostgreSQL database dump complete\n--\n\n", out);
+}
+
+int
+main(int argc, char *argv[])
+{
+	Options		options = {0};
+	const char *output = NULL;
+	int			argi;
+
+	options.tables = 4;
+	options.rows = 10000;
+	options.min_length = 0;
+	options.max_length = 40;
+	options.seed = 1;
+	parse_columns(&options, "text,integer,numeric,timestamp,boolean,text");
+
+	for (argi = 1; argi < argc; argi++)
+	{
+		const char *arg = argv[argi];
+		const char *value = argi + 1 < argc ? argv[argi + 1] : NULL;
+
+		if (strcmp(arg, "--inserts") == 0)
+			options.column_inserts = false;
+		else if (strcmp(arg, "--column-inserts") == 0)
+			options.column_inserts = true;
+		else if (strncmp(arg, "--", 2) != 0)
+		{
+			if (output)
+				usage(argv[0]);
+			output = arg;
+			continue;
+		}
+		else if (!value)
+			usage(argv[0]);
+		else
+		{
+			argi++;
+			if (strcmp(arg, "--tables") == 0)
+				options.tables = atoi(value);
+			else if (strcmp(arg, "--rows") == 0)
+				options.rows = atol(value);
+			else if (strcmp(arg, "--columns") == 0)
+			{
+				if (!parse_columns(&options, value))
+					usage(argv[0]);
+			}
+			else if (strcmp(arg, "--rows-per-insert") == 0)
+				options.rows_per_insert = atol(value);
+			else if (strcmp(arg, "--string-length") == 0)
+			{
+				if (sscanf(value, "%d:%d", &options.min_length, &options.max_length) != 2 ||
+					options.min_length < 0 || options.max_length < options.min_length)
+					usage(argv[0]);
+			}
+			else if (strcmp(arg, "--string-distribution") == 0)
+			{
+				if (strcmp(value, "exponential") == 0)
+					options.exponential = true;
+				else if (strcmp(value, "uniform") == 0)
+					options.exponential = false;
+				else
+					usage(argv[0]);
+			}
+			else if (strcmp(arg, "--quote-rate") == 0)
+				options.quote_rate = atof(value);
+			else if (strcmp(arg, "--newline-rate") == 0)
+				options.newline_rate = atof(value);
+			else if (strcmp(arg, "--tab-rate") == 0)
+				options.tab_rate = atof(value);
+			else if (strcmp(arg, "--backslash-rate") == 0)
+				options.backslash_rate = atof(value);
+			else if (strcmp(arg, "--null-rate") == 0)
+				options.null_rate = atof(value);
+			else if (strcmp(arg, "--seed") == 0)
+				options.seed = strtoull(value, NULL, 10);
+			else
+				usage(argv[0]);
+		}
+	}
+	if (options.tables < 1 || options.rows < 0 || options.rows_per_insert < 0)
+		usage(argv[0]);
+
+	/* xorshift needs a state other than 0 */
+	rng_state = options.seed * UINT64_C(0x9E3779B97F4A7C15) + 1;
+
+	FILE	   *out = output ? fopen(output, "w") : stdout;
+
+	if (!out)
+	{
+		perror("Error opening the output file");
+		return 1;
+	}
+	setvbuf(out, NULL, _IOFBF, 1 << 20);
+	write_dump(out, &options);
+	if (ferror(out) || (output && fclose(out) != 0))
+	{
+		perror("Error writing the dump");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# Loads the text and the binary COPY conversion of a dump into scratch databases
+# of a local PostgreSQL server, once more straight through the wire protocol
+# (--connect), once from the directory output with the parallel restore
+# script and once in restore order with COPY FREEZE (--reorder), and checks that all of them end up with the same table contents as
+# loading the original INSERT statements.
+#
+# Usage: test/insert_to_copy_load.sh [dump.sql]
+#
+# Connection settings come from the usual libpq environment variables (PGHOST,
+# PGPORT, PGUSER, ...), which --connect reads as well. The user needs the
+# CREATEDB privilege.
+
+set -e
+
+DUMP=${1:-test/insert_to_copy_binary.sql}
+CONVERTER=${CONVERTER:-examples/insert_to_copy}
+WORK=${TMPDIR:-/tmp}/insert_to_copy_load.$$
+PREFIX=insert_to_copy_load_$$
+
+mkdir -p "$WORK"
+trap 'for db in inserts text binary wire directory reorder; do dropdb --if-exists "${PREFIX}_$db" >/dev/null 2>&1 || true; done; rm -rf "$WORK"' EXIT
+
+"$CONVERTER" "$DUMP" "$WORK/text.sql"
+"$CONVERTER" --format=binary --data-dir "$WORK/data" "$DUMP" "$WORK/binary.sql"
+"$CONVERTER" --reorder "$DUMP" "$WORK/reorder.sql"
+
+for db in inserts text binary wire directory reorder; do
+	createdb "${PREFIX}_$db"
+done
+psql -X -q -v ON_ERROR_STOP=1 -d "${PREFIX}_inserts" -f "$DUMP" >/dev/null
+psql -X -q -v ON_ERROR_STOP=1 -d "${PREFIX}_text" -f "$WORK/text.sql" >/dev/null
+psql -X -q -v ON_ERROR_STOP=1 -d "${PREFIX}_binary" -f "$WORK/binary.sql" >/dev/null
+psql -X -q -v ON_ERROR_STOP=1 -d "${PREFIX}_reorder" -f "$WORK/reorder.sql" >/dev/null
+"$CONVERTER" --format=binary --connect "dbname=${PREFIX}_wire" "$DUMP"
+"$CONVERTER" --format=directory --chunk-size=1k "$DUMP" "$WORK/directory"
+examples/insert_to_copy_restore.sh -j 4 "$WORK/directory" -d "${PREFIX}_directory" >/dev/null
+
+# Every row of every table in the public schema, as text, in a stable order
+TABLES_QUERY="SELECT quote_ident(relname) FROM pg_class WHERE relnamespace = 'public'::regnamespace AND relkind = 'r' ORDER BY relname"
+
+for db in inserts text binary wire directory reorder; do
+	for table in $(psql -X -At -d "${PREFIX}_$db" -c "$TABLES_QUERY"); do
+		echo "-- $table"
+		psql -X -At -d "${PREFIX}_$db" -c "SELECT t::text FROM ONLY public.$table t ORDER BY 1"
+	done >"$WORK/$db.out"
+done
+
+diff -u "$WORK/inserts.out" "$WORK/text.out"
+diff -u "$WORK/inserts.out" "$WORK/binary.out"
+diff -u "$WORK/inserts.out" "$WORK/wire.out"
+diff -u "$WORK/inserts.out" "$WORK/directory.out"
+diff -u "$WORK/inserts.out" "$WORK/reorder.out"
+echo "Text, binary, --connect, directory and --reorder loads have the same rows as the original dump"
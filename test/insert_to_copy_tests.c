@@ -0,0 +1,60 @@
+const char* tests[] = {
+  "INSERT INTO public.funcoes (id, name, query) VALUES (1, 'teste query', 'sdf')",
+  "COPY public.funcoes (id, name, query) FROM stdin;\n1\tteste query\tsdf\n\\.\n",
+  "INSERT INTO t VALUES (1, 2), (3, 4);",
+  "COPY t FROM stdin;\n1\t2\n3\t4\n\\.\n",
+  "INSERT INTO t VALUES (NULL, -1, 1.50, 12345678901, 1e10, true, false)",
+  "COPY t FROM stdin;\n\\N\t-1\t1.50\t12345678901\t1e10\tt\tf\n\\.\n",
+  "INSERT INTO t VALUES ('it''s', 'a\tb', 'line1\nline2', E'back\\\\slash\\r')",
+  "COPY t FROM stdin;\nit's\ta\\tb\tline1\\nline2\tback\\\\slash\\r\n\\.\n",
+  "INSERT INTO t VALUES ($$dollar 'quoted'$$, B'1010', X'1F')",
+  "COPY t FROM stdin;\ndollar 'quoted'\tb1010\tx1F\n\\.\n",
+  "INSERT INTO \"Mixed Case\".\"Order\" (\"Id\", \"select\") VALUES (1, 2)",
+  "COPY \"Mixed Case\".\"Order\" (\"Id\", \"select\") FROM stdin;\n1\t2\n\\.\n",
+  "INSERT INTO t OVERRIDING SYSTEM VALUE VALUES (1)",
+  "COPY t FROM stdin;\n1\n\\.\n",
+  "INSERT INTO t VALUES ('2024-01-01'::date, DATE '2024-01-02', CAST('12:00' AS time), '\\x0102'::bytea, 'x'::text)",
+  "COPY t FROM stdin;\n2024-01-01\t2024-01-02\t12:00\t\\\\x0102\tx\n\\.\n",
+  "INSERT INTO t VALUES (1::bigint, 9223372036854775807::int8, 1.50::numeric, 2::float8, true::boolean, NULL::int, -1::integer, -'2'::numeric, +3, -(-4.5)::numeric)",
+  "COPY t FROM stdin;\n1\t9223372036854775807\t1.50\t2\tt\t\\N\t-1\t-2\t3\t4.5\n\\.\n",
+  "INSERT INTO t VALUES (ARRAY[1, -2, NULL], ARRAY['a b', 'NULL', '', 'q\"\\', '{x}'], ARRAY[[1, 2], [3, 4]], ARRAY[]::integer[], '{1,2}'::int[], ARRAY['2024-01-01']::date[])",
+  "COPY t FROM stdin;\n{1,-2,NULL}\t{\"a b\",\"NULL\",\"\",\"q\\\\\"\\\\\\\\\",\"{x}\"}\t{{1,2},{3,4}}\t{}\t{1,2}\t{2024-01-01}\n\\.\n",
+  "INSERT INTO t VALUES (ROW(1, 'a b', NULL, '', 'q\"'), (2, ARRAY[1, 2]), ROW('x')::pair)",
+  "COPY t FROM stdin;\n(1,\"a b\",,\"\",\"q\"\"\")\t(2,\"{1,2}\")\t(x)\n\\.\n",
+  "INSERT INTO t (id, name, created) VALUES (DEFAULT, 'a', DEFAULT), (DEFAULT, 'b', '2024-01-01')",
+  "COPY t (name, created) FROM stdin WITH (DEFAULT '\\D');\na\t\\D\nb\t2024-01-01\n\\.\n",
+  "INSERT INTO t VALUES (DEFAULT, 'a')",
+  "COPY t FROM stdin WITH (DEFAULT '\\D');\n\\D\ta\n\\.\n",
+  "INSERT INTO t (id, name) VALUES (DEFAULT, DEFAULT)",
+  "COPY t (id, name) FROM stdin WITH (DEFAULT '\\D');\n\\D\t\\D\n\\.\n",
+  "INSERT INTO t (id, created) VALUES (1, now()), (2, '2024-01-01'), (3, /* ( */ now() - interval '1 day'), (DEFAULT, ')')",
+  "COPY t (id, created) FROM stdin WITH (DEFAULT '\\D');\n2\t2024-01-01\n\\D\t)\n\\.\nINSERT INTO t (id, created) VALUES (1, now()), (3, /* ( */ now() - interval '1 day');\n",
+  "INSERT INTO t VALUES (now())",
+  "INSERT INTO t VALUES (now());\n",
+  "INSERT INTO t VALUES ('1.5'::varchar(2), 1.5::integer, 1::text, 'x'::myschema.int4, -'a'::text, (SELECT 1))",
+  "INSERT INTO t VALUES ('1.5'::varchar(2), 1.5::integer, 1::text, 'x'::myschema.int4, -'a'::text, (SELECT 1));\n",
+  "INSERT INTO t VALUES ('1'::integer, 'x'::\"MyType\", NULL::time with time zone, NULL::pg_catalog.date, '{}'::json[3][])",
+  "COPY t FROM stdin;\n1\tx\t\\N\t\\N\t{}\n\\.\n",
+  "INSERT INTO t VALUES ('1'::bit, 'ab'::char, 'x'::text::date, 'y'::setof text)",
+  "INSERT INTO t VALUES ('1'::bit, 'ab'::char, 'x'::text::date, 'y'::setof text);\n",
+  "INSERT INTO t OVERRIDING SYSTEM VALUE VALUES (1), (now())",
+  "",
+  "INSERT INTO t VALUES (1) ON CONFLICT DO NOTHING",
+  "",
+  "INSERT INTO t VALUES (1) RETURNING id",
+  "",
+  "INSERT INTO t OVERRIDING USER VALUE VALUES (1)",
+  "",
+  "INSERT INTO t (a[1]) VALUES (1)",
+  "",
+  "INSERT INTO t SELECT 1",
+  "",
+  "INSERT INTO t DEFAULT VALUES",
+  "",
+  "INSERT INTO t VALUES (1); INSERT INTO t VALUES (2)",
+  "",
+  "SELECT 1",
+  "",
+};
+
+size_t testsLength = __LINE__ - 4;
@@ -0,0 +1,244 @@
+/*
+ * Stand-in PostgreSQL server for testing insert_to_copy --connect without a
+ * real server.
+ *
+ * Usage: test/pgwire_server <socket path> <record file> [password]
+ *
+ * Listens on the Unix socket, then goes to the background so the caller can
+ * connect right away. It accepts a single connection, answers the startup
+ * (asking for a cleartext password if one is given), every Query and every
+ * COPY FROM STDIN the way a server would, and writes each message it receives
+ * to the record file, one line per message. It exits when the client
+ * disconnects.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int	conn;
+static FILE *record;
+
+static bool
+read_exactly(char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t		n = read(conn, buf, len);
+
+		if (n <= 0)
+			return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+static uint32_t
+get_int32(const char *ptr)
+{
+	const unsigned char *bytes = (const unsigned char *) ptr;
+
+	return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 | (uint32_t) bytes[2] << 8 | bytes[3];
+}
+
+static void
+send_message(char type, const char *payload, size_t len)
+{
+	char		header[5] = {type, (len + 4) >> 24, (len + 4) >> 16, (len + 4) >> 8, len + 4};
+
+	if (write(conn, header, 5) != 5 || (len > 0 && write(conn, payload, len) != (ssize_t) len))
+		exit(1);
+}
+
+static void
+ready_for_query(void)
+{
+	send_message('Z', "I", 1);
+}
+
+static void
+record_escaped(const char *data, size_t len)
+{
+	fputc('"', record);
+	for (size_t i = 0; i < len; i++)
+	{
+		unsigned char c = data[i];
+
+		if (c == '"' || c == '\\')
+			fprintf(record, "\\%c", c);
+		else if (c == '\n')
+			fputs("\\n", record);
+		else if (c == '\t')
+			fputs("\\t", record);
+		else if (c < 0x20 || c >= 0x7f)
+			fprintf(record, "\\x%02x", c);
+		else
+			fputc(c, record);
+	}
+	fputc('"', record);
+}
+
+/* Whether the query is a COPY, after leading whitespace and comments */
+static bool
+is_copy(const char *query)
+{
+	for (;;)
+	{
+		while (isspace((unsigned char) *query))
+			query++;
+		if (strncmp(query, "--", 2) == 0)
+			query += strcspn(query, "\n");
+		else if (strncmp(query, "/*", 2) == 0 && strstr(query, "*/"))
+			query = strstr(query, "*/") + 2;
+		else
+			break;
+	}
+	return strncasecmp(query, "COPY ", 5) == 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un addr = {0};
+	const char *password = argc > 3 ? argv[3] : NULL;
+	int			listener;
+	char		buf[8];
+
+	if (argc < 3)
+	{
+		fprintf(stderr, "Usage: %s <socket path> <record file> [password]\n", argv[0]);
+		return 1;
+	}
+
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", argv[1]);
+	unlink(argv[1]);
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listener, 1) != 0)
+	{
+		perror("pgwire_server");
+		return 1;
+	}
+	record = fopen(argv[2], "w");
+	if (!record)
+	{
+		perror("pgwire_server");
+		return 1;
+	}
+
+	/* The socket is ready, let the caller go on */
+	if (fork() != 0)
+		return 0;
+	alarm(60);
+
+	conn = accept(listener, NULL, NULL);
+	if (conn < 0)
+		return 1;
+
+	/* StartupMessage: length, protocol version, name/value pairs */
+	if (!read_exactly(buf, 4))
+		return 1;
+	{
+		uint32_t	len = get_int32(buf);
+		char	   *startup = malloc(len);
+
+		if (!read_exactly(startup, len - 4))
+			return 1;
+		fprintf(record, "StartupMessage %u", get_int32(startup));
+		for (const char *ptr = startup + 4; ptr < startup + len - 4 && *ptr; ptr += strlen(ptr) + 1)
+		{
+			fprintf(record, " %s=", ptr);
+			ptr += strlen(ptr) + 1;
+			fputs(ptr, record);
+		}
+		fputc('\n', record);
+		free(startup);
+	}
+
+	if (password)
+	{
+		char		type;
+
+		send_message('R', "\0\0\0\3", 4);
+		if (!read_exactly(&type, 1) || !read_exactly(buf, 4))
+			return 1;
+		{
+			uint32_t	len = get_int32(buf) - 4;
+			char	   *payload = malloc(len);
+
+			if (!read_exactly(payload, len))
+				return 1;
+			fprintf(record, "PasswordMessage%s\n", type == 'p' && strcmp(payload, password) == 0 ? "" : " (wrong)");
+			free(payload);
+		}
+	}
+	send_message('R', "\0\0\0\0", 4);
+	send_message('S', "server_version\00016.0", 20);
+	ready_for_query();
+
+	for (;;)
+	{
+		char		type;
+		uint32_t	len;
+		char	   *payload;
+
+		if (!read_exactly(&type, 1) || !read_exactly(buf, 4))
+			break;
+		len = get_int32(buf) - 4;
+		payload = malloc(len + 1);
+		if (!read_exactly(payload, len))
+			break;
+		payload[len] = '\0';
+
+		switch (type)
+		{
+			case 'Q':
+				fputs("Query ", record);
+				record_escaped(payload, len > 0 ? len - 1 : 0);
+				fputc('\n', record);
+				if (is_copy(payload))
+				{
+					/* CopyInResponse: overall format, no per-column formats */
+					send_message('G', strstr(payload, "FORMAT binary") ? "\1\0\0" : "\0\0\0", 3);
+				}
+				else
+				{
+					send_message('C', "OK", 3);
+					ready_for_query();
+				}
+				break;
+			case 'd':
+				fputs("CopyData ", record);
+				record_escaped(payload, len);
+				fputc('\n', record);
+				break;
+			case 'c':
+				fputs("CopyDone\n", record);
+				send_message('C', "COPY", 5);
+				ready_for_query();
+				break;
+			case 'X':
+				fputs("Terminate\n", record);
+				break;
+			default:
+				fprintf(record, "Message %c\n", type);
+				break;
+		}
+		free(payload);
+		if (type == 'X')
+			break;
+	}
+
+	/* The record is complete once the client sees the connection close */
+	fclose(record);
+	close(conn);
+	unlink(argv[1]);
+	return 0;
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+
+#include <pg_query.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "statement_info_tests.c"
+
+static const char *kind_names[] = {
+	"pre-data", "create-table", "data", "post-data", "setting", "transaction", "no-transaction", "sequence-value"
+};
+
+int main()
+{
+	size_t i;
+	bool ret_code = EXIT_SUCCESS;
+
+	for (i = 0; i < testsLength; i += 2)
+	{
+		PgQueryStatementInfoResult result = pg_query_statement_info(tests[i]);
+
+		if (result.error)
+		{
+			ret_code = EXIT_FAILURE;
+			printf("%s\n", result.error->message);
+			pg_query_free_statement_info_result(result);
+			continue;
+		}
+
+		// Summarize as "kind: relation, relation", with " (unlisted)" or " (setting name)"
+		size_t len = 48 + (result.setting ? strlen(result.setting) : 0);
+		for (int j = 0; j < result.n_relations; j++)
+			len += strlen(result.relations[j]) + 2;
+		char *buf = malloc(len);
+		char *ptr = buf;
+		ptr += sprintf(ptr, "%s:", kind_names[result.kind]);
+		for (int j = 0; j < result.n_relations; j++)
+			ptr += sprintf(ptr, "%s %s", j > 0 ? "," : "", result.relations[j]);
+		if (result.uses_unlisted_relations)
+			ptr += sprintf(ptr, " (unlisted)");
+		if (result.setting)
+			ptr += sprintf(ptr, " (setting %s)", result.setting);
+
+		if (strcmp(buf, tests[i + 1]) != 0)
+		{
+			ret_code = EXIT_FAILURE;
+			printf("INVALID result for \"%s\"\nexpected: %s\n  actual: %s\n", tests[i], tests[i + 1], buf);
+		}
+		else
+		{
+			printf(".");
+		}
+
+		free(buf);
+		pg_query_free_statement_info_result(result);
+	}
+
+	printf("\n");
+
+	pg_query_exit();
+
+	return ret_code;
+}
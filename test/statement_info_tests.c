@@ -0,0 +1,118 @@
+const char* tests[] = {
+  "CREATE TABLE public.t (id integer NOT NULL, name text)",
+  "create-table: public.t",
+  "CREATE TABLE t (id int DEFAULT nextval('public.t_id_seq'::regclass), p int REFERENCES parent (id))",
+  "create-table: t, public.t_id_seq, parent",
+  "CREATE TABLE child (LIKE base, extra int) INHERITS (parent)",
+  "create-table: child, parent, base",
+  "CREATE TABLE p (id int, at date) PARTITION BY RANGE (at)",
+  "pre-data: p",
+  "CREATE TABLE p1 PARTITION OF p FOR VALUES FROM ('2024-01-01') TO ('2025-01-01')",
+  "create-table: p1, p",
+  "CREATE SEQUENCE public.t_id_seq AS integer START WITH 1 INCREMENT BY 1",
+  "pre-data: public.t_id_seq",
+  "ALTER SEQUENCE public.t_id_seq OWNED BY public.t.id",
+  "pre-data: public.t_id_seq, public.t",
+  "ALTER SEQUENCE s OWNED BY NONE",
+  "pre-data: s",
+  "ALTER TABLE ONLY public.t ALTER COLUMN id SET DEFAULT nextval('public.\"T_id_seq\"'::regclass)",
+  "pre-data: public.t, public.\"T_id_seq\"",
+  "ALTER TABLE public.t ALTER COLUMN id ADD GENERATED ALWAYS AS IDENTITY (SEQUENCE NAME public.t_id_seq START WITH 1)",
+  "pre-data: public.t, public.t_id_seq",
+  "ALTER TABLE ONLY public.t ADD CONSTRAINT t_pkey PRIMARY KEY (id)",
+  "post-data: public.t",
+  "ALTER TABLE ONLY public.c ADD CONSTRAINT c_t_fkey FOREIGN KEY (t_id) REFERENCES public.t(id)",
+  "post-data: public.c, public.t",
+  "ALTER TABLE t ADD COLUMN x int, ADD CONSTRAINT x_check CHECK (x > 0)",
+  "pre-data: t",
+  "ALTER TABLE public.t OWNER TO app",
+  "pre-data: public.t",
+  "ALTER INDEX public.t_pkey ATTACH PARTITION public.t1_pkey",
+  "post-data: public.t_pkey, public.t1_pkey",
+  "CREATE UNIQUE INDEX t_name_idx ON public.t USING btree (name)",
+  "post-data: public.t",
+  "CREATE TRIGGER t_audit AFTER INSERT ON public.t FOR EACH ROW EXECUTE FUNCTION public.audit()",
+  "post-data: public.t",
+  "CREATE POLICY p ON t USING (true)",
+  "post-data: t",
+  "COMMENT ON CONSTRAINT t_pkey ON public.t IS 'key'",
+  "post-data: public.t",
+  "COMMENT ON COLUMN public.t.name IS 'name'",
+  "pre-data: public.t",
+  "GRANT SELECT ON TABLE public.t TO app",
+  "pre-data: public.t",
+  "CREATE VIEW v AS SELECT * FROM t JOIN u USING (id)",
+  "pre-data: v, t, u",
+  "CREATE FUNCTION f() RETURNS int LANGUAGE sql AS 'SELECT 1'",
+  "pre-data: (unlisted)",
+  "INSERT INTO t (id) SELECT id FROM u",
+  "data: t, u",
+  "UPDATE t SET x = 1",
+  "data: t",
+  "TRUNCATE a, b",
+  "data: a, b",
+  "SELECT pg_catalog.setval('public.t_id_seq', 42, true)",
+  "sequence-value: public.t_id_seq",
+  "SELECT pg_catalog.set_config('search_path', '', false)",
+  "setting: (setting search_path)",
+  "SELECT count(*) FROM t",
+  "pre-data: t (unlisted)",
+  "SET statement_timeout = 0",
+  "setting: (setting statement_timeout)",
+  "SET SESSION \"DateStyle\" TO ISO",
+  "setting: (setting datestyle)",
+  "SET TIME ZONE 'UTC'",
+  "setting: (setting timezone)",
+  "RESET ALL",
+  "setting:",
+  "DROP TABLE IF EXISTS public.t, s.\"Other\" CASCADE",
+  "pre-data: public.t, s.\"Other\"",
+  "DROP SEQUENCE public.t_id_seq",
+  "pre-data: public.t_id_seq",
+  "DROP FUNCTION f()",
+  "pre-data:",
+  "DROP FUNCTION f() CASCADE",
+  "pre-data: (unlisted)",
+  "DROP SCHEMA s CASCADE",
+  "pre-data: (unlisted)",
+  "DROP TYPE mood",
+  "pre-data: (unlisted)",
+  "ALTER TABLE public.t RENAME TO u",
+  "pre-data: public.t",
+  "ALTER TABLE t RENAME COLUMN x TO y",
+  "pre-data: t",
+  "ALTER SEQUENCE public.t_id_seq RENAME TO u_id_seq",
+  "pre-data: public.t_id_seq",
+  "ALTER FUNCTION f() RENAME TO g",
+  "pre-data: (unlisted)",
+  "ALTER TABLE public.t SET SCHEMA other",
+  "pre-data: public.t",
+  "ALTER TYPE mood SET SCHEMA other",
+  "pre-data: (unlisted)",
+  "REFRESH MATERIALIZED VIEW public.mv",
+  "post-data: public.mv (unlisted)",
+  "CLUSTER public.t USING t_pkey",
+  "post-data: public.t",
+  "CLUSTER",
+  "post-data: (unlisted)",
+  "REINDEX TABLE public.t",
+  "post-data: public.t",
+  "REINDEX DATABASE d",
+  "post-data: (unlisted)",
+  "DO $$ BEGIN DELETE FROM t; END $$",
+  "pre-data: (unlisted)",
+  "CALL refresh_totals()",
+  "pre-data: (unlisted)",
+  "SELECT pg_catalog.lo_create('16385')",
+  "pre-data: (unlisted)",
+  "BEGIN",
+  "transaction:",
+  "CREATE DATABASE d",
+  "no-transaction:",
+  "VACUUM ANALYZE t",
+  "no-transaction:",
+  "-- only a comment",
+  "pre-data:"
+};
+
+size_t testsLength = __LINE__ - 4;
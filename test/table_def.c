@@ -0,0 +1,78 @@
+#include <stdio.h>
+
+#include <pg_query.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "table_def_tests.c"
+
+int main()
+{
+	size_t i;
+	bool ret_code = EXIT_SUCCESS;
+
+	for (i = 0; i < testsLength; i += 2)
+	{
+		PgQueryTableDefResult result = pg_query_table_def(tests[i]);
+
+		if (result.error)
+		{
+			ret_code = EXIT_FAILURE;
+			printf("%s\n", result.error->message);
+			pg_query_free_table_def_result(result);
+			continue;
+		}
+
+		// Summarize as "relation: column type, column type[] default, column (drop default) (alter)"
+		// or "" when it isn't a CREATE TABLE or an ALTER TABLE changing columns
+		const char *changes[] = {"", "set default", "drop default", "drop expression", "drop"};
+		size_t len = 1;
+		if (result.relation)
+			len += strlen(result.relation) + 32;
+		for (int j = 0; j < result.n_columns; j++)
+			len += strlen(result.columns[j].name) + (result.columns[j].type_name ? strlen(result.columns[j].type_name) : 6) + 40;
+		char *buf = malloc(len);
+		char *ptr = buf;
+		*ptr = '\0';
+		if (result.relation)
+			ptr += sprintf(ptr, "%s:", result.relation);
+		for (int j = 0; j < result.n_columns; j++)
+		{
+			if (result.columns[j].change != PG_QUERY_COLUMN_DEFINE)
+			{
+				ptr += sprintf(ptr, "%s %s (%s)", j > 0 ? "," : "", result.columns[j].name, changes[result.columns[j].change]);
+				continue;
+			}
+			ptr += sprintf(ptr, "%s %s %s%s%s%s", j > 0 ? "," : "", result.columns[j].name,
+						   result.columns[j].type_name ? result.columns[j].type_name : "(none)",
+						   result.columns[j].is_array ? "[]" : "",
+						   result.columns[j].has_default ? " default" : "",
+						   result.columns[j].is_generated ? " generated" : "");
+		}
+		if (result.has_inherited_columns)
+			ptr += sprintf(ptr, " (inherited)");
+		if (result.is_alter_table)
+			ptr += sprintf(ptr, " (alter)");
+
+		if (strcmp(buf, tests[i + 1]) != 0)
+		{
+			ret_code = EXIT_FAILURE;
+			printf("INVALID result for \"%s\"\nexpected: %s\n  actual: %s\n", tests[i], tests[i + 1], buf);
+		}
+		else
+		{
+			printf(".");
+		}
+
+		free(buf);
+		pg_query_free_table_def_result(result);
+	}
+
+	printf("\n");
+
+	pg_query_exit();
+
+	return ret_code;
+}
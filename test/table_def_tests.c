@@ -0,0 +1,40 @@
+const char* tests[] = {
+  "CREATE TABLE t (id int, name text)",
+  "t: id pg_catalog.int4, name text",
+  "CREATE TABLE public.funcoes (\n    id bigint NOT NULL,\n    name character varying(255),\n    query text\n)",
+  "public.funcoes: id pg_catalog.int8, name pg_catalog.varchar, query text",
+  "CREATE UNLOGGED TABLE s.\"Mixed\" (\"Col\" numeric(10,2), at timestamp with time zone, d date, tags text[])",
+  "s.\"Mixed\": \"Col\" pg_catalog.numeric, at pg_catalog.timestamptz, d date, tags text[]",
+  "CREATE TABLE t (id int PRIMARY KEY, CONSTRAINT c CHECK (id > 0), flag boolean DEFAULT false, f double precision)",
+  "t: id pg_catalog.int4, flag pg_catalog.bool default, f pg_catalog.float8",
+  "CREATE TABLE t (c \"char\", u public.mytype, j jsonb, b bytea)",
+  "t: c char, u public.mytype, j jsonb, b bytea",
+  "CREATE TABLE child (extra int) INHERITS (parent)",
+  "child: extra pg_catalog.int4 (inherited)",
+  "CREATE TABLE t (LIKE other, x int)",
+  "t: x pg_catalog.int4 (inherited)",
+  "CREATE TABLE t OF mytype (id WITH OPTIONS NOT NULL)",
+  "t: id (none) (inherited)",
+  "CREATE TABLE p1 PARTITION OF p FOR VALUES IN (1)",
+  "p1: (inherited)",
+  "CREATE TABLE t AS SELECT 1",
+  "",
+  "INSERT INTO t VALUES (1)",
+  "",
+  "CREATE TABLE \"select\" (\"from\" int)",
+  "\"select\": \"from\" pg_catalog.int4",
+  "CREATE TABLE t (id serial, n bigint GENERATED BY DEFAULT AS IDENTITY, total numeric GENERATED ALWAYS AS (n * 2) STORED, s bigserial[])",
+  "t: id serial default, n pg_catalog.int8 default, total pg_catalog.numeric generated, s bigserial[]",
+  "ALTER TABLE ONLY public.t ALTER COLUMN id SET DEFAULT nextval('public.t_id_seq'::regclass)",
+  "public.t: id (set default) (alter)",
+  "ALTER TABLE public.t ADD COLUMN note text DEFAULT 'x', ADD \"Flag\" boolean, DROP COLUMN old, ALTER total DROP EXPRESSION",
+  "public.t: note text default, \"Flag\" pg_catalog.bool, old (drop), total (drop expression) (alter)",
+  "ALTER TABLE t ALTER COLUMN n DROP DEFAULT, ALTER COLUMN id ADD GENERATED ALWAYS AS IDENTITY, ALTER m DROP IDENTITY IF EXISTS",
+  "t: n (drop default), id (set default), m (drop default) (alter)",
+  "ALTER TABLE ONLY public.t ADD CONSTRAINT t_pkey PRIMARY KEY (id)",
+  "",
+  "ALTER SEQUENCE public.t_id_seq OWNED BY public.t.id",
+  ""
+};
+
+size_t testsLength = __LINE__ - 4;